@@ -20,6 +20,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 // cl_ents.c -- entity parsing and management
 
 #include "client.h"
+#include "q_threads.h"
 
 extern	struct model_s	*cl_mod_powerscreen;
 
@@ -40,34 +41,7 @@ Returns the entity number and the header bits
 */
 int CL_ParseEntityBits (unsigned *bits)
 {
-	unsigned	b, total;
-	int			number;
-
-	total = MSG_ReadByte (&net_message);
-	if (total & U_MOREBITS1)
-	{
-		b = MSG_ReadByte (&net_message);
-		total |= b << 8;
-	}
-	if (total & U_MOREBITS2)
-	{
-		b = MSG_ReadByte (&net_message);
-		total |= b << 16;
-	}
-	if (total & U_MOREBITS3)
-	{
-		b = MSG_ReadByte (&net_message);
-		total |= b << 24;
-	}
-
-	if (total & U_NUMBER16)
-		number = MSG_ReadShort (&net_message);
-	else
-		number = MSG_ReadByte (&net_message);
-
-	*bits = total;
-
-	return number;
+	return MSG_ReadEntityBits (&net_message, bits);
 }
 
 /*
@@ -79,78 +53,7 @@ Can go from either a baseline or a previous packet_entity
 */
 void CL_ParseDelta (entity_state_t *from, entity_state_t *to, int number, int bits)
 {
-	// set everything to the state we are delta'ing from
-	*to = *from;
-
-	VectorCopy (from->origin, to->old_origin);
-	to->number = number;
-
-	if (bits & U_MODEL)
-		to->modelindex = MSG_ReadByte (&net_message);
-
-	if (bits & U_MODEL2)
-		to->modelindex2 = MSG_ReadByte (&net_message);
-
-	if (bits & U_MODEL3)
-		to->modelindex3 = MSG_ReadByte (&net_message);
-
-	if (bits & U_MODEL4)
-		to->modelindex4 = MSG_ReadByte (&net_message);
-
-	if (bits & U_FRAME8)
-		to->frame = MSG_ReadByte (&net_message);
-
-	if (bits & U_FRAME16)
-		to->frame = MSG_ReadShort (&net_message);
-
-	if ((bits & U_SKIN8) && (bits & U_SKIN16))		//used for laser colors
-		to->skinnum = MSG_ReadLong (&net_message);
-	else if (bits & U_SKIN8)
-		to->skinnum = MSG_ReadByte (&net_message);
-	else if (bits & U_SKIN16)
-		to->skinnum = MSG_ReadShort (&net_message);
-
-	if ((bits & (U_EFFECTS8 | U_EFFECTS16)) == (U_EFFECTS8 | U_EFFECTS16))
-		to->effects = MSG_ReadLong (&net_message);
-	else if (bits & U_EFFECTS8)
-		to->effects = MSG_ReadByte (&net_message);
-	else if (bits & U_EFFECTS16)
-		to->effects = MSG_ReadShort (&net_message);
-
-	if ((bits & (U_RENDERFX8 | U_RENDERFX16)) == (U_RENDERFX8 | U_RENDERFX16))
-		to->renderfx = MSG_ReadLong (&net_message);
-	else if (bits & U_RENDERFX8)
-		to->renderfx = MSG_ReadByte (&net_message);
-	else if (bits & U_RENDERFX16)
-		to->renderfx = MSG_ReadShort (&net_message);
-
-	if (bits & U_ORIGIN1)
-		to->origin[0] = MSG_ReadCoord (&net_message);
-	if (bits & U_ORIGIN2)
-		to->origin[1] = MSG_ReadCoord (&net_message);
-	if (bits & U_ORIGIN3)
-		to->origin[2] = MSG_ReadCoord (&net_message);
-
-	if (bits & U_ANGLE1)
-		to->angles[0] = MSG_ReadAngle (&net_message);
-	if (bits & U_ANGLE2)
-		to->angles[1] = MSG_ReadAngle (&net_message);
-	if (bits & U_ANGLE3)
-		to->angles[2] = MSG_ReadAngle (&net_message);
-
-	if (bits & U_OLDORIGIN)
-		MSG_ReadPos (&net_message, to->old_origin);
-
-	if (bits & U_SOUND)
-		to->sound = MSG_ReadByte (&net_message);
-
-	if (bits & U_EVENT)
-		to->event = MSG_ReadByte (&net_message);
-	else
-		to->event = 0;
-
-	if (bits & U_SOLID)
-		to->solid = MSG_ReadShort (&net_message);
+	MSG_ReadDeltaEntity (&net_message, from, to, number, bits);
 }
 
 /*
@@ -544,7 +447,7 @@ void CL_ParseFrame (void)
 	}
 	else
 	{
-		old = &cl.frames[cl.frame.deltaframe & UPDATE_MASK];
+		old = &cl.frames[cl.frame.deltaframe & MAX_UPDATE_MASK];
 
 		if (!old->valid)
 		{
@@ -602,7 +505,7 @@ void CL_ParseFrame (void)
 #endif
 
 	// save the frame off in the backup array for later delta comparisons
-	cl.frames[cl.frame.serverframe &UPDATE_MASK] = cl.frame;
+	cl.frames[cl.frame.serverframe & MAX_UPDATE_MASK] = cl.frame;
 
 	if (cl.frame.valid)
 	{
@@ -1103,7 +1006,7 @@ void CL_AddViewWeapon (player_state_t *ps, player_state_t *ops)
 
 	if (cl_gunAlpha->value != 1)
 	{
-		gun.alpha = Q_Clamp(0.1f, 1.0f, Cvar_VariableValue("cl_gunAlpha"));
+		gun.alpha = Q_Clamp(0.1f, 1.0f, cl_gunAlpha->value);
 		gun.flags |= RF_TRANSLUCENT;
 	}
 
@@ -1136,7 +1039,7 @@ void CL_CalcViewValues(void)
 
 	// find the previous frame to interpolate from
 	ps = &cl.frame.playerstate;
-	i = (cl.frame.serverframe - 1) & UPDATE_MASK;
+	i = (cl.frame.serverframe - 1) & MAX_UPDATE_MASK;
 	oldframe = &cl.frames[i];
 
 	if (oldframe->serverframe != cl.frame.serverframe - 1 || !oldframe->valid)
@@ -1214,6 +1117,46 @@ void CL_CalcViewValues(void)
 	CL_AddViewWeapon (ps, ops);
 }
 
+/*
+===============
+CL_AddPacketEntitiesJob
+
+Packet entities trace the world, which isn't thread safe, so they stay
+on the main thread. The particles they spawn wait for CL_AddParticles
+===============
+*/
+static void CL_AddPacketEntitiesJob (void *unused)
+{
+	CL_AddPacketEntities (&cl.frame);
+}
+
+/*
+===============
+CL_AddTEntsJob
+===============
+*/
+static void CL_AddTEntsJob (void *scene)
+{
+	V_SetScene (scene);
+	CL_AddTEnts ();
+	V_SetScene (NULL);
+}
+
+/*
+===============
+CL_AddLightsJob
+
+Lightstyles are stored by index, only the dlights need a scene
+===============
+*/
+static void CL_AddLightsJob (void *scene)
+{
+	V_SetScene (scene);
+	CL_AddDLights ();
+	CL_AddLightStyles ();
+	V_SetScene (NULL);
+}
+
 /*
 ===============
 CL_AddEntities
@@ -1249,6 +1192,45 @@ void CL_AddEntities (void)
 		cl.lerpfrac = 1.0;
 
 	CL_CalcViewValues ();
+
+	if (cl_jobs->integer)
+	{
+		job_t	jobs[3 + MAX_PARTICLE_JOBS];
+		int		numjobs;
+
+		// the server may have a pool already, otherwise start a small one
+		if (!Thread_Count ())
+			Thread_Init (2);
+
+		memset (jobs, 0, sizeof (jobs));
+
+		jobs[0].name = "CL_AddPacketEntitiesJob";
+		jobs[0].Run = CL_AddPacketEntitiesJob;
+		jobs[0].local = true;
+
+		jobs[1].name = "CL_AddTEntsJob";
+		jobs[1].Run = CL_AddTEntsJob;
+		jobs[1].data = V_JobScene (0);
+
+		jobs[2].name = "CL_AddLightsJob";
+		jobs[2].Run = CL_AddLightsJob;
+		jobs[2].data = V_JobScene (1);
+
+		// the particle integration is the bulk of the parallel work
+		numjobs = 3 + CL_ParticleJobs (jobs + 3, Thread_Count ());
+
+		Thread_RunJobs (jobs, numjobs);
+
+		// the packet entities filled the main scene directly, append the
+		// rest in the order they would have been added in
+		V_MergeScene (jobs[1].data);
+		V_MergeScene (jobs[2].data);
+
+		// the jobs are done, so the particle traces are safe again
+		CL_AddParticles ();
+		return;
+	}
+
 	CL_AddPacketEntities (&cl.frame);
 	CL_AddTEnts ();
 	CL_AddParticles ();
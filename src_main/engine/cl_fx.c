@@ -20,6 +20,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 // cl_fx.c -- entity effects parsing and management
 
 #include "client.h"
+#include "q_threads.h"
 
 void CL_LogoutEffect (vec3_t org, int type);
 void CL_ItemRespawnParticles (vec3_t org);
@@ -735,40 +736,390 @@ PARTICLE MANAGEMENT
 ==============================================================
 */
 
-cparticle_t	*active_particles, *free_particles;
+/*
+Live particles are kept as a structure of arrays, packed at the front so
+a frame can integrate all of them with SIMD before the scalar pass that
+does collision and writes the refresh particles. A dead particle is
+replaced by the last one.
+
+The effects fill in a cparticle_t from CL_AllocParticle, those are moved
+into the arrays at the start of the next CL_AddParticles.
+
+With cl_jobs set, the particles already in the arrays are integrated on
+the thread pool while the packet entities spawn their trails, and
+CL_AddParticles only integrates the rest.
+*/
+
+typedef struct
+{
+	float		*time;
+	float		*org[3];		// at time
+	float		*vel[3];
+	float		*accel[3];
+	float		*alpha;
+	float		*alphavel;
+	float		*bounce;
+	int			*color;
+
+	float		*pos[3];		// integrated for this frame
+	float		*fade;
+
+	cparticle_t	*spawned;		// waiting to be added
+	int			numspawned;
+
+	int			num;
+	int			max;
+	int			integrated;		// at the front, by CL_ParticleJobs
+
+	void		*block;			// all of the arrays, from Z_Malloc
+} particlepool_t;
+
+#define	PARTICLE_FLOATS		18	// arrays above
+
+static particlepool_t	particles;
+
+typedef void (*integrateparticles_t) (int first, int count, float now);
+
+/*
+===============
+CL_IntegrateParticles_C
+===============
+*/
+static void CL_IntegrateParticles_C (int first, int count, float now)
+{
+	int		i, j;
+	float	time, time2;
+
+	for (i = first; i < first + count; i++)
+	{
+		time = (now - particles.time[i]) * 0.001f;
+		time2 = time * time;
+
+		for (j = 0; j < 3; j++)
+			particles.pos[j][i] = particles.org[j][i] + particles.vel[j][i] * time + particles.accel[j][i] * time2;
+
+		// PMM - added INSTANT_PARTICLE handling
+		if (particles.alphavel[i] == INSTANT_PARTICLE)
+			particles.fade[i] = particles.alpha[i];
+		else particles.fade[i] = particles.alpha[i] + time * particles.alphavel[i];
+	}
+}
+
+#ifdef Q_SSE2
+#include <emmintrin.h>
+
+/*
+===============
+CL_IntegrateParticles_SSE2
+
+Same operations in the same order as the C version, so the results match
+===============
+*/
+static void CL_IntegrateParticles_SSE2 (int first, int count, float now)
+{
+	__m128	vnow = _mm_set1_ps (now);
+	__m128	vmsec = _mm_set1_ps (0.001f);
+	__m128	vinstant = _mm_set1_ps (INSTANT_PARTICLE);
+	__m128	time, time2, alpha, alphavel, instant;
+	int		i, j, end = first + (count & ~3);
+
+	for (i = first; i < end; i += 4)
+	{
+		time = _mm_mul_ps (_mm_sub_ps (vnow, _mm_loadu_ps (particles.time + i)), vmsec);
+		time2 = _mm_mul_ps (time, time);
+
+		for (j = 0; j < 3; j++)
+		{
+			__m128 org = _mm_add_ps (_mm_loadu_ps (particles.org[j] + i), _mm_mul_ps (_mm_loadu_ps (particles.vel[j] + i), time));
+			_mm_storeu_ps (particles.pos[j] + i, _mm_add_ps (org, _mm_mul_ps (_mm_loadu_ps (particles.accel[j] + i), time2)));
+		}
+
+		alpha = _mm_loadu_ps (particles.alpha + i);
+		alphavel = _mm_loadu_ps (particles.alphavel + i);
+		instant = _mm_cmpeq_ps (alphavel, vinstant);
+		alphavel = _mm_add_ps (alpha, _mm_mul_ps (time, alphavel));
+		_mm_storeu_ps (particles.fade + i, _mm_or_ps (_mm_and_ps (instant, alpha), _mm_andnot_ps (instant, alphavel)));
+	}
+
+	CL_IntegrateParticles_C (end, count & 3, now);
+}
+#endif
+
+#ifdef Q_AVX2
+#include <immintrin.h>
+
+static Q_TARGET_AVX2 void CL_IntegrateParticles_AVX2 (int first, int count, float now)
+{
+	__m256	vnow = _mm256_set1_ps (now);
+	__m256	vmsec = _mm256_set1_ps (0.001f);
+	__m256	vinstant = _mm256_set1_ps (INSTANT_PARTICLE);
+	__m256	time, time2, alpha, alphavel, instant;
+	int		i, j, end = first + (count & ~7);
+
+	for (i = first; i < end; i += 8)
+	{
+		time = _mm256_mul_ps (_mm256_sub_ps (vnow, _mm256_loadu_ps (particles.time + i)), vmsec);
+		time2 = _mm256_mul_ps (time, time);
+
+		for (j = 0; j < 3; j++)
+		{
+			__m256 org = _mm256_add_ps (_mm256_loadu_ps (particles.org[j] + i), _mm256_mul_ps (_mm256_loadu_ps (particles.vel[j] + i), time));
+			_mm256_storeu_ps (particles.pos[j] + i, _mm256_add_ps (org, _mm256_mul_ps (_mm256_loadu_ps (particles.accel[j] + i), time2)));
+		}
+
+		alpha = _mm256_loadu_ps (particles.alpha + i);
+		alphavel = _mm256_loadu_ps (particles.alphavel + i);
+		instant = _mm256_cmp_ps (alphavel, vinstant, _CMP_EQ_OQ);
+		alphavel = _mm256_add_ps (alpha, _mm256_mul_ps (time, alphavel));
+		_mm256_storeu_ps (particles.fade + i, _mm256_blendv_ps (alphavel, alpha, instant));
+	}
+
+	CL_IntegrateParticles_C (end, count & 7, now);
+}
+#endif
 
-cparticle_t	particles[MAX_PARTICLES];
-int			cl_numparticles = MAX_PARTICLES;
+static integrateparticles_t	cl_integrateparticles = CL_IntegrateParticles_C;
+
+/*
+===============
+CL_SetParticleSIMD
+===============
+*/
+static void CL_SetParticleSIMD (int level)
+{
+	cl_integrateparticles = CL_IntegrateParticles_C;
+
+#ifdef Q_AVX2
+	if (level >= SIMD_AVX2)
+	{
+		cl_integrateparticles = CL_IntegrateParticles_AVX2;
+		return;
+	}
+#endif
+#ifdef Q_SSE2
+	if (level >= SIMD_SSE2)
+		cl_integrateparticles = CL_IntegrateParticles_SSE2;
+#endif
+}
 
 /*
 ===============
 CL_ClearParticles
+
+Also resizes the pool when cl_maxparticles has changed
 ===============
 */
 void CL_ClearParticles (void)
 {
-	int		i;
+	float	*f;
+	int		i, max, stride;
+
+	max = cl_maxparticles->integer;
 
-	memset(particles, 0, sizeof(particles));
+	if (max < 1024)
+		max = 1024;
+	else if (max > MAX_PARTICLES)
+		max = MAX_PARTICLES;
 
-	free_particles = &particles[0];
-	active_particles = NULL;
+	cl_maxparticles->modified = false;
 
-	for (i = 0; i < cl_numparticles; i++)
-		particles[i].next = &particles[i+1];
+	if (max != particles.max)
+	{
+		if (particles.block)
+			Z_Free (particles.block);
+
+		// every array starts on a cache line, so the integration jobs
+		// only share lines with each other at the slice boundaries
+		stride = (max + 15) & ~15;
+		particles.block = Z_Malloc (stride * PARTICLE_FLOATS * sizeof (float) + max * sizeof (cparticle_t) + 64);
+		f = (float *) (((uintptr_t) particles.block + 63) & ~(uintptr_t) 63);
+
+		particles.time = f; f += stride;
+
+		for (i = 0; i < 3; i++)
+		{
+			particles.org[i] = f; f += stride;
+			particles.vel[i] = f; f += stride;
+			particles.accel[i] = f; f += stride;
+			particles.pos[i] = f; f += stride;
+		}
 
-	particles[cl_numparticles-1].next = NULL;
+		particles.alpha = f; f += stride;
+		particles.alphavel = f; f += stride;
+		particles.bounce = f; f += stride;
+		particles.fade = f; f += stride;
+		particles.color = (int *) f; f += stride;
+		particles.spawned = (cparticle_t *) f;
+		particles.max = max;
+	}
+
+	particles.num = 0;
+	particles.numspawned = 0;
+	particles.integrated = 0;
+
+	CL_SetParticleSIMD (Com_SIMDLevel ());
+}
+
+/*
+===============
+CL_AllocParticle
+
+Returns a cleared particle for an effect to fill in, or NULL when the
+pool is full
+===============
+*/
+cparticle_t *CL_AllocParticle (void)
+{
+	cparticle_t	*p;
+
+	if (particles.num + particles.numspawned >= particles.max)
+		return NULL;
+
+	p = &particles.spawned[particles.numspawned++];
+	memset (p, 0, sizeof (*p));
+
+	return p;
+}
+
+/*
+===============
+CL_AddSpawnedParticles
+===============
+*/
+static void CL_AddSpawnedParticles (void)
+{
+	cparticle_t	*p;
+	int			i, j, n;
+
+	for (i = 0, p = particles.spawned; i < particles.numspawned; i++, p++)
+	{
+		n = particles.num++;
+
+		particles.time[n] = p->time;
+
+		for (j = 0; j < 3; j++)
+		{
+			particles.org[j][n] = p->org[j];
+			particles.vel[j][n] = p->vel[j];
+			particles.accel[j][n] = p->accel[j];
+		}
+
+		particles.alpha[n] = p->alpha;
+		particles.alphavel[n] = p->alphavel;
+		particles.bounce[n] = p->bounceFactor;
+		particles.color[n] = p->color;
+	}
+
+	particles.numspawned = 0;
+}
+
+/*
+===============
+CL_IntegrateParticlesJob
+===============
+*/
+typedef struct
+{
+	int			first, count;
+	float		now;
+} particleslice_t;
+
+static particleslice_t	particleslices[MAX_PARTICLE_JOBS];
+
+static void CL_IntegrateParticlesJob (void *slice)
+{
+	particleslice_t	*s = slice;
+
+	cl_integrateparticles (s->first, s->count, s->now);
+}
+
+/*
+===============
+CL_ParticleJobs
+
+Moves the waiting particles into the arrays and fills in up to maxjobs
+jobs that integrate them. The jobs must finish before CL_AddParticles,
+until then effects may only spawn new particles. Returns the number of
+jobs, which is 0 when there are too few particles to be worth it
+===============
+*/
+#define	PARTICLE_JOB_MIN	1024
+
+int CL_ParticleJobs (job_t *jobs, int maxjobs)
+{
+	particleslice_t	*s;
+	int				i, num, per;
+
+	if (cl_maxparticles->modified)
+		CL_ClearParticles ();
+
+	if (!cl_drawParticles->integer)
+		return 0;
+
+	CL_AddSpawnedParticles ();
+
+	if (maxjobs > MAX_PARTICLE_JOBS)
+		maxjobs = MAX_PARTICLE_JOBS;
+
+	if (maxjobs > particles.num / PARTICLE_JOB_MIN)
+		maxjobs = particles.num / PARTICLE_JOB_MIN;
+
+	if (maxjobs < 1)
+		return 0;
+
+	// the arrays are cache line aligned, so whole lines per slice
+	// keep the jobs from writing to the same lines
+	per = (particles.num / maxjobs + 15) & ~15;
+
+	for (i = num = 0, s = particleslices; i < maxjobs && num < particles.num; i++, s++)
+	{
+		s->first = num;
+		s->count = min (per, particles.num - num);
+		s->now = cl.time;
+		num += s->count;
+
+		memset (&jobs[i], 0, sizeof (jobs[i]));
+		jobs[i].name = "CL_IntegrateParticlesJob";
+		jobs[i].Run = CL_IntegrateParticlesJob;
+		jobs[i].data = s;
+	}
+
+	particles.integrated = num;
+
+	return i;
 }
 
 /*
 ===============
 CL_FreeParticle
+
+Moves the last particle into n
 ===============
 */
-void CL_FreeParticle(cparticle_t * p)
+static void CL_FreeParticle (int n)
 {
-	p->next = free_particles;
-	free_particles = p;
+	int		j, last;
+
+	last = --particles.num;
+
+	if (n == last)
+		return;
+
+	particles.time[n] = particles.time[last];
+
+	for (j = 0; j < 3; j++)
+	{
+		particles.org[j][n] = particles.org[j][last];
+		particles.vel[j][n] = particles.vel[j][last];
+		particles.accel[j][n] = particles.accel[j][last];
+		particles.pos[j][n] = particles.pos[j][last];
+	}
+
+	particles.alpha[n] = particles.alpha[last];
+	particles.alphavel[n] = particles.alphavel[last];
+	particles.bounce[n] = particles.bounce[last];
+	particles.color[n] = particles.color[last];
+	particles.fade[n] = particles.fade[last];
 }
 
 /*
@@ -786,14 +1137,9 @@ void CL_BloodPuff(vec3_t org, vec3_t dir, int count)
 
 	for (i = 0; i < count; i++)
 	{
-		if (!free_particles)
+		if (!(p = CL_AllocParticle ()))
 			return;
 
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
-
 		p->time = cl.time;
 		p->color = 240;
 
@@ -831,14 +1177,9 @@ void CL_ParticleEffect (vec3_t org, vec3_t dir, int color, int count)
 
 	for (i = 0; i < count; i++)
 	{
-		if (!free_particles)
+		if (!(p = CL_AllocParticle ()))
 			return;
 
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
-
 		p->time = cl.time;
 		p->color = color + (rand () & 7);
 
@@ -879,14 +1220,9 @@ void CL_ParticleEffect2 (vec3_t org, vec3_t dir, int color, int count)
 
 	for (i = 0; i < count; i++)
 	{
-		if (!free_particles)
+		if (!(p = CL_AllocParticle ()))
 			return;
 
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
-
 		p->time = cl.time;
 		p->color = color;
 
@@ -922,14 +1258,9 @@ void CL_TeleporterParticles (entity_state_t *ent)
 
 	for (i = 0; i < 8; i++)
 	{
-		if (!free_particles)
+		if (!(p = CL_AllocParticle ()))
 			return;
 
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
-
 		p->time = cl.time;
 		p->color = 0xdb;
 
@@ -949,7 +1280,6 @@ void CL_TeleporterParticles (entity_state_t *ent)
 		p->alphavel = -0.5;
 
 		p->bounceFactor = 0.6f;
-		VectorCopy(p->org, p->oldOrg);
 
 		p->ignoreGrav = false;
 	}
@@ -967,14 +1297,9 @@ void CL_LogoutEffect (vec3_t org, int type)
 
 	for (i = 0; i < 500; i++)
 	{
-		if (!free_particles)
+		if (!(p = CL_AllocParticle ()))
 			return;
 
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
-
 		p->time = cl.time;
 
 		if (type == MZ_LOGIN)
@@ -998,7 +1323,6 @@ void CL_LogoutEffect (vec3_t org, int type)
 		p->alphavel = -1.0 / (1.0 + frand () * 0.3);
 
 		p->bounceFactor = 0.6f;
-		VectorCopy(p->org, p->oldOrg);
 
 		p->ignoreGrav = false;
 	}
@@ -1016,14 +1340,9 @@ void CL_ItemRespawnParticles (vec3_t org)
 
 	for (i = 0; i < 64; i++)
 	{
-		if (!free_particles)
+		if (!(p = CL_AllocParticle ()))
 			return;
 
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
-
 		p->time = cl.time;
 
 		p->color = 0xd4 + (rand () & 3);	// green
@@ -1059,14 +1378,9 @@ void CL_ExplosionParticles (vec3_t org)
 
 	for (i = 0; i < 256; i++)
 	{
-		if (!free_particles)
+		if (!(p = CL_AllocParticle ()))
 			return;
 
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
-
 		p->time = cl.time;
 		p->color = 0xe0 + (rand () & 7);
 
@@ -1102,14 +1416,9 @@ void CL_BigTeleportParticles (vec3_t org)
 
 	for (i = 0; i < 4096; i++)
 	{
-		if (!free_particles)
+		if (!(p = CL_AllocParticle ()))
 			return;
 
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
-
 		p->time = cl.time;
 
 		p->color = colortable[rand () &3];
@@ -1157,14 +1466,9 @@ void CL_BlasterParticles (vec3_t org, vec3_t dir, unsigned int color)
 
 	for (i = 0; i < count; i++)
 	{
-		if (!free_particles)
+		if (!(p = CL_AllocParticle ()))
 			return;
 
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
-
 		p->time = cl.time;
 		p->color = color + (rand () & 7);
 
@@ -1214,13 +1518,8 @@ void CL_BlasterTrail (vec3_t start, vec3_t end, float color)
 	{
 		len -= dec;
 
-		if (!free_particles)
+		if (!(p = CL_AllocParticle ()))
 			return;
-
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
 		VectorClear (p->accel);
 
 		p->time = cl.time;
@@ -1269,13 +1568,8 @@ void CL_QuadTrail (vec3_t start, vec3_t end)
 	{
 		len -= dec;
 
-		if (!free_particles)
+		if (!(p = CL_AllocParticle ()))
 			return;
-
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
 		VectorClear (p->accel);
 
 		p->time = cl.time;
@@ -1324,13 +1618,8 @@ void CL_FlagTrail (vec3_t start, vec3_t end, float color)
 	{
 		len -= dec;
 
-		if (!free_particles)
+		if (!(p = CL_AllocParticle ()))
 			return;
-
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
 		VectorClear (p->accel);
 
 		p->time = cl.time;
@@ -1402,16 +1691,12 @@ void CL_DiminishingTrail (vec3_t start, vec3_t end, centity_t *old, int flags)
 	{
 		len -= dec;
 
-		if (!free_particles)
-			return;
-
 		// drop less particles as it flies
 		if ((rand () & 1023) < old->trailcount)
 		{
-			p = free_particles;
-			free_particles = p->next;
-			p->next = active_particles;
-			active_particles = p;
+			if (!(p = CL_AllocParticle ()))
+				return;
+
 			VectorClear (p->accel);
 
 			p->time = cl.time;
@@ -1518,15 +1803,10 @@ void CL_RocketTrail (vec3_t start, vec3_t end, centity_t *old)
 	{
 		len -= dec;
 
-		if (!free_particles)
-			return;
-
 		if ((rand () & 7) == 0)
 		{
-			p = free_particles;
-			free_particles = p->next;
-			p->next = active_particles;
-			active_particles = p;
+			if (!(p = CL_AllocParticle ()))
+				return;
 
 			VectorClear (p->accel);
 			p->time = cl.time;
@@ -1579,14 +1859,9 @@ void CL_RailTrail (vec3_t start, vec3_t end)
 
 	for (i = 0; i < len; i++)
 	{
-		if (!free_particles)
+		if (!(p = CL_AllocParticle ()))
 			return;
 
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
-
 		p->time = cl.time;
 		VectorClear (p->accel);
 
@@ -1621,14 +1896,9 @@ void CL_RailTrail (vec3_t start, vec3_t end)
 	{
 		len -= dec;
 
-		if (!free_particles)
+		if (!(p = CL_AllocParticle ()))
 			return;
 
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
-
 		p->time = cl.time;
 		VectorClear (p->accel);
 
@@ -1673,14 +1943,9 @@ void CL_BubbleTrail (vec3_t start, vec3_t end)
 
 	for (i = 0; i < len; i += dec)
 	{
-		if (!free_particles)
+		if (!(p = CL_AllocParticle ()))
 			return;
 
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
-
 		VectorClear (p->accel);
 		p->time = cl.time;
 
@@ -1746,14 +2011,9 @@ void CL_FlyParticles (vec3_t origin, int count)
 		forward[1] = cp * sy;
 		forward[2] = -sp;
 
-		if (!free_particles)
+		if (!(p = CL_AllocParticle ()))
 			return;
 
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
-
 		p->time = cl.time;
 
 		dist = sin (ltime + i) * 64;
@@ -1849,14 +2109,9 @@ void CL_BfgParticles (entity_t *ent)
 		forward[1] = cp * sy;
 		forward[2] = -sp;
 
-		if (!free_particles)
+		if (!(p = CL_AllocParticle ()))
 			return;
 
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
-
 		p->time = cl.time;
 
 		dist = sin (ltime + i) * 64;
@@ -1894,14 +2149,9 @@ void CL_BFGExplosionParticles (vec3_t org)
 
 	for (i = 0; i < 256; i++)
 	{
-		if (!free_particles)
+		if (!(p = CL_AllocParticle ()))
 			return;
 
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
-
 		p->time = cl.time;
 		p->color = 0xd0 + (rand () & 7);
 
@@ -1939,14 +2189,9 @@ void CL_TeleportParticles (vec3_t org)
 		for (j = -16; j <= 16; j += 4)
 			for (k = -16; k <= 32; k += 4)
 			{
-				if (!free_particles)
+				if (!(p = CL_AllocParticle ()))
 					return;
 
-				p = free_particles;
-				free_particles = p->next;
-				p->next = active_particles;
-				active_particles = p;
-
 				p->time = cl.time;
 				p->color = 7 + (rand () & 7);
 
@@ -1969,7 +2214,6 @@ void CL_TeleportParticles (vec3_t org)
 				p->accel[2] = -PARTICLE_GRAVITY;
 
 				p->bounceFactor = 0.6f;
-				VectorCopy (p->org, p->oldOrg);
 
 				p->ignoreGrav = false;
 			}
@@ -1992,12 +2236,8 @@ void CL_ParticleRailRick (vec3_t org, vec3_t dir)
 	// sparks
 	for (i = 0; i < 25; i++)
 	{
-		if (!free_particles)
+		if (!(p = CL_AllocParticle ()))
 			return;
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
 
 		VectorClear(p->accel);
 		VectorClear(p->vel);
@@ -2024,12 +2264,8 @@ void CL_ParticleRailRick (vec3_t org, vec3_t dir)
 	// smoke
 	for (i = 0; i < 11; i++)
 	{
-		if (!free_particles)
+		if (!(p = CL_AllocParticle ()))
 			return;
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
 
 		p->time = cl.time;
 
@@ -2052,12 +2288,8 @@ void CL_ParticleRailRick (vec3_t org, vec3_t dir)
 	}
 
 	// more smoke
-	if (!free_particles)
+	if (!(p = CL_AllocParticle ()))
 		return;
-	p = free_particles;
-	free_particles = p->next;
-	p->next = active_particles;
-	active_particles = p;
 	
 	VectorClear(p->accel);
 	VectorClear(p->vel);
@@ -2082,12 +2314,8 @@ void CL_ParticleRailRick (vec3_t org, vec3_t dir)
 	// more sparks
 	for (i = 0; i < 35; i++)
 	{
-		if (!free_particles)
+		if (!(p = CL_AllocParticle ()))
 			return;
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
 
 		p->time = cl.time;
 
@@ -2106,8 +2334,6 @@ void CL_ParticleRailRick (vec3_t org, vec3_t dir)
 		p->accel[0] = p->accel[1] = 0;
 		p->accel[2] = -PARTICLE_GRAVITY * 1.5;
 
-		VectorCopy(p->org, p->oldOrg);
-
 		p->bounceFactor = 0.3f;
 	}
 }
@@ -2117,63 +2343,73 @@ void CL_ParticleRailRick (vec3_t org, vec3_t dir)
 CL_AddParticles
 ===============
 */
+static cvar_t	*sv_gravity;		// the game's, it may not exist yet
+
+#ifndef WIN_UWP
+extern unsigned	d_8to24table_rgba[];
+#endif
+
 void CL_AddParticles (void)
 {
-	cparticle_t		*p, *next;
-	float			alpha;
-	float			time, time2;
-	vec3_t			org;
-	int				color;
-	cparticle_t		*active, *tail;
+	particle_t		*out;
+	float			alpha, time;
+	vec3_t			start, org;
+	int				i, j, color, numout, room;
 	int             contents;
 	float			grav;
 
-	active = NULL;
-	tail = NULL;
+	if (cl_maxparticles->modified)
+		CL_ClearParticles ();
 
 	if (!cl_drawParticles->integer)
 		return;
 
 	// allow gravity tweaks by the server
-	grav = Cvar_VariableValue("sv_gravity");
+	grav = Cvar_CachedValue (&sv_gravity, "sv_gravity");
 	if (!grav)
 		grav = 1;
 	else
 		grav /= 800;
 
-	for (p = active_particles; p; p = next)
+	CL_AddSpawnedParticles ();
+
+	// position and alpha of every particle at once, less any the jobs did
+	cl_integrateparticles (particles.integrated, particles.num - particles.integrated, cl.time);
+	particles.integrated = 0;
+
+	out = V_BeginParticles (&room);
+	numout = 0;
+
+	for (i = 0; i < particles.num; )
 	{
-		next = p->next;
+		alpha = particles.fade[i];
+		color = particles.color[i];
 
-		// set alpha
-		// PMM - added INSTANT_PARTICLE handling
-		if (p->alphavel != INSTANT_PARTICLE)
+		for (j = 0; j < 3; j++)
 		{
-			time = (cl.time - p->time) * 0.001;
-			alpha = p->alpha + time * p->alphavel;
+			start[j] = particles.org[j][i];
+			org[j] = particles.pos[j][i];
+		}
 
+		if (particles.alphavel[i] != INSTANT_PARTICLE)
+		{
 			if (alpha <= 0)
 			{
 				// faded out
-				CL_FreeParticle (p);
+				CL_FreeParticle (i);
 				continue;
 			}
-			else if (alpha <= 0.3f && p->color == 240) // this is HACK central...
+			else if (alpha <= 0.3f && color == 240) // this is HACK central...
 			{
 				// do blood decals
 				if (rand() & 4)
 				{
 					trace_t tr;
 
-					time2 = time * time;
-					org[0] = p->org[0] + p->vel[0] * time + p->accel[0] * time2;
-					org[1] = p->org[1] + p->vel[1] * time + p->accel[1] * time2;
-					org[2] = p->org[2] + p->vel[2] * time + p->accel[2] * time2;
-
-					tr = CL_Trace(p->org, org, 0, MASK_SOLID);
+					tr = CL_Trace(start, org, 0, MASK_SOLID);
 					if (tr.fraction != 1.0f)
 					{
-						if (!VectorCompare(tr.plane.normal, vec3_origin) && !(CM_PointContents(p->org, 0) & MASK_WATER)) // no blood splatters underwater...
+						if (!VectorCompare(tr.plane.normal, vec3_origin) && !(CM_PointContents(start, 0) & MASK_WATER)) // no blood splatters underwater...
 						{
 							vec4_t color;
 							Vector4Set(color, 1.0, 0.0, 0.0, 1.0f);
@@ -2183,68 +2419,52 @@ void CL_AddParticles (void)
 				}
 			}
 		}
-		else
-		{
-			alpha = p->alpha;
-		}
 
 		if (alpha > 1.0)
 			alpha = 1;
 
-		// set color
-		color = p->color;
-
-		// backup old position
-		VectorCopy (p->org, p->oldOrg);
-
-		// calculate new position
-		time2 = time * time;
-
-		org[0] = p->org[0] + p->vel[0] * time + p->accel[0] * time2;
-		org[1] = p->org[1] + p->vel[1] * time + p->accel[1] * time2;
-		org[2] = p->org[2] + p->vel[2] * time + p->accel[2] * time2;
-
-		// gravity modulation
-		//if (!p->ignoreGrav)
-		//	org[2] += time2 * -PARTICLE_GRAVITY;
-
 		// collision test
 		if (cl_particleCollision->integer)
 		{
-			if (p->bounceFactor)
+			if (particles.bounce[i])
 			{
 				trace_t trace;
 				vec3_t vel;
 				int hitTime;
-				float time;
 
-				trace = CL_Trace(p->oldOrg, org, 0, CONTENTS_SOLID);
+				trace = CL_Trace(start, org, 0, CONTENTS_SOLID);
 				if (trace.fraction > 0 && trace.fraction < 1)
 				{
 					// reflect the velocity on the trace plane
 					hitTime = cl.time - cls.rframetime + cls.rframetime * trace.fraction;
 
-					time = ((float)hitTime - p->time) * 0.001;
+					time = ((float)hitTime - particles.time[i]) * 0.001;
 
-					Vector3Set (vel, p->vel[0], p->vel[1], p->vel[2] + p->accel[2] * time * grav);
-					VectorReflect (vel, trace.plane.normal, p->vel);
-					VectorScale (p->vel, p->bounceFactor, p->vel);
+					Vector3Set (vel, particles.vel[0][i], particles.vel[1][i], particles.vel[2][i] + particles.accel[2][i] * time * grav);
+					VectorReflect (vel, trace.plane.normal, vel);
+					VectorScale (vel, particles.bounce[i], vel);
 
 					// check for stop, making sure that even on low FPS systems it doesn't bobble
-					if (trace.allsolid || (trace.plane.normal[2] > 0 && (p->vel[2] < 40 || p->vel[2] < -cls.rframetime * p->vel[2])))
+					if (trace.allsolid || (trace.plane.normal[2] > 0 && (vel[2] < 40 || vel[2] < -cls.rframetime * vel[2])))
 					{
-						VectorClear(p->vel);
-						VectorClear(p->accel);
+						VectorClear(vel);
+
+						for (j = 0; j < 3; j++)
+							particles.accel[j][i] = 0;
 
-						p->bounceFactor = 0.0f;
+						particles.bounce[i] = 0.0f;
 					}
 
 					VectorCopy (trace.endpos, org);
 
 					// reset particle
-					p->time = cl.time;
+					particles.time[i] = cl.time;
 
-					VectorCopy (org, p->org);
+					for (j = 0; j < 3; j++)
+					{
+						particles.org[j][i] = org[j];
+						particles.vel[j][i] = vel[j];
+					}
 				}
 			}
 		}
@@ -2253,34 +2473,34 @@ void CL_AddParticles (void)
 		contents = CM_PointContents (org, 0);
 		if (contents & MASK_SOLID)
 		{
-			CL_FreeParticle (p);
+			CL_FreeParticle (i);
 			continue;
 		}
 
-		// have this always below CL_FreeParticle(p); !
-		p->next = NULL;
-		if (!tail)
-		{
-			active = tail = p;
-		}
-		else
+		// add to scene
+		if (numout < room)
 		{
-			tail->next = p;
-			tail = p;
+			VectorCopy (org, out->origin);
+#ifndef WIN_UWP
+			// transform 8bit colors into RGBA
+			out->color = d_8to24table_rgba[color & 255];
+			out->rgba[3] = (alpha < 0) ? 0 : alpha * 255;
+#endif
+			out++;
+			numout++;
 		}
 
-		// add to scene
-		V_AddParticle (org, color, alpha);
-
 		// PMM
-		if (p->alphavel == INSTANT_PARTICLE)
+		if (particles.alphavel[i] == INSTANT_PARTICLE)
 		{
-			p->alphavel = 0.0;
-			p->alpha = 0.0;
+			particles.alphavel[i] = 0.0;
+			particles.alpha[i] = 0.0;
 		}
+
+		i++;
 	}
 
-	active_particles = active;
+	V_EndParticles (numout);
 }
 
 //============================================================================================
@@ -49,6 +49,8 @@ cvar_t	*cl_gunAlpha;
 
 cvar_t	*cl_drawParticles;
 cvar_t	*cl_particleCollision;
+cvar_t	*cl_maxparticles;
+cvar_t	*cl_jobs;
 
 cvar_t	*cl_shownet;
 cvar_t	*cl_showmiss;
@@ -442,7 +444,10 @@ void CL_SendConnectPacket (void)
 	port = Cvar_VariableValue ("qport");
 	userinfo_modified = false;
 
-	Netchan_OutOfBandPrint (NS_CLIENT, adr, "connect %i %i %i \"%s\"\n", PROTOCOL_VERSION, port, cls.challenge, Cvar_Userinfo());
+	// servers that understand the trailing options reply with the ones they
+	// accept in client_connect, others ignore them
+	Netchan_OutOfBandPrint (NS_CLIENT, adr, "connect %i %i %i \"%s\" frames=%i fragments=1\n",
+		PROTOCOL_VERSION, port, cls.challenge, Cvar_Userinfo(), MAX_UPDATE_BACKUP);
 }
 
 /*
@@ -606,6 +611,9 @@ void CL_ClearState (void)
 	memset (&cl_entities, 0, sizeof (cl_entities));
 
 	SZ_Clear (&cls.netchan.message);
+
+	// nothing read ahead for the last server is wanted now
+	Prefetch_Flush ();
 }
 
 /*
@@ -913,6 +921,10 @@ void CL_ConnectionlessPacket (void)
 					got_server = true;
 				}
 			}
+
+			// server will split frames bigger than a packet
+			if (!strcmp (p, "fragments=1"))
+				cls.netchan.fragments = true;
 		}
 
 		if (!got_server)
@@ -1228,6 +1240,8 @@ void CL_InitLocal (void)
 
 	cl_drawParticles = Cvar_Get ("cl_drawParticles", "1", CVAR_ARCHIVE);
 	cl_particleCollision = Cvar_Get("cl_particleCollision", "1", CVAR_ARCHIVE);
+	cl_maxparticles = Cvar_Get ("cl_maxparticles", "16384", CVAR_ARCHIVE);
+	cl_jobs = Cvar_Get ("cl_jobs", "0", CVAR_ARCHIVE);
 
 	cl_gun = Cvar_Get ("cl_gun", "1", 0);
 	cl_gunAlpha = Cvar_Get("cl_gunAlpha", "1.0", CVAR_ARCHIVE);
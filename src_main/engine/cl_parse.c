@@ -73,6 +73,48 @@ void CL_RegisterSounds (void)
 	S_EndRegistration ();
 }
 
+/*
+======================
+CL_PrefetchConfigString
+
+Starts reading what a configstring names while the rest of the signon
+arrives, CL_RegisterSounds and CL_PrepRefresh take it from there
+======================
+*/
+void CL_PrefetchConfigString (int i)
+{
+	char	*s;
+	char	name[MAX_QPATH];
+
+	s = cl.configstrings[i];
+
+	if (!s[0])
+		return;
+
+	if (i >= CS_MODELS && i < CS_MODELS + MAX_MODELS)
+	{
+		RE_PrefetchModel (s);
+	}
+	else if (i >= CS_SOUNDS && i < CS_SOUNDS + MAX_SOUNDS)
+	{
+		// sexed sounds depend on the model of whoever makes them
+		if (s[0] == '*')
+			return;
+
+		// same name as S_LoadSound
+		if (s[0] == '#')
+			Q_strlcpy (name, s + 1, sizeof (name));
+		else
+			Com_sprintf (name, sizeof (name), "sound/%s", s);
+
+		Prefetch_File (name);
+	}
+	else if (i >= CS_IMAGES && i < CS_IMAGES + MAX_IMAGES)
+	{
+		RE_Draw_PrefetchPic (s);
+	}
+}
+
 
 /*
 =====================
@@ -397,6 +439,9 @@ void CL_ParseConfigString (void)
 
 	strcpy (cl.configstrings[i], s);
 
+	if (!cl.refresh_prepped)
+		CL_PrefetchConfigString (i);
+
 	// do something apropriate
 
 	if (i >= CS_LIGHTS && i < CS_LIGHTS + MAX_LIGHTSTYLES)
@@ -20,6 +20,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 // cl_view.c -- player rendering positioning
 
 #include "client.h"
+#include <SDL_thread.h>
 
 // development tools for weapons
 int			gun_frame;
@@ -52,6 +53,21 @@ particle_t	r_particles[MAX_PARTICLES];
 
 lightstyle_t	r_lightstyles[MAX_LIGHTSTYLES];
 
+// what a producer job running on another thread adds, until it is merged
+struct vscene_s
+{
+	int			numentities;
+	entity_t	entities[MAX_ENTITIES];
+
+	int			numdlights;
+	dlight_t	dlights[MAX_LIGHTS];
+};
+
+#define	MAX_JOBSCENES	2
+
+static vscene_t	v_jobscenes[MAX_JOBSCENES];
+static SDL_TLSID	v_scenetls;		// the thread's vscene_t, none for the main scene
+
 int			num_cl_weaponmodels;
 char		cl_weaponmodels[MAX_CLIENTWEAPONMODELS][MAX_QPATH];
 
@@ -78,6 +94,16 @@ V_AddEntity
 */
 void V_AddEntity (entity_t *ent)
 {
+	vscene_t	*scene = SDL_TLSGet (v_scenetls);
+
+	if (scene)
+	{
+		if (scene->numentities < MAX_ENTITIES)
+			scene->entities[scene->numentities++] = *ent;
+
+		return;
+	}
+
 	if (r_numentities >= MAX_ENTITIES)
 		return;
 
@@ -88,26 +114,27 @@ void V_AddEntity (entity_t *ent)
 
 /*
 =====================
-V_AddParticle
+V_BeginParticles
+
+Returns where the next particles go and how many still fit, which
+V_EndParticles adds to the scene
 =====================
 */
-void V_AddParticle(vec3_t org, int color, float alpha)
+particle_t *V_BeginParticles (int *room)
 {
-	particle_t *p;
+	*room = MAX_PARTICLES - r_numparticles;
 
-	if (r_numparticles >= MAX_PARTICLES)
-		return;
-
-	p = &r_particles[r_numparticles++];
-
-	VectorCopy(org, p->origin);
+	return &r_particles[r_numparticles];
+}
 
-#ifndef WIN_UWP
-	// transform 8bit colors into RGBA
-	extern unsigned d_8to24table_rgba[];
-	p->color = d_8to24table_rgba[color & 255];
-	((byte *)&p->color)[3] = (alpha > 1) ? 255 : ((alpha < 0) ? 0 : alpha * 255);
-#endif
+/*
+=====================
+V_EndParticles
+=====================
+*/
+void V_EndParticles (int count)
+{
+	r_numparticles += count;
 }
 
 
@@ -119,11 +146,22 @@ V_AddLight
 void V_AddLight (vec3_t org, float intensity, float r, float g, float b)
 {
 	dlight_t	*dl;
+	vscene_t	*scene = SDL_TLSGet (v_scenetls);
 
-	if (r_numdlights == MAX_LIGHTS)
-		return;
+	if (scene)
+	{
+		if (scene->numdlights == MAX_LIGHTS)
+			return;
+
+		dl = &scene->dlights[scene->numdlights++];
+	}
+	else
+	{
+		if (r_numdlights == MAX_LIGHTS)
+			return;
 
-	dl = &r_dlights[r_numdlights++];
+		dl = &r_dlights[r_numdlights++];
+	}
 
 	VectorCopy (org, dl->origin);
 	dl->radius = intensity;
@@ -132,6 +170,63 @@ void V_AddLight (vec3_t org, float intensity, float r, float g, float b)
 	dl->color[2] = b;
 }
 
+/*
+=====================
+V_JobScene
+
+Returns an empty scene for producer job num to add to
+=====================
+*/
+vscene_t *V_JobScene (int num)
+{
+	vscene_t	*scene;
+
+	if (num < 0 || num >= MAX_JOBSCENES)
+		Com_Error (ERR_FATAL, "V_JobScene: bad job %i", num);
+
+	scene = &v_jobscenes[num];
+	scene->numentities = 0;
+	scene->numdlights = 0;
+
+	return scene;
+}
+
+/*
+=====================
+V_SetScene
+
+Makes V_AddEntity and V_AddLight in this thread add to scene, or to the
+main scene again when it is NULL
+=====================
+*/
+void V_SetScene (vscene_t *scene)
+{
+	SDL_TLSSet (v_scenetls, scene, NULL);
+}
+
+/*
+=====================
+V_MergeScene
+
+Appends a job's entities and lights to the main scene, jobs are merged
+in a fixed order so the scene is the same as when they run one by one
+=====================
+*/
+void V_MergeScene (vscene_t *scene)
+{
+	int		i;
+
+	for (i = 0; i < scene->numentities && r_numentities < MAX_ENTITIES; i++)
+	{
+		r_entities[r_numentities] = scene->entities[i];
+		r_entities[r_numentities].entnum = r_numentities;
+		r_numentities++;
+	}
+
+	for (i = 0; i < scene->numdlights && r_numdlights < MAX_LIGHTS; i++)
+		r_dlights[r_numdlights++] = scene->dlights[i];
+}
+
 /*
 =====================
 V_AddLightStyle
@@ -340,6 +435,9 @@ void CL_PrepRefresh (void)
 	// the renderer can now free unneeded stuff
 	RE_EndRegistration ();
 
+	// let go of anything read ahead that wasn't used
+	Prefetch_Flush ();
+
 	// clear any lines of console text
 	Con_ClearNotify ();
 
@@ -697,6 +795,8 @@ void V_Init (void)
 
 	Cmd_AddCommand ("viewpos", V_Viewpos_f);
 
+	v_scenetls = SDL_TLSCreate ();
+
 	crosshair = Cvar_Get ("crosshair", "0", CVAR_ARCHIVE);
 	crosshairX = Cvar_Get ("crosshairX", "0", CVAR_ARCHIVE);
 	crosshairY = Cvar_Get ("crosshairY", "0", CVAR_ARCHIVE);
@@ -175,7 +175,7 @@ typedef struct
 
 	frame_t		frame;				// received from server
 	int			surpressCount;		// number of messages rate supressed
-	frame_t		frames[UPDATE_BACKUP];
+	frame_t		frames[MAX_UPDATE_BACKUP];
 
 	// the client maintains its own idea of view angles, which are
 	// sent to the server each frame. It is cleared to 0 upon entering each level.
@@ -316,6 +316,8 @@ extern	cvar_t	*cl_stereo;
 
 extern	cvar_t	*cl_drawParticles;
 extern	cvar_t	*cl_particleCollision;
+extern	cvar_t	*cl_maxparticles;
+extern	cvar_t	*cl_jobs;
 
 extern	cvar_t	*cl_gun;
 extern	cvar_t	*cl_gunAlpha;
@@ -379,10 +381,10 @@ typedef struct
 extern	centity_t	cl_entities[MAX_EDICTS];
 extern	cdlight_t	cl_dlights[MAX_LIGHTS];
 
-// the cl_parse_entities must be large enough to hold UPDATE_BACKUP frames of
+// the cl_parse_entities must be large enough to hold MAX_UPDATE_BACKUP frames of
 // entities, so that when a delta compressed message arives from the server
 // it can be un-deltad from the original
-#define	MAX_PARSE_ENTITIES	1024
+#define	MAX_PARSE_ENTITIES	(MAX_UPDATE_BACKUP*64)
 extern	entity_state_t	cl_parse_entities[MAX_PARSE_ENTITIES];
 
 //=============================================================================
@@ -396,12 +398,9 @@ void CL_AddNetgraph (void);
 
 typedef struct particle_s
 {
-	struct particle_s	*next;
-
 	float		time;
 
 	vec3_t		org;
-	vec3_t		oldOrg;
 	vec3_t		vel;
 	vec3_t		accel;
 	float		color;
@@ -418,6 +417,7 @@ typedef struct particle_s
 
 void CL_ClearEffects (void);
 void CL_ClearTEnts (void);
+cparticle_t *CL_AllocParticle (void);
 void CL_BlasterTrail (vec3_t start, vec3_t end, float color);
 void CL_QuadTrail (vec3_t start, vec3_t end);
 void CL_RailTrail (vec3_t start, vec3_t end);
@@ -454,6 +454,7 @@ void CL_AddLightStyles (void);
 
 void CL_PrepRefresh (void);
 void CL_RegisterSounds (void);
+void CL_PrefetchConfigString (int i);
 
 void CL_Quit_f (void);
 
@@ -546,8 +547,14 @@ extern	struct model_s	*gun_model;
 void V_Init (void);
 void V_RenderView (float stereo_separation);
 void V_AddEntity (entity_t *ent);
-void V_AddParticle (vec3_t org, int color, float alpha);
+particle_t *V_BeginParticles (int *room);
+void V_EndParticles (int count);
 void V_AddLight (vec3_t org, float intensity, float r, float g, float b);
+
+typedef struct vscene_s vscene_t;
+vscene_t *V_JobScene (int num);
+void V_SetScene (vscene_t *scene);
+void V_MergeScene (vscene_t *scene);
 void V_AddLightStyle (int style, float r, float g, float b);
 
 //
@@ -574,6 +581,9 @@ void CL_RocketTrail (vec3_t start, vec3_t end, centity_t *old);
 void CL_DiminishingTrail (vec3_t start, vec3_t end, centity_t *old, int flags);
 void CL_FlyEffect (centity_t *ent, vec3_t origin);
 void CL_BfgParticles (entity_t *ent);
+#define	MAX_PARTICLE_JOBS	4
+struct job_s;
+int CL_ParticleJobs (struct job_s *jobs, int maxjobs);
 void CL_AddParticles (void);
 void CL_EntityEvent (entity_state_t *ent);
 
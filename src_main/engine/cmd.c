@@ -23,9 +23,14 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
 void Cmd_ForwardToServer (void);
 
+#define	CMD_HASH_SIZE		512		// must be a power of two
+#define	ALIAS_HASH_SIZE		256		// must be a power of two
+
 cmdalias_t	*cmd_alias;
+static cmdalias_t	*cmd_aliasHash[ALIAS_HASH_SIZE];
 
 qboolean	cmd_wait;
+static qboolean	cmd_nohash;		// cmd_bench times the list walk against the hash
 
 #define	ALIAS_LOOP_COUNT	16
 int		alias_count;		// for detecting runaway loops
@@ -56,10 +61,34 @@ void Cmd_Wait_f (void)
 =============================================================================
 */
 
+/*
+Cbuf_Execute doesn't move the text down after every line, cmd_text.readcount
+is where the unexecuted text starts. Text inserted ahead of it goes into the
+space already executed when it fits, so a large exec or an alias costs its
+own length rather than a copy of everything queued behind it.
+*/
+
 sizebuf_t	cmd_text;
-byte		cmd_text_buf[8192];
+byte		cmd_text_buf[65536];
 
-byte		defer_text_buf[8192];
+byte		defer_text_buf[65536];
+
+/*
+============
+Cbuf_Compact
+
+Moves the unexecuted text to the start of the buffer
+============
+*/
+static void Cbuf_Compact (void)
+{
+	if (!cmd_text.readcount)
+		return;
+
+	cmd_text.cursize -= cmd_text.readcount;
+	memmove (cmd_text.data, cmd_text.data + cmd_text.readcount, cmd_text.cursize);
+	cmd_text.readcount = 0;
+}
 
 /*
 ============
@@ -84,13 +113,16 @@ void Cbuf_AddText (char *text)
 
 	l = strlen (text);
 
+	if (cmd_text.cursize + l >= cmd_text.maxsize)
+		Cbuf_Compact ();
+
 	if (cmd_text.cursize + l >= cmd_text.maxsize)
 	{
 		Com_Printf (S_COLOR_RED "Cbuf_AddText: overflow\n");
 		return;
 	}
 
-	SZ_Write (&cmd_text, text, strlen (text));
+	SZ_Write (&cmd_text, text, l);
 }
 
 
@@ -100,13 +132,25 @@ Cbuf_InsertText
 
 Adds command text immediately after the current command
 Adds a \n to the text
-FIXME: actually change the command buffer to do less copying
 ============
 */
 void Cbuf_InsertText (char *text)
 {
 	char	*temp;
 	int		templen;
+	int		l;
+
+	l = strlen (text);
+
+	// slot it in ahead of the unexecuted text when there's room
+	if (l <= cmd_text.readcount)
+	{
+		cmd_text.readcount -= l;
+		memcpy (cmd_text.data + cmd_text.readcount, text, l);
+		return;
+	}
+
+	Cbuf_Compact ();
 
 	// copy off any commands still remaining in the exec buffer
 	templen = cmd_text.cursize;
@@ -139,6 +183,8 @@ Cbuf_CopyToDefer
 */
 void Cbuf_CopyToDefer (void)
 {
+	Cbuf_Compact ();
+
 	memcpy (defer_text_buf, cmd_text_buf, cmd_text.cursize);
 	defer_text_buf[cmd_text.cursize] = 0;
 	cmd_text.cursize = 0;
@@ -186,21 +232,22 @@ Cbuf_Execute
 */
 void Cbuf_Execute (void)
 {
-	int		i;
+	int		i, len;
 	char	*text;
 	char	line[1024];
 	int		quotes;
 
 	alias_count = 0;		// don't allow infinite alias loops
 
-	while (cmd_text.cursize)
+	while (cmd_text.readcount < cmd_text.cursize)
 	{
 		// find a \n or; line break
-		text = (char *) cmd_text.data;
+		text = (char *) cmd_text.data + cmd_text.readcount;
+		len = cmd_text.cursize - cmd_text.readcount;
 
 		quotes = 0;
 
-		for (i = 0; i < cmd_text.cursize; i++)
+		for (i = 0; i < len; i++)
 		{
 			if (text[i] == '"')
 				quotes++;
@@ -223,18 +270,12 @@ void Cbuf_Execute (void)
 			line[i] = 0;
 		}
 
-		// delete the text from the command buffer and move remaining commands down
-		// this is necessary because commands (exec, alias) can insert data at the
-		// beginning of the text buffer
-
-		if (i == cmd_text.cursize)
-			cmd_text.cursize = 0;
+		// skip the line, commands (exec, alias) can insert data at the
+		// beginning of the remaining text
+		if (i == len)
+			cmd_text.readcount = cmd_text.cursize = 0;
 		else
-		{
-			i++;
-			cmd_text.cursize -= i;
-			memmove (text, text + i, cmd_text.cursize);
-		}
+			cmd_text.readcount += i + 1;
 
 		// execute the command line
 		Cmd_ExecuteString (line);
@@ -247,6 +288,9 @@ void Cbuf_Execute (void)
 			break;
 		}
 	}
+
+	if (cmd_text.readcount == cmd_text.cursize)
+		cmd_text.readcount = cmd_text.cursize = 0;
 }
 
 
@@ -494,6 +538,7 @@ void Cmd_Alias_f (void)
 	cmdalias_t	*a;
 	char		cmd[1024];
 	int			i, c;
+	int			hash;
 	char		*s;
 
 	if (Cmd_Argc() == 1)
@@ -511,7 +556,9 @@ void Cmd_Alias_f (void)
 	}
 
 	// if the alias already exists, reuse it
-	for (a = cmd_alias; a; a = a->next)
+	hash = Com_HashName (s) & (ALIAS_HASH_SIZE - 1);
+
+	for (a = cmd_nohash ? cmd_alias : cmd_aliasHash[hash]; a; a = cmd_nohash ? a->next : a->hashNext)
 	{
 		if (!strcmp (s, a->name))
 		{
@@ -525,6 +572,8 @@ void Cmd_Alias_f (void)
 		a = Z_Malloc (sizeof (cmdalias_t));
 		a->next = cmd_alias;
 		cmd_alias = a;
+		a->hashNext = cmd_aliasHash[hash];
+		cmd_aliasHash[hash] = a;
 	}
 
 	strcpy (a->name, s);
@@ -554,12 +603,15 @@ void Cmd_Alias_f (void)
 =============================================================================
 */
 
+extern	qboolean	cvar_nohash;
+
 static	int			cmd_argc;
 static	char		*cmd_argv[MAX_STRING_TOKENS];
 static	char		*cmd_null_string = "";
 static	char		cmd_args[MAX_STRING_CHARS];
 
 cmd_function_t		*cmd_functions; // possible commands to execute
+static cmd_function_t	*cmd_hash[CMD_HASH_SIZE];
 
 /*
 ============
@@ -766,6 +818,7 @@ Cmd_AddCommand
 void Cmd_AddCommand (char *cmd_name, xcommand_t function)
 {
 	cmd_function_t	*cmd;
+	int				hash;
 
 	// fail if the command is a variable name
 	if (Cvar_VariableString (cmd_name) [0])
@@ -775,7 +828,9 @@ void Cmd_AddCommand (char *cmd_name, xcommand_t function)
 	}
 
 	// fail if the command already exists
-	for (cmd = cmd_functions; cmd; cmd = cmd->next)
+	hash = Com_HashName (cmd_name) & (CMD_HASH_SIZE - 1);
+
+	for (cmd = cmd_hash[hash]; cmd; cmd = cmd->hashNext)
 	{
 		if (!strcmp (cmd_name, cmd->name))
 		{
@@ -789,6 +844,8 @@ void Cmd_AddCommand (char *cmd_name, xcommand_t function)
 	cmd->function = function;
 	cmd->next = cmd_functions;
 	cmd_functions = cmd;
+	cmd->hashNext = cmd_hash[hash];
+	cmd_hash[hash] = cmd;
 }
 
 /*
@@ -815,6 +872,11 @@ void Cmd_RemoveCommand (char *cmd_name)
 		if (!strcmp (cmd_name, cmd->name))
 		{
 			*back = cmd->next;
+
+			for (back = &cmd_hash[Com_HashName (cmd_name) & (CMD_HASH_SIZE - 1)]; *back != cmd; back = &(*back)->hashNext)
+				;
+
+			*back = cmd->hashNext;
 			Z_Free (cmd);
 			return;
 		}
@@ -832,7 +894,7 @@ qboolean Cmd_Exists (char *cmd_name)
 {
 	cmd_function_t	*cmd;
 
-	for (cmd = cmd_functions; cmd; cmd = cmd->next)
+	for (cmd = cmd_hash[Com_HashName (cmd_name) & (CMD_HASH_SIZE - 1)]; cmd; cmd = cmd->hashNext)
 	{
 		if (!strcmp (cmd_name, cmd->name))
 			return true;
@@ -871,13 +933,17 @@ qboolean doneWithDefaultCfg;
 Cmd_ExecuteString
 
 A complete command line has been parsed, so try to execute it
-FIXME: lookupnoadd the token to speed search?
+
+Both hash tables are keyed case insensitively, and as the chains are
+in the same newest first order as the lists, the match found is the
+one the list walk would have found
 ============
 */
 void Cmd_ExecuteString (char *text)
 {
 	cmd_function_t	*cmd;
 	cmdalias_t		*a;
+	unsigned		hash;
 
 	Cmd_TokenizeString (text, true);
 
@@ -891,8 +957,10 @@ void Cmd_ExecuteString (char *text)
 		doneWithDefaultCfg = true;
 	}
 
+	hash = cmd_nohash ? 0 : Com_HashName (cmd_argv[0]);
+
 	// check functions
-	for (cmd = cmd_functions; cmd; cmd = cmd->next)
+	for (cmd = cmd_nohash ? cmd_functions : cmd_hash[hash & (CMD_HASH_SIZE - 1)]; cmd; cmd = cmd_nohash ? cmd->next : cmd->hashNext)
 	{
 		if (!Q_strcasecmp (cmd_argv[0], cmd->name))
 		{
@@ -909,7 +977,7 @@ void Cmd_ExecuteString (char *text)
 	}
 
 	// check alias
-	for (a = cmd_alias; a; a = a->next)
+	for (a = cmd_nohash ? cmd_alias : cmd_aliasHash[hash & (ALIAS_HASH_SIZE - 1)]; a; a = cmd_nohash ? a->next : a->hashNext)
 	{
 		if (!Q_strcasecmp (cmd_argv[0], a->name))
 		{
@@ -984,6 +1052,99 @@ void Cmd_List_f (void)
 	Z_Free (sortedList);
 }
 
+/*
+============
+Cmd_Bench_f
+
+cmd_bench [lines]
+
+Writes an autoexec of the usual set, bare cvar and alias lines and
+execs it with the hash tables and then with the list walks. The bench
+cvars and aliases are left defined, the cvars aren't archived
+============
+*/
+#define	BENCH_VARS		256
+#define	BENCH_ALIASES	64
+#define	BENCH_PASSES	5
+
+static void Cmd_Bench_f (void)
+{
+	char		name[MAX_OSPATH];
+	char		*pending;
+	FILE		*f;
+	int			i, lines, len, pendinglen, mode, pass;
+	unsigned	start, usec[2];
+
+	lines = (Cmd_Argc () > 1) ? atoi (Cmd_Argv (1)) : 2000;
+
+	if (lines < 1)
+	{
+		Com_Printf ("usage: cmd_bench [lines]\n");
+		return;
+	}
+
+	Com_sprintf (name, sizeof (name), "%s/bench_autoexec.cfg", FS_Gamedir ());
+
+	FS_CreatePath (name);
+	f = fopen (name, "w");
+
+	if (!f)
+	{
+		Com_Printf (S_COLOR_RED "ERROR: couldn't open %s.\n", name);
+		return;
+	}
+
+	srand (1);
+
+	// it has to fit the command buffer in one piece
+	for (i = 0, len = 0; i < lines && len < sizeof (cmd_text_buf) - 1024; i++)
+	{
+		if (i < BENCH_VARS)
+			len += fprintf (f, "set bench_%i %i\n", i, rand ());
+		else if (!(i & 7))
+			len += fprintf (f, "alias bench_a%i \"set bench_%i %i\"\n", (i >> 3) % BENCH_ALIASES, rand () % BENCH_VARS, rand ());
+		else if (i & 1)
+			len += fprintf (f, "set bench_%i %i\n", rand () % BENCH_VARS, rand ());
+		else
+			len += fprintf (f, "bench_%i %i\n", rand () % BENCH_VARS, rand ());
+	}
+
+	fclose (f);
+	lines = i;
+
+	// keep whatever was queued behind this command out of the timing
+	pendinglen = cmd_text.cursize - cmd_text.readcount;
+	pending = Z_Malloc (pendinglen + 1);
+	memcpy (pending, cmd_text.data + cmd_text.readcount, pendinglen);
+	cmd_text.readcount = cmd_text.cursize = 0;
+
+	// the first exec defines everything
+	Cbuf_AddText ("exec bench_autoexec.cfg\n");
+	Cbuf_Execute ();
+
+	for (mode = 0; mode < 2; mode++)
+	{
+		cvar_nohash = cmd_nohash = mode;
+		start = Sys_Microseconds ();
+
+		for (pass = 0; pass < BENCH_PASSES; pass++)
+		{
+			Cbuf_AddText ("exec bench_autoexec.cfg\n");
+			Cbuf_Execute ();
+		}
+
+		usec[mode] = Sys_Microseconds () - start;
+	}
+
+	cvar_nohash = cmd_nohash = false;
+
+	Cbuf_AddText (pending);
+	Z_Free (pending);
+
+	Com_Printf ("%i passes of %i lines: hashed %.2f ms (%.2f usec/line), lists %.2f ms (%.2f usec/line)\n", BENCH_PASSES, lines,
+		usec[0] / 1000.0f, (float) usec[0] / (BENCH_PASSES * lines), usec[1] / 1000.0f, (float) usec[1] / (BENCH_PASSES * lines));
+}
+
 /*
 ============
 Cmd_Init
@@ -1000,5 +1161,6 @@ void Cmd_Init (void)
 	Cmd_AddCommand ("alias", Cmd_Alias_f);
 	Cmd_AddCommand ("aliaslist", Cmd_Aliaslist_f);
 	Cmd_AddCommand ("wait", Cmd_Wait_f);
+	Cmd_AddCommand ("cmd_bench", Cmd_Bench_f);
 }
 
@@ -20,6 +20,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 // common.c -- misc functions used in client and server
 #include "qcommon.h"
 #include <setjmp.h>
+#include <SDL_cpuinfo.h>
 #ifdef _WIN32
 #include <windows.h>
 #endif
@@ -49,6 +50,7 @@ cvar_t	*fixedtime;
 cvar_t	*logfile_active;	// 1 = buffer log, 2 = flush after each print
 cvar_t	*showtrace;
 cvar_t	*dedicated;
+cvar_t	*com_simd;
 
 // for timing calculations
 cvar_t	*cl_timedemo;
@@ -550,227 +552,6 @@ void MSG_ReadDir (sizebuf_t *sb, vec3_t dir)
 }
 
 
-/*
-==================
-MSG_WriteDeltaEntity
-
-Writes part of a packetentities message.
-Can delta from either a baseline or a previous packet_entity
-==================
-*/
-void MSG_WriteDeltaEntity (entity_state_t *from, entity_state_t *to, sizebuf_t *msg, qboolean force, qboolean newentity)
-{
-	int		bits;
-
-	if (!to->number)
-		Com_Error (ERR_FATAL, "Unset entity number");
-
-	if (to->number >= MAX_EDICTS)
-		Com_Error (ERR_FATAL, "Entity number >= MAX_EDICTS");
-
-	// send an update
-	bits = 0;
-
-	if (to->number >= 256)
-		bits |= U_NUMBER16;		// number8 is implicit otherwise
-
-	if (to->origin[0] != from->origin[0])
-		bits |= U_ORIGIN1;
-
-	if (to->origin[1] != from->origin[1])
-		bits |= U_ORIGIN2;
-
-	if (to->origin[2] != from->origin[2])
-		bits |= U_ORIGIN3;
-
-	if (to->angles[0] != from->angles[0])
-		bits |= U_ANGLE1;
-
-	if (to->angles[1] != from->angles[1])
-		bits |= U_ANGLE2;
-
-	if (to->angles[2] != from->angles[2])
-		bits |= U_ANGLE3;
-
-	if (to->skinnum != from->skinnum)
-	{
-		if ((unsigned) to->skinnum < 256)
-			bits |= U_SKIN8;
-		else if ((unsigned) to->skinnum < 0x10000)
-			bits |= U_SKIN16;
-		else
-			bits |= (U_SKIN8 | U_SKIN16);
-	}
-
-	if (to->frame != from->frame)
-	{
-		if (to->frame < 256)
-			bits |= U_FRAME8;
-		else
-			bits |= U_FRAME16;
-	}
-
-	if (to->effects != from->effects)
-	{
-		if (to->effects < 256)
-			bits |= U_EFFECTS8;
-		else if (to->effects < 0x8000)
-			bits |= U_EFFECTS16;
-		else
-			bits |= U_EFFECTS8 | U_EFFECTS16;
-	}
-
-	if (to->renderfx != from->renderfx)
-	{
-		if (to->renderfx < 256)
-			bits |= U_RENDERFX8;
-		else if (to->renderfx < 0x8000)
-			bits |= U_RENDERFX16;
-		else
-			bits |= U_RENDERFX8 | U_RENDERFX16;
-	}
-
-	if (to->solid != from->solid)
-		bits |= U_SOLID;
-
-	// event is not delta compressed, just 0 compressed
-	if (to->event)
-		bits |= U_EVENT;
-
-	if (to->modelindex != from->modelindex)
-		bits |= U_MODEL;
-
-	if (to->modelindex2 != from->modelindex2)
-		bits |= U_MODEL2;
-
-	if (to->modelindex3 != from->modelindex3)
-		bits |= U_MODEL3;
-
-	if (to->modelindex4 != from->modelindex4)
-		bits |= U_MODEL4;
-
-	if (to->sound != from->sound)
-		bits |= U_SOUND;
-
-	if (newentity || (to->renderfx & RF_BEAM))
-		bits |= U_OLDORIGIN;
-
-	//
-	// write the message
-	//
-	if (!bits && !force)
-		return;		// nothing to send!
-
-	//----------
-
-	if (bits & 0xff000000)
-		bits |= U_MOREBITS3 | U_MOREBITS2 | U_MOREBITS1;
-	else if (bits & 0x00ff0000)
-		bits |= U_MOREBITS2 | U_MOREBITS1;
-	else if (bits & 0x0000ff00)
-		bits |= U_MOREBITS1;
-
-	MSG_WriteByte (msg,	bits & 255);
-
-	if (bits & 0xff000000)
-	{
-		MSG_WriteByte (msg,	(bits >> 8) & 255);
-		MSG_WriteByte (msg,	(bits >> 16) & 255);
-		MSG_WriteByte (msg,	(bits >> 24) & 255);
-	}
-	else if (bits & 0x00ff0000)
-	{
-		MSG_WriteByte (msg,	(bits >> 8) & 255);
-		MSG_WriteByte (msg,	(bits >> 16) & 255);
-	}
-	else if (bits & 0x0000ff00)
-	{
-		MSG_WriteByte (msg,	(bits >> 8) & 255);
-	}
-
-	//----------
-
-	if (bits & U_NUMBER16)
-		MSG_WriteShort (msg, to->number);
-	else
-		MSG_WriteByte (msg,	to->number);
-
-	if (bits & U_MODEL)
-		MSG_WriteByte (msg,	to->modelindex);
-
-	if (bits & U_MODEL2)
-		MSG_WriteByte (msg,	to->modelindex2);
-
-	if (bits & U_MODEL3)
-		MSG_WriteByte (msg,	to->modelindex3);
-
-	if (bits & U_MODEL4)
-		MSG_WriteByte (msg,	to->modelindex4);
-
-	if (bits & U_FRAME8)
-		MSG_WriteByte (msg, to->frame);
-
-	if (bits & U_FRAME16)
-		MSG_WriteShort (msg, to->frame);
-
-	if ((bits & U_SKIN8) && (bits & U_SKIN16))		//used for laser colors
-		MSG_WriteLong (msg, to->skinnum);
-	else if (bits & U_SKIN8)
-		MSG_WriteByte (msg, to->skinnum);
-	else if (bits & U_SKIN16)
-		MSG_WriteShort (msg, to->skinnum);
-
-
-	if ((bits & (U_EFFECTS8 | U_EFFECTS16)) == (U_EFFECTS8 | U_EFFECTS16))
-		MSG_WriteLong (msg, to->effects);
-	else if (bits & U_EFFECTS8)
-		MSG_WriteByte (msg, to->effects);
-	else if (bits & U_EFFECTS16)
-		MSG_WriteShort (msg, to->effects);
-
-	if ((bits & (U_RENDERFX8 | U_RENDERFX16)) == (U_RENDERFX8 | U_RENDERFX16))
-		MSG_WriteLong (msg, to->renderfx);
-	else if (bits & U_RENDERFX8)
-		MSG_WriteByte (msg, to->renderfx);
-	else if (bits & U_RENDERFX16)
-		MSG_WriteShort (msg, to->renderfx);
-
-	if (bits & U_ORIGIN1)
-		MSG_WriteCoord (msg, to->origin[0]);
-
-	if (bits & U_ORIGIN2)
-		MSG_WriteCoord (msg, to->origin[1]);
-
-	if (bits & U_ORIGIN3)
-		MSG_WriteCoord (msg, to->origin[2]);
-
-	if (bits & U_ANGLE1)
-		MSG_WriteAngle (msg, to->angles[0]);
-
-	if (bits & U_ANGLE2)
-		MSG_WriteAngle (msg, to->angles[1]);
-
-	if (bits & U_ANGLE3)
-		MSG_WriteAngle (msg, to->angles[2]);
-
-	if (bits & U_OLDORIGIN)
-	{
-		MSG_WriteCoord (msg, to->old_origin[0]);
-		MSG_WriteCoord (msg, to->old_origin[1]);
-		MSG_WriteCoord (msg, to->old_origin[2]);
-	}
-
-	if (bits & U_SOUND)
-		MSG_WriteByte (msg, to->sound);
-
-	if (bits & U_EVENT)
-		MSG_WriteByte (msg, to->event);
-
-	if (bits & U_SOLID)
-		MSG_WriteShort (msg, to->solid);
-}
-
-
 //============================================================
 
 //
@@ -880,117 +661,1082 @@ char *MSG_ReadString (sizebuf_t *msg_read)
 	{
 		c = MSG_ReadChar (msg_read);
 
-		if (c == -1 || c == 0)
-			break;
+		if (c == -1 || c == 0)
+			break;
+
+		string[l] = c;
+		l++;
+	}
+	while (l < sizeof (string) - 1);
+
+	string[l] = 0;
+
+	return string;
+}
+
+char *MSG_ReadStringLine (sizebuf_t *msg_read)
+{
+	static char	string[2048];
+	int		l, c;
+
+	l = 0;
+
+	do
+	{
+		c = MSG_ReadChar (msg_read);
+
+		if (c == -1 || c == 0 || c == '\n')
+			break;
+
+		string[l] = c;
+		l++;
+	}
+	while (l < sizeof (string) - 1);
+
+	string[l] = 0;
+
+	return string;
+}
+
+float MSG_ReadCoord (sizebuf_t *msg_read)
+{
+	return MSG_ReadShort (msg_read) * (1.0 / 8);
+}
+
+void MSG_ReadPos (sizebuf_t *msg_read, vec3_t pos)
+{
+	pos[0] = MSG_ReadShort (msg_read) * (1.0 / 8);
+	pos[1] = MSG_ReadShort (msg_read) * (1.0 / 8);
+	pos[2] = MSG_ReadShort (msg_read) * (1.0 / 8);
+}
+
+float MSG_ReadAngle (sizebuf_t *msg_read)
+{
+	return MSG_ReadChar (msg_read) * (360.0 / 256);
+}
+
+float MSG_ReadAngle16 (sizebuf_t *msg_read)
+{
+	return SHORT2ANGLE (MSG_ReadShort (msg_read));
+}
+
+void MSG_ReadDeltaUsercmd (sizebuf_t *msg_read, usercmd_t *from, usercmd_t *move)
+{
+	int bits;
+
+	memcpy (move, from, sizeof (*move));
+
+	bits = MSG_ReadByte (msg_read);
+
+	// read current angles
+	if (bits & CM_ANGLE1)
+		move->angles[0] = MSG_ReadShort (msg_read);
+
+	if (bits & CM_ANGLE2)
+		move->angles[1] = MSG_ReadShort (msg_read);
+
+	if (bits & CM_ANGLE3)
+		move->angles[2] = MSG_ReadShort (msg_read);
+
+	// read movement
+	if (bits & CM_FORWARD)
+		move->forwardmove = MSG_ReadShort (msg_read);
+
+	if (bits & CM_SIDE)
+		move->sidemove = MSG_ReadShort (msg_read);
+
+	if (bits & CM_UP)
+		move->upmove = MSG_ReadShort (msg_read);
+
+	// read buttons
+	if (bits & CM_BUTTONS)
+		move->buttons = MSG_ReadByte (msg_read);
+
+	if (bits & CM_IMPULSE)
+		move->impulse = MSG_ReadByte (msg_read);
+
+	// read time to run command
+	move->msec = MSG_ReadByte (msg_read);
+
+	// read the light level
+	move->lightlevel = MSG_ReadByte (msg_read);
+}
+
+
+void MSG_ReadData (sizebuf_t *msg_read, void *data, int len)
+{
+	int		i;
+
+	for (i = 0; i < len; i++)
+		((byte *) data) [i] = MSG_ReadByte (msg_read);
+}
+
+
+/*
+==============================================================================
+
+			ENTITY DELTAS
+
+MSG_WriteDeltaEntity and MSG_ReadDeltaEntity run for every entity in
+every frame message. When the worst case delta fits in the buffer they
+work on it directly instead of going through the MSG_* calls one field
+at a time, the bytes are the same either way
+==============================================================================
+*/
+
+static int	(*msg_deltabits) (entity_state_t *from, entity_state_t *to);
+static qboolean	msg_slowdelta;		// always take the field at a time paths, for msg_bench
+
+static int MSG_SkinBits (int skinnum)
+{
+	if ((unsigned) skinnum < 256)
+		return U_SKIN8;
+
+	if ((unsigned) skinnum < 0x10000)
+		return U_SKIN16;
+
+	return U_SKIN8 | U_SKIN16;
+}
+
+static int MSG_FrameBits (int frame)
+{
+	return (frame < 256) ? U_FRAME8 : U_FRAME16;
+}
+
+static int MSG_EffectsBits (unsigned effects)
+{
+	if (effects < 256)
+		return U_EFFECTS8;
+
+	if (effects < 0x8000)
+		return U_EFFECTS16;
+
+	return U_EFFECTS8 | U_EFFECTS16;
+}
+
+static int MSG_RenderfxBits (int renderfx)
+{
+	if (renderfx < 256)
+		return U_RENDERFX8;
+
+	if (renderfx < 0x8000)
+		return U_RENDERFX16;
+
+	return U_RENDERFX8 | U_RENDERFX16;
+}
+
+/*
+==================
+MSG_DeltaBits
+
+Which fields of to differ from from, without the bits that don't
+depend on from
+==================
+*/
+static int MSG_DeltaBits (entity_state_t *from, entity_state_t *to)
+{
+	int		bits = 0;
+
+	if (to->origin[0] != from->origin[0])
+		bits |= U_ORIGIN1;
+
+	if (to->origin[1] != from->origin[1])
+		bits |= U_ORIGIN2;
+
+	if (to->origin[2] != from->origin[2])
+		bits |= U_ORIGIN3;
+
+	if (to->angles[0] != from->angles[0])
+		bits |= U_ANGLE1;
+
+	if (to->angles[1] != from->angles[1])
+		bits |= U_ANGLE2;
+
+	if (to->angles[2] != from->angles[2])
+		bits |= U_ANGLE3;
+
+	if (to->skinnum != from->skinnum)
+		bits |= MSG_SkinBits (to->skinnum);
+
+	if (to->frame != from->frame)
+		bits |= MSG_FrameBits (to->frame);
+
+	if (to->effects != from->effects)
+		bits |= MSG_EffectsBits (to->effects);
+
+	if (to->renderfx != from->renderfx)
+		bits |= MSG_RenderfxBits (to->renderfx);
+
+	if (to->solid != from->solid)
+		bits |= U_SOLID;
+
+	if (to->modelindex != from->modelindex)
+		bits |= U_MODEL;
+
+	if (to->modelindex2 != from->modelindex2)
+		bits |= U_MODEL2;
+
+	if (to->modelindex3 != from->modelindex3)
+		bits |= U_MODEL3;
+
+	if (to->modelindex4 != from->modelindex4)
+		bits |= U_MODEL4;
+
+	if (to->sound != from->sound)
+		bits |= U_SOUND;
+
+	return bits;
+}
+
+#ifdef Q_SSE2
+#include <emmintrin.h>
+
+// the bits for every combination of four changed lanes
+#define	LANEBITS(a,b,c,d)	{0, a, b, a|b, c, a|c, b|c, a|b|c, d, a|d, b|d, a|b|d, c|d, a|c|d, b|c|d, a|b|c|d}
+
+static const int	msg_originbits[16] = LANEBITS (U_ORIGIN1, U_ORIGIN2, U_ORIGIN3, U_ANGLE1);
+static const int	msg_anglebits[16] = LANEBITS (U_ANGLE2, U_ANGLE3, 0, 0);
+static const int	msg_modelbits[16] = LANEBITS (U_MODEL, U_MODEL2, U_MODEL3, U_MODEL4);
+static const int	msg_solidbits[16] = LANEBITS (0, U_SOLID, U_SOUND, 0);
+
+#define	INTS_CHANGED(from,to,field) \
+	(~_mm_movemask_ps (_mm_castsi128_ps (_mm_cmpeq_epi32 (_mm_loadu_si128 ((__m128i *) &(from)->field), _mm_loadu_si128 ((__m128i *) &(to)->field)))) & 15)
+
+/*
+==================
+MSG_DeltaBits_SSE2
+
+Compares four fields at a time, entity_state_t keeps the floats and
+the ints in runs. The float compares are unordered like C's !=
+==================
+*/
+static int MSG_DeltaBits_SSE2 (entity_state_t *from, entity_state_t *to)
+{
+	int		bits, changed;
+
+	// origin, angles[0] and angles[1..2]
+	bits = msg_originbits[_mm_movemask_ps (_mm_cmpneq_ps (_mm_loadu_ps (from->origin), _mm_loadu_ps (to->origin)))];
+	bits |= msg_anglebits[_mm_movemask_ps (_mm_cmpneq_ps (_mm_loadu_ps (&from->angles[1]), _mm_loadu_ps (&to->angles[1]))) & 3];
+
+	// modelindex to modelindex4, and renderfx to event for solid and sound
+	bits |= msg_modelbits[INTS_CHANGED (from, to, modelindex)];
+	bits |= msg_solidbits[INTS_CHANGED (from, to, renderfx)];
+
+	// frame, skinnum, effects and renderfx also depend on the new value
+	changed = INTS_CHANGED (from, to, frame);
+
+	if (changed)
+	{
+		if (changed & 1)
+			bits |= MSG_FrameBits (to->frame);
+
+		if (changed & 2)
+			bits |= MSG_SkinBits (to->skinnum);
+
+		if (changed & 4)
+			bits |= MSG_EffectsBits (to->effects);
+
+		if (changed & 8)
+			bits |= MSG_RenderfxBits (to->renderfx);
+	}
+
+	return bits;
+}
+#endif
+
+/*
+==================
+MSG_SetSIMD
+==================
+*/
+static void MSG_SetSIMD (int level)
+{
+	msg_deltabits = MSG_DeltaBits;
+
+#ifdef Q_SSE2
+	if (level >= SIMD_SSE2)
+		msg_deltabits = MSG_DeltaBits_SSE2;
+#endif
+}
+
+/*
+==================
+MSG_WriteDeltaFields
+
+Writes a delta one field at a time, for when it may not fit
+==================
+*/
+static void MSG_WriteDeltaFields (entity_state_t *to, sizebuf_t *msg, int bits)
+{
+	MSG_WriteByte (msg,	bits & 255);
+
+	if (bits & 0xff000000)
+	{
+		MSG_WriteByte (msg,	(bits >> 8) & 255);
+		MSG_WriteByte (msg,	(bits >> 16) & 255);
+		MSG_WriteByte (msg,	(bits >> 24) & 255);
+	}
+	else if (bits & 0x00ff0000)
+	{
+		MSG_WriteByte (msg,	(bits >> 8) & 255);
+		MSG_WriteByte (msg,	(bits >> 16) & 255);
+	}
+	else if (bits & 0x0000ff00)
+	{
+		MSG_WriteByte (msg,	(bits >> 8) & 255);
+	}
+
+	//----------
+
+	if (bits & U_NUMBER16)
+		MSG_WriteShort (msg, to->number);
+	else
+		MSG_WriteByte (msg,	to->number);
+
+	if (bits & U_MODEL)
+		MSG_WriteByte (msg,	to->modelindex);
+
+	if (bits & U_MODEL2)
+		MSG_WriteByte (msg,	to->modelindex2);
+
+	if (bits & U_MODEL3)
+		MSG_WriteByte (msg,	to->modelindex3);
+
+	if (bits & U_MODEL4)
+		MSG_WriteByte (msg,	to->modelindex4);
+
+	if (bits & U_FRAME8)
+		MSG_WriteByte (msg, to->frame);
+
+	if (bits & U_FRAME16)
+		MSG_WriteShort (msg, to->frame);
+
+	if ((bits & U_SKIN8) && (bits & U_SKIN16))		//used for laser colors
+		MSG_WriteLong (msg, to->skinnum);
+	else if (bits & U_SKIN8)
+		MSG_WriteByte (msg, to->skinnum);
+	else if (bits & U_SKIN16)
+		MSG_WriteShort (msg, to->skinnum);
+
+
+	if ((bits & (U_EFFECTS8 | U_EFFECTS16)) == (U_EFFECTS8 | U_EFFECTS16))
+		MSG_WriteLong (msg, to->effects);
+	else if (bits & U_EFFECTS8)
+		MSG_WriteByte (msg, to->effects);
+	else if (bits & U_EFFECTS16)
+		MSG_WriteShort (msg, to->effects);
+
+	if ((bits & (U_RENDERFX8 | U_RENDERFX16)) == (U_RENDERFX8 | U_RENDERFX16))
+		MSG_WriteLong (msg, to->renderfx);
+	else if (bits & U_RENDERFX8)
+		MSG_WriteByte (msg, to->renderfx);
+	else if (bits & U_RENDERFX16)
+		MSG_WriteShort (msg, to->renderfx);
+
+	if (bits & U_ORIGIN1)
+		MSG_WriteCoord (msg, to->origin[0]);
+
+	if (bits & U_ORIGIN2)
+		MSG_WriteCoord (msg, to->origin[1]);
+
+	if (bits & U_ORIGIN3)
+		MSG_WriteCoord (msg, to->origin[2]);
+
+	if (bits & U_ANGLE1)
+		MSG_WriteAngle (msg, to->angles[0]);
+
+	if (bits & U_ANGLE2)
+		MSG_WriteAngle (msg, to->angles[1]);
+
+	if (bits & U_ANGLE3)
+		MSG_WriteAngle (msg, to->angles[2]);
+
+	if (bits & U_OLDORIGIN)
+	{
+		MSG_WriteCoord (msg, to->old_origin[0]);
+		MSG_WriteCoord (msg, to->old_origin[1]);
+		MSG_WriteCoord (msg, to->old_origin[2]);
+	}
+
+	if (bits & U_SOUND)
+		MSG_WriteByte (msg, to->sound);
+
+	if (bits & U_EVENT)
+		MSG_WriteByte (msg, to->event);
+
+	if (bits & U_SOLID)
+		MSG_WriteShort (msg, to->solid);
+}
+
+// unchecked little endian stores, the space has been reserved
+#define	PUT_BYTE(p,c)	(*(p)++ = (byte) (c))
+#define	PUT_SHORT(p,c)	((p)[0] = (byte) (c), (p)[1] = (byte) ((c) >> 8), (p) += 2)
+#define	PUT_LONG(p,c)	((p)[0] = (byte) (c), (p)[1] = (byte) ((c) >> 8), (p)[2] = (byte) ((c) >> 16), (p)[3] = (byte) ((c) >> 24), (p) += 4)
+
+/*
+==================
+MSG_WriteDeltaEntity
+
+Writes part of a packetentities message.
+Can delta from either a baseline or a previous packet_entity
+==================
+*/
+void MSG_WriteDeltaEntity (entity_state_t *from, entity_state_t *to, sizebuf_t *msg, qboolean force, qboolean newentity)
+{
+	int		bits, c;
+	byte	*p;
+
+	if (!to->number)
+		Com_Error (ERR_FATAL, "Unset entity number");
+
+	if (to->number >= MAX_EDICTS)
+		Com_Error (ERR_FATAL, "Entity number >= MAX_EDICTS");
+
+	if (!msg_deltabits)
+		MSG_SetSIMD (Com_SIMDLevel ());
+
+	// send an update
+	bits = msg_deltabits (from, to);
+
+	if (to->number >= 256)
+		bits |= U_NUMBER16;		// number8 is implicit otherwise
+
+	// event is not delta compressed, just 0 compressed
+	if (to->event)
+		bits |= U_EVENT;
+
+	if (newentity || (to->renderfx & RF_BEAM))
+		bits |= U_OLDORIGIN;
+
+	//
+	// write the message
+	//
+	if (!bits && !force)
+		return;		// nothing to send!
+
+	//----------
+
+	if (bits & 0xff000000)
+		bits |= U_MOREBITS3 | U_MOREBITS2 | U_MOREBITS1;
+	else if (bits & 0x00ff0000)
+		bits |= U_MOREBITS2 | U_MOREBITS1;
+	else if (bits & 0x0000ff00)
+		bits |= U_MOREBITS1;
+
+	if (msg_slowdelta || msg->cursize + MAX_DELTA_ENTITY > msg->maxsize)
+	{
+		MSG_WriteDeltaFields (to, msg, bits);
+		return;
+	}
+
+	// reserve the worst case and write straight into the buffer
+	p = msg->data + msg->cursize;
+
+	// all four bytes of bits go down, only the used ones are kept
+	PUT_LONG (p, bits);
+	p -= 4 - (1 + !!(bits & U_MOREBITS1) + !!(bits & U_MOREBITS2) + !!(bits & U_MOREBITS3));
+
+	if (bits & U_NUMBER16)
+		PUT_SHORT (p, to->number);
+	else
+		PUT_BYTE (p, to->number);
+
+	if (bits & (U_MODEL | U_MODEL2 | U_MODEL3 | U_MODEL4))
+	{
+		if (bits & U_MODEL)
+			PUT_BYTE (p, to->modelindex);
+
+		if (bits & U_MODEL2)
+			PUT_BYTE (p, to->modelindex2);
+
+		if (bits & U_MODEL3)
+			PUT_BYTE (p, to->modelindex3);
+
+		if (bits & U_MODEL4)
+			PUT_BYTE (p, to->modelindex4);
+	}
+
+	if (bits & U_FRAME8)
+		PUT_BYTE (p, to->frame);
+
+	if (bits & U_FRAME16)
+		PUT_SHORT (p, to->frame);
+
+	if ((bits & (U_SKIN8 | U_SKIN16)) == (U_SKIN8 | U_SKIN16))		//used for laser colors
+		PUT_LONG (p, to->skinnum);
+	else if (bits & U_SKIN8)
+		PUT_BYTE (p, to->skinnum);
+	else if (bits & U_SKIN16)
+		PUT_SHORT (p, to->skinnum);
+
+	if ((bits & (U_EFFECTS8 | U_EFFECTS16)) == (U_EFFECTS8 | U_EFFECTS16))
+		PUT_LONG (p, to->effects);
+	else if (bits & U_EFFECTS8)
+		PUT_BYTE (p, to->effects);
+	else if (bits & U_EFFECTS16)
+		PUT_SHORT (p, to->effects);
+
+	if ((bits & (U_RENDERFX8 | U_RENDERFX16)) == (U_RENDERFX8 | U_RENDERFX16))
+		PUT_LONG (p, to->renderfx);
+	else if (bits & U_RENDERFX8)
+		PUT_BYTE (p, to->renderfx);
+	else if (bits & U_RENDERFX16)
+		PUT_SHORT (p, to->renderfx);
+
+	if (bits & (U_ORIGIN1 | U_ORIGIN2 | U_ORIGIN3 | U_ANGLE1 | U_ANGLE2 | U_ANGLE3))
+	{
+		if (bits & U_ORIGIN1)
+		{
+			c = (int) (to->origin[0] * 8);
+			PUT_SHORT (p, c);
+		}
+
+		if (bits & U_ORIGIN2)
+		{
+			c = (int) (to->origin[1] * 8);
+			PUT_SHORT (p, c);
+		}
+
+		if (bits & U_ORIGIN3)
+		{
+			c = (int) (to->origin[2] * 8);
+			PUT_SHORT (p, c);
+		}
+
+		if (bits & U_ANGLE1)
+			PUT_BYTE (p, (int) (to->angles[0] * 256 / 360));
+
+		if (bits & U_ANGLE2)
+			PUT_BYTE (p, (int) (to->angles[1] * 256 / 360));
+
+		if (bits & U_ANGLE3)
+			PUT_BYTE (p, (int) (to->angles[2] * 256 / 360));
+	}
+
+	if (bits & U_OLDORIGIN)
+	{
+		c = (int) (to->old_origin[0] * 8);
+		PUT_SHORT (p, c);
+		c = (int) (to->old_origin[1] * 8);
+		PUT_SHORT (p, c);
+		c = (int) (to->old_origin[2] * 8);
+		PUT_SHORT (p, c);
+	}
+
+	if (bits & U_SOUND)
+		PUT_BYTE (p, to->sound);
+
+	if (bits & U_EVENT)
+		PUT_BYTE (p, to->event);
+
+	if (bits & U_SOLID)
+		PUT_SHORT (p, to->solid);
+
+	msg->cursize = p - msg->data;
+}
+
+/*
+==================
+MSG_ReadEntityBits
+
+Reads the bits of a delta and returns the entity number that follows
+==================
+*/
+int MSG_ReadEntityBits (sizebuf_t *msg, unsigned *bits)
+{
+	unsigned	b, total;
+	int			number;
+
+	total = MSG_ReadByte (msg);
+
+	if (total & U_MOREBITS1)
+	{
+		b = MSG_ReadByte (msg);
+		total |= b << 8;
+	}
+
+	if (total & U_MOREBITS2)
+	{
+		b = MSG_ReadByte (msg);
+		total |= b << 16;
+	}
+
+	if (total & U_MOREBITS3)
+	{
+		b = MSG_ReadByte (msg);
+		total |= b << 24;
+	}
+
+	if (total & U_NUMBER16)
+		number = MSG_ReadShort (msg);
+	else
+		number = MSG_ReadByte (msg);
+
+	*bits = total;
+
+	return number;
+}
+
+/*
+==================
+MSG_ReadDeltaFields
+
+Reads a delta one field at a time, for when it may run off the message
+==================
+*/
+static void MSG_ReadDeltaFields (sizebuf_t *msg, entity_state_t *to, int bits)
+{
+	if (bits & U_MODEL)
+		to->modelindex = MSG_ReadByte (msg);
+
+	if (bits & U_MODEL2)
+		to->modelindex2 = MSG_ReadByte (msg);
+
+	if (bits & U_MODEL3)
+		to->modelindex3 = MSG_ReadByte (msg);
+
+	if (bits & U_MODEL4)
+		to->modelindex4 = MSG_ReadByte (msg);
+
+	if (bits & U_FRAME8)
+		to->frame = MSG_ReadByte (msg);
+
+	if (bits & U_FRAME16)
+		to->frame = MSG_ReadShort (msg);
+
+	if ((bits & U_SKIN8) && (bits & U_SKIN16))		//used for laser colors
+		to->skinnum = MSG_ReadLong (msg);
+	else if (bits & U_SKIN8)
+		to->skinnum = MSG_ReadByte (msg);
+	else if (bits & U_SKIN16)
+		to->skinnum = MSG_ReadShort (msg);
+
+	if ((bits & (U_EFFECTS8 | U_EFFECTS16)) == (U_EFFECTS8 | U_EFFECTS16))
+		to->effects = MSG_ReadLong (msg);
+	else if (bits & U_EFFECTS8)
+		to->effects = MSG_ReadByte (msg);
+	else if (bits & U_EFFECTS16)
+		to->effects = MSG_ReadShort (msg);
+
+	if ((bits & (U_RENDERFX8 | U_RENDERFX16)) == (U_RENDERFX8 | U_RENDERFX16))
+		to->renderfx = MSG_ReadLong (msg);
+	else if (bits & U_RENDERFX8)
+		to->renderfx = MSG_ReadByte (msg);
+	else if (bits & U_RENDERFX16)
+		to->renderfx = MSG_ReadShort (msg);
+
+	if (bits & U_ORIGIN1)
+		to->origin[0] = MSG_ReadCoord (msg);
+	if (bits & U_ORIGIN2)
+		to->origin[1] = MSG_ReadCoord (msg);
+	if (bits & U_ORIGIN3)
+		to->origin[2] = MSG_ReadCoord (msg);
+
+	if (bits & U_ANGLE1)
+		to->angles[0] = MSG_ReadAngle (msg);
+	if (bits & U_ANGLE2)
+		to->angles[1] = MSG_ReadAngle (msg);
+	if (bits & U_ANGLE3)
+		to->angles[2] = MSG_ReadAngle (msg);
+
+	if (bits & U_OLDORIGIN)
+		MSG_ReadPos (msg, to->old_origin);
+
+	if (bits & U_SOUND)
+		to->sound = MSG_ReadByte (msg);
+
+	if (bits & U_EVENT)
+		to->event = MSG_ReadByte (msg);
+	else
+		to->event = 0;
+
+	if (bits & U_SOLID)
+		to->solid = MSG_ReadShort (msg);
+}
+
+// unchecked little endian loads, the bytes are known to be there
+#define	GET_SHORT(p)	((short) ((p)[0] | ((p)[1] << 8)))
+#define	GET_LONG(p)		((int) ((unsigned) (p)[0] | ((unsigned) (p)[1] << 8) | ((unsigned) (p)[2] << 16) | ((unsigned) (p)[3] << 24)))
+
+/*
+==================
+MSG_ReadDeltaEntity
+
+Can go from either a baseline or a previous packet_entity
+==================
+*/
+void MSG_ReadDeltaEntity (sizebuf_t *msg, entity_state_t *from, entity_state_t *to, int number, int bits)
+{
+	byte	*p;
+
+	// set everything to the state we are delta'ing from
+	*to = *from;
+
+	VectorCopy (from->origin, to->old_origin);
+	to->number = number;
+
+	if (msg_slowdelta || msg->readcount + MAX_DELTA_ENTITY > msg->cursize)
+	{
+		MSG_ReadDeltaFields (msg, to, bits);
+		return;
+	}
+
+	p = msg->data + msg->readcount;
+
+	if (bits & (U_MODEL | U_MODEL2 | U_MODEL3 | U_MODEL4))
+	{
+		if (bits & U_MODEL)
+			to->modelindex = *p++;
+
+		if (bits & U_MODEL2)
+			to->modelindex2 = *p++;
+
+		if (bits & U_MODEL3)
+			to->modelindex3 = *p++;
+
+		if (bits & U_MODEL4)
+			to->modelindex4 = *p++;
+	}
+
+	if (bits & U_FRAME8)
+		to->frame = *p++;
+
+	if (bits & U_FRAME16)
+	{
+		to->frame = GET_SHORT (p);
+		p += 2;
+	}
+
+	if ((bits & (U_SKIN8 | U_SKIN16)) == (U_SKIN8 | U_SKIN16))		//used for laser colors
+	{
+		to->skinnum = GET_LONG (p);
+		p += 4;
+	}
+	else if (bits & U_SKIN8)
+		to->skinnum = *p++;
+	else if (bits & U_SKIN16)
+	{
+		to->skinnum = GET_SHORT (p);
+		p += 2;
+	}
+
+	if ((bits & (U_EFFECTS8 | U_EFFECTS16)) == (U_EFFECTS8 | U_EFFECTS16))
+	{
+		to->effects = GET_LONG (p);
+		p += 4;
+	}
+	else if (bits & U_EFFECTS8)
+		to->effects = *p++;
+	else if (bits & U_EFFECTS16)
+	{
+		to->effects = GET_SHORT (p);
+		p += 2;
+	}
+
+	if ((bits & (U_RENDERFX8 | U_RENDERFX16)) == (U_RENDERFX8 | U_RENDERFX16))
+	{
+		to->renderfx = GET_LONG (p);
+		p += 4;
+	}
+	else if (bits & U_RENDERFX8)
+		to->renderfx = *p++;
+	else if (bits & U_RENDERFX16)
+	{
+		to->renderfx = GET_SHORT (p);
+		p += 2;
+	}
+
+	if (bits & (U_ORIGIN1 | U_ORIGIN2 | U_ORIGIN3 | U_ANGLE1 | U_ANGLE2 | U_ANGLE3))
+	{
+		if (bits & U_ORIGIN1)
+		{
+			to->origin[0] = GET_SHORT (p) * (1.0 / 8);
+			p += 2;
+		}
+
+		if (bits & U_ORIGIN2)
+		{
+			to->origin[1] = GET_SHORT (p) * (1.0 / 8);
+			p += 2;
+		}
+
+		if (bits & U_ORIGIN3)
+		{
+			to->origin[2] = GET_SHORT (p) * (1.0 / 8);
+			p += 2;
+		}
+
+		if (bits & U_ANGLE1)
+			to->angles[0] = (signed char) *p++ * (360.0 / 256);
+
+		if (bits & U_ANGLE2)
+			to->angles[1] = (signed char) *p++ * (360.0 / 256);
+
+		if (bits & U_ANGLE3)
+			to->angles[2] = (signed char) *p++ * (360.0 / 256);
+	}
+
+	if (bits & U_OLDORIGIN)
+	{
+		to->old_origin[0] = GET_SHORT (p) * (1.0 / 8);
+		to->old_origin[1] = GET_SHORT (p + 2) * (1.0 / 8);
+		to->old_origin[2] = GET_SHORT (p + 4) * (1.0 / 8);
+		p += 6;
+	}
+
+	if (bits & U_SOUND)
+		to->sound = *p++;
+
+	if (bits & U_EVENT)
+		to->event = *p++;
+	else
+		to->event = 0;
+
+	if (bits & U_SOLID)
+	{
+		to->solid = GET_SHORT (p);
+		p += 2;
+	}
+
+	msg->readcount = p - msg->data;
+}
+
+/*
+==================
+MSG_RandomFloat / MSG_RandomInt
+
+Values from every range the delta encoding treats differently
+==================
+*/
+static float MSG_RandomFloat (void)
+{
+	switch (rand () & 3)
+	{
+	case 0:
+		return (float) ((rand () & 0xffff) - 0x8000) / 8;	// on the coord grid
+
+	case 1:
+		return crand () * 4096;
+
+	case 2:
+		return (rand () & 1) ? 0.0f : -0.0f;
+
+	default:
+		return frand () * 360;
+	}
+}
+
+static int MSG_RandomInt (void)
+{
+	switch (rand () & 3)
+	{
+	case 0:
+		return rand () & 255;
+
+	case 1:
+		return rand () & 0xffff;
+
+	case 2:
+		return (rand () << 16) ^ rand ();
+
+	default:
+		return -(rand () & 0xffff);
+	}
+}
+
+/*
+==================
+MSG_RandomDelta
+
+Fills from with random values and changes about half of them in to
+==================
+*/
+static void MSG_RandomDelta (entity_state_t *from, entity_state_t *to)
+{
+	float	*f, *tf;
+	int		*n, *tn;
+	int		i;
+
+	// entity_state_t is the number, nine floats and then ints
+	from->number = 1 + rand () % (MAX_EDICTS - 1);
+
+	for (i = 0, f = from->origin; i < 9; i++)
+		f[i] = MSG_RandomFloat ();
+
+	for (n = &from->modelindex; n <= &from->event; n++)
+		*n = MSG_RandomInt ();
+
+	*to = *from;
+
+	for (i = 0, f = from->origin, tf = to->origin; i < 9; i++)
+	{
+		if (rand () & 1)
+			tf[i] = MSG_RandomFloat ();
+	}
+
+	for (n = &from->modelindex, tn = &to->modelindex; n <= &from->event; n++, tn++)
+	{
+		if (rand () & 1)
+			*tn = MSG_RandomInt ();
+	}
+}
+
+/*
+==================
+MSG_Bench_f
+
+msg_bench [count]
+
+Checks that the direct delta paths write and read the same bytes as the
+field at a time ones on count random deltas, then times both on frames
+of typical updates
+==================
+*/
+#define	MSG_BENCH_ENTITIES	256
+
+static void MSG_Bench_f (void)
+{
+	static entity_state_t	from[MSG_BENCH_ENTITIES], to[MSG_BENCH_ENTITIES];
+	static byte		buf[2][MAX_MSGLEN];
+	entity_state_t	out[2];
+	sizebuf_t		msg[2];
+	unsigned		bits;
+	int				i, j, mode, count, level, number, length, errors;
+	qboolean		force, newentity;
+	unsigned		start, usec[3][2];
 
-		string[l] = c;
-		l++;
+	count = (Cmd_Argc () > 1) ? atoi (Cmd_Argv (1)) : 100000;
+
+	if (count < 1)
+	{
+		Com_Printf ("usage: msg_bench [count]\n");
+		return;
 	}
-	while (l < sizeof (string) - 1);
 
-	string[l] = 0;
+	level = Com_SIMDLevel ();
+	errors = 0;
+	srand (1);
 
-	return string;
-}
+	for (i = 0; i < count; i++)
+	{
+		MSG_RandomDelta (&from[0], &to[0]);
+		force = rand () & 1;
+		newentity = rand () & 1;
 
-char *MSG_ReadStringLine (sizebuf_t *msg_read)
-{
-	static char	string[2048];
-	int		l, c;
+		// 0 is the direct path, 1 the field at a time one
+		for (mode = 0; mode < 2; mode++)
+		{
+			msg_slowdelta = mode;
+			MSG_SetSIMD (mode ? SIMD_NONE : level);
+			SZ_Init (&msg[mode], buf[mode], sizeof (buf[mode]));
+			MSG_WriteDeltaEntity (&from[0], &to[0], &msg[mode], force, newentity);
+		}
 
-	l = 0;
+		if (msg[0].cursize != msg[1].cursize || memcmp (buf[0], buf[1], msg[0].cursize))
+		{
+			if (!errors++)
+				Com_Printf (S_COLOR_RED "delta %i: wrote %i bytes, expected %i\n", i, msg[0].cursize, msg[1].cursize);
 
-	do
-	{
-		c = MSG_ReadChar (msg_read);
+			continue;
+		}
 
-		if (c == -1 || c == 0 || c == '\n')
-			break;
+		if (!msg[0].cursize)
+			continue;
 
-		string[l] = c;
-		l++;
-	}
-	while (l < sizeof (string) - 1);
+		// leave room behind the delta so the direct read is taken
+		length = msg[0].cursize;
+		memset (buf[0] + length, 0, MAX_DELTA_ENTITY);
+		msg[0].cursize += MAX_DELTA_ENTITY;
 
-	string[l] = 0;
+		for (mode = 0; mode < 2; mode++)
+		{
+			msg_slowdelta = mode;
+			MSG_BeginReading (&msg[0]);
+			number = MSG_ReadEntityBits (&msg[0], &bits);
+			MSG_ReadDeltaEntity (&msg[0], &from[0], &out[mode], number, bits);
 
-	return string;
-}
+			if (msg[0].readcount != length && !errors++)
+				Com_Printf (S_COLOR_RED "delta %i: read %i bytes of %i\n", i, msg[0].readcount, length);
+		}
 
-float MSG_ReadCoord (sizebuf_t *msg_read)
-{
-	return MSG_ReadShort (msg_read) * (1.0 / 8);
-}
+		if (out[0].number != to[0].number || memcmp (&out[0], &out[1], sizeof (out[0])))
+		{
+			if (!errors++)
+				Com_Printf (S_COLOR_RED "delta %i: read back a different entity\n", i);
+		}
+	}
 
-void MSG_ReadPos (sizebuf_t *msg_read, vec3_t pos)
-{
-	pos[0] = MSG_ReadShort (msg_read) * (1.0 / 8);
-	pos[1] = MSG_ReadShort (msg_read) * (1.0 / 8);
-	pos[2] = MSG_ReadShort (msg_read) * (1.0 / 8);
-}
+	Com_Printf ("%i random deltas, %i errors\n", count, errors);
 
-float MSG_ReadAngle (sizebuf_t *msg_read)
-{
-	return MSG_ReadChar (msg_read) * (360.0 / 256);
-}
+	// typical frames, most entities move or animate and some fire events
+	for (i = 0; i < MSG_BENCH_ENTITIES; i++)
+	{
+		MSG_RandomDelta (&from[i], &to[i]);
+		to[i] = from[i];
+		to[i].number = from[i].number = i + 1 + (i & 1) * 256;
 
-float MSG_ReadAngle16 (sizebuf_t *msg_read)
-{
-	return SHORT2ANGLE (MSG_ReadShort (msg_read));
-}
+		if (rand () & 1)
+		{
+			to[i].origin[0] = from[i].origin[0] + crand () * 16;
+			to[i].origin[1] = from[i].origin[1] + crand () * 16;
+		}
 
-void MSG_ReadDeltaUsercmd (sizebuf_t *msg_read, usercmd_t *from, usercmd_t *move)
-{
-	int bits;
+		if (rand () & 1)
+			to[i].frame = rand () & 255;
 
-	memcpy (move, from, sizeof (*move));
+		if (!(rand () & 3))
+			to[i].angles[1] = frand () * 360;
 
-	bits = MSG_ReadByte (msg_read);
+		to[i].event = (rand () & 7) ? 0 : 1 + (rand () & 15);
+	}
 
-	// read current angles
-	if (bits & CM_ANGLE1)
-		move->angles[0] = MSG_ReadShort (msg_read);
+	count = 1 + count / 100;
 
-	if (bits & CM_ANGLE2)
-		move->angles[1] = MSG_ReadShort (msg_read);
+	// 0 is field at a time, 1 direct, 2 direct with the vector compares
+	for (mode = 0; mode < 3; mode++)
+	{
+		msg_slowdelta = !mode;
+		MSG_SetSIMD (mode == 2 ? level : SIMD_NONE);
 
-	if (bits & CM_ANGLE3)
-		move->angles[2] = MSG_ReadShort (msg_read);
+		start = Sys_Microseconds ();
 
-	// read movement
-	if (bits & CM_FORWARD)
-		move->forwardmove = MSG_ReadShort (msg_read);
+		for (j = 0; j < count; j++)
+		{
+			SZ_Init (&msg[0], buf[0], sizeof (buf[0]));
 
-	if (bits & CM_SIDE)
-		move->sidemove = MSG_ReadShort (msg_read);
+			for (i = 0; i < MSG_BENCH_ENTITIES; i++)
+				MSG_WriteDeltaEntity (&from[i], &to[i], &msg[0], false, false);
+		}
 
-	if (bits & CM_UP)
-		move->upmove = MSG_ReadShort (msg_read);
+		usec[mode][0] = Sys_Microseconds () - start;
 
-	// read buttons
-	if (bits & CM_BUTTONS)
-		move->buttons = MSG_ReadByte (msg_read);
+		start = Sys_Microseconds ();
 
-	if (bits & CM_IMPULSE)
-		move->impulse = MSG_ReadByte (msg_read);
+		for (j = 0; j < count; j++)
+		{
+			MSG_BeginReading (&msg[0]);
 
-	// read time to run command
-	move->msec = MSG_ReadByte (msg_read);
+			for (i = 0; i < MSG_BENCH_ENTITIES && msg[0].readcount < msg[0].cursize; i++)
+			{
+				number = MSG_ReadEntityBits (&msg[0], &bits);
+				MSG_ReadDeltaEntity (&msg[0], &from[i], &out[0], number, bits);
+			}
+		}
 
-	// read the light level
-	move->lightlevel = MSG_ReadByte (msg_read);
-}
+		usec[mode][1] = Sys_Microseconds () - start;
+	}
 
+	msg_slowdelta = false;
+	MSG_SetSIMD (level);
 
-void MSG_ReadData (sizebuf_t *msg_read, void *data, int len)
-{
-	int		i;
+	count *= MSG_BENCH_ENTITIES;
 
-	for (i = 0; i < len; i++)
-		((byte *) data) [i] = MSG_ReadByte (msg_read);
+	Com_Printf ("encode: fields %.1f ns, direct %.1f ns, direct %s %.1f ns per entity\n",
+		usec[0][0] * 1000.0f / count, usec[1][0] * 1000.0f / count, Com_SIMDName (level > SIMD_SSE2 ? SIMD_SSE2 : level), usec[2][0] * 1000.0f / count);
+	Com_Printf ("decode: fields %.1f ns, direct %.1f ns per entity\n",
+		usec[0][1] * 1000.0f / count, usec[1][1] * 1000.0f / count);
 }
 
-
 //===========================================================================
 
 void SZ_Init (sizebuf_t *buf, byte *data, int length)
@@ -1231,24 +1977,114 @@ int Com_RealTime (qtime_t * qtime)
 
 						ZONE MEMORY ALLOCATION
 
-just cleared malloc with counters now...
+Every tag gets its own zone. Small blocks are carved out of the zone's
+slabs and go back on a free list for their size class when freed, bigger
+ones are malloc'd and chained to the zone. Z_FreeTags drops a zone's
+slabs and chain whole instead of freeing block by block.
+
+With z_debug set new blocks are malloc'd one by one and carry a trailer
+that Z_Free checks for overruns, so memory tools see every block.
 
 ==============================================================================
 */
 
-#define	Z_MAGIC		0x1d1d
+#define	Z_MAGIC			0x1d1d
+#define	Z_MAGIC_DEBUG	0x1d1e		// malloc'd on its own with a trailer
+#define	Z_TRAILER		0x1d1d1d1d
+
+#define	Z_MAXTAGS		64
+#define	Z_CLASSES		8			// 32, 64 ... 4096 byte blocks
+#define	Z_MINCLASS		32
+#define	Z_SLABSIZE		0x10000
 
 typedef struct zhead_s
 {
-	struct zhead_s	*prev, *next;
+	struct zhead_s	*prev, *next;	// chained blocks, or the free list
 	short	magic;
 	short	tag;			// for group free
 	int		size;
 } zhead_t;
-static zhead_t z_chain = { 0 };
+
+typedef struct zslab_s
+{
+	struct zslab_s	*next;
+	int		used;
+	int		pad;
+} zslab_t;
+
+typedef struct
+{
+	int		tag;
+	int		count, bytes;		// blocks handed out
+	int		numslabs;
+	zslab_t	*slabs;				// the first one is carved from
+	zhead_t	chain;				// blocks not in a slab
+	zhead_t	*freelist[Z_CLASSES];
+} zone_t;
+
+static zone_t	z_zones[Z_MAXTAGS];
+static int		z_numzones;
+static zone_t	*z_lastzone;
+
+static cvar_t	*z_debug;
 
 int		z_count, z_bytes;
 
+/*
+========================
+Z_Zone
+
+Finds the zone for tag, creating it if asked to
+========================
+*/
+static zone_t *Z_Zone (int tag, qboolean create)
+{
+	zone_t	*zone;
+	int		i;
+
+	if (z_lastzone && z_lastzone->tag == tag)
+		return z_lastzone;
+
+	for (i = 0, zone = z_zones; i < z_numzones; i++, zone++)
+	{
+		if (zone->tag == tag)
+			return (z_lastzone = zone);
+	}
+
+	if (!create)
+		return NULL;
+
+	if (z_numzones == Z_MAXTAGS)
+		Com_Error (ERR_FATAL, "Z_TagMalloc: more than %i tags", Z_MAXTAGS);
+
+	zone = &z_zones[z_numzones++];
+	zone->tag = tag;
+	zone->chain.next = zone->chain.prev = &zone->chain;
+
+	return (z_lastzone = zone);
+}
+
+/*
+========================
+Z_Class
+
+The size class a block of size bytes, header included, is carved at,
+-1 if it is too big for a slab
+========================
+*/
+static int Z_Class (int size)
+{
+	int		c, classsize;
+
+	for (c = 0, classsize = Z_MINCLASS; c < Z_CLASSES; c++, classsize <<= 1)
+	{
+		if (size <= classsize)
+			return c;
+	}
+
+	return -1;
+}
+
 /*
 ========================
 Z_Free
@@ -1257,18 +2093,46 @@ Z_Free
 void Z_Free (void *ptr)
 {
 	zhead_t	*z;
+	zone_t	*zone;
+	int		c, trailer;
 
 	z = ((zhead_t *)ptr) - 1;
 
-	if (z->magic != Z_MAGIC)
+	if (z->magic != Z_MAGIC && z->magic != Z_MAGIC_DEBUG)
 		Com_Error (ERR_FATAL, "Z_Free: bad magic");
 
-	z->prev->next = z->next;
-	z->next->prev = z->prev;
+	if (z->magic == Z_MAGIC_DEBUG)
+	{
+		memcpy (&trailer, (byte *)z + z->size - sizeof (trailer), sizeof (trailer));
+
+		if (trailer != Z_TRAILER)
+			Com_Error (ERR_FATAL, "Z_Free: %i byte block overrun", z->size - (int)sizeof (zhead_t) - (int)sizeof (trailer));
+	}
+
+	zone = Z_Zone (z->tag, false);
 
+	if (!zone)
+		Com_Error (ERR_FATAL, "Z_Free: bad tag");
+
+	zone->count--;
+	zone->bytes -= z->size;
 	z_count--;
 	z_bytes -= z->size;
-	free (z);
+
+	c = (z->magic == Z_MAGIC) ? Z_Class (z->size) : -1;
+
+	if (c == -1)
+	{
+		z->prev->next = z->next;
+		z->next->prev = z->prev;
+		free (z);
+		return;
+	}
+
+	// back to the slab, a second free will find no magic
+	z->magic = 0;
+	z->next = zone->freelist[c];
+	zone->freelist[c] = z;
 }
 
 
@@ -1279,7 +2143,14 @@ Z_Stats_f
 */
 void Z_Stats_f (void)
 {
+	zone_t	*zone;
+	int		i;
+
 	Com_Printf ("%i bytes in %i blocks\n", z_bytes, z_count);
+	Com_Printf ("   tag   blocks      bytes  slabs\n");
+
+	for (i = 0, zone = z_zones; i < z_numzones; i++, zone++)
+		Com_Printf ("%6i %8i %10i %6i\n", zone->tag, zone->count, zone->bytes, zone->numslabs);
 }
 
 /*
@@ -1289,14 +2160,77 @@ Z_FreeTags
 */
 void Z_FreeTags (int tag)
 {
+	zone_t	*zone;
 	zhead_t	*z, *next;
+	zslab_t	*slab, *nextslab;
 
-	for (z=z_chain.next ; z != &z_chain ; z=next)
+	zone = Z_Zone (tag, false);
+
+	if (!zone)
+		return;
+
+	for (z = zone->chain.next; z != &zone->chain; z = next)
 	{
 		next = z->next;
-		if (z->tag == tag)
-			Z_Free ((void *)(z+1));
+		free (z);
+	}
+
+	for (slab = zone->slabs; slab; slab = nextslab)
+	{
+		nextslab = slab->next;
+		free (slab);
+	}
+
+	z_count -= zone->count;
+	z_bytes -= zone->bytes;
+
+	memset (zone, 0, sizeof (*zone));
+	zone->tag = tag;
+	zone->chain.next = zone->chain.prev = &zone->chain;
+}
+
+/*
+========================
+Z_SlabAlloc
+
+Carves a block of class c out of the zone, zero filled
+========================
+*/
+static zhead_t *Z_SlabAlloc (zone_t *zone, int c)
+{
+	zhead_t	*z;
+	zslab_t	*slab;
+	int		classsize;
+
+	classsize = Z_MINCLASS << c;
+
+	if ((z = zone->freelist[c]) != NULL)
+	{
+		zone->freelist[c] = z->next;
+		memset (z, 0, classsize);
+		return z;
+	}
+
+	slab = zone->slabs;
+
+	if (!slab || slab->used + classsize > Z_SLABSIZE)
+	{
+		// the rest of the old slab is lost until the tag is freed
+		slab = calloc (1, Z_SLABSIZE);
+
+		if (!slab)
+			Com_Error (ERR_FATAL, "Z_Malloc: failed on allocation of %i bytes", Z_SLABSIZE);
+
+		slab->next = zone->slabs;
+		slab->used = sizeof (zslab_t);
+		zone->slabs = slab;
+		zone->numslabs++;
 	}
+
+	z = (zhead_t *)((byte *)slab + slab->used);
+	slab->used += classsize;
+
+	return z;
 }
 
 /*
@@ -1307,22 +2241,47 @@ Z_TagMalloc
 void *Z_TagMalloc (int size, int tag)
 {
 	zhead_t	*z;
+	zone_t	*zone;
+	int		c, trailer;
+	qboolean debug;
+
+	zone = Z_Zone (tag, true);
+	debug = (z_debug && z_debug->integer);
 
 	size = size + sizeof(zhead_t);
-	z = malloc(size);
-	if (!z)
-		Com_Error (ERR_FATAL, "Z_Malloc: failed on allocation of %i bytes",size);
-	memset (z, 0, size);
+
+	if (debug)
+		size += sizeof (trailer);
+
+	c = debug ? -1 : Z_Class (size);
+
+	if (c == -1)
+	{
+		z = malloc(size);
+		if (!z)
+			Com_Error (ERR_FATAL, "Z_Malloc: failed on allocation of %i bytes",size);
+		memset (z, 0, size);
+
+		z->next = zone->chain.next;
+		z->prev = &zone->chain;
+		zone->chain.next->prev = z;
+		zone->chain.next = z;
+	}
+	else z = Z_SlabAlloc (zone, c);
+
+	zone->count++;
+	zone->bytes += size;
 	z_count++;
 	z_bytes += size;
-	z->magic = Z_MAGIC;
+	z->magic = debug ? Z_MAGIC_DEBUG : Z_MAGIC;
 	z->tag = tag;
 	z->size = size;
 
-	z->next = z_chain.next;
-	z->prev = &z_chain;
-	z_chain.next->prev = z;
-	z_chain.next = z;
+	if (debug)
+	{
+		trailer = Z_TRAILER;
+		memcpy ((byte *)z + size - sizeof (trailer), &trailer, sizeof (trailer));
+	}
 
 	return (void *)(z+1);
 }
@@ -1337,6 +2296,75 @@ void *Z_Malloc (int size)
 	return Z_TagMalloc (size, 0);
 }
 
+/*
+========================
+Z_Bench_f
+
+z_bench [blocks] [levels]
+
+Allocates and frees levels the way the game does, many small
+strings and structures under one tag that is freed at the next
+map change, with slabs and then with one malloc per block
+========================
+*/
+#define	Z_BENCHTAG	0x7ffe
+
+static void Z_Bench_f (void)
+{
+	void		**blocks;
+	int			i, l, mode, numblocks, levels, size;
+	unsigned	start, usec[2];
+	char		debug[16];
+
+	numblocks = (Cmd_Argc () > 1) ? atoi (Cmd_Argv (1)) : 50000;
+	levels = (Cmd_Argc () > 2) ? atoi (Cmd_Argv (2)) : 20;
+
+	if (numblocks < 1 || levels < 1)
+	{
+		Com_Printf ("usage: z_bench [blocks] [levels]\n");
+		return;
+	}
+
+	blocks = malloc (numblocks * sizeof (*blocks));
+	Q_strlcpy (debug, z_debug->string, sizeof (debug));
+
+	for (mode = 0; mode < 2; mode++)
+	{
+		Cvar_SetValue ("z_debug", mode);
+		srand (1);
+		start = Sys_Microseconds ();
+
+		for (l = 0; l < levels; l++)
+		{
+			for (i = 0; i < numblocks; i++)
+			{
+				// mostly entity strings, some edict sized and a few big ones
+				size = 8 + (rand () & 63);
+
+				if (!(i & 15))
+					size = 256 + (rand () & 1023);
+				if (!(i & 1023))
+					size = 8192 + (rand () & 8191);
+
+				blocks[i] = Z_TagMalloc (size, Z_BENCHTAG);
+			}
+
+			// a few get freed on their own during play
+			for (i = 0; i < numblocks; i += 7)
+				Z_Free (blocks[i]);
+
+			Z_FreeTags (Z_BENCHTAG);
+		}
+
+		usec[mode] = Sys_Microseconds () - start;
+	}
+
+	Cvar_Set ("z_debug", debug);
+	free (blocks);
+
+	Com_Printf ("%i levels of %i blocks: slabs %.1f ms, malloc %.1f ms\n", levels, numblocks, usec[0] / 1000.0f, usec[1] / 1000.0f);
+}
+
 
 //============================================================================
 
@@ -1408,6 +2436,24 @@ static byte chktbl[1024] =
 	0x39, 0x4f, 0xdd, 0xe4, 0xb6, 0x19, 0x27, 0xfb, 0xb8, 0xf5, 0x32, 0x73, 0xe5, 0xcb, 0x32
 };
 
+/*
+====================
+Com_HashName
+
+Case insensitive FNV-1a, so one hash serves the cvar and command tables
+whichever way they compare names
+====================
+*/
+unsigned Com_HashName (const char *name)
+{
+	unsigned	hash;
+
+	for (hash = 2166136261u; *name; name++)
+		hash = (hash ^ (byte) tolower (*name)) * 16777619u;
+
+	return hash;
+}
+
 /*
 ====================
 COM_BlockSequenceCRCByte
@@ -1462,6 +2508,41 @@ float	crand (void)
 	return (rand () & 32767) * (2.0 / 32767) - 1;
 }
 
+/*
+=================
+Com_SIMDLevel
+
+Highest vector instruction set both the cpu and com_simd allow
+=================
+*/
+int Com_SIMDLevel (void)
+{
+	int		level = SIMD_NONE;
+
+#ifdef Q_SSE2
+	level = SIMD_SSE2;
+#ifdef Q_AVX2
+	if (SDL_HasAVX2 ())
+		level = SIMD_AVX2;
+#endif
+#endif
+
+	if (com_simd && com_simd->integer < level)
+		level = com_simd->integer > SIMD_NONE ? com_simd->integer : SIMD_NONE;
+
+	return level;
+}
+
+const char *Com_SIMDName (int level)
+{
+	static const char *names[] = {"none", "sse2", "avx2"};
+
+	if (level < SIMD_NONE || level > SIMD_AVX2)
+		return "?";
+
+	return names[level];
+}
+
 /*
 =================
 Qcommon_ExecConfigs
@@ -1504,8 +2585,6 @@ void Qcommon_Init (int argc, char **argv)
 	if (setjmp (abortframe))
 		Sys_Error ("Error during initialization");
 
-	z_chain.next = z_chain.prev = &z_chain;
-
 	// prepare enough of the subsystems to handle
 	// cvar and command buffer management
 	COM_InitArgv (argc, argv);
@@ -1533,12 +2612,15 @@ void Qcommon_Init (int argc, char **argv)
 		Q_strlcpy (userGivenGame, game, sizeof(userGivenGame));
 	}
 
+	Prefetch_Init ();
 	FS_InitFilesystem ();
 
 	Qcommon_ExecConfigs (true);
 
 	// init commands and vars
 	Cmd_AddCommand ("z_stats", Z_Stats_f);
+	Cmd_AddCommand ("z_bench", Z_Bench_f);
+	Cmd_AddCommand ("msg_bench", MSG_Bench_f);
 
 	host_speeds = Cvar_Get ("host_speeds", "0", 0);
 	log_stats = Cvar_Get ("log_stats", "0", 0);
@@ -1547,6 +2629,10 @@ void Qcommon_Init (int argc, char **argv)
 	fixedtime = Cvar_Get ("fixedtime", "0", 0);
 	logfile_active = Cvar_Get ("logfile", "0", 0);
 	showtrace = Cvar_Get ("showtrace", "0", 0);
+	com_simd = Cvar_Get ("com_simd", "2", CVAR_ARCHIVE);
+	z_debug = Cvar_Get ("z_debug", "0", 0);
+
+	Prof_Init ();
 
 #ifdef DEDICATED_ONLY
 	dedicated = Cvar_Get ("dedicated", "1", CVAR_NOSET);
@@ -1684,11 +2770,12 @@ void Qcommon_Frame (int msec)
 	// content tracing debug
 	if (showtrace->value)
 	{
-		extern	int c_traces, c_brush_traces;
+		extern	int c_traces, c_brush_traces, c_tracehits;
 		extern	int	c_pointcontents;
 
-		Com_Printf ("%4i traces %4i points\n", c_traces, c_pointcontents);
+		Com_Printf ("%4i traces %4i cached %4i points\n", c_traces, c_tracehits, c_pointcontents);
 		c_traces = 0;
+		c_tracehits = 0;
 		c_brush_traces = 0;
 		c_pointcontents = 0;
 	}
@@ -1958,6 +3045,8 @@ Qcommon_Shutdown
 */
 void Qcommon_Shutdown (void)
 {
+	Prefetch_Shutdown ();
+
 	Cvar_Shutdown ();
 
 	FS_Shutdown ();
@@ -21,7 +21,12 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
 #include "qcommon.h"
 
+#define	CVAR_HASH_SIZE	1024		// must be a power of two
+
 cvar_t	*cvar_vars;
+static cvar_t	*cvar_hash[CVAR_HASH_SIZE];
+
+qboolean	cvar_nohash;		// cmd_bench times the list walk against the hash
 
 /*
 ============
@@ -46,13 +51,56 @@ static cvar_t *Cvar_FindVar (char *var_name)
 {
 	cvar_t	*var;
 
-	for (var = cvar_vars; var; var = var->next)
+	if (cvar_nohash)
+	{
+		for (var = cvar_vars; var; var = var->next)
+			if (!strcmp (var_name, var->name))
+				return var;
+
+		return NULL;
+	}
+
+	for (var = cvar_hash[Com_HashName (var_name) & (CVAR_HASH_SIZE - 1)]; var; var = var->hashNext)
 		if (!strcmp (var_name, var->name))
 			return var;
 
 	return NULL;
 }
 
+/*
+============
+Cvar_Cached
+
+For code that reads a cvar it doesn't own every frame, the name is
+only looked up until the cvar exists. cvars are never freed while
+running so the handle stays good
+============
+*/
+cvar_t *Cvar_Cached (cvar_t **handle, char *var_name)
+{
+	if (!*handle)
+		*handle = Cvar_FindVar (var_name);
+
+	return *handle;
+}
+
+/*
+============
+Cvar_CachedValue
+============
+*/
+float Cvar_CachedValue (cvar_t **handle, char *var_name)
+{
+	cvar_t	*var;
+
+	var = Cvar_Cached (handle, var_name);
+
+	if (!var)
+		return 0;
+
+	return var->value;
+}
+
 /*
 ============
 Cvar_VariableValue
@@ -148,6 +196,7 @@ The flags will be or'ed in if the variable exists.
 cvar_t *Cvar_Get (char *var_name, char *var_value, int flags)
 {
 	cvar_t	*var;
+	int		hash;
 
 	if (flags & (CVAR_USERINFO | CVAR_SERVERINFO))
 	{
@@ -194,6 +243,10 @@ cvar_t *Cvar_Get (char *var_name, char *var_value, int flags)
 	var->next = cvar_vars;
 	cvar_vars = var;
 
+	hash = Com_HashName (var_name) & (CVAR_HASH_SIZE - 1);
+	var->hashNext = cvar_hash[hash];
+	cvar_hash[hash] = var;
+
 	var->flags = flags;
 
 	return var;
@@ -640,6 +693,9 @@ void Cvar_Shutdown (void)
 		var = c;
 	}
 
+	cvar_vars = NULL;
+	memset (cvar_hash, 0, sizeof (cvar_hash));
+
 	Cmd_RemoveCommand("cvarlist");
 	Cmd_RemoveCommand("set");
 }
@@ -20,6 +20,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
 #include "qcommon.h"
 #include <errno.h>
+#include <SDL_mutex.h>
 
 #include "unzip.h"
 
@@ -45,13 +46,20 @@ This is a precacution against having a malicious server instruct clients to writ
 #define MAX_WRITE		0x10000
 #define MAX_FIND_FILES	0x04000
 #define MAX_PAKS		100
+#define FS_HASH_SIZE	(1 << 15)	// must be a power of two
+#define FS_LOADLOG		4096
 
 typedef struct
 {
 	char		name[MAX_QPATH];
 	fsMode_t	mode;
 	FILE        *file;	// Only one will be used.
-	unzFile     *zip;	// (file or zip)
+	unzFile     *zip;	// (file, zip or mem)
+	byte		*mem;	// slice of a mapped pak
+	int			memSize;
+	int			memPos;
+	struct fsPack_s	*pack;	// the mapped pak
+	qboolean	used;	// claimed by FS_HandleForFile
 } fsHandle_t;
 
 typedef struct fsLink_s
@@ -62,20 +70,27 @@ typedef struct fsLink_s
 	struct fsLink_s *next;
 } fsLink_t;
 
-typedef struct
+typedef struct fsPackFile_s
 {
 	char		name[MAX_QPATH];
 	int			size;
 	int			offset;		// Ignored in PKZ files.
+	unz_file_pos zipPos;	// PKZ only, so opening needs no directory scan
+	struct fsPack_s *pack;
+	struct fsPackFile_s *hashNext;
 } fsPackFile_t;
 
-typedef struct
+typedef struct fsPack_s
 {
 	char		name[MAX_OSPATH];
 	int			numFiles;
 	FILE        *pak;
 	unzFile     *pkz;
 	fsPackFile_t *files;
+	byte		*map;		// PAK mapped into memory, reads are slices of it
+	int			mapSize;
+	int			numSlices;	// FS_LoadFile buffers still pointing into map
+	struct fsPack_s *nextRetired;
 } fsPack_t;
 
 typedef struct fsSearchPath_s
@@ -102,6 +117,22 @@ fsLink_t       *fs_links;
 fsSearchPath_t *fs_searchPaths;
 fsSearchPath_t *fs_baseSearchPaths;
 
+// every file of every pack on the search path, by case insensitive name
+static fsPackFile_t *fs_fileHash[FS_HASH_SIZE];
+
+// packs taken off the search path while FS_LoadFile buffers still
+// point into their mapping
+static fsPack_t *fs_retiredPacks;
+
+// names opened since the last level load started, for fs_bench
+static char		fs_loadLog[FS_LOADLOG][MAX_QPATH];
+static int		fs_numLoadLog;
+static qboolean	fs_logLoads = true;
+
+// prefetch workers open files alongside the main thread, this guards
+// the handles, the load log and the slice counts
+static SDL_mutex	*fs_lock;
+
 // Pack formats / suffixes
 fsPackTypes_t	fs_packtypes[] = {	
 	{ "pak", PAK },
@@ -115,6 +146,7 @@ cvar_t         *fs_basedir;
 cvar_t         *fs_cddir;
 cvar_t         *fs_gamedirvar;
 cvar_t         *fs_debug;
+cvar_t         *fs_packindex;
 
 // raw search path, the actual search path is built from this one
 typedef struct fsRawPath_s
@@ -227,17 +259,28 @@ fsHandle_t *FS_HandleForFile(const char *path, fileHandle_t * f)
 	int		i;
 	fsHandle_t     *handle;
 
+	SDL_LockMutex(fs_lock);
+
 	handle = fs_handles;
 	for (i = 0; i < MAX_HANDLES; i++, handle++)
 	{
-		if (handle->file == NULL && handle->zip == NULL)
+		if (!handle->used)
 		{
+			handle->used = true;
 			strncpy(handle->name, path, sizeof(handle->name));
 			*f = i + 1;
+			SDL_UnlockMutex(fs_lock);
 			return handle;
 		}
 	}
 
+	SDL_UnlockMutex(fs_lock);
+
+	// a prefetch worker can't Com_Error on its own stack, the file is
+	// loaded again by the main thread which reports it
+	if (Prefetch_Worker())
+		return NULL;
+
 	// failed
 	Com_Error(ERR_DROP, "FS_HandleForFile: none free");
 
@@ -319,6 +362,97 @@ int FS_FOpenFileWrite(fsHandle_t * handle)
 	return -1;
 }
 
+/*
+=================
+FS_HashFileName
+
+Case insensitive, like the Q_stricmp the names are compared with
+=================
+*/
+static unsigned FS_HashFileName(const char *name)
+{
+	unsigned hash = 2166136261u;
+	int c;
+
+	while ((c = *name++) != 0)
+	{
+		if (c >= 'A' && c <= 'Z')
+			c += 'a' - 'A';
+
+		hash = (hash ^ c) * 16777619u;
+	}
+
+	return hash & (FS_HASH_SIZE - 1);
+}
+
+/*
+=================
+FS_RebuildHash
+
+Indexes the files of every pack on the search path. Has to be called
+whenever a pack is added to or taken off the path.
+=================
+*/
+static void FS_RebuildHash(void)
+{
+	fsSearchPath_t *search;
+	fsPackFile_t *file;
+	unsigned hash;
+	int i;
+
+	memset(fs_fileHash, 0, sizeof(fs_fileHash));
+
+	for (search = fs_searchPaths; search; search = search->next)
+	{
+		if (!search->pack)
+			continue;
+
+		// backwards, so the first of two files with the same
+		// name in a pack is found first like in a linear scan
+		for (i = search->pack->numFiles - 1; i >= 0; i--)
+		{
+			file = &search->pack->files[i];
+			hash = FS_HashFileName(file->name);
+
+			file->pack = search->pack;
+			file->hashNext = fs_fileHash[hash];
+			fs_fileHash[hash] = file;
+		}
+	}
+}
+
+/*
+=================
+FS_FindPackFile
+
+hash is FS_HashFileName of name
+=================
+*/
+static fsPackFile_t *FS_FindPackFile(fsPack_t *pack, char *name, unsigned hash)
+{
+	fsPackFile_t *file;
+	int i;
+
+	if (fs_packindex->value)
+	{
+		for (file = fs_fileHash[hash]; file; file = file->hashNext)
+		{
+			if (file->pack == pack && Q_stricmp(file->name, name) == 0)
+				return file;
+		}
+
+		return NULL;
+	}
+
+	for (i = 0; i < pack->numFiles; i++)
+	{
+		if (Q_stricmp(pack->files[i].name, name) == 0)
+			return &pack->files[i];
+	}
+
+	return NULL;
+}
+
 /*
 =================
 FS_FOpenFileRead
@@ -330,11 +464,24 @@ files inside pack files (both PAK and PKZ).
 int FS_FOpenFileRead(fsHandle_t * handle, qboolean gamedirOnly)
 {
 	char		path[MAX_OSPATH];
-	int		i;
+	unsigned	hash;
 	fsSearchPath_t *search;
 	fsPack_t       *pack;
+	fsPackFile_t   *file;
+	qboolean		worker;
 
-	file_from_pak = false;
+	// file_from_pak and the debug prints belong to the main thread
+	worker = Prefetch_Worker();
+
+	if (!worker)
+		file_from_pak = false;
+
+	SDL_LockMutex(fs_lock);
+	if (fs_logLoads && fs_numLoadLog < FS_LOADLOG)
+		Q_strlcpy(fs_loadLog[fs_numLoadLog++], handle->name, MAX_QPATH);
+	SDL_UnlockMutex(fs_lock);
+
+	hash = FS_HashFileName(handle->name);
 
 	// search through the path, one element at a time.
 	for (search = fs_searchPaths; search; search = search->next)
@@ -357,44 +504,56 @@ int FS_FOpenFileRead(fsHandle_t * handle, qboolean gamedirOnly)
 		if (search->pack)
 		{
 			pack = search->pack;
-			for (i = 0; i < pack->numFiles; i++)
+			file = FS_FindPackFile(pack, handle->name, hash);
+
+			if (!file)
+				continue;
+
+			// found it
+			if (fs_debug->value && !worker)
+				Com_Printf("FS_FOpenFileRead: '%s' (found in '%s').\n",	handle->name, pack->name);
+
+			if (!worker)
+				file_from_pak = true;
+
+			if (pack->map && file->offset >= 0 && file->size >= 0 && file->size <= pack->mapSize - file->offset)
 			{
-				if (Q_stricmp(pack->files[i].name, handle->name) == 0)
+				// mapped PAK
+				handle->mem = pack->map + file->offset;
+				handle->memSize = file->size;
+				handle->memPos = 0;
+				handle->pack = pack;
+				return file->size;
+			}
+			else if (pack->pak)
+			{
+				// PAK
+				handle->file = fopen(pack->name, "rb");
+				if (handle->file)
 				{
-					// found it
-					if (fs_debug->value)
-						Com_Printf("FS_FOpenFileRead: '%s' (found in '%s').\n",	handle->name, pack->name);
-
-					if (pack->pak)
-					{
-						// PAK
-						file_from_pak = true;
-						handle->file = fopen(pack->name, "rb");
-						if (handle->file)
-						{
-							fseek(handle->file, pack->files[i].offset, SEEK_SET);
-							return pack->files[i].size;
-						}
-					}
-					else if (pack->pkz)
+					fseek(handle->file, file->offset, SEEK_SET);
+					return file->size;
+				}
+			}
+			else if (pack->pkz)
+			{
+				// PKZ
+				handle->zip = unzOpen(pack->name);
+				if (handle->zip)
+				{
+					if (unzGoToFilePos(handle->zip, &file->zipPos) == UNZ_OK)
 					{
-						// PKZ
-						file_from_pak = true;
-						handle->zip = unzOpen(pack->name);
-						if (handle->zip)
-						{
-							if (unzLocateFile(handle->zip, handle->name, 2) == UNZ_OK)
-							{
-								if (unzOpenCurrentFile(handle->zip) == UNZ_OK)
-									return pack->files[i].size;
-							}
-							unzClose(handle->zip);
-						}
+						if (unzOpenCurrentFile(handle->zip) == UNZ_OK)
+							return file->size;
 					}
-
-					Com_Error(ERR_FATAL, "Couldn't reopen '%s'", pack->name);
+					unzClose(handle->zip);
 				}
 			}
+
+			if (worker)
+				return -1;
+
+			Com_Error(ERR_FATAL, "Couldn't reopen '%s'", pack->name);
 		}
 		else
 		{
@@ -414,7 +573,7 @@ int FS_FOpenFileRead(fsHandle_t * handle, qboolean gamedirOnly)
 			if (handle->file)
 			{
 				// found it
-				if (fs_debug->value)
+				if (fs_debug->value && !worker)
 					Com_Printf("FS_FOpenFileRead: '%s' (found in '%s').\n",	handle->name, search->path);
 
 				return FS_FileLength(handle->file);
@@ -423,7 +582,7 @@ int FS_FOpenFileRead(fsHandle_t * handle, qboolean gamedirOnly)
 	}
 
 	// not found
-	if (fs_debug->value)
+	if (fs_debug->value && !worker)
 		Com_Printf(S_COLOR_RED "FS_FOpenFileRead: couldn't find '%s'.\n", handle->name);
 
 	return -1;
@@ -452,7 +611,9 @@ void FS_FCloseFile(fileHandle_t f)
 		unzClose(handle->zip);
 	}
 
+	SDL_LockMutex(fs_lock);
 	memset(handle, 0, sizeof(*handle));
+	SDL_UnlockMutex(fs_lock);
 }
 
 /*
@@ -470,6 +631,12 @@ int FS_FOpenFile(const char *name, fileHandle_t *f, fsMode_t mode, qboolean game
 
 	handle = FS_HandleForFile(name, f);
 
+	if (!handle)
+	{
+		*f = 0;
+		return -1;
+	}
+
 	strncpy(handle->name, name, sizeof(handle->name));
 	handle->mode = mode;
 
@@ -493,12 +660,32 @@ int FS_FOpenFile(const char *name, fileHandle_t *f, fsMode_t mode, qboolean game
 		return size;
 
 	// couldn't open, so free the handle.
+	SDL_LockMutex(fs_lock);
 	memset(handle, 0, sizeof(*handle));
+	SDL_UnlockMutex(fs_lock);
 	*f = 0;
 
 	return -1;
 }
 
+/*
+=================
+FS_ReadMem
+
+Reads from a slice of a mapped pak, returns 0 at the end like fread.
+=================
+*/
+static int FS_ReadMem(fsHandle_t *handle, byte *buf, int len)
+{
+	if (len > handle->memSize - handle->memPos)
+		len = handle->memSize - handle->memPos;
+
+	memcpy(buf, handle->mem + handle->memPos, len);
+	handle->memPos += len;
+
+	return len;
+}
+
 /*
 =================
 FS_ReadFile
@@ -526,6 +713,8 @@ int FS_Read(void *buffer, int size, fileHandle_t f)
 			r = fread(buf, 1, remaining, handle->file);
 		else if (handle->zip)
 			r = unzReadCurrentFile(handle->zip, buf, remaining);
+		else if (handle->mem)
+			r = FS_ReadMem(handle, buf, remaining);
 		else
 			return 0;
 
@@ -539,12 +728,18 @@ int FS_Read(void *buffer, int size, fileHandle_t f)
 			else
 			{
 				// already tried once
+				if (Prefetch_Worker())
+					return size - remaining;
+
 				Com_Error(ERR_FATAL, va("FS_Read: 0 bytes read from '%s'", handle->name));
 				return size - remaining;
 			}
 		}
 		else if (r == -1)
 		{
+			if (Prefetch_Worker())
+				return size - remaining;
+
 			Com_Error(ERR_FATAL, "FS_Read: -1 bytes read from '%s'", handle->name);
 		}
 
@@ -588,6 +783,8 @@ int FS_FRead(void *buffer, int size, int count, fileHandle_t f)
 				r = fread(buf, 1, remaining, handle->file);
 			else if (handle->zip)
 				r = unzReadCurrentFile(handle->zip, buf, remaining);
+			else if (handle->mem)
+				r = FS_ReadMem(handle, buf, remaining);
 			else
 				return 0;
 
@@ -644,6 +841,8 @@ int FS_Write(const void *buffer, int size, fileHandle_t f)
 			w = fwrite(buf, 1, remaining, handle->file);
 		else if (handle->zip)
 			Com_Error(ERR_FATAL, "FS_Write: can't write to zip file '%s'", handle->name);
+		else if (handle->mem)
+			Com_Error(ERR_FATAL, "FS_Write: can't write to pack file '%s'", handle->name);
 		else
 			return 0;
 
@@ -674,6 +873,8 @@ int FS_FTell(fileHandle_t f)
 		return ftell(handle->file);
 	else if (handle->zip)
 		return unztell(handle->zip);
+	else if (handle->mem)
+		return handle->memPos;
 
 	return 0;
 }
@@ -804,6 +1005,29 @@ void FS_Seek(fileHandle_t f, int offset, fsOrigin_t origin)
 			remaining -= r;
 		}
 	}
+	else if (handle->mem)
+	{
+		switch (origin)
+		{
+			case FS_SEEK_SET:
+				handle->memPos = offset;
+				break;
+			case FS_SEEK_CUR:
+				handle->memPos += offset;
+				break;
+			case FS_SEEK_END:
+				handle->memPos = handle->memSize + offset;
+				break;
+			default:
+				Com_Error(ERR_FATAL, "FS_Seek: bad origin (%i)", origin);
+				break;
+		}
+
+		if (handle->memPos < 0)
+			handle->memPos = 0;
+		else if (handle->memPos > handle->memSize)
+			handle->memPos = handle->memSize;
+	}
 }
 
 /*
@@ -864,12 +1088,25 @@ int FS_LoadFile(char *path, void **buffer)
 	byte		*buf;
 	int			size;
 	fileHandle_t f;
+	fsHandle_t	*handle;
+
+	if (buffer)
+	{
+		// read ahead during the level load
+		size = Prefetch_TakeFile(path, buffer);
+
+		if (size != -1)
+			return size;
+	}
 
 	buf = NULL;
 	size = FS_FOpenFile(path, &f, FS_READ, false);
 
 	if (size <= 0)
 	{
+		// an empty file was still opened
+		if (size == 0)
+			FS_FCloseFile(f);
 		if (buffer)
 			*buffer = NULL;
 		return size;
@@ -879,15 +1116,83 @@ int FS_LoadFile(char *path, void **buffer)
 		FS_FCloseFile(f);
 		return size;
 	}
+
+	handle = FS_GetFileByHandle(f);
+
+	if (handle->mem)
+	{
+		// hand out the mapped pak itself, FS_FreeFile knows not to free it
+		*buffer = handle->mem;
+		SDL_LockMutex(fs_lock);
+		handle->pack->numSlices++;
+		SDL_UnlockMutex(fs_lock);
+		FS_FCloseFile(f);
+		return size;
+	}
+
 	buf = malloc(size);
-	*buffer = buf;
 
-	FS_Read(buf, size, f);
+	// only a prefetch worker gets a short read back instead of an error
+	if (FS_Read(buf, size, f) != size)
+	{
+		FS_FCloseFile(f);
+		free(buf);
+		*buffer = NULL;
+		return -1;
+	}
+
+	*buffer = buf;
 	FS_FCloseFile(f);
 
 	return size;
 }
 
+/*
+=============
+FS_ReleaseSlice
+
+Returns true if the buffer was a slice of a mapped pak.
+=============
+*/
+static qboolean FS_ReleaseSlice(void *buffer)
+{
+	fsSearchPath_t *search;
+	fsPack_t *pack, **prev;
+
+	SDL_LockMutex(fs_lock);
+
+	for (search = fs_searchPaths; search; search = search->next)
+	{
+		pack = search->pack;
+
+		if (pack && pack->map && (byte *)buffer >= pack->map && (byte *)buffer < pack->map + pack->mapSize)
+		{
+			pack->numSlices--;
+			SDL_UnlockMutex(fs_lock);
+			return true;
+		}
+	}
+
+	for (prev = &fs_retiredPacks; (pack = *prev) != NULL; prev = &pack->nextRetired)
+	{
+		if ((byte *)buffer >= pack->map && (byte *)buffer < pack->map + pack->mapSize)
+		{
+			if (--pack->numSlices == 0)
+			{
+				*prev = pack->nextRetired;
+				Sys_UnmapFile(pack->map, pack->mapSize);
+				Z_Free(pack);
+			}
+			SDL_UnlockMutex(fs_lock);
+			return true;
+		}
+	}
+
+	SDL_UnlockMutex(fs_lock);
+
+	return false;
+}
+
 /*
 =============
 FS_FreeFile
@@ -900,6 +1205,10 @@ void FS_FreeFile(void *buffer)
 		Com_DPrintf("FS_FreeFile: NULL buffer.\n");
 		return;
 	}
+
+	if (FS_ReleaseSlice(buffer))
+		return;
+
 	free(buffer);
 }
 
@@ -962,6 +1271,7 @@ fsPack_t *FS_LoadPAK(const char *packPath)
 	pack->pkz = NULL;
 	pack->numFiles = numFiles;
 	pack->files = files;
+	pack->map = Sys_MapFile(handle, &pack->mapSize);
 
 	Com_Printf("Added packfile '%s' (%i files).\n", pack, numFiles);
 
@@ -1017,6 +1327,7 @@ fsPack_t *FS_LoadPKZ(const char *packPath)
 		strncpy(files[i].name, fileName, sizeof(files[i].name));
 		files[i].offset = -1; // offset is not used in ZIP files
 		files[i].size = info.uncompressed_size;
+		unzGetFilePos(handle, &files[i].zipPos);
 		i++;
 		status = unzGoToNextFile(handle);
 	}
@@ -1033,6 +1344,41 @@ fsPack_t *FS_LoadPKZ(const char *packPath)
 	return pack;
 }
 
+/*
+=================
+FS_FreePack
+
+Closes a pack taken off the search path. The mapping stays around until
+the last FS_LoadFile buffer pointing into it is freed.
+=================
+*/
+static void FS_FreePack(fsPack_t *pack)
+{
+	if (pack->pak)
+		fclose(pack->pak);
+
+	if (pack->pkz)
+		unzClose(pack->pkz);
+
+	Z_Free(pack->files);
+
+	if (pack->map && pack->numSlices)
+	{
+		pack->pak = NULL;
+		pack->pkz = NULL;
+		pack->files = NULL;
+		pack->numFiles = 0;
+		pack->nextRetired = fs_retiredPacks;
+		fs_retiredPacks = pack;
+		return;
+	}
+
+	if (pack->map)
+		Sys_UnmapFile(pack->map, pack->mapSize);
+
+	Z_Free(pack);
+}
+
 /*
 ================
 FS_NextPath
@@ -1452,6 +1798,130 @@ void FS_Dir_f(void)
 	}
 }
 
+/*
+================
+FS_ResetLoadLog
+
+Called when a level starts loading, fs_bench replays the files opened
+from then on.
+================
+*/
+void FS_ResetLoadLog(void)
+{
+	fs_numLoadLog = 0;
+}
+
+/*
+================
+FS_ReplayLoadLog
+================
+*/
+static void FS_ReplayLoadLog(int *found, int *bytes)
+{
+	void *buf;
+	int i, size;
+
+	*found = *bytes = 0;
+
+	for (i = 0; i < fs_numLoadLog; i++)
+	{
+		size = FS_LoadFile(fs_loadLog[i], &buf);
+
+		if (buf)
+		{
+			(*found)++;
+			*bytes += size;
+			FS_FreeFile(buf);
+		}
+	}
+}
+
+/*
+================
+FS_Bench_f
+
+Replays the opens of the last level load. The cold pass starts from an
+empty pack index and freshly mapped paks, so it pays for building the
+index and faulting the paks in again, though whatever the OS has cached
+stays cached. The warm pass runs right after it, the last pass is warm
+too but scans every pack like fs_packindex 0.
+================
+*/
+void FS_Bench_f(void)
+{
+	fsSearchPath_t *search;
+	fsPack_t *pack;
+	qboolean remap;
+	char packindex[16];
+	int i, found, bytes;
+	unsigned start, usec[3];
+
+	if (!fs_numLoadLog)
+	{
+		Com_Printf("Nothing to replay, load a level first.\n");
+		return;
+	}
+
+	// read ahead buffers would skew the timings and pin the mappings
+	Prefetch_Flush();
+
+	// paks can only be mapped again while nothing points into them
+	remap = true;
+
+	for (i = 0; i < MAX_HANDLES; i++)
+	{
+		if (fs_handles[i].mem)
+			remap = false;
+	}
+
+	for (search = fs_searchPaths; search; search = search->next)
+	{
+		if (search->pack && search->pack->numSlices)
+			remap = false;
+	}
+
+	fs_logLoads = false;
+	Q_strlcpy(packindex, fs_packindex->string, sizeof(packindex));
+	Cvar_Set("fs_packindex", "1");
+
+	start = Sys_Microseconds();
+
+	if (remap)
+	{
+		for (search = fs_searchPaths; search; search = search->next)
+		{
+			pack = search->pack;
+
+			if (!pack || !pack->map)
+				continue;
+
+			Sys_UnmapFile(pack->map, pack->mapSize);
+			pack->map = Sys_MapFile(pack->pak, &pack->mapSize);
+		}
+	}
+
+	FS_RebuildHash();
+	FS_ReplayLoadLog(&found, &bytes);
+	usec[0] = Sys_Microseconds() - start;
+
+	start = Sys_Microseconds();
+	FS_ReplayLoadLog(&found, &bytes);
+	usec[1] = Sys_Microseconds() - start;
+
+	Cvar_Set("fs_packindex", "0");
+
+	start = Sys_Microseconds();
+	FS_ReplayLoadLog(&found, &bytes);
+	usec[2] = Sys_Microseconds() - start;
+
+	Cvar_Set("fs_packindex", packindex);
+	fs_logLoads = true;
+
+	Com_Printf("%i opens, %i found, %i KB\n", fs_numLoadLog, found, bytes >> 10);
+	Com_Printf("cold %.1f ms%s, warm %.1f ms, warm without index %.1f ms\n", usec[0] / 1000.0f,
+		remap ? "" : " (paks in use, not remapped)", usec[1] / 1000.0f, usec[2] / 1000.0f);
+}
+
 /*
 ================
 FS_AddDirToSearchPath
@@ -1470,6 +1940,9 @@ void FS_AddDirToSearchPath(char *dir, qboolean create)
 	fsSearchPath_t *search;
 	size_t len = strlen(dir);
 
+	// nothing may be reading from the old search path
+	Prefetch_Flush();
+
 	// the directory must not end with an /
 	// it would f*ck up the logic in other parts of the game...
 	if (dir[len - 1] == '/')
@@ -1556,6 +2029,8 @@ void FS_AddDirToSearchPath(char *dir, qboolean create)
 
 		FS_FreeFileList (list, nfiles);
 	}
+
+	FS_RebuildHash ();
 }
 
 /*
@@ -1627,31 +2102,26 @@ void FS_BuildGameSpecificSearchPath (char *dir)
 	if (!Q_stricmp(dir, BASEDIRNAME))
 		return;
 
+	Prefetch_Flush();
+
 	// we may already have specialised directories in our search path
 	// this can happen if the server changes the mod. Let's remove them
 	while (fs_searchPaths != fs_baseSearchPaths)
 	{
 		if (fs_searchPaths->pack)
-		{
-			if (fs_searchPaths->pack->pak)
-				fclose (fs_searchPaths->pack->pak);
-
-			if (fs_searchPaths->pack->pkz)
-				unzClose (fs_searchPaths->pack->pkz);
-
-			Z_Free (fs_searchPaths->pack->files);
-			Z_Free (fs_searchPaths->pack);
-		}
+			FS_FreePack (fs_searchPaths->pack);
 
 		next = fs_searchPaths->next;
 		Z_Free (fs_searchPaths);
 		fs_searchPaths = next;
 	}
 
+	FS_RebuildHash ();
+
 	// close open files for game dir
 	for (i = 0; i < MAX_HANDLES; i++)
 	{
-		if (strstr(fs_handles[i].name, dir) && ((fs_handles[i].file != NULL) || (fs_handles[i].zip != NULL)))
+		if (strstr(fs_handles[i].name, dir) && ((fs_handles[i].file != NULL) || (fs_handles[i].zip != NULL) || (fs_handles[i].mem != NULL)))
 			FS_FCloseFile(i);
 	}
 
@@ -1731,12 +2201,17 @@ void FS_InitFilesystem (void)
 	Cmd_AddCommand ("path", FS_Path_f);
 	Cmd_AddCommand ("link", FS_Link_f);
 	Cmd_AddCommand ("dir", FS_Dir_f);
+	Cmd_AddCommand ("fs_bench", FS_Bench_f);
 
 	// Register cvars
 	fs_basedir = Cvar_Get ("basedir", ".", CVAR_NOSET);
 	fs_cddir = Cvar_Get ("cddir", "", CVAR_NOSET);
 	fs_gamedirvar = Cvar_Get ("game", "", CVAR_LATCH | CVAR_SERVERINFO);
 	fs_debug = Cvar_Get ("fs_debug", "0", 0);
+	fs_packindex = Cvar_Get ("fs_packindex", "1", 0);
+
+	if (!fs_lock)
+		fs_lock = SDL_CreateMutex ();
 
 	// Build search path
 	FS_BuildRawPath ();
@@ -1758,9 +2233,11 @@ void FS_Shutdown (void)
 	int				i;
 	fsHandle_t		*handle;
 	fsSearchPath_t	*next;
-	fsPack_t		*pack;
+
+	Prefetch_Flush();
 
 	// Unregister commands
+	Cmd_RemoveCommand("fs_bench");
 	Cmd_RemoveCommand("dir");
 	Cmd_RemoveCommand("link");
 	Cmd_RemoveCommand("path");
@@ -1782,17 +2259,11 @@ void FS_Shutdown (void)
 	while (fs_searchPaths != NULL)
 	{
 		if (fs_searchPaths->pack != NULL)
-		{
-			pack = fs_searchPaths->pack;
-			if (pack->pak != NULL)
-				fclose(pack->pak);
-			if (pack->pkz != NULL)
-				unzClose(pack->pkz);
-			Z_Free(pack->files);
-			Z_Free(pack);
-		}
+			FS_FreePack(fs_searchPaths->pack);
 		next = fs_searchPaths->next;
 		Z_Free(fs_searchPaths);
 		fs_searchPaths = next;
 	}
+
+	FS_RebuildHash();
 }
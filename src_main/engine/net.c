@@ -19,6 +19,10 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 */
 
 // net.c
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE		// for recvmmsg and sendmmsg
+#endif
+
 #ifdef _WIN32
 #ifndef _INC_WINDOWS
 #define WIN32_LEAN_AND_MEAN
@@ -27,6 +31,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 #if !(defined(_WINSOCKAPI_) || defined(_WINSOCK_H))
 #define _WINSOCK_DEPRECATED_NO_WARNINGS
 #include <winsock2.h>
+#include <ws2tcpip.h>	// socklen_t
 #endif
 #elif defined(__linux__) || defined(__FreeBSD__) || defined(__APPLE__)
 #include <unistd.h>
@@ -49,6 +54,11 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 #endif
 #include "qcommon.h"
 
+#include <SDL_thread.h>
+#include <SDL_mutex.h>
+#include <SDL_atomic.h>
+#include <SDL_timer.h>
+
 #define	MAX_LOOPBACK	4
 
 typedef struct
@@ -66,10 +76,38 @@ typedef struct
 
 cvar_t		*net_shownet;
 static cvar_t	*noudp;
+static cvar_t	*net_batch;
+static cvar_t	*net_thread;
+
+static SDL_Thread	*net_threadhandle;		// dedicated server network thread
 
 loopback_t	loopbacks[2];
 int			ip_sockets[2];
 
+#ifdef __linux__
+// batched socket io, received packets are read a batch at a time and
+// handed out one by one by NET_GetPacket, sent packets are queued
+// between NET_BeginPacketBatch and NET_FlushPackets
+#define	NET_BATCH	64
+
+typedef struct
+{
+	struct mmsghdr		msgs[NET_BATCH];
+	struct iovec		iovecs[NET_BATCH];
+	struct sockaddr_in	addrs[NET_BATCH];
+	netadr_t			to[NET_BATCH];		// for send error messages
+	byte				data[NET_BATCH][MAX_PACKETLEN];
+	int					count;				// packets in the batch
+	int					current;			// next received packet to hand out
+} netbatch_t;
+
+static netbatch_t	net_recvbatch[2];
+static netbatch_t	net_sendbatch[2];
+static qboolean		net_batching[2];		// between NET_BeginPacketBatch and NET_FlushPackets
+
+static void NET_SendError (netadr_t to);
+#endif
+
 //=============================================================================
 
 void NetadrToSockadr (netadr_t *a, struct sockaddr *s)
@@ -293,6 +331,581 @@ void NET_SendLoopPacket (netsrc_t sock, int length, void *data, netadr_t to)
 
 //=============================================================================
 
+#ifdef NET_BATCH
+/*
+====================
+NET_RecvBatch
+
+Reads as many waiting packets as fit in the batch with one call.
+Returns the packet count, or -1 with errno set
+====================
+*/
+static int NET_RecvBatch (int net_socket, netbatch_t *b)
+{
+	int		i, ret;
+
+	b->count = b->current = 0;
+
+	for (i = 0; i < NET_BATCH; i++)
+	{
+		b->iovecs[i].iov_base = b->data[i];
+		b->iovecs[i].iov_len = sizeof (b->data[i]);
+
+		memset (&b->msgs[i].msg_hdr, 0, sizeof (b->msgs[i].msg_hdr));
+		b->msgs[i].msg_hdr.msg_name = &b->addrs[i];
+		b->msgs[i].msg_hdr.msg_namelen = sizeof (b->addrs[i]);
+		b->msgs[i].msg_hdr.msg_iov = &b->iovecs[i];
+		b->msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	ret = recvmmsg (net_socket, b->msgs, NET_BATCH, MSG_DONTWAIT, NULL);
+
+	if (ret > 0)
+		b->count = ret;
+
+	return ret;
+}
+
+
+/*
+====================
+NET_SendBatch
+
+Sends all queued packets, with as few calls as the socket allows.
+Returns the number of packets that went out, or -1 if sendmmsg isn't
+supported and nothing was sent
+====================
+*/
+static int NET_SendBatch (int net_socket, netbatch_t *b)
+{
+	int		i, ret, sent;
+
+	for (i = 0; i < b->count; i++)
+	{
+		memset (&b->msgs[i].msg_hdr, 0, sizeof (b->msgs[i].msg_hdr));
+		b->msgs[i].msg_hdr.msg_name = &b->addrs[i];
+		b->msgs[i].msg_hdr.msg_namelen = sizeof (b->addrs[i]);
+		b->msgs[i].msg_hdr.msg_iov = &b->iovecs[i];
+		b->msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	for (i = 0, sent = 0; i < b->count; )
+	{
+		ret = sendmmsg (net_socket, b->msgs + i, b->count - i, 0);
+
+		if (ret == -1)
+		{
+			if (errno == ENOSYS && !sent)
+				return -1;
+
+			// the first packet of the rest failed, skip it like sendto would
+			NET_SendError (b->to[i]);
+			i++;
+			continue;
+		}
+
+		i += ret;
+		sent += ret;
+	}
+
+	b->count = 0;
+
+	return sent;
+}
+
+
+/*
+====================
+NET_GetBatchedPacket
+
+Returns 1 with the next packet, 0 if nothing is waiting, or -1 if
+this system can't batch
+====================
+*/
+static int NET_GetBatchedPacket (netsrc_t sock, int net_socket, netadr_t *net_from, sizebuf_t *net_message)
+{
+	netbatch_t	*b = &net_recvbatch[sock];
+	int			len;
+
+	for ( ; ; )
+	{
+		if (b->current >= b->count)
+		{
+			if (NET_RecvBatch (net_socket, b) == -1)
+			{
+				if (errno == ENOSYS)
+				{
+					Com_Printf (S_COLOR_YELLOW "WARNING: recvmmsg not supported, disabling net_batch\n");
+					Cvar_Set ("net_batch", "0");
+					return -1;
+				}
+
+				if (errno != EWOULDBLOCK && errno != EAGAIN)
+					Com_Printf ("NET_GetPacket: %s\n", NET_ErrorString ());
+
+				return 0;
+			}
+		}
+
+		len = b->msgs[b->current].msg_len;
+		SockadrToNetadr ((struct sockaddr *) &b->addrs[b->current], net_from);
+
+		if (len >= net_message->maxsize || (b->msgs[b->current].msg_hdr.msg_flags & MSG_TRUNC))
+		{
+			Com_Printf ("Oversize packet from %s\n", NET_AdrToString (*net_from));
+			b->current++;
+			continue;
+		}
+
+		memcpy (net_message->data, b->data[b->current], len);
+		net_message->cursize = len;
+		b->current++;
+
+		return 1;
+	}
+}
+#endif
+
+
+/*
+====================
+NET_BeginPacketBatch
+
+Packets sent on sock are queued until NET_FlushPackets
+====================
+*/
+void NET_BeginPacketBatch (netsrc_t sock)
+{
+#ifdef NET_BATCH
+	net_batching[sock] = net_batch->value && ip_sockets[sock] && !(sock == NS_SERVER && net_threadhandle);
+#endif
+}
+
+
+/*
+====================
+NET_FlushPackets
+====================
+*/
+void NET_FlushPackets (netsrc_t sock)
+{
+#ifdef NET_BATCH
+	netbatch_t	*b = &net_sendbatch[sock];
+	int			i;
+
+	net_batching[sock] = false;
+
+	if (!b->count)
+		return;
+
+	if (ip_sockets[sock] && NET_SendBatch (ip_sockets[sock], b) == -1)
+	{
+		Com_Printf (S_COLOR_YELLOW "WARNING: sendmmsg not supported, disabling net_batch\n");
+		Cvar_Set ("net_batch", "0");
+
+		for (i = 0; i < b->count; i++)
+			NET_SendPacket (sock, b->iovecs[i].iov_len, b->data[i], b->to[i]);
+	}
+
+	b->count = 0;
+#endif
+}
+
+/*
+=============================================================================
+
+DEDICATED SERVER NETWORK THREAD
+
+With net_thread set, a dedicated server reads and writes its socket on a
+thread of its own. Packets are passed to and from the server frame through
+single producer, single consumer rings, and the connectionless queries that
+don't need the game are answered right on the network thread, so a flood
+of them can't hold up the simulation.
+
+=============================================================================
+*/
+
+#define	NET_QUEUE_SIZE	512		// must be a power of two
+
+typedef struct
+{
+	netadr_t	adr;			// where it came from or goes to
+	int			time;			// Sys_Milliseconds when it arrived
+	int			length;
+	byte		data[MAX_PACKETLEN + 1];	// one more to tell oversize packets apart
+} netpacket_t;
+
+typedef struct
+{
+	SDL_atomic_t	head;		// only moved by the producer
+	SDL_atomic_t	tail;		// only moved by the consumer
+	netpacket_t		packets[NET_QUEUE_SIZE];
+} netqueue_t;
+
+enum
+{
+	NETSTAT_RECEIVED,
+	NETSTAT_ANSWERED,
+	NETSTAT_DROPPED,
+	NETSTAT_SENT,
+	NETSTAT_SENDERRORS,
+	NETSTAT_MAX
+};
+
+static netqueue_t	net_inqueue;		// network thread -> server frame
+static netqueue_t	net_outqueue;		// server frame -> network thread
+
+static SDL_threadID	net_threadid;
+static SDL_atomic_t	net_threadquit;
+static SDL_sem		*net_threadsem;		// posted when net_inqueue gets packets
+static SDL_atomic_t	net_threadstats[NETSTAT_MAX];
+static int			net_queuedelay, net_queuecount;	// server frame side
+
+static qboolean		(*net_threadhandler) (netadr_t *from, sizebuf_t *msg);
+
+/*
+====================
+NET_QueueWriteSlot
+
+Returns the slot the producer can fill next, or NULL if the ring is full
+====================
+*/
+static netpacket_t *NET_QueueWriteSlot (netqueue_t *q)
+{
+	int		head;
+
+	head = SDL_AtomicGet (&q->head);
+
+	if (head - SDL_AtomicGet (&q->tail) >= NET_QUEUE_SIZE)
+		return NULL;
+
+	return &q->packets[head & (NET_QUEUE_SIZE - 1)];
+}
+
+static void NET_QueuePush (netqueue_t *q)
+{
+	SDL_AtomicAdd (&q->head, 1);
+}
+
+/*
+====================
+NET_QueueReadSlot
+
+Returns the oldest packet for the consumer, or NULL if the ring is empty
+====================
+*/
+static netpacket_t *NET_QueueReadSlot (netqueue_t *q)
+{
+	int		tail;
+
+	tail = SDL_AtomicGet (&q->tail);
+
+	if (tail == SDL_AtomicGet (&q->head))
+		return NULL;
+
+	return &q->packets[tail & (NET_QUEUE_SIZE - 1)];
+}
+
+static void NET_QueuePop (netqueue_t *q)
+{
+	SDL_AtomicAdd (&q->tail, 1);
+}
+
+
+/*
+====================
+NET_ThreadReceive
+
+Reads everything waiting on the socket. Nothing on the network
+thread may print, problems only show up in net_threadinfo
+====================
+*/
+static void NET_ThreadReceive (int net_socket)
+{
+	netpacket_t		*p, scratch;
+	struct sockaddr	from;
+	socklen_t		fromlen;
+	int				ret, queued;
+	sizebuf_t		msg;
+
+	queued = 0;
+
+	for ( ; ; )
+	{
+		// with the ring full, queries are still answered
+		if ((p = NET_QueueWriteSlot (&net_inqueue)) == NULL)
+			p = &scratch;
+
+		fromlen = sizeof (from);
+		ret = recvfrom (net_socket, p->data, sizeof (p->data), 0, &from, &fromlen);
+
+		if (ret == -1)
+			break;
+
+		if (ret > MAX_PACKETLEN)
+			continue;		// oversize packet
+
+		SockadrToNetadr (&from, &p->adr);
+		p->length = ret;
+		p->time = Sys_Milliseconds ();
+		SDL_AtomicAdd (&net_threadstats[NETSTAT_RECEIVED], 1);
+
+		if (net_threadhandler && ret >= 4 && *(int *) p->data == -1)
+		{
+			SZ_Init (&msg, p->data, MAX_PACKETLEN);
+			msg.cursize = ret;
+
+			if (net_threadhandler (&p->adr, &msg))
+			{
+				SDL_AtomicAdd (&net_threadstats[NETSTAT_ANSWERED], 1);
+				continue;
+			}
+		}
+
+		if (p == &scratch)
+		{
+			SDL_AtomicAdd (&net_threadstats[NETSTAT_DROPPED], 1);
+			continue;
+		}
+
+		NET_QueuePush (&net_inqueue);
+		queued++;
+	}
+
+	if (queued && !SDL_SemValue (net_threadsem))
+		SDL_SemPost (net_threadsem);
+}
+
+
+/*
+====================
+NET_ThreadSend
+
+Sends everything the server frame queued
+====================
+*/
+static void NET_ThreadSend (int net_socket)
+{
+	netpacket_t		*p;
+	struct sockaddr	addr;
+
+	while ((p = NET_QueueReadSlot (&net_outqueue)) != NULL)
+	{
+		NetadrToSockadr (&p->adr, &addr);
+
+		if (sendto (net_socket, p->data, p->length, 0, &addr, sizeof (addr)) == -1)
+			SDL_AtomicAdd (&net_threadstats[NETSTAT_SENDERRORS], 1);
+		else
+			SDL_AtomicAdd (&net_threadstats[NETSTAT_SENT], 1);
+
+		NET_QueuePop (&net_outqueue);
+	}
+}
+
+
+/*
+====================
+NET_ThreadMain
+====================
+*/
+static int NET_ThreadMain (void *data)
+{
+	int				net_socket = *(int *) data;
+	struct timeval	timeout;
+	fd_set			fdset;
+
+	while (!SDL_AtomicGet (&net_threadquit))
+	{
+		// wake up on packets, or after a msec to send what the server queued
+		FD_ZERO (&fdset);
+		FD_SET (net_socket, &fdset);
+		timeout.tv_sec = 0;
+		timeout.tv_usec = 1000;
+		select (net_socket + 1, &fdset, NULL, NULL, &timeout);
+
+		NET_ThreadReceive (net_socket);
+		NET_ThreadSend (net_socket);
+	}
+
+	return 0;
+}
+
+
+/*
+====================
+NET_StartThread
+====================
+*/
+static void NET_StartThread (void)
+{
+	int		i;
+
+	if (net_threadhandle || !ip_sockets[NS_SERVER])
+		return;
+
+	SDL_AtomicSet (&net_inqueue.head, 0);
+	SDL_AtomicSet (&net_inqueue.tail, 0);
+	SDL_AtomicSet (&net_outqueue.head, 0);
+	SDL_AtomicSet (&net_outqueue.tail, 0);
+	SDL_AtomicSet (&net_threadquit, 0);
+
+	for (i = 0; i < NETSTAT_MAX; i++)
+		SDL_AtomicSet (&net_threadstats[i], 0);
+
+	net_queuedelay = net_queuecount = 0;
+
+	net_threadsem = SDL_CreateSemaphore (0);
+	net_threadhandle = SDL_CreateThread (NET_ThreadMain, "net", &ip_sockets[NS_SERVER]);
+
+	if (!net_threadhandle)
+	{
+		Com_Printf (S_COLOR_YELLOW "WARNING: couldn't start the network thread: %s\n", SDL_GetError ());
+		SDL_DestroySemaphore (net_threadsem);
+		net_threadsem = NULL;
+		return;
+	}
+
+	net_threadid = SDL_GetThreadID (net_threadhandle);
+	Com_Printf ("Network thread started\n");
+}
+
+
+/*
+====================
+NET_StopThread
+
+Sends whatever is still queued, so final messages get out
+====================
+*/
+static void NET_StopThread (void)
+{
+	if (!net_threadhandle)
+		return;
+
+	SDL_AtomicSet (&net_threadquit, 1);
+	SDL_WaitThread (net_threadhandle, NULL);
+	net_threadhandle = NULL;
+
+	NET_ThreadSend (ip_sockets[NS_SERVER]);
+
+	SDL_DestroySemaphore (net_threadsem);
+	net_threadsem = NULL;
+}
+
+
+/*
+====================
+NET_GetQueuedPacket
+====================
+*/
+static qboolean NET_GetQueuedPacket (netadr_t *net_from, sizebuf_t *net_message)
+{
+	netpacket_t	*p;
+
+	for ( ; ; )
+	{
+		if ((p = NET_QueueReadSlot (&net_inqueue)) == NULL)
+			return false;
+
+		if (p->length <= net_message->maxsize)
+			break;
+
+		// drop it and keep draining
+		Com_Printf ("Oversize packet from %s\n", NET_AdrToString (p->adr));
+		NET_QueuePop (&net_inqueue);
+	}
+
+	memcpy (net_message->data, p->data, p->length);
+	net_message->cursize = p->length;
+	*net_from = p->adr;
+
+	net_queuedelay += Sys_Milliseconds () - p->time;
+	net_queuecount++;
+
+	NET_QueuePop (&net_inqueue);
+
+	return true;
+}
+
+
+/*
+====================
+NET_QueueSendPacket
+
+Hands a packet to the network thread, waiting if it has fallen behind
+====================
+*/
+static void NET_QueueSendPacket (int length, void *data, netadr_t to)
+{
+	netpacket_t	*p;
+
+	if (length > MAX_PACKETLEN)
+		Com_Error (ERR_FATAL, "NET_SendPacket: %i bytes is too long", length);
+
+	while ((p = NET_QueueWriteSlot (&net_outqueue)) == NULL)
+		SDL_Delay (0);
+
+	p->adr = to;
+	p->length = length;
+	memcpy (p->data, data, length);
+
+	NET_QueuePush (&net_outqueue);
+}
+
+
+/*
+====================
+NET_SetConnectionlessHandler
+
+The handler is called on the network thread for every connectionless
+packet and returns true if it answered it, the rest go to the server frame
+====================
+*/
+void NET_SetConnectionlessHandler (qboolean (*handler) (netadr_t *from, sizebuf_t *msg))
+{
+	net_threadhandler = handler;
+}
+
+
+/*
+====================
+NET_ThreadActive
+====================
+*/
+qboolean NET_ThreadActive (void)
+{
+	return net_threadhandle != NULL;
+}
+
+
+/*
+====================
+NET_ThreadInfo_f
+====================
+*/
+static void NET_ThreadInfo_f (void)
+{
+	if (!net_threadhandle)
+	{
+		Com_Printf ("Network thread is not running.\n");
+		return;
+	}
+
+	Com_Printf ("received  : %i\n", SDL_AtomicGet (&net_threadstats[NETSTAT_RECEIVED]));
+	Com_Printf ("answered  : %i\n", SDL_AtomicGet (&net_threadstats[NETSTAT_ANSWERED]));
+	Com_Printf ("dropped   : %i\n", SDL_AtomicGet (&net_threadstats[NETSTAT_DROPPED]));
+	Com_Printf ("sent      : %i\n", SDL_AtomicGet (&net_threadstats[NETSTAT_SENT]));
+	Com_Printf ("send errs : %i\n", SDL_AtomicGet (&net_threadstats[NETSTAT_SENDERRORS]));
+	Com_Printf ("queued    : %i in, %i out\n",
+				SDL_AtomicGet (&net_inqueue.head) - SDL_AtomicGet (&net_inqueue.tail),
+				SDL_AtomicGet (&net_outqueue.head) - SDL_AtomicGet (&net_outqueue.tail));
+
+	if (net_queuecount)
+		Com_Printf ("avg wait  : %.2f msec over %i packets\n", (float) net_queuedelay / net_queuecount, net_queuecount);
+}
+
+//=============================================================================
+
 qboolean NET_GetPacket (netsrc_t sock, netadr_t *net_from, sizebuf_t *net_message)
 {
 	int 	ret;
@@ -305,6 +918,9 @@ qboolean NET_GetPacket (netsrc_t sock, netadr_t *net_from, sizebuf_t *net_messag
 	if (NET_GetLoopPacket (sock, net_from, net_message))
 		return true;
 
+	if (sock == NS_SERVER && net_threadhandle)
+		return NET_GetQueuedPacket (net_from, net_message);
+
 	for (protocol = 0; protocol < 2; protocol++)
 	{
 		if (protocol == 0)
@@ -313,6 +929,24 @@ qboolean NET_GetPacket (netsrc_t sock, netadr_t *net_from, sizebuf_t *net_messag
 		if (!net_socket)
 			continue;
 
+#ifdef NET_BATCH
+		// still hand out what was read before net_batch was turned off
+		if (net_batch->value || net_recvbatch[sock].current < net_recvbatch[sock].count)
+		{
+			ret = NET_GetBatchedPacket (sock, net_socket, net_from, net_message);
+
+			if (ret != -1)
+			{
+				if (ret)
+					return true;
+
+				continue;
+			}
+
+			// batching isn't supported, use the normal path
+		}
+#endif
+
 		fromlen = sizeof (from);
 		ret = recvfrom (net_socket, net_message->data, net_message->maxsize, 0, (struct sockaddr *) &from, &fromlen);
 
@@ -362,9 +996,55 @@ qboolean NET_GetPacket (netsrc_t sock, netadr_t *net_from, sizebuf_t *net_messag
 
 //=============================================================================
 
+/*
+====================
+NET_SendError
+
+Reports a failed send unless it's one that happens in normal play
+====================
+*/
+static void NET_SendError (netadr_t to)
+{
+	int		err;
+
+#ifdef _WIN32
+	err = WSAGetLastError();
+	switch (err) {
+		case WSAEWOULDBLOCK:
+		case WSAEINTR:
+			// wouldblock is silent
+			break;
+		case WSAEADDRNOTAVAIL:
+			// some PPP links dont allow broadcasts
+			if (to.type == NA_BROADCAST)
+				break;
+			// intentional fallthrough
+		default:
+			Com_Printf(S_COLOR_RED "NET_SendPacket ERROR: %s (%d) to %s\n",	NET_ErrorString(), err, NET_AdrToString(to));
+			break;
+	}
+#else
+	err = errno;
+
+	switch (err) {
+		case EWOULDBLOCK:
+			// wouldblock is silent
+			break;
+		case ECONNRESET:
+		case EHOSTUNREACH:
+		case ENETUNREACH:
+		case ENETDOWN:
+			break;
+		default:
+			Com_Printf(S_COLOR_RED "NET_SendPacket ERROR: %s (%d) to %s\n", NET_ErrorString(), err, NET_AdrToString(to));
+			break;
+	}
+#endif
+}
+
 void NET_SendPacket (netsrc_t sock, int length, void *data, netadr_t to)
 {
-	int		ret, err;
+	int		ret;
 	struct sockaddr	addr;
 	int		net_socket;
 
@@ -391,46 +1071,56 @@ void NET_SendPacket (netsrc_t sock, int length, void *data, netadr_t to)
 	else
 		Com_Error (ERR_FATAL, "NET_SendPacket: bad address type");
 
-	NetadrToSockadr (&to, &addr);
+	if (sock == NS_SERVER && net_threadhandle)
+	{
+		// replies made on the network thread go straight out
+		if (SDL_ThreadID () == net_threadid)
+		{
+			NetadrToSockadr (&to, &addr);
 
-	ret = sendto (net_socket, data, length, 0, &addr, sizeof (addr));
+			if (sendto (net_socket, data, length, 0, &addr, sizeof (addr)) == -1)
+				SDL_AtomicAdd (&net_threadstats[NETSTAT_SENDERRORS], 1);
+			else
+				SDL_AtomicAdd (&net_threadstats[NETSTAT_SENT], 1);
 
-	if (ret == -1)
-	{
-#ifdef _WIN32
-		err = WSAGetLastError();
-		switch (err) {
-			case WSAEWOULDBLOCK:
-			case WSAEINTR:
-				// wouldblock is silent
-				break;
-			case WSAEADDRNOTAVAIL:
-				// some PPP links dont allow broadcasts
-				if (to.type == NA_BROADCAST)
-					break;
-				// intentional fallthrough
-			default:
-				Com_Printf(S_COLOR_RED "NET_SendPacket ERROR: %s (%d) to %s\n",	NET_ErrorString(), err, NET_AdrToString(to));
-				break;
+			return;
 		}
-#else
-		err = errno;
 
-		switch (err) {
-			case EWOULDBLOCK:
-				// wouldblock is silent
-				break;
-			case ECONNRESET:
-			case EHOSTUNREACH:
-			case ENETUNREACH:
-			case ENETDOWN:
-				break;
-			default:
-				Com_Printf(S_COLOR_RED "NET_SendPacket ERROR: %s (%d) to %s\n", NET_ErrorString(), err, NET_AdrToString(to));
-				break;
+		NET_QueueSendPacket (length, data, to);
+		return;
+	}
+
+	NetadrToSockadr (&to, &addr);
+
+#ifdef NET_BATCH
+	if (net_batching[sock])
+	{
+		netbatch_t	*b = &net_sendbatch[sock];
+
+		if (length > sizeof (b->data[0]))
+			Com_Error (ERR_FATAL, "NET_SendPacket: %i bytes is too long", length);
+
+		memcpy (b->data[b->count], data, length);
+		memcpy (&b->addrs[b->count], &addr, sizeof (b->addrs[0]));
+		b->iovecs[b->count].iov_base = b->data[b->count];
+		b->iovecs[b->count].iov_len = length;
+		b->to[b->count] = to;
+
+		if (++b->count == NET_BATCH)
+		{
+			// keep queueing after a full batch
+			NET_FlushPackets (sock);
+			net_batching[sock] = net_batch->value;
 		}
-#endif
+
+		return;
 	}
+#endif
+
+	ret = sendto (net_socket, data, length, 0, &addr, sizeof (addr));
+
+	if (ret == -1)
+		NET_SendError (to);
 }
 
 
@@ -529,6 +1219,9 @@ void NET_OpenIP (void)
 
 		if (!ip_sockets[NS_SERVER] && dedicated)
 			Com_Error (ERR_FATAL, "Couldn't allocate dedicated server IP port");
+
+		if (dedicated && net_thread->value)
+			NET_StartThread ();
 	}
 
 	// dedicated servers don't need client ports
@@ -574,6 +1267,9 @@ void NET_Config (qboolean multiplayer)
 
 	if (!multiplayer)
 	{
+		// the network thread owns the server socket
+		NET_StopThread ();
+
 		// shut down any existing sockets
 		for (i = 0; i < 2; i++)
 		{
@@ -582,6 +1278,12 @@ void NET_Config (qboolean multiplayer)
 				closesocket (ip_sockets[i]);
 				ip_sockets[i] = 0;
 			}
+
+#ifdef NET_BATCH
+			net_recvbatch[i].count = net_recvbatch[i].current = 0;
+			net_sendbatch[i].count = 0;
+			net_batching[i] = false;
+#endif
 		}
 	}
 	else
@@ -610,6 +1312,12 @@ void NET_Sleep (int msec)
 	if (!dedicated || !dedicated->value)
 		return; // we're not a server, just run full speed
 
+	if (net_threadhandle)
+	{
+		SDL_SemWaitTimeout (net_threadsem, msec);
+		return;
+	}
+
 	FD_ZERO (&fdset);
 	i = 0;
 
@@ -626,6 +1334,184 @@ void NET_Sleep (int msec)
 
 //===================================================================
 
+/*
+====================
+NET_BenchDrain
+
+Reads everything waiting on the bench socket
+====================
+*/
+static int NET_BenchDrain (int net_socket, qboolean batched, void *batch)
+{
+	byte	buf[MAX_PACKETLEN];
+	struct sockaddr	from;
+	socklen_t	fromlen;
+	int		ret, received;
+
+	received = 0;
+
+#ifdef NET_BATCH
+	if (batched)
+	{
+		while ((ret = NET_RecvBatch (net_socket, (netbatch_t *) batch)) > 0)
+			received += ret;
+
+		return received;
+	}
+#endif
+
+	for ( ; ; )
+	{
+		fromlen = sizeof (from);
+
+		if (recvfrom (net_socket, buf, sizeof (buf), 0, &from, &fromlen) == -1)
+			break;
+
+		received++;
+	}
+
+	return received;
+}
+
+
+/*
+====================
+NET_Bench_f
+
+Sends packets to ourselves through the loopback interface, with one
+call per packet and batched, and reports the packets per second
+====================
+*/
+static void NET_Bench_f (void)
+{
+	int		count, size, mode, i, burst, sent, received;
+	int		sendsock, recvsock;
+	socklen_t	addrlen;
+	struct sockaddr_in	addr;
+	byte	packet[MAX_PACKETLEN];
+	unsigned int	start, end, usec;
+	void	*recvbatch = NULL;
+#ifdef NET_BATCH
+	netbatch_t	*b = NULL;
+#endif
+
+	count = (Cmd_Argc () > 1) ? atoi (Cmd_Argv (1)) : 100000;
+	size = (Cmd_Argc () > 2) ? atoi (Cmd_Argv (2)) : 1024;
+
+	if (count < 1)
+		count = 1;
+
+	if (size < 1 || size >= MAX_PACKETLEN)
+		size = 1024;
+
+	sendsock = NET_IPSocket ("localhost", PORT_ANY);
+	recvsock = NET_IPSocket ("localhost", PORT_ANY);
+
+	addrlen = sizeof (addr);
+
+	if (!sendsock || !recvsock || getsockname (recvsock, (struct sockaddr *) &addr, &addrlen) == -1)
+	{
+		Com_Printf (S_COLOR_RED "net_bench: couldn't open sockets\n");
+
+		if (sendsock)
+			closesocket (sendsock);
+
+		if (recvsock)
+			closesocket (recvsock);
+
+		return;
+	}
+
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+
+	for (i = 0; i < size; i++)
+		packet[i] = i;
+
+#ifdef NET_BATCH
+	b = Z_Malloc (sizeof (*b));
+	recvbatch = Z_Malloc (sizeof (*b));
+#endif
+
+	Com_Printf ("%i packets of %i bytes over loopback\n", count, size);
+
+	for (mode = 0; mode < 2; mode++)
+	{
+#ifndef NET_BATCH
+		if (mode == 1)
+			break;
+#endif
+		sent = received = 0;
+		start = Sys_Microseconds ();
+
+		while (sent < count)
+		{
+			burst = count - sent;
+
+#ifdef NET_BATCH
+			if (burst > NET_BATCH)
+				burst = NET_BATCH;
+
+			if (mode == 1)
+			{
+				// copy like NET_SendPacket does when queueing
+				for (i = 0; i < burst; i++)
+				{
+					memcpy (b->data[i], packet, size);
+					b->addrs[i] = addr;
+					b->iovecs[i].iov_base = b->data[i];
+					b->iovecs[i].iov_len = size;
+					memset (&b->to[i], 0, sizeof (b->to[i]));
+				}
+
+				b->count = burst;
+
+				if (NET_SendBatch (sendsock, b) == -1)
+				{
+					Com_Printf (S_COLOR_RED "net_bench: sendmmsg not supported\n");
+					break;
+				}
+			}
+			else
+#else
+			if (burst > 64)
+				burst = 64;
+#endif
+			{
+				for (i = 0; i < burst; i++)
+					sendto (sendsock, packet, size, 0, (struct sockaddr *) &addr, sizeof (addr));
+			}
+
+			sent += burst;
+			received += NET_BenchDrain (recvsock, mode, recvbatch);
+		}
+
+		// pick up the stragglers
+		end = Sys_Microseconds ();
+
+		while (Sys_Microseconds () - end < 10000)
+			received += NET_BenchDrain (recvsock, mode, recvbatch);
+
+		usec = end - start;
+
+		if (!usec)
+			usec = 1;
+
+		Com_Printf ("%s: %8.0f packets/sec, %i of %i received\n", mode ? "batched   " : "per packet",
+					(double) sent * 1000000.0 / usec, received, sent);
+	}
+
+#ifdef NET_BATCH
+	Z_Free (b);
+	Z_Free (recvbatch);
+#endif
+
+	closesocket (sendsock);
+	closesocket (recvsock);
+}
+
+//===================================================================
+
 
 /*
 ====================
@@ -655,6 +1541,11 @@ void NET_Init (void)
 	noudp = Cvar_Get ("noudp", "0", CVAR_NOSET);
 
 	net_shownet = Cvar_Get ("net_shownet", "0", 0);
+	net_batch = Cvar_Get ("net_batch", "1", CVAR_ARCHIVE);
+	net_thread = Cvar_Get ("net_thread", "0", CVAR_NOSET);
+
+	Cmd_AddCommand ("net_bench", NET_Bench_f);
+	Cmd_AddCommand ("net_threadinfo", NET_ThreadInfo_f);
 }
 
 
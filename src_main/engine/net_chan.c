@@ -24,12 +24,17 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
 packet header
 -------------
-31	sequence
+30	sequence
+1	is this packet a fragment of a larger message
 1	does this message contain a reliable payload
 31	acknowledge sequence
 1	acknowledge receipt of even/odd message
 16	qport
 
+fragments follow the header with
+15	offset of the fragment in the message
+1	more fragments follow
+
 The remote connection never knows if it missed a reliable message, the
 local side detects that it has been dropped by seeing a sequence acknowledge
 higher thatn the last reliable sequence, but without the correct evon/odd
@@ -54,6 +59,11 @@ message is included if there is sufficient room.
 To the receiver, there is no distinction between the reliable and unreliable
 parts of the message, they are just processed out as a single larger message.
 
+Messages bigger than a packet are only sent when both sides agreed to it
+at connect. They are split into fragments that all carry the same sequence
+and are sent at once, the receiver reassembles them in order and drops the
+whole message if any fragment is lost. Loopback never fragments.
+
 Illogical packet sequence numbers cause the packet to be dropped, but do
 not kill the connection. This, combined with the tight window of valid
 reliable acknowledgement numbers provides protection against malicious
@@ -111,7 +121,7 @@ Sends an out-of-band datagram
 void Netchan_OutOfBand (int net_socket, netadr_t adr, int length, byte *data)
 {
 	sizebuf_t	send;
-	byte		send_buf[MAX_MSGLEN];
+	byte		send_buf[MAX_PACKETLEN];
 
 	// write the packet header
 	SZ_Init (&send, send_buf, sizeof (send_buf));
@@ -133,7 +143,7 @@ Sends a text message in an out-of-band datagram
 void Netchan_OutOfBandPrint (int net_socket, netadr_t adr, char *format, ...)
 {
 	va_list		argptr;
-	static char		string[MAX_MSGLEN - 4];
+	static char		string[MAX_PACKETLEN - 4];
 
 	va_start (argptr, format);
 	vsprintf (string, format, argptr);
@@ -186,6 +196,39 @@ static qboolean Netchan_NeedReliable (netchan_t *chan)
 	return send_reliable;
 }
 
+/*
+===============
+Netchan_TransmitFragments
+
+Sends a message bigger than a packet as consecutive fragments, each
+with the message header and FRAGMENT_BIT set in the sequence
+===============
+*/
+static void Netchan_TransmitFragments (netchan_t *chan, unsigned w1, sizebuf_t *send, int headerlen)
+{
+	sizebuf_t	frag;
+	byte		frag_buf[MAX_PACKETLEN];
+	int			offset, length, more;
+
+	for (offset = headerlen; offset < send->cursize; offset += length)
+	{
+		length = send->cursize - offset;
+
+		if (length > FRAGMENT_SIZE)
+			length = FRAGMENT_SIZE;
+
+		more = (offset + length < send->cursize) ? FRAGMENT_MORE : 0;
+
+		SZ_Init (&frag, frag_buf, sizeof (frag_buf));
+		MSG_WriteLong (&frag, w1 | FRAGMENT_BIT);
+		SZ_Write (&frag, send->data + 4, headerlen - 4);	// acknowledge and qport
+		MSG_WriteShort (&frag, (offset - headerlen) | more);
+		SZ_Write (&frag, send->data + offset, length);
+
+		NET_SendPacket (chan->sock, frag.cursize, frag.data, chan->remote_address);
+	}
+}
+
 /*
 ===============
 Netchan_Transmit
@@ -202,6 +245,7 @@ void Netchan_Transmit (netchan_t *chan, int length, byte *data)
 	byte		send_buf[MAX_MSGLEN];
 	qboolean	send_reliable;
 	unsigned	w1, w2;
+	int			headerlen;
 
 	// check for message overflow
 	if (chan->message.overflowed)
@@ -222,9 +266,9 @@ void Netchan_Transmit (netchan_t *chan, int length, byte *data)
 	}
 
 	// write the packet header
-	SZ_Init (&send, send_buf, sizeof (send_buf));
+	SZ_Init (&send, send_buf, chan->fragments ? sizeof (send_buf) : MAX_PACKETLEN);
 
-	w1 = (chan->outgoing_sequence & ~ (1 << 31)) | (send_reliable << 31);
+	w1 = (chan->outgoing_sequence & ~ (3 << 30)) | (send_reliable << 31);
 	w2 = (chan->incoming_sequence & ~ (1 << 31)) | (chan->incoming_reliable_sequence << 31);
 
 	chan->outgoing_sequence++;
@@ -237,6 +281,8 @@ void Netchan_Transmit (netchan_t *chan, int length, byte *data)
 	if (chan->sock == NS_CLIENT)
 		MSG_WriteShort (&send, qport->value);
 
+	headerlen = send.cursize;
+
 	// copy the reliable message to the packet first
 	if (send_reliable)
 	{
@@ -251,7 +297,9 @@ void Netchan_Transmit (netchan_t *chan, int length, byte *data)
 		Com_Printf ("Netchan_Transmit: dumped unreliable\n");
 
 	// send the datagram
-	NET_SendPacket (chan->sock, send.cursize, send.data, chan->remote_address);
+	if (send.cursize > MAX_PACKETLEN && chan->remote_address.type != NA_LOOPBACK)
+		Netchan_TransmitFragments (chan, w1, &send, headerlen);
+	else NET_SendPacket (chan->sock, send.cursize, send.data, chan->remote_address);
 
 	if (showpackets->value)
 	{
@@ -288,6 +336,8 @@ qboolean Netchan_Process (netchan_t *chan, sizebuf_t *msg)
 	unsigned	sequence, sequence_ack;
 	unsigned	reliable_ack, reliable_message;
 	int			qport;
+	qboolean	fragment;
+	int			offset, more, length;
 
 	// get sequence numbers
 	MSG_BeginReading (msg);
@@ -298,10 +348,20 @@ qboolean Netchan_Process (netchan_t *chan, sizebuf_t *msg)
 	if (chan->sock == NS_SERVER)
 		qport = MSG_ReadShort (msg);
 
+	fragment = chan->fragments && (sequence & FRAGMENT_BIT);
+	offset = more = 0;
+
+	if (fragment)
+	{
+		offset = MSG_ReadShort (msg) & 0xffff;
+		more = offset & FRAGMENT_MORE;
+		offset &= ~FRAGMENT_MORE;
+	}
+
 	reliable_message = sequence >> 31;
 	reliable_ack = sequence_ack >> 31;
 
-	sequence &= ~ (1 << 31);
+	sequence &= ~ (3 << 30);
 	sequence_ack &= ~ (1 << 31);
 
 	if (showpackets->value)
@@ -339,6 +399,53 @@ qboolean Netchan_Process (netchan_t *chan, sizebuf_t *msg)
 		return false;
 	}
 
+	// gather fragments until the message is complete
+	if (fragment)
+	{
+		if (sequence != chan->fragment_sequence)
+		{
+			chan->fragment_sequence = sequence;
+			chan->fragment_length = 0;
+		}
+
+		length = msg->cursize - msg->readcount;
+
+		// an earlier fragment was lost, so is the message
+		if (offset != chan->fragment_length || offset + length > sizeof (chan->fragment_buf))
+		{
+			if (showdrop->value)
+			{
+				Com_Printf ("%s:Dropped fragment of %i at offset %i\n",
+					NET_AdrToString (chan->remote_address),
+					sequence,
+					offset);
+			}
+
+			return false;
+		}
+
+		memcpy (chan->fragment_buf + offset, msg->data + msg->readcount, length);
+		chan->fragment_length += length;
+
+		if (more)
+			return false;
+
+		// the message replaces the last fragment right behind the
+		// header, where demo recording expects the payload to start
+		msg->readcount -= 2;
+
+		if (msg->readcount + chan->fragment_length > msg->maxsize)
+		{
+			Com_Printf ("%s:Oversize message %i\n", NET_AdrToString (chan->remote_address), sequence);
+			chan->fragment_length = 0;
+			return false;
+		}
+
+		memcpy (msg->data + msg->readcount, chan->fragment_buf, chan->fragment_length);
+		msg->cursize = msg->readcount + chan->fragment_length;
+		chan->fragment_length = 0;
+	}
+
 	// dropped packets don't keep the message from being used
 	chan->dropped = sequence - (chan->incoming_sequence + 1);
 
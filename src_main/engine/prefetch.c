@@ -0,0 +1,490 @@
+/*
+Copyright (C) 1997-2001 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+*/
+// prefetch.c -- level load read ahead
+
+/*
+While the client is connecting the server sends every model, sound and
+image it will need as configstrings, long before CL_PrepRefresh gets to
+register them one at a time. Prefetch_Add queues each name with a load
+function that the worker threads run in order, reading the file and
+doing whatever decoding doesn't need the main thread.
+
+Registration then asks for each name with Prefetch_Take. A finished
+entry is handed over, one still loading is waited for, and one no worker
+has started yet is cancelled so the main thread loads it itself rather
+than sit idle. Prefetch_Flush throws away whatever was never asked for,
+it runs at the end of every level load and before the search path
+changes.
+
+The queue is reset by every flush, so an entry is loaded at most once
+per level load and entries are never reused while a worker holds one.
+*/
+
+#include "qcommon.h"
+#include <SDL_thread.h>
+#include <SDL_mutex.h>
+
+#define	PREFETCH_MAX		2048
+#define	PREFETCH_HASH		512			// must be a power of two
+#define	PREFETCH_THREADS	8
+
+typedef enum
+{
+	PF_QUEUED,
+	PF_LOADING,
+	PF_DONE,
+	PF_TAKEN			// handed to the main thread, or cancelled
+} pfstate_t;
+
+typedef struct prefetch_s
+{
+	char			name[MAX_QPATH];
+	prefetchload_t	load;
+	prefetchfree_t	release;
+	pfstate_t		state;
+	void			*data;
+	struct prefetch_s *hashNext;
+} prefetch_t;
+
+typedef struct
+{
+	int				len;
+	void			*buffer;
+} prefetchfile_t;
+
+cvar_t				*fs_prefetch;
+
+static prefetch_t	pf_entries[PREFETCH_MAX];
+static prefetch_t	*pf_hash[PREFETCH_HASH];
+static int			pf_numEntries;
+static int			pf_nextEntry;		// first entry no worker has picked up
+static int			pf_numTaken;
+static qboolean		pf_flushing;
+
+static SDL_mutex	*pf_lock;
+static SDL_cond		*pf_work;			// entries queued, or shutting down
+static SDL_cond		*pf_done;			// an entry finished loading
+static SDL_Thread	*pf_threads[PREFETCH_THREADS];
+static SDL_threadID	pf_threadIDs[PREFETCH_THREADS];
+static int			pf_numThreads;
+static qboolean		pf_quit;
+static SDL_threadID	pf_mainThread;
+
+
+/*
+================
+Prefetch_HashName
+================
+*/
+static unsigned Prefetch_HashName (char *name)
+{
+	unsigned	hash;
+
+	for (hash = 2166136261u; *name; name++)
+		hash = (hash ^ (byte) *name) * 16777619u;
+
+	return hash & (PREFETCH_HASH - 1);
+}
+
+/*
+================
+Prefetch_Find
+
+Called with pf_lock held
+================
+*/
+static prefetch_t *Prefetch_Find (char *name, prefetchload_t load)
+{
+	prefetch_t	*pf;
+
+	for (pf = pf_hash[Prefetch_HashName (name)]; pf; pf = pf->hashNext)
+	{
+		if (pf->load == load && !strcmp (pf->name, name))
+			return pf;
+	}
+
+	return NULL;
+}
+
+/*
+================
+Prefetch_Thread
+================
+*/
+static int Prefetch_Thread (void *unused)
+{
+	prefetch_t	*pf;
+	void		*data;
+
+	SDL_LockMutex (pf_lock);
+
+	while (!pf_quit)
+	{
+		if (pf_nextEntry == pf_numEntries)
+		{
+			SDL_CondWait (pf_work, pf_lock);
+			continue;
+		}
+
+		pf = &pf_entries[pf_nextEntry++];
+
+		if (pf->state != PF_QUEUED)
+			continue;		// the main thread got to it first
+
+		pf->state = PF_LOADING;
+		SDL_UnlockMutex (pf_lock);
+
+		data = pf->load (pf->name);
+
+		SDL_LockMutex (pf_lock);
+		pf->data = data;
+		pf->state = PF_DONE;
+		SDL_CondBroadcast (pf_done);
+	}
+
+	SDL_UnlockMutex (pf_lock);
+
+	return 0;
+}
+
+/*
+================
+Prefetch_Worker
+
+True when called from one of the prefetch threads
+================
+*/
+qboolean Prefetch_Worker (void)
+{
+	SDL_threadID	id;
+	int				i;
+
+	if (!pf_numThreads)
+		return false;
+
+	id = SDL_ThreadID ();
+
+	for (i = 0; i < pf_numThreads; i++)
+	{
+		if (pf_threadIDs[i] == id)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+================
+Prefetch_Add
+
+Queues name to be loaded by a worker, threads are started as they are
+first needed
+================
+*/
+void Prefetch_Add (char *name, prefetchload_t load, prefetchfree_t release)
+{
+	prefetch_t	*pf;
+	unsigned	hash;
+	int			threads;
+
+	if (!pf_lock || fs_prefetch->integer <= 0)
+		return;
+
+	if (!name[0] || strlen (name) >= MAX_QPATH)
+		return;
+
+	SDL_LockMutex (pf_lock);
+
+	if (pf_flushing || pf_numEntries == PREFETCH_MAX || Prefetch_Find (name, load))
+	{
+		SDL_UnlockMutex (pf_lock);
+		return;
+	}
+
+	threads = fs_prefetch->integer;
+
+	if (threads > PREFETCH_THREADS)
+		threads = PREFETCH_THREADS;
+
+	while (pf_numThreads < threads)
+	{
+		pf_threads[pf_numThreads] = SDL_CreateThread (Prefetch_Thread, "prefetch", NULL);
+
+		if (!pf_threads[pf_numThreads])
+			break;
+
+		pf_threadIDs[pf_numThreads] = SDL_GetThreadID (pf_threads[pf_numThreads]);
+		pf_numThreads++;
+	}
+
+	if (!pf_numThreads)
+	{
+		SDL_UnlockMutex (pf_lock);
+		return;
+	}
+
+	pf = &pf_entries[pf_numEntries++];
+	Q_strlcpy (pf->name, name, sizeof (pf->name));
+	pf->load = load;
+	pf->release = release;
+	pf->state = PF_QUEUED;
+	pf->data = NULL;
+
+	hash = Prefetch_HashName (name);
+	pf->hashNext = pf_hash[hash];
+	pf_hash[hash] = pf;
+
+	SDL_CondSignal (pf_work);
+	SDL_UnlockMutex (pf_lock);
+}
+
+/*
+================
+Prefetch_Take
+================
+*/
+void *Prefetch_Take (char *name, prefetchload_t load)
+{
+	prefetch_t	*pf;
+	void		*data;
+
+	// the workers load through the same functions that take, and must
+	// never wait on their own entry
+	if (!pf_lock || SDL_ThreadID () != pf_mainThread)
+		return NULL;
+
+	SDL_LockMutex (pf_lock);
+
+	pf = pf_numEntries ? Prefetch_Find (name, load) : NULL;
+
+	if (!pf || pf->state == PF_TAKEN)
+	{
+		SDL_UnlockMutex (pf_lock);
+		return NULL;
+	}
+
+	if (pf->state == PF_QUEUED)
+	{
+		// nobody has started on it, loading it here beats waiting
+		pf->state = PF_TAKEN;
+		SDL_UnlockMutex (pf_lock);
+		return NULL;
+	}
+
+	while (pf->state == PF_LOADING)
+		SDL_CondWait (pf_done, pf_lock);
+
+	data = pf->data;
+	pf->data = NULL;
+	pf->state = PF_TAKEN;
+	pf_numTaken++;
+
+	SDL_UnlockMutex (pf_lock);
+
+	return data;
+}
+
+/*
+================
+Prefetch_Flush
+================
+*/
+void Prefetch_Flush (void)
+{
+	prefetch_t	*pf;
+	int			i, loading;
+
+	if (!pf_lock)
+		return;
+
+	SDL_LockMutex (pf_lock);
+
+	if (!pf_numEntries)
+	{
+		SDL_UnlockMutex (pf_lock);
+		return;
+	}
+
+	pf_flushing = true;
+
+	// cancel what hasn't started and wait out the rest
+	for ( ; ; )
+	{
+		loading = 0;
+
+		for (i = 0, pf = pf_entries; i < pf_numEntries; i++, pf++)
+		{
+			if (pf->state == PF_QUEUED)
+				pf->state = PF_TAKEN;
+			else if (pf->state == PF_LOADING)
+				loading++;
+		}
+
+		if (!loading)
+			break;
+
+		SDL_CondWait (pf_done, pf_lock);
+	}
+
+	for (i = 0, pf = pf_entries; i < pf_numEntries; i++, pf++)
+	{
+		if (pf->state == PF_DONE && pf->data)
+			pf->release (pf->data);
+	}
+
+	Com_DPrintf ("prefetch: %i of %i used\n", pf_numTaken, pf_numEntries);
+
+	memset (pf_hash, 0, sizeof (pf_hash));
+	pf_numEntries = 0;
+	pf_nextEntry = 0;
+	pf_numTaken = 0;
+	pf_flushing = false;
+
+	SDL_UnlockMutex (pf_lock);
+}
+
+
+/*
+==============================================================================
+
+RAW FILES
+
+==============================================================================
+*/
+
+/*
+================
+Prefetch_LoadFile
+
+FS_LoadFile fails quietly on a worker, the main thread then loads the
+file itself and reports whatever went wrong
+================
+*/
+static void *Prefetch_LoadFile (char *name)
+{
+	prefetchfile_t	*file;
+	void			*buffer;
+	int				len;
+
+	len = FS_LoadFile (name, &buffer);
+
+	if (!buffer)
+		return NULL;
+
+	file = malloc (sizeof (*file));
+	file->len = len;
+	file->buffer = buffer;
+
+	return file;
+}
+
+/*
+================
+Prefetch_FreeFile
+================
+*/
+static void Prefetch_FreeFile (void *data)
+{
+	prefetchfile_t	*file = data;
+
+	FS_FreeFile (file->buffer);
+	free (file);
+}
+
+/*
+================
+Prefetch_File
+================
+*/
+void Prefetch_File (char *name)
+{
+	Prefetch_Add (name, Prefetch_LoadFile, Prefetch_FreeFile);
+}
+
+/*
+================
+Prefetch_TakeFile
+
+Returns the length like FS_LoadFile, or -1 if name wasn't read ahead
+================
+*/
+int Prefetch_TakeFile (char *name, void **buffer)
+{
+	prefetchfile_t	*file;
+	int				len;
+
+	file = Prefetch_Take (name, Prefetch_LoadFile);
+
+	if (!file)
+		return -1;
+
+	*buffer = file->buffer;
+	len = file->len;
+	free (file);
+
+	return len;
+}
+
+
+/*
+================
+Prefetch_Init
+================
+*/
+void Prefetch_Init (void)
+{
+	fs_prefetch = Cvar_Get ("fs_prefetch", "2", CVAR_ARCHIVE);
+
+	pf_lock = SDL_CreateMutex ();
+	pf_work = SDL_CreateCond ();
+	pf_done = SDL_CreateCond ();
+	pf_mainThread = SDL_ThreadID ();
+}
+
+/*
+================
+Prefetch_Shutdown
+================
+*/
+void Prefetch_Shutdown (void)
+{
+	int		i;
+
+	if (!pf_lock)
+		return;
+
+	Prefetch_Flush ();
+
+	SDL_LockMutex (pf_lock);
+	pf_quit = true;
+	SDL_CondBroadcast (pf_work);
+	SDL_UnlockMutex (pf_lock);
+
+	for (i = 0; i < pf_numThreads; i++)
+		SDL_WaitThread (pf_threads[i], NULL);
+
+	pf_numThreads = 0;
+	pf_quit = false;
+
+	SDL_DestroyCond (pf_done);
+	SDL_DestroyCond (pf_work);
+	SDL_DestroyMutex (pf_lock);
+	pf_lock = NULL;
+}
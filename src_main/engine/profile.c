@@ -0,0 +1,218 @@
+/*
+Copyright (C) 1997-2001 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+*/
+// profile.c -- server frame profiler
+
+/*
+Zones are timed with Prof_Begin / Prof_End pairs around the interesting
+parts of a server frame and appended to a ring of events that any thread
+can write to. Prof_Frame marks the start of each server frame so the
+last PROF_FRAMES frames can be written out with prof_dump as Chrome
+trace event JSON, which chrome://tracing and Perfetto load directly.
+
+Zone names are copied into the event, the game's literals go away when
+its DLL is unloaded on a map change.
+*/
+
+#include "qcommon.h"
+#include <SDL_atomic.h>
+#include <SDL_thread.h>
+
+#define	PROF_EVENTS		(1 << 17)		// must be a power of two
+#define	PROF_FRAMES		100				// ten seconds of server frames
+
+#define	PROF_NAMELEN	32
+
+typedef struct
+{
+	char			name[PROF_NAMELEN];
+	unsigned		start;				// Sys_Microseconds
+	unsigned		usec;
+	SDL_threadID	thread;
+} profevent_t;
+
+cvar_t			*host_profile;
+
+static qboolean		prof_active;
+static profevent_t	*prof_events;
+static SDL_atomic_t	prof_next;				// total events ever written
+
+static int			prof_frames[PROF_FRAMES];	// first event of each frame
+static int			prof_framecount;
+static SDL_threadID	prof_mainthread;
+
+
+/*
+================
+Prof_Begin
+
+Returns 0 when not profiling so Prof_End can skip the zone
+================
+*/
+unsigned Prof_Begin (void)
+{
+	unsigned	start;
+
+	if (!prof_active)
+		return 0;
+
+	start = Sys_Microseconds ();
+
+	return start ? start : 1;
+}
+
+/*
+================
+Prof_End
+================
+*/
+void Prof_End (const char *name, unsigned start)
+{
+	profevent_t	*ev;
+	unsigned	now;
+
+	if (!start || !prof_active)
+		return;
+
+	now = Sys_Microseconds ();
+
+	ev = &prof_events[SDL_AtomicAdd (&prof_next, 1) & (PROF_EVENTS - 1)];
+	Q_strlcpy (ev->name, name, sizeof (ev->name));
+	ev->start = start;
+	ev->usec = now - start;
+	ev->thread = SDL_ThreadID ();
+}
+
+/*
+================
+Prof_Frame
+
+Called from the main thread at the start of every server frame, while
+no other thread is inside a zone
+================
+*/
+void Prof_Frame (void)
+{
+	if (!host_profile->integer)
+	{
+		prof_active = false;
+		return;
+	}
+
+	if (!prof_events)
+	{
+		prof_events = Z_Malloc (sizeof (profevent_t) * PROF_EVENTS);
+		prof_mainthread = SDL_ThreadID ();
+	}
+
+	prof_frames[prof_framecount % PROF_FRAMES] = SDL_AtomicGet (&prof_next);
+	prof_framecount++;
+	prof_active = true;
+}
+
+/*
+================
+Prof_Dump_f
+
+prof_dump [filename]
+================
+*/
+static void Prof_Dump_f (void)
+{
+	char		name[MAX_OSPATH];
+	FILE		*f;
+	int			i, first, last, frames;
+	unsigned	worst;
+	char		worstname[PROF_NAMELEN];
+	profevent_t	*ev;
+
+	if (!prof_events || !prof_framecount)
+	{
+		Com_Printf ("Nothing recorded, set host_profile 1 while a server is running.\n");
+		return;
+	}
+
+	Com_sprintf (name, sizeof (name), "%s/%s.json", FS_Gamedir (), (Cmd_Argc () > 1) ? Cmd_Argv (1) : "profile");
+
+	FS_CreatePath (name);
+	f = fopen (name, "w");
+
+	if (!f)
+	{
+		Com_Printf (S_COLOR_RED "ERROR: couldn't open %s.\n", name);
+		return;
+	}
+
+	// start at the oldest frame whose events haven't been overwritten,
+	// if a single frame overflowed the ring keep what is left of it
+	last = SDL_AtomicGet (&prof_next);
+	first = last - PROF_EVENTS;
+	frames = prof_framecount < PROF_FRAMES ? prof_framecount : PROF_FRAMES;
+
+	for (i = frames; i > 0; i--)
+	{
+		if (last - prof_frames[(prof_framecount - i) % PROF_FRAMES] <= PROF_EVENTS)
+		{
+			first = prof_frames[(prof_framecount - i) % PROF_FRAMES];
+			break;
+		}
+	}
+
+	frames = i ? i : 1;
+
+	fprintf (f, "{\"traceEvents\":[\n");
+	fprintf (f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%lu,\"args\":{\"name\":\"main\"}}", (unsigned long) prof_mainthread);
+
+	worst = 0;
+	worstname[0] = 0;
+
+	for (i = first; i != last; i++)
+	{
+		ev = &prof_events[i & (PROF_EVENTS - 1)];
+
+		fprintf (f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%lu,\"ts\":%u,\"dur\":%u}",
+			ev->name, (unsigned long) ev->thread, ev->start, ev->usec);
+
+		if (ev->thread == prof_mainthread && ev->usec > worst)
+		{
+			worst = ev->usec;
+			Q_strlcpy (worstname, ev->name, sizeof (worstname));
+		}
+	}
+
+	fprintf (f, "\n]}\n");
+	fclose (f);
+
+	Com_Printf ("Wrote %i events from %i frames to %s\n", last - first, frames, name);
+
+	if (worstname[0])
+		Com_Printf ("longest main thread zone: %s, %u usec\n", worstname, worst);
+}
+
+/*
+================
+Prof_Init
+================
+*/
+void Prof_Init (void)
+{
+	host_profile = Cvar_Get ("host_profile", "0", 0);
+
+	Cmd_AddCommand ("prof_dump", Prof_Dump_f);
+}
@@ -49,6 +49,8 @@ void SZ_Print (sizebuf_t *buf, char *data);	// strcats onto the sizebuf
 struct usercmd_s;
 struct entity_state_s;
 
+#define	MAX_DELTA_ENTITY	48		// MSG_WriteDeltaEntity writes at most 43 bytes
+
 void MSG_WriteChar (sizebuf_t *sb, int c);
 void MSG_WriteByte (sizebuf_t *sb, int c);
 void MSG_WriteShort (sizebuf_t *sb, int c);
@@ -79,6 +81,8 @@ void	MSG_ReadPos (sizebuf_t *sb, vec3_t pos);
 float	MSG_ReadAngle (sizebuf_t *sb);
 float	MSG_ReadAngle16 (sizebuf_t *sb);
 void	MSG_ReadDeltaUsercmd (sizebuf_t *sb, struct usercmd_s *from, struct usercmd_s *cmd);
+int		MSG_ReadEntityBits (sizebuf_t *sb, unsigned *bits);
+void	MSG_ReadDeltaEntity (sizebuf_t *sb, struct entity_state_s *from, struct entity_state_s *to, int number, int bits);
 
 void	MSG_ReadDir (sizebuf_t *sb, vec3_t vector);
 
@@ -135,6 +139,11 @@ PROTOCOL
 // must be power of two
 #define	UPDATE_MASK		(UPDATE_BACKUP-1)
 
+// clients that ask for it at connect get a longer history to delta from,
+// vanilla clients always get UPDATE_BACKUP
+#define	MAX_UPDATE_BACKUP	64	// must be power of two
+#define	MAX_UPDATE_MASK		(MAX_UPDATE_BACKUP-1)
+
 //==================
 // the svc_strings[] array in cl_parse.c should mirror this
 //==================
@@ -418,6 +427,11 @@ void	Cvar_SetValue (char *var_name, float value);
 float	Cvar_VariableValue (char *var_name);
 // returns 0 if not defined or non numeric
 
+cvar_t	*Cvar_Cached (cvar_t **handle, char *var_name);
+float	Cvar_CachedValue (cvar_t **handle, char *var_name);
+// for hot code reading a cvar registered elsewhere, *handle must start
+// as NULL and is filled in the first time the cvar is found
+
 int		Cvar_VariableInteger(char *var_name);
 // returns 0 if not defined or non numeric
 
@@ -467,9 +481,15 @@ NET
 
 #define	PORT_ANY	-1
 
-#define	MAX_MSGLEN		1400		// max length of a message
+#define	MAX_PACKETLEN	1400		// max length of a single packet
+#define	MAX_MSGLEN		0x4000		// max length of a message, bigger than
+									// MAX_PACKETLEN only on fragmenting channels
 #define	PACKET_HEADER	10			// two ints and a short
 
+#define	FRAGMENT_BIT	(1 << 30)	// in the sequence, the message is split
+#define	FRAGMENT_MORE	0x8000		// in the fragment offset, more follow
+#define	FRAGMENT_SIZE	(MAX_PACKETLEN - PACKET_HEADER - 2)
+
 typedef enum {NA_LOOPBACK, NA_BROADCAST, NA_IP} netadrtype_t;
 
 typedef enum {NS_CLIENT, NS_SERVER} netsrc_t;
@@ -490,6 +510,10 @@ void		NET_Config (qboolean multiplayer);
 
 qboolean	NET_GetPacket (netsrc_t sock, netadr_t *net_from, sizebuf_t *net_message);
 void		NET_SendPacket (netsrc_t sock, int length, void *data, netadr_t to);
+void		NET_BeginPacketBatch (netsrc_t sock);	// queue sends on sock until NET_FlushPackets
+void		NET_FlushPackets (netsrc_t sock);
+void		NET_SetConnectionlessHandler (qboolean (*handler) (netadr_t *from, sizebuf_t *msg));
+qboolean	NET_ThreadActive (void);	// a dedicated server network thread owns NS_SERVER
 
 qboolean	NET_CompareAdr (netadr_t a, netadr_t b);
 qboolean	NET_CompareBaseAdr (netadr_t a, netadr_t b);
@@ -532,11 +556,17 @@ typedef struct
 
 	// reliable staging and holding areas
 	sizebuf_t	message;		// writing buffer to send to server
-	byte		message_buf[MAX_MSGLEN-16];		// leave space for header
+	byte		message_buf[MAX_PACKETLEN-16];		// leave space for header
 
 	// message is copied to this buffer when it is first transfered
 	int			reliable_length;
-	byte		reliable_buf[MAX_MSGLEN-16];	// unacked reliable message
+	byte		reliable_buf[MAX_PACKETLEN-16];	// unacked reliable message
+
+	// both sides agreed at connect to split messages bigger than a packet
+	qboolean	fragments;
+	int			fragment_sequence;			// message being reassembled
+	int			fragment_length;
+	byte		fragment_buf[MAX_MSGLEN];
 } netchan_t;
 
 extern	netadr_t	net_from;
@@ -581,6 +611,21 @@ int			CM_TransformedPointContents (vec3_t p, int headnode, vec3_t origin, vec3_t
 trace_t		CM_BoxTrace (vec3_t start, vec3_t end,
 						 vec3_t mins, vec3_t maxs,
 						 int headnode, int brushmask);
+// independent traces, results are returned in query order
+typedef struct
+{
+	vec3_t		start, end;
+	vec3_t		mins, maxs;
+	int			headnode;
+	int			brushmask;
+} tracequery_t;
+
+void		CM_BoxTraceBatch (tracequery_t *queries, trace_t *results, int count);
+void		CM_ClearTraceCache (void);
+void		CM_TraceRecord_f (void);
+void		CM_TraceReplay_f (void);
+void		CM_TraceBench_f (void);
+
 trace_t		CM_TransformedBoxTrace (vec3_t start, vec3_t end,
 									vec3_t mins, vec3_t maxs,
 									int headnode, int brushmask,
@@ -589,6 +634,16 @@ trace_t		CM_TransformedBoxTrace (vec3_t start, vec3_t end,
 byte		*CM_ClusterPVS (int cluster);
 byte		*CM_ClusterPHS (int cluster);
 
+// thread safe versions, buffer must hold MAX_MAP_LEAFS/8 bytes but
+// may be left untouched, so only ever read the returned row
+byte		*CM_CopyClusterPVS (int cluster, byte *buffer);
+byte		*CM_CopyClusterPHS (int cluster, byte *buffer);
+
+// rows are zero padded to a multiple of 32 bytes
+int			CM_VisRowBytes (void);
+void		CM_MergeVis (byte *out, const byte *in);
+void		CM_VisBench_f (void);
+
 int			CM_PointLeafnum (vec3_t p);
 
 // call with topnode set to the headnode, returns with topnode
@@ -685,10 +740,48 @@ int			FS_LoadFile (char *path, void **buffer);
 // properly handles partial reads
 
 void		FS_FreeFile(void *buffer);
+// buffers may point straight into a mapped pak, they must not be freed
+// any other way
+
+void		FS_ResetLoadLog(void);
+void		FS_Bench_f(void);
+// fs_bench replays the files opened since the last FS_ResetLoadLog
 
 void		FS_CreatePath(char *path);
 
 
+/*
+==============================================================
+
+PREFETCH
+
+Files named in the configstrings are read and decoded by worker
+threads while the client is still connecting, the main thread then
+takes the results instead of loading them itself.
+==============================================================
+*/
+
+typedef void	*(*prefetchload_t) (char *name);
+typedef void	(*prefetchfree_t) (void *data);
+// load functions run on a worker thread, they may use the filesystem,
+// malloc and Prefetch_Add but nothing else that isn't thread safe.
+// returning NULL makes the main thread load the file the normal way
+
+void		Prefetch_Init (void);
+void		Prefetch_Shutdown (void);
+void		Prefetch_Add (char *name, prefetchload_t load, prefetchfree_t release);
+void		*Prefetch_Take (char *name, prefetchload_t load);
+// NULL if name wasn't prefetched with load, otherwise the caller owns
+// the data. waits if a worker is still loading it
+void		Prefetch_Flush (void);
+// waits for the workers and releases everything nobody took
+qboolean	Prefetch_Worker (void);
+
+void		Prefetch_File (char *name);
+int			Prefetch_TakeFile (char *name, void **buffer);
+// FS_LoadFile checks for files read ahead with Prefetch_File
+
+
 /*
 ==============================================================
 
@@ -740,6 +833,7 @@ int			Com_ServerState (void);		// this should have just been a cvar...
 void		Com_SetServerState (int state);
 
 unsigned	Com_BlockChecksum (void *buffer, int length);
+unsigned	Com_HashName (const char *name);
 byte		COM_BlockSequenceCRCByte (byte *base, int length, int sequence);
 
 // real time
@@ -769,6 +863,23 @@ extern	cvar_t	*log_stats;
 
 extern	FILE *log_stats_file;
 
+// vectorized code paths, capped by the com_simd cvar
+#define	SIMD_NONE	0
+#define	SIMD_SSE2	1
+#define	SIMD_AVX2	2
+
+int			Com_SIMDLevel (void);
+const char	*Com_SIMDName (int level);
+
+// frame profiler zones, name must be a string literal
+//	unsigned prof = Prof_Begin ();
+//	...
+//	Prof_End ("SV_ReadPackets", prof);
+void		Prof_Init (void);
+void		Prof_Frame (void);
+unsigned	Prof_Begin (void);
+void		Prof_End (const char *name, unsigned start);
+
 // host_speeds times
 extern	int		time_before_game;
 extern	int		time_after_game;
@@ -834,6 +945,11 @@ void	Sys_Print (char *string);
 char	*Sys_GetHomeDir (void);
 char	*Sys_GetBinaryDir (void);
 
+void	*Sys_MapFile (FILE *f, int *length);
+void	Sys_UnmapFile (void *base, int length);
+// maps a whole file copy on write, so the memory can be written
+// without touching the file. returns NULL if it can't be mapped
+
 void	Sys_Error (char *error, ...);
 
 void	Sys_SigHandler (int signal);
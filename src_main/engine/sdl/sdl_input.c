@@ -870,7 +870,7 @@ void IN_ControllerInit(void)
 					Com_DPrintf(S_COLOR_GREEN "...loaded %d additional mappings\n", results);
 				else
 					Com_DPrintf(S_COLOR_RED "...error: %s\n", SDL_GetError());
-				free(buffer);
+				FS_FreeFile(buffer);
 			}
 		}
 
@@ -47,6 +47,7 @@ extern _declspec(dllexport) int AmdPowerXpressRequestHighPerformance = 1;
 #define _GNU_SOURCE // for mremap() - must be before sys/mman.h include!
 #endif
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <dirent.h>
 #include <unistd.h>
@@ -301,6 +302,64 @@ void Sys_Mkdir (char *path)
 
 //===============================================================================
 
+/*
+================
+Sys_MapFile
+================
+*/
+void *Sys_MapFile (FILE *f, int *length)
+{
+#ifdef _WIN32
+	HANDLE	mapping;
+	void	*base;
+
+	*length = _filelength (_fileno (f));
+
+	if (*length <= 0)
+		return NULL;
+
+	mapping = CreateFileMapping ((HANDLE) _get_osfhandle (_fileno (f)), NULL, PAGE_WRITECOPY, 0, 0, NULL);
+
+	if (!mapping)
+		return NULL;
+
+	base = MapViewOfFile (mapping, FILE_MAP_COPY, 0, 0, 0);
+	CloseHandle (mapping);
+
+	return base;
+#else
+	struct stat	st;
+	void		*base;
+
+	if (fstat (fileno (f), &st) || st.st_size <= 0 || st.st_size > 0x7fffffff)
+		return NULL;
+
+	*length = st.st_size;
+	base = mmap (NULL, *length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno (f), 0);
+
+	if (base == MAP_FAILED)
+		return NULL;
+
+	return base;
+#endif
+}
+
+/*
+================
+Sys_UnmapFile
+================
+*/
+void Sys_UnmapFile (void *base, int length)
+{
+#ifdef _WIN32
+	UnmapViewOfFile (base);
+#else
+	munmap (base, length);
+#endif
+}
+
+//===============================================================================
+
 char	findbase[MAX_OSPATH];
 char	findpath[MAX_OSPATH];
 int		findhandle;
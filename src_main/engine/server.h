@@ -56,6 +56,7 @@ typedef struct
 
 	char		configstrings[MAX_CONFIGSTRINGS][MAX_QPATH];
 	entity_state_t	baselines[MAX_EDICTS];
+	unsigned	baselinetag;		// delta cache tag of the baselines
 
 	// the multicast buffer is used to send a message to a set of clients
 	// it is only used to marshall data until SV_Multicast is called
@@ -86,13 +87,19 @@ typedef struct
 	byte				areabits[MAX_MAP_AREAS/8];		// portalarea visibility bits
 	player_state_t		ps;
 	int					num_entities;
-	int					first_entity;		// into the circular sv_packet_entities[]
+	int					first_entity;		// into the client's circular entity history
 	int					senttime;			// for ping calculations
 } client_frame_t;
 
 #define	LATENCY_COUNTS	16
 #define	RATE_MESSAGES	10
 
+// each client owns a slice of svs.client_entities, so frames can be
+// built for several clients at once. the slice holds sv_updatebackup
+// frames, a client only deltas from as many as its own ring holds
+#define	MAX_PACKET_ENTITIES	64
+#define	CLIENT_ENTITIES		(svs.updatebackup*MAX_PACKET_ENTITIES)
+
 typedef struct client_s
 {
 	client_state_t	state;
@@ -121,7 +128,16 @@ typedef struct client_s
 	sizebuf_t		datagram;
 	byte			datagram_buf[MAX_MSGLEN];
 
-	client_frame_t	frames[UPDATE_BACKUP];	// updates can be delta'd from here
+	client_frame_t	*frames;			// [svs.updatebackup] updates can be delta'd from here
+	int				updatebackup;		// frames the client keeps, power of two
+	int				next_client_entities;	// next entity_state_t in this client's slice
+
+	// the frame message is built by SV_BuildClientDatagram, possibly
+	// on a worker thread, then sent from the main thread
+	qboolean		snapshot_pending;
+	int				snapshot_flags;			// SNAP_* warnings to print when sending
+	int				snapshot_size;
+	byte			snapshot_buf[MAX_MSGLEN];
 
 	byte			*download;			// file being downloaded
 	int				downloadsize;		// total bytes (can't use EOF because of paks)
@@ -133,6 +149,13 @@ typedef struct client_s
 	int				challenge;			// challenge of this user, randomly generated
 
 	netchan_t		netchan;
+	struct client_s	*hashnext;			// next client in the same svs.client_hash chain
+
+	// where the client's origin was last found by SV_Multicast
+	vec3_t			leaforigin;
+	int				leafframe;			// svs.multicastframe, 0 = not looked up
+	int				leafcluster;
+	int				leafarea;
 } client_t;
 
 // a client can leave the server in one of four ways:
@@ -141,6 +164,83 @@ typedef struct client_s
 // getting kicked off by the server operator
 // a program error, like an overflowed reliable buffer
 
+// clients are found by base address and qport, the port isn't
+// hashed because translating routers can change it
+#define	CLIENT_HASH_SIZE	512
+
+#define	CLIENT_FRAME(cl,n) (&(cl)->frames[(n) & ((cl)->updatebackup - 1)])
+
+#define	CLIENT_ENTITY_NUM(cl,n) (&svs.client_entities[((cl) - svs.clients) * CLIENT_ENTITIES + ((n) & (CLIENT_ENTITIES - 1))])
+#define	CLIENT_ENTITY_TAG(cl,n) (&svs.client_entity_tags[((cl) - svs.clients) * CLIENT_ENTITIES + ((n) & (CLIENT_ENTITIES - 1))])
+
+#define	SNAP_DATAGRAM_OVERFLOW	1	// reliable datagram was dropped
+#define	SNAP_MSG_OVERFLOW		2	// even the clientonly frame didn't fit
+
+// frames are clipped to a single packet unless the client reassembles
+// fragments, then room is left for the header and a full reliable message
+#define	CLIENT_MSGLEN(cl)	((cl)->netchan.fragments ? MAX_MSGLEN - MAX_PACKETLEN : MAX_PACKETLEN)
+
+// an unclipped frame message is written here first and only copied
+// to the client if it fits in CLIENT_MSGLEN, so overflows never need
+// to print from inside a worker
+#define	MAX_SNAPSHOT_MSGLEN	0x10000
+
+// clients standing in the same clusters share a fat PVS, the last few
+// merged leaf sets are kept per worker so no locking is needed
+#define	FATPVS_MEMO				8
+#define	FATPVS_MEMO_CLUSTERS	8		// bigger sets are merged every time
+
+typedef struct
+{
+	int			spawncount;
+	int			numclusters;			// 0 = free
+	int			clusters[FATPVS_MEMO_CLUSTERS];		// sorted
+	unsigned	lastused;
+	byte		pvs[MAX_MAP_LEAFS/8];
+} fatpvs_memo_t;
+
+// clients that see the same change to an entity get the same bytes,
+// so each worker keeps the last few deltas it encoded for every entity
+// and copies them into the next message that needs one.
+//
+// comparing the states costs about as much as encoding them, so they
+// are matched by where they came from instead. every state copied into
+// a client's ring is tagged with the svs.snapshotgen it was built in,
+// all clients copy the same ent->s in one generation, and the low bit
+// marks the one client that owns the entity and sees it as not solid
+#define	DELTA_WAYS			2			// different deltas kept per entity
+
+#define	DELTA_FORCE			1
+#define	DELTA_NEWENTITY		2
+
+typedef struct
+{
+	unsigned		fromtag;			// 0 = empty
+	unsigned		totag;
+	int				flags;				// DELTA_*
+	int				len;
+	unsigned		lastused;			// delta_lookups when last hit
+	byte			data[MAX_DELTA_ENTITY];
+} deltacache_t;
+
+// per thread scratch space for building client frames
+typedef struct
+{
+	byte		fatpvs[65536/8];		// 32767 is MAX_MAP_LEAFS
+	fatpvs_memo_t	fatpvs_memo[FATPVS_MEMO];
+	unsigned	fatpvs_lookups;
+	unsigned	fatpvs_hits;
+	byte		pvsrow[MAX_MAP_LEAFS/8];
+	byte		phsrow[MAX_MAP_LEAFS/8];
+	byte		entbits[MAX_EDICTS/8];		// entities in the visible clusters
+	byte		msg_buf[MAX_SNAPSHOT_MSGLEN];
+	deltacache_t	deltacache[MAX_EDICTS][DELTA_WAYS];
+	unsigned	delta_lookups;
+	unsigned	delta_hits;
+	unsigned	encode_usec;			// in SV_WriteFrameToClient
+	unsigned	encode_frames;
+} snapshot_worker_t;
+
 //=============================================================================
 
 // MAX_CHALLENGES is made large to prevent a denial
@@ -167,14 +267,29 @@ typedef struct
 	// used to check late spawns
 
 	client_t	*clients;					// [maxclients->value];
-	int			num_client_entities;		// maxclients->value*UPDATE_BACKUP*MAX_PACKET_ENTITIES
-	int			next_client_entities;		// next client_entity to use
+	int			updatebackup;				// sv_updatebackup when the game started
+	client_frame_t	*client_frames;			// [maxclients->value*updatebackup]
+	int			num_client_entities;		// maxclients->value*CLIENT_ENTITIES
 	entity_state_t	*client_entities;		// [num_client_entities]
+	unsigned	*client_entity_tags;		// [num_client_entities] for the delta cache
+	unsigned	snapshotgen;				// bumped for every round of client frames and new baselines
+
+	int			num_snapshot_workers;		// sv_threads workers plus the main thread
+	snapshot_worker_t	*snapshot_workers;	// [num_snapshot_workers]
 
 	int			last_heartbeat;
 
 	challenge_t	challenges[MAX_CHALLENGES];	// to prevent invalid IPs from connecting
 
+	client_t	*client_hash[CLIENT_HASH_SIZE];	// non free clients by address and qport
+
+	// SV_Multicast keeps client leafs and recipient sets for one frame
+	int			multicastframe;
+	int			multicastgen;				// bumped when a client changes cluster or area
+	unsigned	num_multicasts;
+	unsigned	num_multicast_tests;		// client visibility tests made
+	unsigned	num_multicast_saved;		// client visibility tests answered from the cache
+
 	// serverrecord values
 	FILE		*demofile;
 	sizebuf_t	demo_multicast;
@@ -197,6 +312,11 @@ extern	cvar_t		*sv_noreload;			// don't reload level state when reentering
 extern	cvar_t		*sv_airaccelerate;		// don't reload level state when reentering
 // development tool
 extern	cvar_t		*sv_enforcetime;
+extern	cvar_t		*sv_threads;			// worker threads for building client frames
+extern	cvar_t		*sv_entindex;			// use the cluster index to build client frames
+extern	cvar_t		*sv_areagrid;			// loose grid instead of areanodes, on the next map
+extern	cvar_t		*sv_deltacache;			// reuse entity deltas across clients
+extern	cvar_t		*sv_updatebackup;		// frames kept for clients that ask for more
 
 extern	client_t	*sv_client;
 extern	edict_t		*sv_player;
@@ -208,6 +328,8 @@ extern	edict_t		*sv_player;
 //
 void SV_FinalMessage (char *message, qboolean reconnect);
 void SV_DropClient (client_t *drop);
+void SV_HashClient (client_t *cl);
+void SV_UnhashClient (client_t *cl);
 
 int SV_ModelIndex (char *name);
 int SV_SoundIndex (char *name);
@@ -222,6 +344,8 @@ void SV_SendServerinfo (client_t *client);
 void SV_UserinfoChanged (client_t *cl);
 
 
+void SV_LoadTest_f (void);
+
 void Master_Heartbeat (void);
 void Master_Packet (void);
 
@@ -229,6 +353,7 @@ void Master_Packet (void);
 // sv_init.c
 //
 void SV_InitGame (void);
+void SV_InitSnapshotWorkers (void);
 void SV_Map (qboolean attractloop, char *levelstring, qboolean loadgame);
 
 
@@ -250,7 +375,9 @@ void SV_FlushRedirect (int sv_redirected, char *outputbuf);
 void SV_DemoCompleted (void);
 void SV_SendClientMessages (void);
 
+void SV_ClearMulticastCache (void);
 void SV_Multicast (vec3_t origin, multicast_t to);
+void SV_MulticastStats_f (void);
 void SV_StartSound (vec3_t origin, edict_t *entity, int channel,
 					int soundindex, float volume,
 					float attenuation, float timeofs);
@@ -273,9 +400,11 @@ void SV_Status_f (void);
 //
 // sv_ents.c
 //
-void SV_WriteFrameToClient (client_t *client, sizebuf_t *msg);
+void SV_WriteFrameToClient (client_t *client, sizebuf_t *msg, snapshot_worker_t *worker);
 void SV_RecordDemoMessage (void);
-void SV_BuildClientFrame (client_t *client, qboolean clientonly);
+void SV_DeltaStats_f (void);
+void SV_BuildClientFrame (client_t *client, qboolean clientonly, snapshot_worker_t *worker);
+void SV_FixEntityNumbers (void);
 
 
 void SV_Error (char *error, ...);
@@ -311,6 +440,14 @@ void SV_LinkEdict (edict_t *ent);
 // sets ent->leafnums[] for pvs determination even if the entity
 // is not solid
 
+void SV_ClearClusterIndex (void);
+void SV_RefreshClusterIndex (void);
+// keeps the entity lists of each cluster in sync with the edicts,
+// called once a frame before building client frames
+
+void SV_ClusterEntities (byte *pvs, byte *phs, byte *entbits);
+// marks the entities that may be visible through either vis row
+
 int SV_AreaEdicts (vec3_t mins, vec3_t maxs, edict_t **list, int maxcount, int areatype);
 // fills in a table of edict pointers with edicts that have bounding boxes
 // that intersect the given area. It is possible for a non-axial bmodel
@@ -319,6 +456,9 @@ int SV_AreaEdicts (vec3_t mins, vec3_t maxs, edict_t **list, int maxcount, int a
 // returns the number of pointers filled in
 // ??? does this always return the world?
 
+void SV_AreaBench_f (void);
+// times SV_AreaEdicts with the areanode tree and the loose grid
+
 //===================================================================
 
 //
@@ -21,6 +21,10 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
 #include "client.h"
 #include "snd_local.h"
+#include <SDL_atomic.h>
+#include <SDL_mutex.h>
+#include <SDL_thread.h>
+#include <SDL_timer.h>
 
 void S_Play (void);
 void S_SoundList (void);
@@ -72,6 +76,83 @@ cvar_t		*s_khz;
 cvar_t		*s_show;
 cvar_t		*s_mixahead;
 cvar_t		*s_ambient;
+cvar_t		*s_mixthread;
+cvar_t		*s_mixlatency;
+cvar_t		*s_cachesize;
+
+int			s_cachebytes;		// in all the sfx caches
+int			s_cachesequence;	// bumped each time a sound is loaded or started
+int			s_cacheevictions;
+
+int			s_underruns;	// times the device played past what was painted
+
+// where sounds are heard from, S_Update sets it each frame
+typedef struct
+{
+	vec3_t		origin;
+	vec3_t		right;
+	int			viewentity;		// always heard at full volume
+	qboolean	active;			// nothing is spatialized outside of a level
+} listener_t;
+
+static listener_t	s_listener;
+
+// commands from the main thread to the mixer thread
+typedef enum
+{
+	MIX_PLAY,			// a playsound from S_StartSound
+	MIX_ORIGIN,			// an entity's sound origin moved
+	MIX_FRAME,			// new listener, respatialize and drop the autosounds
+	MIX_LOOP			// an autosound from S_AddLoopSounds
+} mixcmdtype_t;
+
+typedef struct
+{
+	mixcmdtype_t	type;
+
+	union
+	{
+		playsound_t	play;
+		listener_t	listener;
+
+		struct
+		{
+			int		entnum;
+			vec3_t	origin;
+		} origin;
+
+		struct
+		{
+			sfx_t	*sfx;
+			int		left, right;
+		} loop;
+	} u;
+} mixcmd_t;
+
+#define	MIX_COMMANDS	4096		// must be a power of two
+
+static mixcmd_t		s_mixcmds[MIX_COMMANDS];
+static SDL_atomic_t	s_mixhead;			// only the main thread writes it
+static SDL_atomic_t	s_mixtail;			// only whoever holds s_mixlock writes it
+static SDL_atomic_t	s_mixhold;			// the main thread clears or paints
+static SDL_atomic_t	s_mixquit;
+static SDL_atomic_t	s_mixmsec;			// how far ahead the thread paints
+static SDL_atomic_t	s_mixpainted;		// paintedtime as of the last paint
+static SDL_mutex	*s_mixlock;
+static SDL_Thread	*s_mixer;
+static qboolean		s_mixthreaded;
+static int			s_mixdropped;
+
+static listener_t	s_mixlistener;
+static vec3_t		s_mixorigins[MAX_EDICTS];	// entity sound origins the mixer was sent
+static vec3_t		s_sentorigins[MAX_EDICTS];	// the main thread's copy
+
+static qboolean S_MixSend (mixcmd_t *cmd);
+static void S_StartMixer (void);
+static void S_StopMixer (void);
+static void S_ClearChannels (void);
+static void S_UncacheSound (sfx_t *sfx);
+static void S_MixSendFrame (void);
 
 int			s_rawend;
 portable_samplepair_t s_rawsamples[MAX_RAW_SAMPLES];
@@ -93,6 +174,10 @@ static void S_SoundInfo_f (void)
 		Com_Printf("%5d submission_chunk\n", dma.submission_chunk);
 		Com_Printf("%5d speed\n", dma.speed);
 		Com_Printf("0x%x dma buffer\n", dma.buffer);
+		Com_Printf("%5d underruns\n", s_underruns);
+
+		if (s_mixthreaded)
+			Com_Printf("mixer thread %i msec ahead, %i commands dropped\n", SDL_AtomicGet (&s_mixmsec), s_mixdropped);
 #if USE_OPENAL
 	}
 #endif
@@ -120,11 +205,15 @@ void S_Init (void)
 	s_mixahead = Cvar_Get ("s_mixahead", "0.2", CVAR_ARCHIVE);
 	s_show = Cvar_Get ("s_show", "0", 0);
 	s_ambient = Cvar_Get ("s_ambient", "1", 0);
+	s_mixthread = Cvar_Get ("s_mixthread", "0", CVAR_ARCHIVE);
+	s_mixlatency = Cvar_Get ("s_mixlatency", "0.05", CVAR_ARCHIVE);
+	s_cachesize = Cvar_Get ("s_cachesize", "32768", CVAR_ARCHIVE);
 
 	Cmd_AddCommand ("play", S_Play);
 	Cmd_AddCommand ("stopsound", S_StopAllSounds);
 	Cmd_AddCommand ("soundlist", S_SoundList);
 	Cmd_AddCommand ("soundinfo", S_SoundInfo_f);
+	Cmd_AddCommand ("snd_mixbench", S_MixBench_f);
 
 	// start one of available sound engines
 	sound_started = SS_NOT;
@@ -157,6 +246,9 @@ void S_Init (void)
 	// clear DMA buffer
 	S_StopAllSounds();
 
+	if (sound_started == SS_DMA && s_mixthread->integer)
+		S_StartMixer ();
+
 	Com_Printf ("------------------------------------\n");
 }
 
@@ -175,6 +267,7 @@ void S_Shutdown (void)
 	if (!sound_started)
 		return;
 
+	S_StopMixer ();
 	S_StopAllSounds ();
 
 #ifdef USE_CODEC_OGG
@@ -202,6 +295,7 @@ void S_Shutdown (void)
 	}
 
 	num_sfx = 0;
+	s_cachebytes = 0;
 
 #if USE_OPENAL
 	if (sound_started == SS_OAL)
@@ -217,6 +311,7 @@ void S_Shutdown (void)
 	Cmd_RemoveCommand("stopsound");
 	Cmd_RemoveCommand("soundlist");
 	Cmd_RemoveCommand("soundinfo");
+	Cmd_RemoveCommand("snd_mixbench");
 }
 
 /*
@@ -355,6 +450,8 @@ void S_EndRegistration (void)
 	sfx_t	*sfx;
 	int		size;
 
+	S_MixLock ();
+
 	// free any sounds not from this registration sequence
 	for (i = 0, sfx = known_sfx; i < num_sfx; i++, sfx++)
 	{
@@ -365,7 +462,10 @@ void S_EndRegistration (void)
 		{
 			// don't need this sound
 			if (sfx->cache)	// it is possible to have a leftover
+			{
 				Z_Free (sfx->cache);	// from a server that didn't finish loading
+				s_cachebytes -= sfx->cachebytes;
+			}
 
 			memset (sfx, 0, sizeof (*sfx));
 		}
@@ -381,20 +481,151 @@ void S_EndRegistration (void)
 
 	}
 
-	// load everything in
+	S_MixUnlock ();
+
+	// load everything in that fits, the rest is loaded when first started.
+	// S_LoadSound doesn't trim while registering, so stop at the first
+	// sound that goes past the cap and drop it again
 	for (i = 0, sfx = known_sfx; i < num_sfx; i++, sfx++)
 	{
 		if (!sfx->name[0])
 			continue;
 
+		if (sfx->cache)
+		{
+			S_LoadSound (sfx);	// only marks it used
+			continue;
+		}
+
 		S_LoadSound (sfx);
+
+		if (s_cachesize->integer > 0 && s_cachebytes > s_cachesize->integer * 1024)
+		{
+			if (sfx->cache)
+				S_UncacheSound (sfx);
+			break;
+		}
 	}
 
 	s_registering = false;
 }
 
+/*
+=====================
+S_UncacheSound
+=====================
+*/
+static void S_UncacheSound (sfx_t *sfx)
+{
+#if USE_OPENAL
+	if (sound_started == SS_OAL)
+		AL_DeleteSfx (sfx);
+#endif
+
+	Z_Free (sfx->cache);
+	sfx->cache = NULL;
+	s_cachebytes -= sfx->cachebytes;
+	sfx->cachebytes = 0;
+}
+
+/*
+=====================
+S_TrimSoundCache
+
+Frees the least recently started sounds until the caches fit in
+s_cachesize kilobytes again. Sounds on a channel or waiting to start
+are kept, and so is keep. Does nothing while registering, the preload
+in S_EndRegistration stops at the cap itself
+=====================
+*/
+void S_TrimSoundCache (sfx_t *keep)
+{
+	qboolean	busy[MAX_SFX];
+	playsound_t	*ps;
+	sfx_t		*sfx, *oldest;
+	int			i, limit;
+
+	if (!s_cachesize || s_cachesize->integer <= 0)
+		return;
+
+	if (s_registering)
+		return;
+
+	limit = s_cachesize->integer * 1024;
+
+	if (s_cachebytes <= limit)
+		return;
+
+	S_MixLock ();
+
+	memset (busy, 0, sizeof (busy));
+
+	for (i = 0; i < s_numchannels; i++)
+	{
+		if (channels[i].sfx)
+			busy[channels[i].sfx - known_sfx] = true;
+	}
+
+	for (ps = s_pendingplays.next; ps != &s_pendingplays; ps = ps->next)
+		busy[ps->sfx - known_sfx] = true;
+
+	busy[keep - known_sfx] = true;
+
+	while (s_cachebytes > limit)
+	{
+		oldest = NULL;
+
+		for (i = 0, sfx = known_sfx; i < num_sfx; i++, sfx++)
+		{
+			if (!sfx->cache || busy[i])
+				continue;
+
+			if (!oldest || sfx->lastused < oldest->lastused)
+				oldest = sfx;
+		}
+
+		// everything left is playing
+		if (!oldest)
+			break;
+
+		S_UncacheSound (oldest);
+		s_cacheevictions++;
+	}
+
+	S_MixUnlock ();
+}
+
 //=============================================================================
 
+/*
+=================
+S_ChannelListener
+
+While the mixer thread runs the channels are spatialized from what it
+was last sent
+=================
+*/
+static listener_t *S_ChannelListener (void)
+{
+	return s_mixthreaded ? &s_mixlistener : &s_listener;
+}
+
+/*
+=================
+S_MixSound
+
+The mixer thread can't load sounds. It is only sent loaded ones, but
+registration may have freed them since
+=================
+*/
+sfxcache_t *S_MixSound (sfx_t *sfx)
+{
+	if (s_mixthreaded)
+		return sfx->cache;
+
+	return S_LoadSound (sfx);
+}
+
 /*
 =================
 S_PickChannel
@@ -406,10 +637,13 @@ channel_t *S_PickChannel (int entnum, int entchannel)
 	int			first_to_die;
 	int			life_left;
 	channel_t	*ch;
+	int			viewentity;
 
 	if (entchannel < 0)
 		Com_Error (ERR_DROP, "S_PickChannel: entchannel<0");
 
+	viewentity = S_ChannelListener ()->viewentity;
+
 	// Check for replacement sound, or find the best one to replace
 	first_to_die = -1;
 	life_left = 0x7fffffff;
@@ -426,7 +660,7 @@ channel_t *S_PickChannel (int entnum, int entchannel)
 		}
 
 		// don't let monster sounds override player sounds
-		if (channels[ch_idx].entnum == cl.playernum + 1 && entnum != cl.playernum + 1 && channels[ch_idx].sfx)
+		if (channels[ch_idx].entnum == viewentity && entnum != viewentity && channels[ch_idx].sfx)
 			continue;
 
 		if (channels[ch_idx].end - paintedtime < life_left)
@@ -458,21 +692,21 @@ S_SpatializeOrigin
 Used for spatializing channels and autosounds
 =================
 */
-void S_SpatializeOrigin (vec3_t origin, float master_vol, float dist_mult, int *left_vol, int *right_vol)
+static void S_SpatializeOrigin (listener_t *listener, vec3_t origin, float master_vol, float dist_mult, int *left_vol, int *right_vol)
 {
 	vec_t		dot;
 	vec_t		dist;
 	vec_t		lscale, rscale, scale;
 	vec3_t		source_vec;
 
-	if (cls.state != ca_active)
+	if (!listener->active)
 	{
 		*left_vol = *right_vol = 255;
 		return;
 	}
 
 	// calculate stereo seperation and distance attenuation
-	VectorSubtract (origin, listener_origin, source_vec);
+	VectorSubtract (origin, listener->origin, source_vec);
 
 	dist = VectorNormalize (source_vec);
 	dist -= (SOUND_FULLVOLUME * 80);
@@ -481,7 +715,7 @@ void S_SpatializeOrigin (vec3_t origin, float master_vol, float dist_mult, int *
 		dist = 0;			// close enough to be at full volume
 
 	dist *= dist_mult;		// different attenuation levels
-	dot = DotProduct (listener_right, source_vec);
+	dot = DotProduct (listener->right, source_vec);
 
 	if (dma.channels == 1 || !dist_mult)
 	{
@@ -516,10 +750,13 @@ S_Spatialize
 */
 void S_Spatialize (channel_t *ch)
 {
+	listener_t	*listener;
 	vec3_t		origin;
 
+	listener = S_ChannelListener ();
+
 	// anything coming from the view entity will always be full volume
-	if (ch->entnum == cl.playernum + 1)
+	if (ch->entnum == listener->viewentity)
 	{
 		ch->leftvol = ch->master_vol;
 		ch->rightvol = ch->master_vol;
@@ -530,12 +767,16 @@ void S_Spatialize (channel_t *ch)
 	{
 		VectorCopy (ch->origin, origin);
 	}
+	else if (s_mixthreaded)
+	{
+		VectorCopy (s_mixorigins[ch->entnum], origin);
+	}
 	else
 	{
 		CL_GetEntitySoundOrigin (ch->entnum, origin);
 	}
 
-	S_SpatializeOrigin (origin, ch->master_vol, ch->dist_mult, &ch->leftvol, &ch->rightvol);
+	S_SpatializeOrigin (listener, origin, ch->master_vol, ch->dist_mult, &ch->leftvol, &ch->rightvol);
 }
 
 
@@ -580,6 +821,37 @@ void S_FreePlaysound (playsound_t *ps)
 }
 
 
+/*
+=================
+S_InsertPlaysound
+
+Copies play into the pending list, sorted by start time
+=================
+*/
+static void S_InsertPlaysound (playsound_t *play)
+{
+	playsound_t	*ps, *sort;
+
+	ps = S_AllocPlaysound ();
+
+	if (!ps)
+		return;
+
+	*ps = *play;
+
+	for (sort = s_pendingplays.next ;
+			sort != &s_pendingplays && sort->begin < ps->begin ;
+			sort = sort->next)
+		;
+
+	ps->next = sort;
+	ps->prev = sort->prev;
+
+	ps->next->prev = ps;
+	ps->prev->next = ps;
+}
+
+
 /*
 ===============
 S_IssuePlaysound
@@ -594,7 +866,7 @@ void S_IssuePlaysound (playsound_t *ps)
 	channel_t	*ch;
 	sfxcache_t	*sc;
 
-	if (s_show->value)
+	if (s_show->value && !s_mixthreaded)
 		Com_Printf ("Issue %i\n", ps->begin);
 
 	// pick a channel to play on
@@ -606,10 +878,11 @@ void S_IssuePlaysound (playsound_t *ps)
 	}
 
 	// load playsound into cache
-	sc = S_LoadSound(ps->sfx);
+	sc = S_MixSound (ps->sfx);
 	if (!sc)
 	{
-		Com_Printf (S_COLOR_RED "S_IssuePlaysound: couldn't load %s\n", ps->sfx->name);
+		if (!s_mixthreaded)
+			Com_Printf (S_COLOR_RED "S_IssuePlaysound: couldn't load %s\n", ps->sfx->name);
 		S_FreePlaysound (ps);
 		return;
 	}
@@ -707,17 +980,25 @@ struct sfx_s *S_RegisterSexedSound (entity_state_t *ent, char *base)
 
 static int DMA_DriftBeginofs(float timeofs)
 {
+	int painted, start;
+
+	// the mixer thread owns paintedtime and publishes it after each paint
+	if (s_mixthreaded)
+		painted = SDL_AtomicGet (&s_mixpainted);
+	else
+		painted = paintedtime;
+
 	// drift s_beginofs
-	int start = (int)(cl.frame.servertime * 0.001f * dma.speed + s_beginofs);
+	start = (int)(cl.frame.servertime * 0.001f * dma.speed + s_beginofs);
 
-	if (start < paintedtime)
+	if (start < painted)
 	{
-		start = paintedtime;
+		start = painted;
 		s_beginofs = (int)(start - (cl.frame.servertime * 0.001f * dma.speed));
 	}
-	else if (start > paintedtime + 0.3f * dma.speed)
+	else if (start > painted + 0.3f * dma.speed)
 	{
-		start = (int)(paintedtime + 0.1f * dma.speed);
+		start = (int)(painted + 0.1f * dma.speed);
 		s_beginofs = (int)(start - (cl.frame.servertime * 0.001f * dma.speed));
 	}
 	else
@@ -725,7 +1006,7 @@ static int DMA_DriftBeginofs(float timeofs)
 		s_beginofs -= 10;
 	}
 
-	return timeofs ? start + timeofs * dma.speed : paintedtime;
+	return timeofs ? start + timeofs * dma.speed : painted;
 }
 
 /*
@@ -740,7 +1021,8 @@ Entchannel 0 will never override a playing sound
 void S_StartSound (vec3_t origin, int entnum, int entchannel, sfx_t *sfx, float fvol, float attenuation, float timeofs)
 {
 	sfxcache_t	*sc;
-	playsound_t	*ps, *sort;
+	playsound_t	play, *ps;
+	mixcmd_t	cmd;
 
 	if (!sound_started)
 		return;
@@ -761,10 +1043,7 @@ void S_StartSound (vec3_t origin, int entnum, int entchannel, sfx_t *sfx, float
 		return;		// couldn't load the sound's data
 
 	// make the playsound_t
-	ps = S_AllocPlaysound ();
-
-	if (!ps)
-		return;
+	ps = &play;
 
 	if (origin)
 	{
@@ -825,16 +1104,13 @@ void S_StartSound (vec3_t origin, int entnum, int entchannel, sfx_t *sfx, float
 	}
 
 	// sort into the pending sound list
-	for (sort = s_pendingplays.next ;
-			sort != &s_pendingplays && sort->begin < ps->begin ;
-			sort = sort->next)
-		;
-
-	ps->next = sort;
-	ps->prev = sort->prev;
-
-	ps->next->prev = ps;
-	ps->prev->next = ps;
+	if (s_mixthreaded)
+	{
+		cmd.type = MIX_PLAY;
+		cmd.u.play = play;
+		S_MixSend (&cmd);
+	}
+	else S_InsertPlaysound (&play);
 }
 
 
@@ -890,16 +1166,15 @@ void S_ClearBuffer (void)
 
 /*
 ==================
-S_StopAllSounds
+S_ClearChannels
+
+Stops every channel and playsound
 ==================
 */
-void S_StopAllSounds (void)
+static void S_ClearChannels (void)
 {
 	int		i;
 
-	if (!sound_started)
-		return;
-
 	// clear all the playsounds
 	memset (s_playsounds, 0, sizeof (s_playsounds));
 	s_freeplays.next = s_freeplays.prev = &s_freeplays;
@@ -923,6 +1198,21 @@ void S_StopAllSounds (void)
 
 	// clear all the channels
 	memset (channels, 0, sizeof (channels));
+}
+
+/*
+==================
+S_StopAllSounds
+==================
+*/
+void S_StopAllSounds (void)
+{
+	if (!sound_started)
+		return;
+
+	S_MixLock ();
+	S_ClearChannels ();
+	S_MixUnlock ();
 
 	// stop any music streaming
 #ifdef USE_CODEC_OGG
@@ -962,6 +1252,37 @@ void S_BuildSoundList (int *sounds)
 	}
 }
 
+/*
+==================
+S_StartLoopSound
+==================
+*/
+static qboolean S_StartLoopSound (sfx_t *sfx, int left, int right)
+{
+	channel_t	*ch;
+	sfxcache_t	*sc;
+
+	sc = sfx->cache;
+
+	if (!sc)
+		return true;
+
+	// allocate a channel
+	ch = S_PickChannel (0, 0);
+
+	if (!ch)
+		return false;
+
+	ch->leftvol = left;
+	ch->rightvol = right;
+	ch->autosound = true;	// remove next frame
+	ch->sfx = sfx;
+	ch->pos = paintedtime % sc->length;
+	ch->end = paintedtime + sc->length - ch->pos;
+
+	return true;
+}
+
 /*
 ==================
 S_AddLoopSounds
@@ -976,12 +1297,12 @@ void S_AddLoopSounds (void)
 	int			i, j;
 	int			sounds[MAX_EDICTS];
 	int			left, right, left_total, right_total;
-	channel_t	*ch;
 	sfx_t		*sfx;
 	sfxcache_t	*sc;
 	int			num;
 	entity_state_t	*ent;
 	vec3_t		origin;
+	mixcmd_t	cmd;
 
 	if (cl_paused->value)
 		return;
@@ -1004,7 +1325,8 @@ void S_AddLoopSounds (void)
 		if (!sfx)
 			continue;		// bad sound effect
 
-		sc = sfx->cache;
+		// may have been left out or trimmed by s_cachesize
+		sc = S_LoadSound (sfx);
 		if (!sc)
 			continue;
 
@@ -1013,7 +1335,7 @@ void S_AddLoopSounds (void)
 
 		// find the total contribution of all sounds of this type
 		CL_GetEntitySoundOrigin (ent->number, origin);
-		S_SpatializeOrigin (origin, 255.0, SOUND_LOOPATTENUATE, &left_total, &right_total);
+		S_SpatializeOrigin (&s_listener, origin, 255.0, SOUND_LOOPATTENUATE, &left_total, &right_total);
 
 		for (j = i + 1; j < cl.frame.num_entities; j++)
 		{
@@ -1026,7 +1348,7 @@ void S_AddLoopSounds (void)
 			ent = &cl_parse_entities[num];
 
 			CL_GetEntitySoundOrigin (ent->number, origin);
-			S_SpatializeOrigin (origin, 255.0, SOUND_LOOPATTENUATE, &left, &right);
+			S_SpatializeOrigin (&s_listener, origin, 255.0, SOUND_LOOPATTENUATE, &left, &right);
 			left_total += left;
 			right_total += right;
 		}
@@ -1034,24 +1356,22 @@ void S_AddLoopSounds (void)
 		if (left_total == 0 && right_total == 0)
 			continue;		// not audible
 
-		// allocate a channel
-		ch = S_PickChannel (0, 0);
-
-		if (!ch)
-			return;
-
 		if (left_total > 255)
 			left_total = 255;
 
 		if (right_total > 255)
 			right_total = 255;
 
-		ch->leftvol = left_total;
-		ch->rightvol = right_total;
-		ch->autosound = true;	// remove next frame
-		ch->sfx = sfx;
-		ch->pos = paintedtime % sc->length;
-		ch->end = paintedtime + sc->length - ch->pos;
+		if (s_mixthreaded)
+		{
+			cmd.type = MIX_LOOP;
+			cmd.u.loop.sfx = sfx;
+			cmd.u.loop.left = left_total;
+			cmd.u.loop.right = right_total;
+			S_MixSend (&cmd);
+		}
+		else if (!S_StartLoopSound (sfx, left_total, right_total))
+			return;
 	}
 }
 
@@ -1059,12 +1379,10 @@ void S_AddLoopSounds (void)
 
 /*
 ============
-S_RawSamples
-
-Cinematic streaming and voice over network
+S_WriteRawSamples
 ============
 */
-void S_RawSamples (int samples, int rate, int width, int channels, byte *data)
+static void S_WriteRawSamples (int samples, int rate, int width, int channels, byte *data)
 {
 	int		i;
 	int		src, dst;
@@ -1164,6 +1482,20 @@ void S_RawSamples (int samples, int rate, int width, int channels, byte *data)
 	}
 }
 
+/*
+============
+S_RawSamples
+
+Cinematic streaming and voice over network
+============
+*/
+void S_RawSamples (int samples, int rate, int width, int channels, byte *data)
+{
+	S_MixLock ();
+	S_WriteRawSamples (samples, rate, width, channels, data);
+	S_MixUnlock ();
+}
+
 //=============================================================================
 
 static void GetSoundtime(void)
@@ -1195,7 +1527,12 @@ static void GetSoundtime(void)
 			// time to chop things off to avoid 32 bit limits
 			buffers = 0;
 			paintedtime = fullsamples;
-			S_StopAllSounds();
+
+			// the mixer thread can't stop the music
+			if (s_mixthreaded)
+				S_ClearChannels ();
+			else
+				S_StopAllSounds ();
 		}
 	}
 
@@ -1205,6 +1542,93 @@ static void GetSoundtime(void)
 }
 
 
+/*
+============
+S_UpdateChannels
+
+Respatializes the channels and drops the autosounds, S_AddLoopSounds
+starts them again
+============
+*/
+static void S_UpdateChannels (void)
+{
+	int			i;
+	channel_t	*ch;
+
+	// update spatialization for dynamic sounds
+	ch = channels;
+
+	for (i = 0; i < s_numchannels; i++, ch++)
+	{
+		if (!ch->sfx)
+			continue;
+
+		if (ch->autosound)
+		{
+			// autosounds are regenerated fresh each frame
+			memset (ch, 0, sizeof (*ch));
+			continue;
+		}
+
+		S_Spatialize (ch);    // respatialize channel
+
+		if (!ch->leftvol && !ch->rightvol)
+		{
+			memset (ch, 0, sizeof (*ch));
+			continue;
+		}
+	}
+}
+
+/*
+============
+S_Mix
+
+Paints ahead seconds past where the device is playing
+============
+*/
+static void S_Mix (float ahead)
+{
+	int			samps;
+	unsigned    endtime;
+
+	SNDDMA_BeginPainting ();
+
+	if (!dma.buffer)
+		return;
+
+	// Updates DMA time
+	GetSoundtime ();
+
+	// check to make sure that we haven't overshot
+	if (paintedtime < soundtime)
+	{
+		if (!s_mixthreaded)
+			Com_DPrintf ("S_Update : overflow\n");
+
+		if (paintedtime)
+			s_underruns++;
+
+		paintedtime = soundtime;
+	}
+
+	// mix ahead of current position
+	endtime = soundtime + ahead * dma.speed;
+
+	// mix to an even submission block size
+	endtime = (endtime + dma.submission_chunk - 1) & ~(dma.submission_chunk - 1);
+	samps = dma.samples >> (dma.channels - 1);
+
+	if (endtime - soundtime > samps)
+		endtime = soundtime + samps;
+
+	S_PaintChannels (endtime);
+
+	SNDDMA_Submit ();
+
+	SDL_AtomicSet (&s_mixpainted, paintedtime);
+}
+
 /*
 ============
 S_Update
@@ -1215,20 +1639,28 @@ Called once each time through the main loop
 void S_Update (vec3_t origin, vec3_t forward, vec3_t right, vec3_t up)
 {
 	int			i;
-	int			total, samps;
-	unsigned    endtime;
+	int			total;
 	channel_t	*ch;
 
 	if (!sound_started)
 		return;
 
+	// video frames pace the mixing rather than the device
+	if (s_mixthreaded)
+		SDL_AtomicSet (&s_mixhold, cls.disable_screen || CL_VideoRecording ());
+
 	// if the loading plaque is up, clear everything
 	// out to make sure we aren't looping a dirty
 	// dma buffer while loading
 	if (cls.disable_screen)
 	{
 		if (sound_started == SS_DMA)
+		{
+			S_MixLock ();
 			S_ClearBuffer ();
+			S_MixUnlock ();
+		}
+
 		return;
 	}
 
@@ -1237,6 +1669,11 @@ void S_Update (vec3_t origin, vec3_t forward, vec3_t right, vec3_t up)
 	VectorCopy (right, listener_right);
 	VectorCopy (up, listener_up);
 
+	VectorCopy (origin, s_listener.origin);
+	VectorCopy (right, s_listener.right);
+	s_listener.viewentity = cl.playernum + 1;
+	s_listener.active = (cls.state == ca_active);
+
 #if USE_OPENAL
 	if (sound_started == SS_OAL)
 	{
@@ -1247,37 +1684,26 @@ void S_Update (vec3_t origin, vec3_t forward, vec3_t right, vec3_t up)
 	
 	// rebuild scale tables if volume is modified
 	if (s_volume->modified)
+	{
+		S_MixLock ();
 		S_InitScaletable ();
+		S_MixUnlock ();
+	}
 
-	// update spatialization for dynamic sounds
-	ch = channels;
-
-	for (i = 0; i < s_numchannels; i++, ch++)
+	if (s_mixthreaded)
 	{
-		if (!ch->sfx)
-			continue;
-
-		if (ch->autosound)
-		{
-			// autosounds are regenerated fresh each frame
-			memset (ch, 0, sizeof (*ch));
-			continue;
-		}
-
-		S_Spatialize (ch);    // respatialize channel
-
-		if (!ch->leftvol && !ch->rightvol)
-		{
-			memset (ch, 0, sizeof (*ch));
-			continue;
-		}
+		S_MixSendFrame ();
 	}
+	else
+	{
+		S_UpdateChannels ();
 
-	// add loopsounds
-	S_AddLoopSounds ();
+		// add loopsounds
+		S_AddLoopSounds ();
+	}
 
 	// debugging output
-	if (s_show->value)
+	if (s_show->value && !s_mixthreaded)
 	{
 		total = 0;
 		ch = channels;
@@ -1299,35 +1725,270 @@ void S_Update (vec3_t origin, vec3_t forward, vec3_t right, vec3_t up)
 	OGG_Stream ();
 #endif
 
+	if (s_mixthreaded)
+	{
+		SDL_AtomicSet (&s_mixmsec, s_mixlatency->value * 1000);
+
+		if (!CL_VideoRecording ())
+			return;
+	}
+
 	// mix some sound
-	SNDDMA_BeginPainting ();
+	S_MixLock ();
+	S_Mix (s_mixahead->value);
+	S_MixUnlock ();
+}
 
-	if (!dma.buffer)
+/*
+===============================================================================
+
+MIXER THREAD
+
+With s_mixthread set the DMA backend is painted by a thread of its own,
+s_mixlatency seconds ahead of the device however long client frames
+take. The thread owns the channels, the playsounds and paintedtime, and
+the main thread sends it what S_StartSound and S_Update would have done
+to them through a single producer, single consumer ring.
+
+The thread holds s_mixlock while it paints. The main thread only takes
+it for the raw sample stream and for the rare changes to everything at
+once, like stopping all sounds or freeing sounds after registration.
+Whoever takes the lock applies the queued commands first.
+
+===============================================================================
+*/
+
+/*
+============
+S_MixSend
+
+Called from the main thread, false if the ring is full
+============
+*/
+static qboolean S_MixSend (mixcmd_t *cmd)
+{
+	int		head;
+
+	head = SDL_AtomicGet (&s_mixhead);
+
+	if (head - SDL_AtomicGet (&s_mixtail) >= MIX_COMMANDS)
+	{
+		s_mixdropped++;
+		return false;
+	}
+
+	s_mixcmds[head & (MIX_COMMANDS - 1)] = *cmd;
+	SDL_AtomicSet (&s_mixhead, head + 1);
+
+	return true;
+}
+
+/*
+============
+S_MixCommands
+
+Called with s_mixlock held
+============
+*/
+static void S_MixCommands (void)
+{
+	int			head, tail;
+	mixcmd_t	*cmd;
+
+	head = SDL_AtomicGet (&s_mixhead);
+
+	for (tail = SDL_AtomicGet (&s_mixtail); tail != head; tail++)
+	{
+		cmd = &s_mixcmds[tail & (MIX_COMMANDS - 1)];
+
+		switch (cmd->type)
+		{
+		case MIX_PLAY:
+			// begins are never a second ahead, unless paintedtime was
+			// chopped back after the main thread read it
+			if ((int) (cmd->u.play.begin - paintedtime) > dma.speed)
+				cmd->u.play.begin = paintedtime;
+
+			S_InsertPlaysound (&cmd->u.play);
+			break;
+
+		case MIX_ORIGIN:
+			VectorCopy (cmd->u.origin.origin, s_mixorigins[cmd->u.origin.entnum]);
+			break;
+
+		case MIX_FRAME:
+			s_mixlistener = cmd->u.listener;
+			VectorCopy (s_mixlistener.origin, s_mixorigins[0]);
+			S_UpdateChannels ();
+			break;
+
+		case MIX_LOOP:
+			S_StartLoopSound (cmd->u.loop.sfx, cmd->u.loop.left, cmd->u.loop.right);
+			break;
+		}
+	}
+
+	SDL_AtomicSet (&s_mixtail, tail);
+}
+
+/*
+============
+S_MixLock
+
+Lets the main thread change what the mixer thread owns
+============
+*/
+void S_MixLock (void)
+{
+	if (!s_mixthreaded)
 		return;
 
-	// Updates DMA time
-	GetSoundtime ();
+	SDL_LockMutex (s_mixlock);
+	S_MixCommands ();
+}
 
-	// check to make sure that we haven't overshot
-	if (paintedtime < soundtime)
+void S_MixUnlock (void)
+{
+	if (s_mixthreaded)
+		SDL_UnlockMutex (s_mixlock);
+}
+
+/*
+============
+S_MixSendFrame
+
+Sends what S_Update does to the channels each frame, only the entity
+sound origins that moved are sent
+============
+*/
+static void S_MixSendFrame (void)
+{
+	mixcmd_t		cmd;
+	entity_state_t	*ent;
+	int				i;
+
+	if (cls.state == ca_active)
 	{
-		Com_DPrintf ("S_Update : overflow\n");
-		paintedtime = soundtime;
+		cmd.type = MIX_ORIGIN;
+
+		for (i = 0; i < cl.frame.num_entities; i++)
+		{
+			ent = &cl_parse_entities[(cl.frame.parse_entities + i) & (MAX_PARSE_ENTITIES - 1)];
+			CL_GetEntitySoundOrigin (ent->number, cmd.u.origin.origin);
+
+			if (VectorCompare (cmd.u.origin.origin, s_sentorigins[ent->number]))
+				continue;
+
+			cmd.u.origin.entnum = ent->number;
+
+			if (S_MixSend (&cmd))
+				VectorCopy (cmd.u.origin.origin, s_sentorigins[ent->number]);
+		}
 	}
 
-	// mix ahead of current position
-	endtime = soundtime + s_mixahead->value * dma.speed;
+	cmd.type = MIX_FRAME;
+	cmd.u.listener = s_listener;
+	S_MixSend (&cmd);
 
-	// mix to an even submission block size
-	endtime = (endtime + dma.submission_chunk - 1) & ~(dma.submission_chunk - 1);
-	samps = dma.samples >> (dma.channels - 1);
+	S_AddLoopSounds ();
+}
 
-	if (endtime - soundtime > samps)
-		endtime = soundtime + samps;
+/*
+============
+S_MixThread
+============
+*/
+static int S_MixThread (void *unused)
+{
+	int		ahead, delay;
 
-	S_PaintChannels (endtime);
+	while (!SDL_AtomicGet (&s_mixquit))
+	{
+		ahead = SDL_AtomicGet (&s_mixmsec);
 
-	SNDDMA_Submit ();
+		SDL_LockMutex (s_mixlock);
+		S_MixCommands ();
+
+		if (!SDL_AtomicGet (&s_mixhold))
+			S_Mix (ahead * 0.001f);
+
+		SDL_UnlockMutex (s_mixlock);
+
+		// wake a few times within the latency so the device never runs dry
+		delay = ahead / 4;
+
+		if (delay < 1)
+			delay = 1;
+		else if (delay > 20)
+			delay = 20;
+
+		SDL_Delay (delay);
+	}
+
+	return 0;
+}
+
+/*
+============
+S_StartMixer
+============
+*/
+static void S_StartMixer (void)
+{
+	s_mixlock = SDL_CreateMutex ();
+
+	if (!s_mixlock)
+		return;
+
+	SDL_AtomicSet (&s_mixhead, 0);
+	SDL_AtomicSet (&s_mixtail, 0);
+	SDL_AtomicSet (&s_mixhold, 0);
+	SDL_AtomicSet (&s_mixquit, 0);
+	SDL_AtomicSet (&s_mixmsec, s_mixlatency->value * 1000);
+	SDL_AtomicSet (&s_mixpainted, paintedtime);
+	s_mixdropped = 0;
+
+	s_mixlistener = s_listener;
+	memset (s_mixorigins, 0, sizeof (s_mixorigins));
+	memset (s_sentorigins, 0, sizeof (s_sentorigins));
+
+	// set before the thread starts, it checks it too
+	s_mixthreaded = true;
+	s_mixer = SDL_CreateThread (S_MixThread, "mixer", NULL);
+
+	if (!s_mixer)
+	{
+		Com_Printf (S_COLOR_RED "Couldn't start the mixer thread: %s.\n", SDL_GetError ());
+		s_mixthreaded = false;
+		SDL_DestroyMutex (s_mixlock);
+		s_mixlock = NULL;
+		return;
+	}
+
+	Com_Printf ("Mixing on its own thread, %i msec ahead.\n", SDL_AtomicGet (&s_mixmsec));
+}
+
+/*
+============
+S_StopMixer
+
+Hands the channels back to the main thread
+============
+*/
+static void S_StopMixer (void)
+{
+	if (!s_mixer)
+		return;
+
+	SDL_AtomicSet (&s_mixquit, 1);
+	SDL_WaitThread (s_mixer, NULL);
+	s_mixer = NULL;
+
+	S_MixCommands ();
+	s_mixthreaded = false;
+
+	SDL_DestroyMutex (s_mixlock);
+	s_mixlock = NULL;
 }
 
 /*
@@ -1400,4 +2061,7 @@ void S_SoundList (void)
 	}
 
 	Com_Printf ("Total resident: %i\n", total);
+
+	if (s_cachesize->integer > 0)
+		Com_Printf ("Cache: %i of %i KB, %i sounds evicted\n", s_cachebytes / 1024, s_cachesize->integer, s_cacheevictions);
 }
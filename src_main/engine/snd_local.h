@@ -44,6 +44,8 @@ typedef struct sfx_s
 	char 		name[MAX_QPATH];
 	int			registration_sequence;
 	sfxcache_t	*cache;
+	int			cachebytes;		// counted against s_cachesize
+	int			lastused;		// s_cachesequence when last started
 	char 		*truename;
 } sfx_t;
 
@@ -195,15 +197,29 @@ extern cvar_t	*s_khz;
 extern cvar_t	*s_show;
 extern cvar_t	*s_mixahead;
 extern cvar_t	*s_ambient;
+extern cvar_t	*s_mixthread;
+extern cvar_t	*s_mixlatency;
+extern cvar_t	*s_cachesize;
+
+extern int		s_cachebytes;
+extern int		s_cachesequence;
 
 void S_InitScaletable (void);
 
 sfxcache_t *S_LoadSound (sfx_t *s);
+void S_TrimSoundCache (sfx_t *keep);
+
+// the mixer thread, when running, owns the channels and playsounds
+sfxcache_t *S_MixSound (sfx_t *sfx);
+void S_MixLock (void);
+void S_MixUnlock (void);
 
 void S_IssuePlaysound (playsound_t *ps);
 
 void S_PaintChannels (int endtime);
 
+void S_MixBench_f (void);
+
 // picks a channel based on priorities, empty slots, number of channels
 channel_t *S_PickChannel (int entnum, int entchannel);
 
@@ -109,6 +109,8 @@ sfxcache_t *S_LoadSound (sfx_t *s)
 	if (s->name[0] == '*')
 		return NULL;
 
+	s->lastused = ++s_cachesequence;
+
 	// see if still in memory
 	sc = s->cache;
 
@@ -157,6 +159,9 @@ sfxcache_t *S_LoadSound (sfx_t *s)
 			return NULL;
 		}
 
+		s->cachebytes = len + sizeof(sfxcache_t);
+		s_cachebytes += s->cachebytes;
+
 		sc->length = info.samples;
 		sc->loopstart = info.loopstart;
 		sc->speed = info.rate;
@@ -166,11 +171,23 @@ sfxcache_t *S_LoadSound (sfx_t *s)
 
 #if USE_OPENAL
 	if (sound_started == SS_OAL)
+	{
+		// the samples are held by the AL buffer
 		sc = AL_UploadSfx (s, &info, data + info.dataofs);
+
+		if (sc)
+		{
+			s->cachebytes = sc->size + sizeof (sfxcache_t);
+			s_cachebytes += s->cachebytes;
+		}
+	}
 	else
 #endif
 		ResampleSfx (s, sc->speed, sc->width, data + info.dataofs);
 
 	FS_FreeFile(data);
+
+	S_TrimSoundCache (s);
+
 	return sc;
 }
@@ -28,31 +28,283 @@ int		snd_scaletable[32][256];
 int 	*snd_p, snd_linear_count, snd_vol;
 short	*snd_out;
 
-static void S_WriteLinearBlastStereo16 (void)
+/*
+===============================================================================
+
+MIXING KERNELS
+
+The vector kernels do the same integer math as the scalar ones several
+samples at a time, so every mixer writes the same samples
+
+===============================================================================
+*/
+
+typedef void (*paint8_t) (portable_samplepair_t *samp, const byte *sfx, int count, const int *lscale, const int *rscale);
+typedef void (*paint16_t) (portable_samplepair_t *samp, const short *sfx, int count, int leftvol, int rightvol);
+typedef void (*clipstereo16_t) (short *out, const int *in, int count);
+
+static void S_Paint8_C (portable_samplepair_t *samp, const byte *sfx, int count, const int *lscale, const int *rscale)
+{
+	int		i, data;
+
+	for (i = 0; i < count; i++, samp++)
+	{
+		data = sfx[i];
+		samp->left += lscale[data];
+		samp->right += rscale[data];
+	}
+}
+
+static void S_Paint16_C (portable_samplepair_t *samp, const short *sfx, int count, int leftvol, int rightvol)
+{
+	int		i, data;
+
+	for (i = 0; i < count; i++, samp++)
+	{
+		data = sfx[i];
+		samp->left += (data * leftvol) >> 8;
+		samp->right += (data * rightvol) >> 8;
+	}
+}
+
+static void S_ClipStereo16_C (short *out, const int *in, int count)
 {
 	int		i;
 	int		val;
 
-	for (i = 0; i < snd_linear_count; i += 2)
+	for (i = 0; i < count; i++)
 	{
-		val = snd_p[i] >> 8;
+		val = in[i] >> 8;
 
 		if (val > 0x7fff)
-			snd_out[i] = 0x7fff;
+			out[i] = 0x7fff;
 		else if (val < (short) 0x8000)
-			snd_out[i] = (short) 0x8000;
+			out[i] = (short) 0x8000;
 		else
-			snd_out[i] = val;
+			out[i] = val;
+	}
+}
 
-		val = snd_p[i+1] >> 8;
+#ifdef Q_SSE2
+#include <emmintrin.h>
 
-		if (val > 0x7fff)
-			snd_out[i+1] = 0x7fff;
-		else if (val < (short) 0x8000)
-			snd_out[i+1] = (short) 0x8000;
-		else
-			snd_out[i+1] = val;
+/*
+================
+S_Paint8_SSE2
+
+A scale table row is the signed sample times row[1]. SSE2 has no 32 bit
+multiply, so pmaddwd makes each product as
+sample * (scale & 255) + (sample << 8) * (scale >> 8)
+================
+*/
+static void S_Paint8_SSE2 (portable_samplepair_t *samp, const byte *sfx, int count, const int *lscale, const int *rscale)
+{
+	__m128i		lmul, rmul, in, s, lo, hi, l0, l1, r0, r1;
+	__m128i		*out;
+	int			i;
+
+	if ((unsigned) lscale[1] > 0xffff || (unsigned) rscale[1] > 0xffff)
+	{
+		S_Paint8_C (samp, sfx, count, lscale, rscale);
+		return;
+	}
+
+	lmul = _mm_set1_epi32 ((lscale[1] & 255) | ((lscale[1] >> 8) << 16));
+	rmul = _mm_set1_epi32 ((rscale[1] & 255) | ((rscale[1] >> 8) << 16));
+
+	for (i = 0; i + 8 <= count; i += 8)
+	{
+		in = _mm_loadl_epi64 ((const __m128i *) (sfx + i));
+		s = _mm_srai_epi16 (_mm_unpacklo_epi8 (in, in), 8);
+
+		lo = _mm_unpacklo_epi16 (s, _mm_slli_epi16 (s, 8));
+		hi = _mm_unpackhi_epi16 (s, _mm_slli_epi16 (s, 8));
+		l0 = _mm_madd_epi16 (lo, lmul);
+		l1 = _mm_madd_epi16 (hi, lmul);
+		r0 = _mm_madd_epi16 (lo, rmul);
+		r1 = _mm_madd_epi16 (hi, rmul);
+
+		out = (__m128i *) (samp + i);
+		_mm_storeu_si128 (out + 0, _mm_add_epi32 (_mm_loadu_si128 (out + 0), _mm_unpacklo_epi32 (l0, r0)));
+		_mm_storeu_si128 (out + 1, _mm_add_epi32 (_mm_loadu_si128 (out + 1), _mm_unpackhi_epi32 (l0, r0)));
+		_mm_storeu_si128 (out + 2, _mm_add_epi32 (_mm_loadu_si128 (out + 2), _mm_unpacklo_epi32 (l1, r1)));
+		_mm_storeu_si128 (out + 3, _mm_add_epi32 (_mm_loadu_si128 (out + 3), _mm_unpackhi_epi32 (l1, r1)));
+	}
+
+	S_Paint8_C (samp + i, sfx + i, count - i, lscale, rscale);
+}
+
+/*
+================
+S_Paint16_SSE2
+
+The volumes are unsigned 16 bit, the high half of each signed product
+is the unsigned one less the volume where the sample is negative
+================
+*/
+static void S_Paint16_SSE2 (portable_samplepair_t *samp, const short *sfx, int count, int leftvol, int rightvol)
+{
+	__m128i		lvol, rvol, in, sign, plo, phi, l0, l1, r0, r1;
+	__m128i		*out;
+	int			i;
+
+	if ((unsigned) leftvol > 0xffff || (unsigned) rightvol > 0xffff)
+	{
+		S_Paint16_C (samp, sfx, count, leftvol, rightvol);
+		return;
+	}
+
+	lvol = _mm_set1_epi16 ((short) leftvol);
+	rvol = _mm_set1_epi16 ((short) rightvol);
+
+	for (i = 0; i + 8 <= count; i += 8)
+	{
+		in = _mm_loadu_si128 ((const __m128i *) (sfx + i));
+		sign = _mm_srai_epi16 (in, 15);
+
+		plo = _mm_mullo_epi16 (in, lvol);
+		phi = _mm_sub_epi16 (_mm_mulhi_epu16 (in, lvol), _mm_and_si128 (sign, lvol));
+		l0 = _mm_srai_epi32 (_mm_unpacklo_epi16 (plo, phi), 8);
+		l1 = _mm_srai_epi32 (_mm_unpackhi_epi16 (plo, phi), 8);
+
+		plo = _mm_mullo_epi16 (in, rvol);
+		phi = _mm_sub_epi16 (_mm_mulhi_epu16 (in, rvol), _mm_and_si128 (sign, rvol));
+		r0 = _mm_srai_epi32 (_mm_unpacklo_epi16 (plo, phi), 8);
+		r1 = _mm_srai_epi32 (_mm_unpackhi_epi16 (plo, phi), 8);
+
+		out = (__m128i *) (samp + i);
+		_mm_storeu_si128 (out + 0, _mm_add_epi32 (_mm_loadu_si128 (out + 0), _mm_unpacklo_epi32 (l0, r0)));
+		_mm_storeu_si128 (out + 1, _mm_add_epi32 (_mm_loadu_si128 (out + 1), _mm_unpackhi_epi32 (l0, r0)));
+		_mm_storeu_si128 (out + 2, _mm_add_epi32 (_mm_loadu_si128 (out + 2), _mm_unpacklo_epi32 (l1, r1)));
+		_mm_storeu_si128 (out + 3, _mm_add_epi32 (_mm_loadu_si128 (out + 3), _mm_unpackhi_epi32 (l1, r1)));
+	}
+
+	S_Paint16_C (samp + i, sfx + i, count - i, leftvol, rightvol);
+}
+
+static void S_ClipStereo16_SSE2 (short *out, const int *in, int count)
+{
+	__m128i		a, b;
+	int			i;
+
+	// packssdw saturates exactly like the scalar clamp
+	for (i = 0; i + 8 <= count; i += 8)
+	{
+		a = _mm_srai_epi32 (_mm_loadu_si128 ((const __m128i *) (in + i)), 8);
+		b = _mm_srai_epi32 (_mm_loadu_si128 ((const __m128i *) (in + i + 4)), 8);
+		_mm_storeu_si128 ((__m128i *) (out + i), _mm_packs_epi32 (a, b));
+	}
+
+	S_ClipStereo16_C (out + i, in + i, count - i);
+}
+#endif
+
+#ifdef Q_AVX2
+#include <immintrin.h>
+
+static Q_TARGET_AVX2 void S_Paint8_AVX2 (portable_samplepair_t *samp, const byte *sfx, int count, const int *lscale, const int *rscale)
+{
+	__m256i		lmul, rmul, s, l, r, a, b;
+	__m256i		*out;
+	int			i;
+
+	lmul = _mm256_set1_epi32 (lscale[1]);
+	rmul = _mm256_set1_epi32 (rscale[1]);
+
+	for (i = 0; i + 8 <= count; i += 8)
+	{
+		s = _mm256_cvtepi8_epi32 (_mm_loadl_epi64 ((const __m128i *) (sfx + i)));
+		l = _mm256_mullo_epi32 (s, lmul);
+		r = _mm256_mullo_epi32 (s, rmul);
+
+		// the unpacks work within each 128 bit lane
+		a = _mm256_unpacklo_epi32 (l, r);
+		b = _mm256_unpackhi_epi32 (l, r);
+
+		out = (__m256i *) (samp + i);
+		_mm256_storeu_si256 (out + 0, _mm256_add_epi32 (_mm256_loadu_si256 (out + 0), _mm256_permute2x128_si256 (a, b, 0x20)));
+		_mm256_storeu_si256 (out + 1, _mm256_add_epi32 (_mm256_loadu_si256 (out + 1), _mm256_permute2x128_si256 (a, b, 0x31)));
+	}
+
+	S_Paint8_C (samp + i, sfx + i, count - i, lscale, rscale);
+}
+
+static Q_TARGET_AVX2 void S_Paint16_AVX2 (portable_samplepair_t *samp, const short *sfx, int count, int leftvol, int rightvol)
+{
+	__m256i		lvol, rvol, s, l, r, a, b;
+	__m256i		*out;
+	int			i;
+
+	lvol = _mm256_set1_epi32 (leftvol);
+	rvol = _mm256_set1_epi32 (rightvol);
+
+	for (i = 0; i + 8 <= count; i += 8)
+	{
+		s = _mm256_cvtepi16_epi32 (_mm_loadu_si128 ((const __m128i *) (sfx + i)));
+		l = _mm256_srai_epi32 (_mm256_mullo_epi32 (s, lvol), 8);
+		r = _mm256_srai_epi32 (_mm256_mullo_epi32 (s, rvol), 8);
+
+		a = _mm256_unpacklo_epi32 (l, r);
+		b = _mm256_unpackhi_epi32 (l, r);
+
+		out = (__m256i *) (samp + i);
+		_mm256_storeu_si256 (out + 0, _mm256_add_epi32 (_mm256_loadu_si256 (out + 0), _mm256_permute2x128_si256 (a, b, 0x20)));
+		_mm256_storeu_si256 (out + 1, _mm256_add_epi32 (_mm256_loadu_si256 (out + 1), _mm256_permute2x128_si256 (a, b, 0x31)));
+	}
+
+	S_Paint16_C (samp + i, sfx + i, count - i, leftvol, rightvol);
+}
+
+static Q_TARGET_AVX2 void S_ClipStereo16_AVX2 (short *out, const int *in, int count)
+{
+	__m256i		a, b;
+	int			i;
+
+	for (i = 0; i + 16 <= count; i += 16)
+	{
+		a = _mm256_srai_epi32 (_mm256_loadu_si256 ((const __m256i *) (in + i)), 8);
+		b = _mm256_srai_epi32 (_mm256_loadu_si256 ((const __m256i *) (in + i + 8)), 8);
+
+		// packssdw interleaves the lanes, put them back in order
+		_mm256_storeu_si256 ((__m256i *) (out + i), _mm256_permute4x64_epi64 (_mm256_packs_epi32 (a, b), 0xd8));
 	}
+
+	S_ClipStereo16_C (out + i, in + i, count - i);
+}
+#endif
+
+static paint8_t			snd_paint8 = S_Paint8_C;
+static paint16_t		snd_paint16 = S_Paint16_C;
+static clipstereo16_t	snd_clipstereo16 = S_ClipStereo16_C;
+
+/*
+================
+S_SetMixSIMD
+================
+*/
+static void S_SetMixSIMD (int level)
+{
+	snd_paint8 = S_Paint8_C;
+	snd_paint16 = S_Paint16_C;
+	snd_clipstereo16 = S_ClipStereo16_C;
+
+#ifdef Q_AVX2
+	if (level >= SIMD_AVX2)
+	{
+		snd_paint8 = S_Paint8_AVX2;
+		snd_paint16 = S_Paint16_AVX2;
+		snd_clipstereo16 = S_ClipStereo16_AVX2;
+		return;
+	}
+#endif
+#ifdef Q_SSE2
+	if (level >= SIMD_SSE2)
+	{
+		snd_paint8 = S_Paint8_SSE2;
+		snd_paint16 = S_Paint16_SSE2;
+		snd_clipstereo16 = S_ClipStereo16_SSE2;
+	}
+#endif
 }
 
 static void S_TransferStereo16 (unsigned long *pbuf, int endtime)
@@ -78,7 +330,7 @@ static void S_TransferStereo16 (unsigned long *pbuf, int endtime)
 		snd_linear_count <<= 1;
 
 		// write a linear blast of samples
-		S_WriteLinearBlastStereo16 ();
+		snd_clipstereo16 (snd_out, snd_p, snd_linear_count);
 
 		snd_p += snd_linear_count;
 		lpaintedtime += (snd_linear_count >> 1);
@@ -185,14 +437,8 @@ CHANNEL MIXING
 ===============================================================================
 */
 
-static void S_PaintChannelFrom8(channel_t *ch, sfxcache_t *sc, int count, int offset)
+static void S_PaintChannelFrom8 (channel_t *ch, sfxcache_t *sc, int count, int offset)
 {
-	int 	data;
-	int		*lscale, *rscale;
-	unsigned char *sfx;
-	int		i;
-	portable_samplepair_t	*samp;
-
 	if (ch->leftvol > 255)
 		ch->leftvol = 255;
 	if (ch->rightvol > 255)
@@ -200,45 +446,16 @@ static void S_PaintChannelFrom8(channel_t *ch, sfxcache_t *sc, int count, int of
 
 	//ZOID-- >>11 has been changed to >>3, >>11 didn't make much sense
 	//as it would always be zero.
-	lscale = snd_scaletable[ch->leftvol >> 3];
-	rscale = snd_scaletable[ch->rightvol >> 3];
-	sfx = (signed char *)sc->data + ch->pos;
-
-	samp = &paintbuffer[offset];
-
-	for (i = 0; i < count; i++, samp++)
-	{
-		data = sfx[i];
-		samp->left += lscale[data];
-		samp->right += rscale[data];
-	}
+	snd_paint8 (&paintbuffer[offset], sc->data + ch->pos, count,
+		snd_scaletable[ch->leftvol >> 3], snd_scaletable[ch->rightvol >> 3]);
 
 	ch->pos += count;
 }
 
-static void S_PaintChannelFrom16(channel_t *ch, sfxcache_t *sc, int count, int offset)
+static void S_PaintChannelFrom16 (channel_t *ch, sfxcache_t *sc, int count, int offset)
 {
-	int data;
-	int left, right;
-	int leftvol, rightvol;
-	signed short *sfx;
-	int	i;
-	portable_samplepair_t	*samp;
-
-	leftvol = ch->leftvol * snd_vol;
-	rightvol = ch->rightvol * snd_vol;
-	sfx = (signed short *)sc->data + ch->pos;
-
-	samp = &paintbuffer[offset];
-
-	for (i = 0; i < count; i++, samp++)
-	{
-		data = sfx[i];
-		left = (data * leftvol) >> 8;
-		right = (data * rightvol) >> 8;
-		samp->left += left;
-		samp->right += right;
-	}
+	snd_paint16 (&paintbuffer[offset], (short *) sc->data + ch->pos, count,
+		ch->leftvol * snd_vol, ch->rightvol * snd_vol);
 
 	ch->pos += count;
 }
@@ -332,7 +549,7 @@ void S_PaintChannels (int endtime)
 				if (ch->end - ltime < count)
 					count = ch->end - ltime;
 
-				sc = S_LoadSound (ch->sfx);
+				sc = S_MixSound (ch->sfx);
 
 				if (!sc)
 					break;
@@ -389,6 +606,8 @@ void S_InitScaletable (void)
 
 	s_volume->modified = false;
 
+	S_SetMixSIMD (Com_SIMDLevel ());
+
 	for (i = 0; i < 32; i++)
 	{
 		scale = i * 8 * 256 * Q_Clamp(0, 1, s_volume->value);
@@ -397,3 +616,144 @@ void S_InitScaletable (void)
 			snd_scaletable[i][j] = ((signed char) j) * scale;
 	}
 }
+
+
+/*
+===============================================================================
+
+MIXER BENCHMARK
+
+===============================================================================
+*/
+
+#define	MIXBENCH_SAMPLES	(PAINTBUFFER_SIZE * 8)
+
+/*
+===================
+S_MixBenchRender
+
+Every channel starts at an odd offset and stops short of the end, so
+the kernels' unaligned loads and scalar tails are run too
+===================
+*/
+static void S_MixBenchRender (channel_t *chans, int numchans, sfxcache_t **sc, short *out)
+{
+	channel_t	*ch;
+	int			i, done, skip;
+
+	for (done = 0; done < MIXBENCH_SAMPLES; done += PAINTBUFFER_SIZE)
+	{
+		memset (paintbuffer, 0, sizeof (paintbuffer));
+
+		for (i = 0, ch = chans; i < numchans; i++, ch++)
+		{
+			skip = i % 7;
+			ch->pos = (i * 331 + done) % (MIXBENCH_SAMPLES - PAINTBUFFER_SIZE);
+			ch->leftvol = (i * 37 + done / PAINTBUFFER_SIZE * 11) & 255;
+			ch->rightvol = 255 - ch->leftvol;
+
+			if (i & 1)
+				S_PaintChannelFrom16 (ch, sc[1], PAINTBUFFER_SIZE - skip * 2, skip);
+			else
+				S_PaintChannelFrom8 (ch, sc[0], PAINTBUFFER_SIZE - skip * 2, skip);
+		}
+
+		snd_clipstereo16 (out + done * 2, (int *) paintbuffer, PAINTBUFFER_SIZE * 2);
+	}
+}
+
+/*
+===================
+S_MixBench_f
+
+snd_mixbench [channels] [passes]
+
+Mixes 8 and 16 bit noise into a stereo 16 bit buffer with each mixer
+the cpu has, no sound device is needed. The scalar mix is the
+reference the vector ones have to match sample for sample
+===================
+*/
+void S_MixBench_f (void)
+{
+	sfxcache_t	*sc[2];
+	channel_t	*chans;
+	short		*out, *ref;
+	int			numchans, passes, level, maxlevel, i, j;
+	unsigned	seed, start, usec;
+	qboolean	mismatch;
+
+	numchans = Cmd_Argc () > 1 ? atoi (Cmd_Argv (1)) : MAX_CHANNELS;
+	passes = Cmd_Argc () > 2 ? atoi (Cmd_Argv (2)) : 20;
+
+	if (numchans < 1)
+		numchans = 1;
+
+	if (passes < 1)
+		passes = 1;
+
+	// loud enough that the sum clips
+	for (i = 0, seed = 0x1234; i < 2; i++)
+	{
+		sc[i] = Z_Malloc (sizeof (sfxcache_t) + MIXBENCH_SAMPLES * (i + 1));
+		sc[i]->length = MIXBENCH_SAMPLES;
+		sc[i]->loopstart = -1;
+		sc[i]->speed = dma.speed ? dma.speed : 22050;
+		sc[i]->width = i + 1;
+
+		for (j = 0; j < MIXBENCH_SAMPLES; j++)
+		{
+			seed = seed * 1103515245 + 12345;
+
+			if (i)
+				((short *) sc[i]->data)[j] = seed >> 16;
+			else
+				sc[i]->data[j] = seed >> 24;
+		}
+	}
+
+	chans = Z_Malloc (sizeof (channel_t) * numchans);
+	out = Z_Malloc (MIXBENCH_SAMPLES * 2 * sizeof (short) * 2);
+	ref = out + MIXBENCH_SAMPLES * 2;
+
+	S_InitScaletable ();
+	snd_vol = Q_Clamp (0, 1, s_volume->value) * 256;
+
+	maxlevel = Com_SIMDLevel ();
+	mismatch = false;
+
+	// the paintbuffer belongs to the mixer thread
+	S_MixLock ();
+
+	S_SetMixSIMD (SIMD_NONE);
+	S_MixBenchRender (chans, numchans, sc, ref);
+
+	Com_Printf ("%i channels, %i samples, %i passes\n", numchans, MIXBENCH_SAMPLES, passes);
+
+	for (level = SIMD_NONE; level <= maxlevel; level++)
+	{
+		S_SetMixSIMD (level);
+		start = Sys_Microseconds ();
+
+		for (i = 0; i < passes; i++)
+			S_MixBenchRender (chans, numchans, sc, out);
+
+		usec = Sys_Microseconds () - start;
+		Com_Printf ("mix %-5s : %8.1f usec, %6.1f nsec/sample/channel, %5.0fx realtime at 44 kHz\n", Com_SIMDName (level),
+			(float) usec / passes, (float) usec * 1000 / ((double) passes * MIXBENCH_SAMPLES * numchans),
+			usec ? (double) passes * MIXBENCH_SAMPLES * 1000000 / (44100.0 * usec) : 0.0);
+
+		if (memcmp (out, ref, MIXBENCH_SAMPLES * 2 * sizeof (short)))
+			mismatch = true;
+	}
+
+	S_SetMixSIMD (maxlevel);
+	S_MixUnlock ();
+
+	if (mismatch)
+		Com_Printf (S_COLOR_RED "mixes differ!\n");
+
+	Z_Free (out);
+	Z_Free (chans);
+	Z_Free (sc[1]);
+	Z_Free (sc[0]);
+}
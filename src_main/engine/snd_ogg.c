@@ -40,7 +40,16 @@ int ogg_bigendian = 1;
 int ogg_bigendian = 0;
 #endif
 
-byte *ogg_buffer;			// File buffer
+// the compressed file is read as it is decoded rather than loaded whole,
+// FS_Read treats reading past the end as fatal so reads are clamped
+typedef struct
+{
+	fileHandle_t	f;
+	int				size;
+	int				pos;
+} oggfile_t;
+
+oggfile_t ogg_file;			// File being played
 char ovBuf[4096];           // Buffer for sound
 OggVorbis_File ovFile;		// Ogg Vorbis file
 vorbis_info *ogg_info;		// Ogg Vorbis file information
@@ -57,6 +66,73 @@ cvar_t *ogg_sequence;		// Sequence play indicator
 
 void OGG_LoadFileList (void);
 
+/*
+===========
+OGG_ReadFunc
+===========
+*/
+static size_t OGG_ReadFunc (void *ptr, size_t size, size_t nmemb, void *datasource)
+{
+	oggfile_t	*file = datasource;
+	int			len;
+
+	if (!size)
+		return 0;
+
+	len = size * nmemb;
+
+	if (len > file->size - file->pos)
+		len = (file->size - file->pos) / size * size;
+
+	if (len <= 0)
+		return 0;
+
+	len = FS_Read (ptr, len, file->f);
+	file->pos += len;
+
+	return len / size;
+}
+
+/*
+===========
+OGG_CloseFunc
+===========
+*/
+static int OGG_CloseFunc (void *datasource)
+{
+	oggfile_t	*file = datasource;
+
+	if (file->f)
+		FS_FCloseFile (file->f);
+
+	file->f = 0;
+
+	return 0;
+}
+
+// no seeking, vorbisfile would seek to the end of every file it opens,
+// and seeking in a pak means reading up to the offset again
+static ov_callbacks ogg_callbacks = {OGG_ReadFunc, NULL, OGG_CloseFunc, NULL};
+
+/*
+===========
+OGG_OpenFile
+===========
+*/
+static qboolean OGG_OpenFile (char *name, oggfile_t *file)
+{
+	file->pos = 0;
+	file->size = FS_FOpenFile (name, &file->f, FS_READ, false);
+
+	if (file->size == -1)
+	{
+		file->f = 0;
+		return false;
+	}
+
+	return true;
+}
+
 // console commands
 void OGG_ListCmd (void);
 void OGG_PauseCmd (void);
@@ -118,7 +194,6 @@ void OGG_Init(void)
 	// Initialize variables
 	if (ogg_first_init)
 	{
-		ogg_buffer = NULL;
 		ogg_curfile = -1;
 		ogg_info = NULL;
 		ogg_status = STOP;
@@ -168,28 +243,25 @@ void OGG_Shutdown(void)
 ===========
 OGG_Check
 
-Check if the file is a valid Ogg Vorbis file
+Check if the file is a valid Ogg Vorbis file, only the headers are read
 ===========
 */
 static qboolean OGG_Check(char *name)
 {
-	qboolean res = false;
-	byte *buffer;
-	int size;
+	oggfile_t file;
 	OggVorbis_File ovf;
 
-	if ((size = FS_LoadFile(name, (void **)&buffer)) > 0)
-	{
-		if (ov_test(NULL, &ovf, (char *)buffer, size) == 0)
-		{
-			res = true;
-			ov_clear(&ovf);
-		}
+	if (!OGG_OpenFile(name, &file))
+		return false;
 
-		FS_FreeFile(buffer);
+	if (ov_test_callbacks(&file, &ovf, NULL, 0, ogg_callbacks) != 0)
+	{
+		OGG_CloseFunc(&file);
+		return false;
 	}
 
-	return res;
+	ov_clear(&ovf);
+	return true;
 }
 
 /*
@@ -245,7 +317,6 @@ Play Ogg Vorbis file (with absolute or relative index)
 */
 qboolean OGG_Open(ogg_seek_t type, int offset)
 {
-	int size; 
 	int pos = -1;
 	int res;
 
@@ -292,18 +363,17 @@ qboolean OGG_Open(ogg_seek_t type, int offset)
 	}
 
 	// find file
-	if ((size = FS_LoadFile(ogg_filelist[pos], (void **)&ogg_buffer)) == -1)
+	if (!OGG_OpenFile(ogg_filelist[pos], &ogg_file))
 	{
 		Com_Printf(S_COLOR_RED "OGG_Open: could not open %d (%s): %s.\n", pos, ogg_filelist[pos], strerror(errno));
 		return false;
 	}
 
 	// open ogg vorbis file
-	if ((res = ov_open(NULL, &ovFile, (char *)ogg_buffer, size)) < 0)
+	if ((res = ov_open_callbacks(&ogg_file, &ovFile, NULL, 0, ogg_callbacks)) < 0)
 	{
 		Com_Printf(S_COLOR_RED "OGG_Open: '%s' is not a valid Ogg Vorbis file (error %i).\n", ogg_filelist[pos], res);
-		FS_FreeFile(ogg_buffer);
-		ogg_buffer = NULL;
+		OGG_CloseFunc(&ogg_file);
 		return false;
 	}
 
@@ -313,8 +383,6 @@ qboolean OGG_Open(ogg_seek_t type, int offset)
 	{
 		Com_Printf(S_COLOR_RED "OGG_Open: Unable to get stream information for %s.\n", ogg_filelist[pos]);
 		ov_clear(&ovFile);
-		FS_FreeFile(ogg_buffer);
-		ogg_buffer = NULL;
 		return false;
 	}
 
@@ -423,16 +491,11 @@ void OGG_Stop(void)
 		AL_UnqueueRawSamples();
 #endif
 
+	// closes ogg_file too
 	ov_clear(&ovFile);
 	ogg_status = STOP;
 	ogg_info = NULL;
 	ogg_numbufs = 0;
-
-	if (ogg_buffer != NULL)
-	{
-		FS_FreeFile(ogg_buffer);
-		ogg_buffer = NULL;
-	}
 }
 
 /*
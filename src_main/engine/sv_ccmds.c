@@ -354,6 +354,7 @@ void SV_ReadLevelFile (void)
 
 	FS_Read (sv.configstrings, sizeof (sv.configstrings), f);
 	CM_ReadPortalState (f);
+	SV_ClearMulticastCache ();
 	FS_FCloseFile (f);
 
 	Com_sprintf (name, sizeof (name), "%s/save/current/%s.sav", FS_Gamedir(), sv.name);
@@ -1088,6 +1089,109 @@ void SV_ServerCommand_f (void)
 	ge->ServerCommand ();
 }
 
+/*
+===============
+SV_FrameBench_f
+
+Times building the frames of every client in the game, with the full
+edict scan and with the cluster index. The frames built here are thrown
+away, the clients get theirs as usual on the next server frame
+===============
+*/
+void SV_FrameBench_f (void)
+{
+	client_t		*cl;
+	client_frame_t	*frame, oldframe;
+	entity_state_t	*oldents;
+	unsigned		*oldtags;
+	int				i, j, mode, count, numclients;
+	int				oldentindex, oldnext;
+	int				numents[2];
+	unsigned int	start, usec[2];
+	unsigned int	lookups, hits;
+
+	if (sv.state != ss_game)
+	{
+		Com_Printf (S_COLOR_RED "No map loaded.\n");
+		return;
+	}
+
+	count = (Cmd_Argc () > 1) ? atoi (Cmd_Argv (1)) : 100;
+
+	if (count < 1)
+		count = 1;
+
+	SV_FixEntityNumbers ();
+	SV_RefreshClusterIndex ();
+
+	oldentindex = sv_entindex->integer;
+	oldents = Z_Malloc (sizeof (entity_state_t) * CLIENT_ENTITIES);
+	oldtags = Z_Malloc (sizeof (unsigned) * CLIENT_ENTITIES);
+	numclients = 0;
+	usec[0] = usec[1] = 0;
+	numents[0] = numents[1] = 0;
+
+	for (i = 0, cl = svs.clients; i < maxclients->value; i++, cl++)
+	{
+		if (cl->state != cs_spawned)
+			continue;
+
+		// keep everything the next real frame may delta from
+		frame = CLIENT_FRAME (cl, sv.framenum);
+		oldframe = *frame;
+		oldnext = cl->next_client_entities;
+		memcpy (oldents, CLIENT_ENTITY_NUM (cl, 0), sizeof (entity_state_t) * CLIENT_ENTITIES);
+		memcpy (oldtags, CLIENT_ENTITY_TAG (cl, 0), sizeof (unsigned) * CLIENT_ENTITIES);
+
+		for (mode = 0; mode < 2; mode++)
+		{
+			Cvar_SetValue ("sv_entindex", mode);
+			start = Sys_Microseconds ();
+
+			for (j = 0; j < count; j++)
+			{
+				cl->next_client_entities = oldnext;
+				SV_BuildClientFrame (cl, false, &svs.snapshot_workers[0]);
+			}
+
+			usec[mode] += Sys_Microseconds () - start;
+			numents[mode] += frame->num_entities;
+		}
+
+		*frame = oldframe;
+		cl->next_client_entities = oldnext;
+		memcpy (CLIENT_ENTITY_NUM (cl, 0), oldents, sizeof (entity_state_t) * CLIENT_ENTITIES);
+		memcpy (CLIENT_ENTITY_TAG (cl, 0), oldtags, sizeof (unsigned) * CLIENT_ENTITIES);
+		numclients++;
+	}
+
+	Cvar_SetValue ("sv_entindex", oldentindex);
+	Z_Free (oldents);
+	Z_Free (oldtags);
+
+	if (!numclients)
+	{
+		Com_Printf (S_COLOR_RED "No clients in game.\n");
+		return;
+	}
+
+	Com_Printf ("%i clients, %i edicts, %i frames each\n", numclients, ge->num_edicts, count);
+	Com_Printf ("full scan    : %8.2f usec/client, %i entities\n", (float) usec[0] / (numclients * count), numents[0]);
+	Com_Printf ("cluster index: %8.2f usec/client, %i entities\n", (float) usec[1] / (numclients * count), numents[1]);
+
+	if (numents[0] != numents[1])
+		Com_Printf (S_COLOR_YELLOW "WARNING: cluster index sent a different entity count\n");
+
+	// includes the real frames since the workers were allocated
+	for (i = 0, lookups = hits = 0; i < svs.num_snapshot_workers; i++)
+	{
+		lookups += svs.snapshot_workers[i].fatpvs_lookups;
+		hits += svs.snapshot_workers[i].fatpvs_hits;
+	}
+
+	Com_Printf ("fat pvs memo : %u of %u multi cluster lookups shared\n", hits, lookups);
+}
+
 //===========================================================
 
 /*
@@ -1121,5 +1225,15 @@ void SV_InitOperatorCommands (void)
 	Cmd_AddCommand ("killserver", SV_KillServer_f);
 
 	Cmd_AddCommand ("sv", SV_ServerCommand_f);
+
+	Cmd_AddCommand ("sv_framebench", SV_FrameBench_f);
+	Cmd_AddCommand ("sv_loadtest", SV_LoadTest_f);
+	Cmd_AddCommand ("sv_multicaststats", SV_MulticastStats_f);
+	Cmd_AddCommand ("sv_deltastats", SV_DeltaStats_f);
+	Cmd_AddCommand ("sv_areabench", SV_AreaBench_f);
+	Cmd_AddCommand ("cm_visbench", CM_VisBench_f);
+	Cmd_AddCommand ("cm_tracerecord", CM_TraceRecord_f);
+	Cmd_AddCommand ("cm_tracereplay", CM_TraceReplay_f);
+	Cmd_AddCommand ("cm_tracebench", CM_TraceBench_f);
 }
 
@@ -50,6 +50,48 @@ typedef struct
 	int			checkcount;		// to avoid repeated testings
 } cbrush_t;
 
+// flattened copies of the collision tree for tracing, built after the
+// map and the box hull are loaded. a node carries its plane so a step
+// down the tree touches a single 32 byte line, and brushes carry the
+// bounds of their axial sides so most can be skipped without looking
+// at their sides at all
+typedef struct
+{
+	vec3_t		normal;
+	float		dist;
+	int			type;
+	int			children[2];		// negative numbers are leafs
+	int			pad;
+} cflatnode_t;
+
+typedef struct
+{
+	vec3_t		normal;
+	float		dist;
+	cplane_t	*plane;				// copied into the trace on a hit
+	mapsurface_t	*surface;
+} cflatside_t;
+
+typedef struct
+{
+	vec3_t		mins, maxs;			// huge on axes without an axial side
+	int			contents;
+	int			numsides;
+	int			firstside;
+	int			firstblock;			// into cm_sideblocks
+	int			checkcount;
+} cflatbrush_t;
+
+// the same sides again, eight at a time in structure of arrays form
+// for the vector clipping routines
+#define	SIDE_BLOCK		8
+
+typedef struct
+{
+	float		normal[3][SIDE_BLOCK];
+	float		dist[SIDE_BLOCK];
+} csideblock_t;
+
 typedef struct
 {
 	int		numareaportals;
@@ -102,6 +144,11 @@ dareaportal_t map_areaportals[MAX_MAP_AREAPORTALS];
 
 int			numclusters = 1;
 
+cflatnode_t		cm_flatnodes[MAX_MAP_NODES+6];		// extra for box hull
+cflatside_t		cm_flatsides[MAX_MAP_BRUSHSIDES];
+cflatbrush_t	cm_flatbrushes[MAX_MAP_BRUSHES];
+csideblock_t	cm_sideblocks[MAX_MAP_BRUSHSIDES/SIDE_BLOCK + MAX_MAP_BRUSHES];
+
 mapsurface_t	nullsurface;
 
 int			floodvalid;
@@ -110,9 +157,16 @@ qboolean	portalopen[MAX_MAP_AREAPORTALS];
 
 
 cvar_t		*map_noareas;
+cvar_t		*cm_tracecache;
+cvar_t		*cm_flathull;
 
 void	CM_InitBoxHull (void);
 void	FloodAreaConnections (void);
+static void	CM_InitVisCache (void);
+static void	CM_FreeVisCache (void);
+static void	CM_InitFlatHull (void);
+static void	CM_FlattenBoxHull (void);
+static void	CM_SetBrushSIMD (int level);
 
 
 int		c_pointcontents;
@@ -594,6 +648,8 @@ cmodel_t *CM_LoadMap (char *name, qboolean clientload, unsigned *checksum)
 	static unsigned	last_checksum;
 
 	map_noareas = Cvar_Get ("map_noareas", "0", 0);
+	cm_tracecache = Cvar_Get ("cm_tracecache", "1", 0);
+	cm_flathull = Cvar_Get ("cm_flathull", "1", 0);
 
 	if (!strcmp (map_name, name) && (clientload || !Cvar_VariableValue ("flushmap")))
 	{
@@ -617,6 +673,7 @@ cmodel_t *CM_LoadMap (char *name, qboolean clientload, unsigned *checksum)
 	numentitychars = 0;
 	map_entitystring[0] = 0;
 	map_name[0] = 0;
+	CM_FreeVisCache ();
 
 	if (!name || !name[0])
 	{
@@ -624,9 +681,13 @@ cmodel_t *CM_LoadMap (char *name, qboolean clientload, unsigned *checksum)
 		numclusters = 1;
 		numareas = 1;
 		*checksum = 0;
+		CM_InitVisCache ();
 		return &map_cmodels[0];			// cinematic servers won't have anything at all
 	}
 
+	// fs_bench replays what the level opens from here on
+	FS_ResetLoadLog ();
+
 	//
 	// load the file
 	//
@@ -665,6 +726,9 @@ cmodel_t *CM_LoadMap (char *name, qboolean clientload, unsigned *checksum)
 	FS_FreeFile (buf);
 
 	CM_InitBoxHull ();
+	CM_InitFlatHull ();
+	CM_InitVisCache ();
+	CM_ClearTraceCache ();
 
 	memset (portalopen, 0, sizeof (portalopen));
 	FloodAreaConnections ();
@@ -837,6 +901,8 @@ int	CM_HeadnodeForBox (vec3_t mins, vec3_t maxs)
 	box_planes[10].dist = mins[2];
 	box_planes[11].dist = -mins[2];
 
+	CM_FlattenBoxHull ();
+
 	return box_headnode;
 }
 
@@ -887,14 +953,19 @@ int CM_PointLeafnum (vec3_t p)
 CM_BoxLeafnums
 
 Fills in a list of all the leafs touched
+The walk state lives on the caller's stack so several
+threads can gather leafs at the same time
 =============
 */
-int		leaf_count, leaf_maxcount;
-int		*leaf_list;
-float	*leaf_mins, *leaf_maxs;
-int		leaf_topnode;
+typedef struct
+{
+	int		count, maxcount;
+	int		*list;
+	float	*mins, *maxs;
+	int		topnode;
+} boxleafs_t;
 
-void CM_BoxLeafnums_r (int nodenum)
+void CM_BoxLeafnums_r (boxleafs_t *bl, int nodenum)
 {
 	cplane_t	*plane;
 	clipnode_t	*node;
@@ -904,20 +975,20 @@ void CM_BoxLeafnums_r (int nodenum)
 	{
 		if (nodenum < 0)
 		{
-			if (leaf_count >= leaf_maxcount)
+			if (bl->count >= bl->maxcount)
 			{
 				//				Com_Printf ("CM_BoxLeafnums_r: overflow\n");
 				return;
 			}
 
-			leaf_list[leaf_count++] = -1 - nodenum;
+			bl->list[bl->count++] = -1 - nodenum;
 			return;
 		}
 
 		node = &map_nodes[nodenum];
 		plane = node->plane;
-		//		s = BoxOnPlaneSide (leaf_mins, leaf_maxs, plane);
-		s = BOX_ON_PLANE_SIDE (leaf_mins, leaf_maxs, plane);
+		//		s = BoxOnPlaneSide (bl->mins, bl->maxs, plane);
+		s = BOX_ON_PLANE_SIDE (bl->mins, bl->maxs, plane);
 
 		if (s == 1)
 			nodenum = node->children[0];
@@ -926,10 +997,10 @@ void CM_BoxLeafnums_r (int nodenum)
 		else
 		{
 			// go down both
-			if (leaf_topnode == -1)
-				leaf_topnode = nodenum;
+			if (bl->topnode == -1)
+				bl->topnode = nodenum;
 
-			CM_BoxLeafnums_r (node->children[0]);
+			CM_BoxLeafnums_r (bl, node->children[0]);
 			nodenum = node->children[1];
 		}
 	}
@@ -937,20 +1008,22 @@ void CM_BoxLeafnums_r (int nodenum)
 
 int	CM_BoxLeafnums_headnode (vec3_t mins, vec3_t maxs, int *list, int listsize, int headnode, int *topnode)
 {
-	leaf_list = list;
-	leaf_count = 0;
-	leaf_maxcount = listsize;
-	leaf_mins = mins;
-	leaf_maxs = maxs;
+	boxleafs_t	bl;
 
-	leaf_topnode = -1;
+	bl.list = list;
+	bl.count = 0;
+	bl.maxcount = listsize;
+	bl.mins = mins;
+	bl.maxs = maxs;
 
-	CM_BoxLeafnums_r (headnode);
+	bl.topnode = -1;
+
+	CM_BoxLeafnums_r (&bl, headnode);
 
 	if (topnode)
-		*topnode = leaf_topnode;
+		*topnode = bl.topnode;
 
-	return leaf_count;
+	return bl.count;
 }
 
 int	CM_BoxLeafnums (vec3_t mins, vec3_t maxs, int *list, int listsize, int *topnode)
@@ -1065,6 +1138,7 @@ BOX TRACING
 vec3_t	trace_start, trace_end;
 vec3_t	trace_mins, trace_maxs;
 vec3_t	trace_extents;
+vec3_t	trace_absmins, trace_absmaxs;	// swept box, grown by BRUSH_REJECT_EPSILON
 
 trace_t	trace_trace;
 int		trace_contents;
@@ -1460,232 +1534,1704 @@ void CM_RecursiveHullCheck (int num, float p1f, float p2f, vec3_t p1, vec3_t p2)
 }
 
 
+/*
+===============================================================================
 
-//======================================================================
+FLAT HULL
 
-/*
-==================
-CM_BoxTrace
-==================
+Same walk as CM_RecursiveHullCheck and friends over the flattened tree,
+doing the same float operations in the same order so the results are
+bit for bit identical. cm_flathull 0 goes back to the original layout,
+cm_tracebench compares the two.
+
+===============================================================================
 */
-trace_t		CM_BoxTrace (vec3_t start, vec3_t end,
-						 vec3_t mins, vec3_t maxs,
-						 int headnode, int brushmask)
-{
-	int		i;
 
-	checkcount++;		// for multi-check avoidance
+// a brush is only skipped when the swept box is at least this far outside
+// its bounds, so both trace end points are well in front of one of its
+// axial sides and clipping it couldn't have changed the trace
+#define	BRUSH_REJECT_EPSILON	1.0
 
-	c_traces++;			// for statistics, may be zeroed
+/*
+================
+CM_FlattenNode
+================
+*/
+static void CM_FlattenNode (int num)
+{
+	clipnode_t	*in = &map_nodes[num];
+	cflatnode_t	*out = &cm_flatnodes[num];
+
+	VectorCopy (in->plane->normal, out->normal);
+	out->dist = in->plane->dist;
+	out->type = in->plane->type;
+	out->children[0] = in->children[0];
+	out->children[1] = in->children[1];
+	out->pad = 0;
+}
 
-	// fill in a default trace
-	memset (&trace_trace, 0, sizeof (trace_trace));
-	trace_trace.fraction = 1;
-	trace_trace.surface = & (nullsurface.c);
+/*
+================
+CM_FlattenBrush
+================
+*/
+static void CM_FlattenBrush (int num)
+{
+	cbrush_t		*in = &map_brushes[num];
+	cflatbrush_t	*out = &cm_flatbrushes[num];
+	cbrushside_t	*side;
+	cflatside_t		*fs;
+	csideblock_t	*block;
+	cplane_t		*plane;
+	int				i, j, axis;
 
-	if (!numnodes)	// map not loaded
-		return trace_trace;
+	out->contents = in->contents;
+	out->numsides = in->numsides;
+	out->firstside = in->firstbrushside;
+	out->checkcount = 0;
 
-	trace_contents = brushmask;
-	VectorCopy (start, trace_start);
-	VectorCopy (end, trace_end);
-	VectorCopy (mins, trace_mins);
-	VectorCopy (maxs, trace_maxs);
+	for (j = 0; j < 3; j++)
+	{
+		out->mins[j] = -99999999;
+		out->maxs[j] = 99999999;
+	}
 
-	//
-	// check for position test special case
-	//
-	if (start[0] == end[0] && start[1] == end[1] && start[2] == end[2])
+	for (i = 0; i < in->numsides; i++)
 	{
-		int		leafs[1024];
-		int		i, numleafs;
-		vec3_t	c1, c2;
-		int		topnode;
+		side = &map_brushsides[in->firstbrushside + i];
+		plane = side->plane;
 
-		VectorAdd (start, mins, c1);
-		VectorAdd (start, maxs, c2);
+		fs = &cm_flatsides[in->firstbrushside + i];
+		VectorCopy (plane->normal, fs->normal);
+		fs->dist = plane->dist;
+		fs->plane = plane;
+		fs->surface = side->surface;
 
-		for (i = 0; i < 3; i++)
-		{
-			c1[i] -= 1;
-			c2[i] += 1;
-		}
+		// the unused lanes of the last block stay zero
+		block = &cm_sideblocks[out->firstblock + i / SIDE_BLOCK];
 
-		numleafs = CM_BoxLeafnums_headnode (c1, c2, leafs, 1024, headnode, &topnode);
+		for (j = 0; j < 3; j++)
+			block->normal[j][i % SIDE_BLOCK] = plane->normal[j];
 
-		for (i = 0; i < numleafs; i++)
-		{
-			CM_TestInLeaf (leafs[i]);
+		block->dist[i % SIDE_BLOCK] = plane->dist;
 
-			if (trace_trace.allsolid)
+		// only sides that face straight along an axis bound the brush
+		for (j = 0, axis = -1; j < 3; j++)
+		{
+			if (plane->normal[j] == 1 || plane->normal[j] == -1)
+				axis = j;
+			else if (plane->normal[j] != 0)
 				break;
 		}
 
-		VectorCopy (start, trace_trace.endpos);
-		return trace_trace;
-	}
-
-	//
-	// check for point special case
-	//
-	if (mins[0] == 0 && mins[1] == 0 && mins[2] == 0
-			&& maxs[0] == 0 && maxs[1] == 0 && maxs[2] == 0)
-	{
-		trace_ispoint = true;
-		VectorClear (trace_extents);
-	}
-	else
-	{
-		trace_ispoint = false;
-		trace_extents[0] = -mins[0] > maxs[0] ? -mins[0] : maxs[0];
-		trace_extents[1] = -mins[1] > maxs[1] ? -mins[1] : maxs[1];
-		trace_extents[2] = -mins[2] > maxs[2] ? -mins[2] : maxs[2];
-	}
-
-	//
-	// general sweeping through world
-	//
-	CM_RecursiveHullCheck (headnode, 0, 1, start, end);
+		if (j != 3 || axis == -1)
+			continue;
 
-	if (trace_trace.fraction == 1)
-	{
-		VectorCopy (end, trace_trace.endpos);
-	}
-	else
-	{
-		for (i = 0; i < 3; i++)
-			trace_trace.endpos[i] = start[i] + trace_trace.fraction * (end[i] - start[i]);
+		if (plane->normal[axis] > 0)
+		{
+			if (plane->dist < out->maxs[axis])
+				out->maxs[axis] = plane->dist;
+		}
+		else
+		{
+			if (-plane->dist > out->mins[axis])
+				out->mins[axis] = -plane->dist;
+		}
 	}
-
-	return trace_trace;
 }
 
-
 /*
-==================
-CM_TransformedBoxTrace
-
-Handles offseting and rotation of the end points for moving and
-rotating entities
-==================
+================
+CM_InitFlatHull
+================
 */
-#ifdef _WIN32
-#pragma optimize( "", off )
-#endif
-
-
-trace_t		CM_TransformedBoxTrace (vec3_t start, vec3_t end,
-									vec3_t mins, vec3_t maxs,
-									int headnode, int brushmask,
-									vec3_t origin, vec3_t angles)
+static void CM_InitFlatHull (void)
 {
-	trace_t		trace;
-	vec3_t		start_l, end_l;
-	vec3_t		a;
-	vec3_t		forward, right, up;
-	vec3_t		temp;
-	qboolean	rotated;
+	int		i, numblocks;
 
-	// subtract origin offset
-	VectorSubtract (start, origin, start_l);
-	VectorSubtract (end, origin, end_l);
+	// includes the box hull
+	for (i = 0; i < numnodes + 6; i++)
+		CM_FlattenNode (i);
 
-	// rotate start and end into the models frame of reference
-	if (headnode != box_headnode &&
-			(angles[0] || angles[1] || angles[2]))
-		rotated = true;
-	else
-		rotated = false;
+	memset (cm_sideblocks, 0, sizeof (cm_sideblocks));
 
-	if (rotated)
+	for (i = 0, numblocks = 0; i < numbrushes + 1; i++)
 	{
-		AngleVectors (angles, forward, right, up);
-
-		VectorCopy (start_l, temp);
-		start_l[0] = DotProduct (temp, forward);
-		start_l[1] = -DotProduct (temp, right);
-		start_l[2] = DotProduct (temp, up);
+		cm_flatbrushes[i].firstblock = numblocks;
+		numblocks += (map_brushes[i].numsides + SIDE_BLOCK - 1) / SIDE_BLOCK;
 
-		VectorCopy (end_l, temp);
-		end_l[0] = DotProduct (temp, forward);
-		end_l[1] = -DotProduct (temp, right);
-		end_l[2] = DotProduct (temp, up);
+		CM_FlattenBrush (i);
 	}
 
-	// sweep the box through the model
-	trace = CM_BoxTrace (start_l, end_l, mins, maxs, headnode, brushmask);
+	CM_SetBrushSIMD (Com_SIMDLevel ());
+}
 
-	if (rotated && trace.fraction != 1.0)
-	{
-		// FIXME: figure out how to do this with existing angles
-		VectorNegate (angles, a);
-		AngleVectors (a, forward, right, up);
+/*
+================
+CM_FlattenBoxHull
 
-		VectorCopy (trace.plane.normal, temp);
-		trace.plane.normal[0] = DotProduct (temp, forward);
-		trace.plane.normal[1] = -DotProduct (temp, right);
-		trace.plane.normal[2] = DotProduct (temp, up);
-	}
+The box planes change for every entity that gets clipped against
+================
+*/
+static void CM_FlattenBoxHull (void)
+{
+	int		i;
 
-	trace.endpos[0] = start[0] + trace.fraction * (end[0] - start[0]);
-	trace.endpos[1] = start[1] + trace.fraction * (end[1] - start[1]);
-	trace.endpos[2] = start[2] + trace.fraction * (end[2] - start[2]);
+	for (i = 0; i < 6; i++)
+		cm_flatnodes[box_headnode + i].dist = map_nodes[box_headnode + i].plane->dist;
 
-	return trace;
+	CM_FlattenBrush (box_brush - map_brushes);
 }
 
-#ifdef _WIN32
-#pragma optimize( "", on )
-#endif
-
-
-
 /*
-===============================================================================
-
-PVS / PHS
-
-===============================================================================
+================
+CM_BrushOutsideTrace
+================
 */
+static qboolean CM_BrushOutsideTrace (cflatbrush_t *brush)
+{
+	return trace_absmins[0] > brush->maxs[0] || trace_absmaxs[0] < brush->mins[0]
+		|| trace_absmins[1] > brush->maxs[1] || trace_absmaxs[1] < brush->mins[1]
+		|| trace_absmins[2] > brush->maxs[2] || trace_absmaxs[2] < brush->mins[2];
+}
 
 /*
-===================
-CM_DecompressVis
-===================
+================
+CM_FlatClipBoxToBrush
+================
 */
-void CM_DecompressVis (byte *in, byte *out)
+static void CM_FlatClipBoxToBrush (vec3_t mins, vec3_t maxs, vec3_t p1, vec3_t p2,
+								   trace_t *trace, cflatbrush_t *brush)
 {
-	int		c;
-	byte	*out_p;
-	int		row;
-
-	row = (numclusters + 7) >> 3;
-	out_p = out;
+	int			i, j;
+	float		dist;
+	float		enterfrac, leavefrac;
+	vec3_t		ofs;
+	float		d1, d2;
+	qboolean	getout, startout;
+	float		f;
+	cflatside_t	*side, *leadside;
 
-	if (!in || !numvisibility)
-	{
-		// no vis info, so make all visible
-		while (row)
-		{
-			*out_p++ = 0xff;
-			row--;
-		}
+	enterfrac = -1;
+	leavefrac = 1;
 
+	if (!brush->numsides)
 		return;
-	}
 
-	do
-	{
-		if (*in)
-		{
-			*out_p++ = *in++;
-			continue;
-		}
+	c_brush_traces++;
 
-		c = in[1];
-		in += 2;
+	getout = false;
+	startout = false;
+	leadside = NULL;
 
-		if ((out_p - out) + c > row)
+	for (i = 0, side = &cm_flatsides[brush->firstside]; i < brush->numsides; i++, side++)
+	{
+		if (!trace_ispoint)
+		{
+			// push the plane out apropriately for mins/maxs
+			for (j = 0; j < 3; j++)
+			{
+				if (side->normal[j] < 0)
+					ofs[j] = maxs[j];
+				else
+					ofs[j] = mins[j];
+			}
+
+			dist = DotProduct (ofs, side->normal);
+			dist = side->dist - dist;
+		}
+		else
+		{
+			// special point case
+			dist = side->dist;
+		}
+
+		d1 = DotProduct (p1, side->normal) - dist;
+		d2 = DotProduct (p2, side->normal) - dist;
+
+		if (d2 > 0)
+			getout = true;	// endpoint is not in solid
+
+		if (d1 > 0)
+			startout = true;
+
+		// if completely in front of face, no intersection
+		if (d1 > 0 && d2 >= d1)
+			return;
+
+		if (d1 <= 0 && d2 <= 0)
+			continue;
+
+		// crosses face
+		if (d1 > d2)
+		{
+			// enter
+			f = (d1 - DIST_EPSILON) / (d1 - d2);
+
+			if (f > enterfrac)
+			{
+				enterfrac = f;
+				leadside = side;
+			}
+		}
+		else
+		{
+			// leave
+			f = (d1 + DIST_EPSILON) / (d1 - d2);
+
+			if (f < leavefrac)
+				leavefrac = f;
+		}
+	}
+
+	if (!startout)
+	{
+		// original point was inside brush
+		trace->startsolid = true;
+
+		if (!getout)
+			trace->allsolid = true;
+
+		return;
+	}
+
+	if (enterfrac < leavefrac)
+	{
+		if (enterfrac > -1 && enterfrac < trace->fraction)
+		{
+			if (enterfrac < 0)
+				enterfrac = 0;
+
+			trace->fraction = enterfrac;
+			trace->plane = *leadside->plane;
+			trace->surface = & (leadside->surface->c);
+			trace->contents = brush->contents;
+		}
+	}
+}
+
+/*
+================
+CM_FlatTestBoxInBrush
+================
+*/
+static void CM_FlatTestBoxInBrush (vec3_t mins, vec3_t maxs, vec3_t p1,
+								   trace_t *trace, cflatbrush_t *brush)
+{
+	int			i, j;
+	float		dist;
+	vec3_t		ofs;
+	float		d1;
+	cflatside_t	*side;
+
+	if (!brush->numsides)
+		return;
+
+	for (i = 0, side = &cm_flatsides[brush->firstside]; i < brush->numsides; i++, side++)
+	{
+		// push the plane out apropriately for mins/maxs
+		for (j = 0; j < 3; j++)
+		{
+			if (side->normal[j] < 0)
+				ofs[j] = maxs[j];
+			else
+				ofs[j] = mins[j];
+		}
+
+		dist = DotProduct (ofs, side->normal);
+		dist = side->dist - dist;
+
+		d1 = DotProduct (p1, side->normal) - dist;
+
+		// if completely in front of face, no intersection
+		if (d1 > 0)
+			return;
+	}
+
+	// inside this brush
+	trace->startsolid = trace->allsolid = true;
+	trace->fraction = 0;
+	trace->contents = brush->contents;
+}
+
+/*
+===============================================================================
+
+SIMD BRUSH CLIPPING
+
+The vector routines work out the distances of four or eight brush sides
+to the trace end points at once, with the same float operations as the
+scalar code, and take the early out if any of them has the trace in
+front of it. The decisions that depend on side order are then made by
+the same scalar code as CM_FlatClipBoxToBrush, so the results match the
+scalar reference exactly. cm_tracebench compares them.
+
+===============================================================================
+*/
+
+#define	MAX_SIMD_SIDES	64			// brushes with more sides use the scalar code
+
+typedef void (*clipbrush_t) (vec3_t mins, vec3_t maxs, vec3_t p1, vec3_t p2, trace_t *trace, cflatbrush_t *brush);
+typedef void (*testbrush_t) (vec3_t mins, vec3_t maxs, vec3_t p1, trace_t *trace, cflatbrush_t *brush);
+
+static clipbrush_t	cm_clipbrush = CM_FlatClipBoxToBrush;
+static testbrush_t	cm_testbrush = CM_FlatTestBoxInBrush;
+
+/*
+================
+CM_ClipBoxToSides
+
+The part of CM_FlatClipBoxToBrush after the side distances are known,
+for brushes where no side has the whole trace in front of it
+================
+*/
+static void CM_ClipBoxToSides (const float *d1s, const float *d2s, trace_t *trace, cflatbrush_t *brush)
+{
+	int			i;
+	float		enterfrac, leavefrac;
+	float		d1, d2;
+	qboolean	getout, startout;
+	float		f;
+	cflatside_t	*leadside;
+
+	enterfrac = -1;
+	leavefrac = 1;
+	getout = false;
+	startout = false;
+	leadside = NULL;
+
+	for (i = 0; i < brush->numsides; i++)
+	{
+		d1 = d1s[i];
+		d2 = d2s[i];
+
+		if (d2 > 0)
+			getout = true;	// endpoint is not in solid
+
+		if (d1 > 0)
+			startout = true;
+
+		if (d1 <= 0 && d2 <= 0)
+			continue;
+
+		// crosses face
+		if (d1 > d2)
+		{
+			// enter
+			f = (d1 - DIST_EPSILON) / (d1 - d2);
+
+			if (f > enterfrac)
+			{
+				enterfrac = f;
+				leadside = &cm_flatsides[brush->firstside + i];
+			}
+		}
+		else
+		{
+			// leave
+			f = (d1 + DIST_EPSILON) / (d1 - d2);
+
+			if (f < leavefrac)
+				leavefrac = f;
+		}
+	}
+
+	if (!startout)
+	{
+		// original point was inside brush
+		trace->startsolid = true;
+
+		if (!getout)
+			trace->allsolid = true;
+
+		return;
+	}
+
+	if (enterfrac < leavefrac)
+	{
+		if (enterfrac > -1 && enterfrac < trace->fraction)
+		{
+			if (enterfrac < 0)
+				enterfrac = 0;
+
+			trace->fraction = enterfrac;
+			trace->plane = *leadside->plane;
+			trace->surface = & (leadside->surface->c);
+			trace->contents = brush->contents;
+		}
+	}
+}
+
+static void CM_BrushInside (trace_t *trace, cflatbrush_t *brush)
+{
+	trace->startsolid = trace->allsolid = true;
+	trace->fraction = 0;
+	trace->contents = brush->contents;
+}
+
+// lanes of a group of sides that hold real sides
+#define	SIDE_LANES(numsides, i, width)	((numsides) - (i) >= (width) ? (1 << (width)) - 1 : (1 << ((numsides) - (i))) - 1)
+
+#ifdef Q_SSE2
+#include <xmmintrin.h>
+
+/*
+================
+CM_ClipBoxToBrush_SSE2 / CM_TestBoxInBrush_SSE2
+================
+*/
+static void CM_ClipBoxToBrush_SSE2 (vec3_t mins, vec3_t maxs, vec3_t p1, vec3_t p2,
+									trace_t *trace, cflatbrush_t *brush)
+{
+	float			d1s[MAX_SIMD_SIDES], d2s[MAX_SIMD_SIDES];
+	__m128			zero, lo[3], hi[3], a[3], b[3];
+	__m128			n0, n1, n2, dist, m0, m1, m2, d1, d2;
+	csideblock_t	*block;
+	int				i, k;
+
+	if (!brush->numsides)
+		return;
+
+	if (brush->numsides > MAX_SIMD_SIDES)
+	{
+		CM_FlatClipBoxToBrush (mins, maxs, p1, p2, trace, brush);
+		return;
+	}
+
+	c_brush_traces++;
+
+	zero = _mm_setzero_ps ();
+
+	for (k = 0; k < 3; k++)
+	{
+		lo[k] = _mm_set1_ps (mins[k]);
+		hi[k] = _mm_set1_ps (maxs[k]);
+		a[k] = _mm_set1_ps (p1[k]);
+		b[k] = _mm_set1_ps (p2[k]);
+	}
+
+	for (i = 0; i < brush->numsides; i += 4)
+	{
+		block = &cm_sideblocks[brush->firstblock + i / SIDE_BLOCK];
+		k = i % SIDE_BLOCK;
+
+		n0 = _mm_loadu_ps (&block->normal[0][k]);
+		n1 = _mm_loadu_ps (&block->normal[1][k]);
+		n2 = _mm_loadu_ps (&block->normal[2][k]);
+		dist = _mm_loadu_ps (&block->dist[k]);
+
+		if (!trace_ispoint)
+		{
+			// push the planes out apropriately for mins/maxs
+			m0 = _mm_cmplt_ps (n0, zero);
+			m1 = _mm_cmplt_ps (n1, zero);
+			m2 = _mm_cmplt_ps (n2, zero);
+			m0 = _mm_or_ps (_mm_and_ps (m0, hi[0]), _mm_andnot_ps (m0, lo[0]));
+			m1 = _mm_or_ps (_mm_and_ps (m1, hi[1]), _mm_andnot_ps (m1, lo[1]));
+			m2 = _mm_or_ps (_mm_and_ps (m2, hi[2]), _mm_andnot_ps (m2, lo[2]));
+
+			dist = _mm_sub_ps (dist, _mm_add_ps (_mm_add_ps (_mm_mul_ps (m0, n0), _mm_mul_ps (m1, n1)), _mm_mul_ps (m2, n2)));
+		}
+
+		d1 = _mm_sub_ps (_mm_add_ps (_mm_add_ps (_mm_mul_ps (a[0], n0), _mm_mul_ps (a[1], n1)), _mm_mul_ps (a[2], n2)), dist);
+		d2 = _mm_sub_ps (_mm_add_ps (_mm_add_ps (_mm_mul_ps (b[0], n0), _mm_mul_ps (b[1], n1)), _mm_mul_ps (b[2], n2)), dist);
+
+		// if completely in front of any face, no intersection
+		if (_mm_movemask_ps (_mm_and_ps (_mm_cmpgt_ps (d1, zero), _mm_cmpge_ps (d2, d1))) & SIDE_LANES (brush->numsides, i, 4))
+			return;
+
+		_mm_storeu_ps (d1s + i, d1);
+		_mm_storeu_ps (d2s + i, d2);
+	}
+
+	CM_ClipBoxToSides (d1s, d2s, trace, brush);
+}
+
+static void CM_TestBoxInBrush_SSE2 (vec3_t mins, vec3_t maxs, vec3_t p1,
+									trace_t *trace, cflatbrush_t *brush)
+{
+	__m128			zero, lo[3], hi[3], a[3];
+	__m128			n0, n1, n2, dist, m0, m1, m2, d1;
+	csideblock_t	*block;
+	int				i, k;
+
+	if (!brush->numsides)
+		return;
+
+	zero = _mm_setzero_ps ();
+
+	for (k = 0; k < 3; k++)
+	{
+		lo[k] = _mm_set1_ps (mins[k]);
+		hi[k] = _mm_set1_ps (maxs[k]);
+		a[k] = _mm_set1_ps (p1[k]);
+	}
+
+	for (i = 0; i < brush->numsides; i += 4)
+	{
+		block = &cm_sideblocks[brush->firstblock + i / SIDE_BLOCK];
+		k = i % SIDE_BLOCK;
+
+		n0 = _mm_loadu_ps (&block->normal[0][k]);
+		n1 = _mm_loadu_ps (&block->normal[1][k]);
+		n2 = _mm_loadu_ps (&block->normal[2][k]);
+
+		m0 = _mm_cmplt_ps (n0, zero);
+		m1 = _mm_cmplt_ps (n1, zero);
+		m2 = _mm_cmplt_ps (n2, zero);
+		m0 = _mm_or_ps (_mm_and_ps (m0, hi[0]), _mm_andnot_ps (m0, lo[0]));
+		m1 = _mm_or_ps (_mm_and_ps (m1, hi[1]), _mm_andnot_ps (m1, lo[1]));
+		m2 = _mm_or_ps (_mm_and_ps (m2, hi[2]), _mm_andnot_ps (m2, lo[2]));
+
+		dist = _mm_sub_ps (_mm_loadu_ps (&block->dist[k]),
+			_mm_add_ps (_mm_add_ps (_mm_mul_ps (m0, n0), _mm_mul_ps (m1, n1)), _mm_mul_ps (m2, n2)));
+		d1 = _mm_sub_ps (_mm_add_ps (_mm_add_ps (_mm_mul_ps (a[0], n0), _mm_mul_ps (a[1], n1)), _mm_mul_ps (a[2], n2)), dist);
+
+		// if completely in front of face, no intersection
+		if (_mm_movemask_ps (_mm_cmpgt_ps (d1, zero)) & SIDE_LANES (brush->numsides, i, 4))
+			return;
+	}
+
+	CM_BrushInside (trace, brush);
+}
+#endif
+
+#ifdef Q_AVX2
+#include <immintrin.h>
+
+/*
+================
+CM_ClipBoxToBrush_AVX2 / CM_TestBoxInBrush_AVX2
+================
+*/
+static Q_TARGET_AVX2 void CM_ClipBoxToBrush_AVX2 (vec3_t mins, vec3_t maxs, vec3_t p1, vec3_t p2,
+												  trace_t *trace, cflatbrush_t *brush)
+{
+	float			d1s[MAX_SIMD_SIDES], d2s[MAX_SIMD_SIDES];
+	__m256			zero, lo[3], hi[3], a[3], b[3];
+	__m256			n0, n1, n2, dist, m0, m1, m2, d1, d2;
+	csideblock_t	*block;
+	int				i, k;
+
+	if (!brush->numsides)
+		return;
+
+	if (brush->numsides > MAX_SIMD_SIDES)
+	{
+		CM_FlatClipBoxToBrush (mins, maxs, p1, p2, trace, brush);
+		return;
+	}
+
+	c_brush_traces++;
+
+	zero = _mm256_setzero_ps ();
+
+	for (k = 0; k < 3; k++)
+	{
+		lo[k] = _mm256_set1_ps (mins[k]);
+		hi[k] = _mm256_set1_ps (maxs[k]);
+		a[k] = _mm256_set1_ps (p1[k]);
+		b[k] = _mm256_set1_ps (p2[k]);
+	}
+
+	for (i = 0, block = &cm_sideblocks[brush->firstblock]; i < brush->numsides; i += SIDE_BLOCK, block++)
+	{
+		n0 = _mm256_loadu_ps (block->normal[0]);
+		n1 = _mm256_loadu_ps (block->normal[1]);
+		n2 = _mm256_loadu_ps (block->normal[2]);
+		dist = _mm256_loadu_ps (block->dist);
+
+		if (!trace_ispoint)
+		{
+			// push the planes out apropriately for mins/maxs
+			m0 = _mm256_blendv_ps (lo[0], hi[0], _mm256_cmp_ps (n0, zero, _CMP_LT_OQ));
+			m1 = _mm256_blendv_ps (lo[1], hi[1], _mm256_cmp_ps (n1, zero, _CMP_LT_OQ));
+			m2 = _mm256_blendv_ps (lo[2], hi[2], _mm256_cmp_ps (n2, zero, _CMP_LT_OQ));
+
+			dist = _mm256_sub_ps (dist, _mm256_add_ps (_mm256_add_ps (_mm256_mul_ps (m0, n0), _mm256_mul_ps (m1, n1)), _mm256_mul_ps (m2, n2)));
+		}
+
+		d1 = _mm256_sub_ps (_mm256_add_ps (_mm256_add_ps (_mm256_mul_ps (a[0], n0), _mm256_mul_ps (a[1], n1)), _mm256_mul_ps (a[2], n2)), dist);
+		d2 = _mm256_sub_ps (_mm256_add_ps (_mm256_add_ps (_mm256_mul_ps (b[0], n0), _mm256_mul_ps (b[1], n1)), _mm256_mul_ps (b[2], n2)), dist);
+
+		// if completely in front of any face, no intersection
+		if (_mm256_movemask_ps (_mm256_and_ps (_mm256_cmp_ps (d1, zero, _CMP_GT_OQ), _mm256_cmp_ps (d2, d1, _CMP_GE_OQ)))
+				& SIDE_LANES (brush->numsides, i, SIDE_BLOCK))
+			return;
+
+		_mm256_storeu_ps (d1s + i, d1);
+		_mm256_storeu_ps (d2s + i, d2);
+	}
+
+	// the scalar code isn't vex encoded
+	_mm256_zeroupper ();
+
+	CM_ClipBoxToSides (d1s, d2s, trace, brush);
+}
+
+static Q_TARGET_AVX2 void CM_TestBoxInBrush_AVX2 (vec3_t mins, vec3_t maxs, vec3_t p1,
+												  trace_t *trace, cflatbrush_t *brush)
+{
+	__m256			zero, lo[3], hi[3], a[3];
+	__m256			n0, n1, n2, dist, m0, m1, m2, d1;
+	csideblock_t	*block;
+	int				i, k;
+
+	if (!brush->numsides)
+		return;
+
+	zero = _mm256_setzero_ps ();
+
+	for (k = 0; k < 3; k++)
+	{
+		lo[k] = _mm256_set1_ps (mins[k]);
+		hi[k] = _mm256_set1_ps (maxs[k]);
+		a[k] = _mm256_set1_ps (p1[k]);
+	}
+
+	for (i = 0, block = &cm_sideblocks[brush->firstblock]; i < brush->numsides; i += SIDE_BLOCK, block++)
+	{
+		n0 = _mm256_loadu_ps (block->normal[0]);
+		n1 = _mm256_loadu_ps (block->normal[1]);
+		n2 = _mm256_loadu_ps (block->normal[2]);
+
+		m0 = _mm256_blendv_ps (lo[0], hi[0], _mm256_cmp_ps (n0, zero, _CMP_LT_OQ));
+		m1 = _mm256_blendv_ps (lo[1], hi[1], _mm256_cmp_ps (n1, zero, _CMP_LT_OQ));
+		m2 = _mm256_blendv_ps (lo[2], hi[2], _mm256_cmp_ps (n2, zero, _CMP_LT_OQ));
+
+		dist = _mm256_sub_ps (_mm256_loadu_ps (block->dist),
+			_mm256_add_ps (_mm256_add_ps (_mm256_mul_ps (m0, n0), _mm256_mul_ps (m1, n1)), _mm256_mul_ps (m2, n2)));
+		d1 = _mm256_sub_ps (_mm256_add_ps (_mm256_add_ps (_mm256_mul_ps (a[0], n0), _mm256_mul_ps (a[1], n1)), _mm256_mul_ps (a[2], n2)), dist);
+
+		// if completely in front of face, no intersection
+		if (_mm256_movemask_ps (_mm256_cmp_ps (d1, zero, _CMP_GT_OQ)) & SIDE_LANES (brush->numsides, i, SIDE_BLOCK))
+			return;
+	}
+
+	CM_BrushInside (trace, brush);
+}
+#endif
+
+/*
+================
+CM_SetBrushSIMD
+================
+*/
+static void CM_SetBrushSIMD (int level)
+{
+	cm_clipbrush = CM_FlatClipBoxToBrush;
+	cm_testbrush = CM_FlatTestBoxInBrush;
+
+#ifdef Q_AVX2
+	if (level >= SIMD_AVX2)
+	{
+		cm_clipbrush = CM_ClipBoxToBrush_AVX2;
+		cm_testbrush = CM_TestBoxInBrush_AVX2;
+		return;
+	}
+#endif
+#ifdef Q_SSE2
+	if (level >= SIMD_SSE2)
+	{
+		cm_clipbrush = CM_ClipBoxToBrush_SSE2;
+		cm_testbrush = CM_TestBoxInBrush_SSE2;
+	}
+#endif
+}
+
+/*
+================
+CM_FlatTraceToLeaf
+================
+*/
+static void CM_FlatTraceToLeaf (int leafnum)
+{
+	int				k;
+	cleaf_t			*leaf;
+	cflatbrush_t	*b;
+	unsigned short	*leafbrush;
+
+	leaf = &map_leafs[leafnum];
+
+	if (!(leaf->contents & trace_contents))
+		return;
+
+	leafbrush = &map_leafbrushes[leaf->firstleafbrush];
+
+	// trace line against all brushes in the leaf
+	for (k = 0; k < leaf->numleafbrushes; k++, leafbrush++)
+	{
+		b = &cm_flatbrushes[*leafbrush];
+
+		if (b->checkcount == checkcount)
+			continue;	// already checked this brush in another leaf
+
+		b->checkcount = checkcount;
+
+		if (!(b->contents & trace_contents))
+			continue;
+
+		if (CM_BrushOutsideTrace (b))
+			continue;
+
+		cm_clipbrush (trace_mins, trace_maxs, trace_start, trace_end, &trace_trace, b);
+
+		if (!trace_trace.fraction)
+			return;
+	}
+}
+
+/*
+================
+CM_FlatTestInLeaf
+================
+*/
+static void CM_FlatTestInLeaf (int leafnum)
+{
+	int				k;
+	cleaf_t			*leaf;
+	cflatbrush_t	*b;
+	unsigned short	*leafbrush;
+
+	leaf = &map_leafs[leafnum];
+
+	if (!(leaf->contents & trace_contents))
+		return;
+
+	leafbrush = &map_leafbrushes[leaf->firstleafbrush];
+
+	for (k = 0; k < leaf->numleafbrushes; k++, leafbrush++)
+	{
+		b = &cm_flatbrushes[*leafbrush];
+
+		if (b->checkcount == checkcount)
+			continue;	// already checked this brush in another leaf
+
+		b->checkcount = checkcount;
+
+		if (!(b->contents & trace_contents))
+			continue;
+
+		if (CM_BrushOutsideTrace (b))
+			continue;
+
+		cm_testbrush (trace_mins, trace_maxs, trace_start, &trace_trace, b);
+
+		if (!trace_trace.fraction)
+			return;
+	}
+}
+
+/*
+==================
+CM_FlatHullCheck
+==================
+*/
+static void CM_FlatHullCheck (int num, float p1f, float p2f, vec3_t p1, vec3_t p2)
+{
+	cflatnode_t	*node;
+	float		t1, t2, offset;
+	float		frac, frac2;
+	float		idist;
+	int			i;
+	vec3_t		mid;
+	int			side;
+	float		midf;
+
+	if (trace_trace.fraction <= p1f)
+		return;		// already hit something nearer
+
+	// if < 0, we are in a leaf node
+	if (num < 0)
+	{
+		CM_FlatTraceToLeaf (-1 - num);
+		return;
+	}
+
+	// find the point distances to the seperating plane
+	// and the offset for the size of the box
+	node = cm_flatnodes + num;
+
+	if (node->type < 3)
+	{
+		t1 = p1[node->type] - node->dist;
+		t2 = p2[node->type] - node->dist;
+		offset = trace_extents[node->type];
+	}
+	else
+	{
+		t1 = DotProduct (node->normal, p1) - node->dist;
+		t2 = DotProduct (node->normal, p2) - node->dist;
+
+		if (trace_ispoint)
+			offset = 0;
+		else
+			offset = fabs (trace_extents[0] * node->normal[0]) +
+					 fabs (trace_extents[1] * node->normal[1]) +
+					 fabs (trace_extents[2] * node->normal[2]);
+	}
+
+	// see which sides we need to consider
+	if (t1 >= offset && t2 >= offset)
+	{
+		CM_FlatHullCheck (node->children[0], p1f, p2f, p1, p2);
+		return;
+	}
+
+	if (t1 < -offset && t2 < -offset)
+	{
+		CM_FlatHullCheck (node->children[1], p1f, p2f, p1, p2);
+		return;
+	}
+
+	// put the crosspoint DIST_EPSILON pixels on the near side
+	if (t1 < t2)
+	{
+		idist = 1.0 / (t1 - t2);
+		side = 1;
+		frac2 = (t1 + offset + DIST_EPSILON) * idist;
+		frac = (t1 - offset + DIST_EPSILON) * idist;
+	}
+	else if (t1 > t2)
+	{
+		idist = 1.0 / (t1 - t2);
+		side = 0;
+		frac2 = (t1 - offset - DIST_EPSILON) * idist;
+		frac = (t1 + offset + DIST_EPSILON) * idist;
+	}
+	else
+	{
+		side = 0;
+		frac = 1;
+		frac2 = 0;
+	}
+
+	// move up to the node
+	if (frac < 0)
+		frac = 0;
+
+	if (frac > 1)
+		frac = 1;
+
+	midf = p1f + (p2f - p1f) * frac;
+
+	for (i = 0; i < 3; i++)
+		mid[i] = p1[i] + frac * (p2[i] - p1[i]);
+
+	CM_FlatHullCheck (node->children[side], p1f, midf, p1, mid);
+
+	// go past the node
+	if (frac2 < 0)
+		frac2 = 0;
+
+	if (frac2 > 1)
+		frac2 = 1;
+
+	midf = p1f + (p2f - p1f) * frac2;
+
+	for (i = 0; i < 3; i++)
+		mid[i] = p1[i] + frac2 * (p2[i] - p1[i]);
+
+	CM_FlatHullCheck (node->children[side^1], midf, p2f, mid, p2);
+}
+
+
+
+//======================================================================
+
+/*
+==================
+CM_DoBoxTrace
+==================
+*/
+static trace_t	CM_DoBoxTrace (vec3_t start, vec3_t end,
+							   vec3_t mins, vec3_t maxs,
+							   int headnode, int brushmask)
+{
+	int		i;
+	qboolean	flat;
+
+	checkcount++;		// for multi-check avoidance
+
+	// fill in a default trace
+	memset (&trace_trace, 0, sizeof (trace_trace));
+	trace_trace.fraction = 1;
+	trace_trace.surface = & (nullsurface.c);
+
+	if (!numnodes)	// map not loaded
+		return trace_trace;
+
+	trace_contents = brushmask;
+	VectorCopy (start, trace_start);
+	VectorCopy (end, trace_end);
+	VectorCopy (mins, trace_mins);
+	VectorCopy (maxs, trace_maxs);
+
+	flat = cm_flathull->integer;
+
+	for (i = 0; i < 3; i++)
+	{
+		trace_absmins[i] = (start[i] < end[i] ? start[i] : end[i]) + mins[i] - BRUSH_REJECT_EPSILON;
+		trace_absmaxs[i] = (start[i] > end[i] ? start[i] : end[i]) + maxs[i] + BRUSH_REJECT_EPSILON;
+	}
+
+	//
+	// check for position test special case
+	//
+	if (start[0] == end[0] && start[1] == end[1] && start[2] == end[2])
+	{
+		int		leafs[1024];
+		int		i, numleafs;
+		vec3_t	c1, c2;
+		int		topnode;
+
+		VectorAdd (start, mins, c1);
+		VectorAdd (start, maxs, c2);
+
+		for (i = 0; i < 3; i++)
+		{
+			c1[i] -= 1;
+			c2[i] += 1;
+		}
+
+		numleafs = CM_BoxLeafnums_headnode (c1, c2, leafs, 1024, headnode, &topnode);
+
+		for (i = 0; i < numleafs; i++)
+		{
+			if (flat)
+				CM_FlatTestInLeaf (leafs[i]);
+			else
+				CM_TestInLeaf (leafs[i]);
+
+			if (trace_trace.allsolid)
+				break;
+		}
+
+		VectorCopy (start, trace_trace.endpos);
+		return trace_trace;
+	}
+
+	//
+	// check for point special case
+	//
+	if (mins[0] == 0 && mins[1] == 0 && mins[2] == 0
+			&& maxs[0] == 0 && maxs[1] == 0 && maxs[2] == 0)
+	{
+		trace_ispoint = true;
+		VectorClear (trace_extents);
+	}
+	else
+	{
+		trace_ispoint = false;
+		trace_extents[0] = -mins[0] > maxs[0] ? -mins[0] : maxs[0];
+		trace_extents[1] = -mins[1] > maxs[1] ? -mins[1] : maxs[1];
+		trace_extents[2] = -mins[2] > maxs[2] ? -mins[2] : maxs[2];
+	}
+
+	//
+	// general sweeping through world
+	//
+	if (flat)
+		CM_FlatHullCheck (headnode, 0, 1, start, end);
+	else
+		CM_RecursiveHullCheck (headnode, 0, 1, start, end);
+
+	if (trace_trace.fraction == 1)
+	{
+		VectorCopy (end, trace_trace.endpos);
+	}
+	else
+	{
+		for (i = 0; i < 3; i++)
+			trace_trace.endpos[i] = start[i] + trace_trace.fraction * (end[i] - start[i]);
+	}
+
+	return trace_trace;
+}
+
+
+/*
+===============================================================================
+
+TRACE CACHE
+
+The world and inline model hulls never change while a map is loaded, so
+a trace through them depends only on its arguments. Identical traces in
+the same server frame, like several monsters checking sight to the same
+player, are answered from a small direct mapped table. The box hull is
+rebuilt for every entity clip and is never cached.
+
+===============================================================================
+*/
+
+#define	TRACE_MEMO			4096	// must be a power of two
+#define	TRACE_BATCH			1024
+
+typedef struct
+{
+	tracequery_t	query;
+	int				frame;			// entry is valid when this is cm_traceframe
+	trace_t			trace;
+} tracememo_t;
+
+typedef struct
+{
+	int		leafnum;
+	int		index;
+} tracesort_t;
+
+static tracememo_t	cm_tracememo[TRACE_MEMO];
+static int			cm_traceframe = 1;
+int					c_tracehits;
+
+static FILE			*cm_tracefile;		// cm_tracerecord output
+
+#define	TRACE_MAGIC		(('R' << 24) + ('T' << 16) + ('M' << 8) + 'C')
+#define	TRACE_VERSION	1
+
+/*
+==================
+CM_ClearTraceCache
+
+Called at the start of every server frame and on map changes
+==================
+*/
+void CM_ClearTraceCache (void)
+{
+	tracequery_t	marker;
+
+	cm_traceframe++;
+
+	// a negative headnode separates frames in a recording
+	if (cm_tracefile)
+	{
+		memset (&marker, 0, sizeof (marker));
+		marker.headnode = -1;
+		fwrite (&marker, sizeof (marker), 1, cm_tracefile);
+	}
+}
+
+static unsigned CM_HashTraceQuery (tracequery_t *q)
+{
+	unsigned	*w = (unsigned *) q;
+	unsigned	hash = 2166136261u;
+	int			i;
+
+	for (i = 0; i < sizeof (*q) / sizeof (unsigned); i++)
+		hash = (hash ^ w[i]) * 16777619u;
+
+	return hash ^ (hash >> 15);
+}
+
+/*
+==================
+CM_BoxTrace
+==================
+*/
+trace_t		CM_BoxTrace (vec3_t start, vec3_t end,
+						 vec3_t mins, vec3_t maxs,
+						 int headnode, int brushmask)
+{
+	tracequery_t	q;
+	tracememo_t		*memo;
+	unsigned		prof;
+
+	c_traces++;			// for statistics, may be zeroed
+
+	if (headnode == box_headnode || !numnodes)
+		return CM_DoBoxTrace (start, end, mins, maxs, headnode, brushmask);
+
+	VectorCopy (start, q.start);
+	VectorCopy (end, q.end);
+	VectorCopy (mins, q.mins);
+	VectorCopy (maxs, q.maxs);
+	q.headnode = headnode;
+	q.brushmask = brushmask;
+
+	if (cm_tracefile)
+		fwrite (&q, sizeof (q), 1, cm_tracefile);
+
+	if (!cm_tracecache->integer)
+		return CM_DoBoxTrace (start, end, mins, maxs, headnode, brushmask);
+
+	// compared bit for bit, so -0 and 0 are different traces
+	memo = &cm_tracememo[CM_HashTraceQuery (&q) & (TRACE_MEMO - 1)];
+
+	if (memo->frame == cm_traceframe && !memcmp (&memo->query, &q, sizeof (q)))
+	{
+		c_tracehits++;
+		trace_trace = memo->trace;
+		return trace_trace;
+	}
+
+	prof = Prof_Begin ();
+
+	memo->query = q;
+	memo->frame = cm_traceframe;
+	memo->trace = CM_DoBoxTrace (start, end, mins, maxs, headnode, brushmask);
+
+	Prof_End ("CM_BoxTrace", prof);
+
+	return memo->trace;
+}
+
+static int CM_SortTraceQueries (const void *a, const void *b)
+{
+	const tracesort_t	*qa = a;
+	const tracesort_t	*qb = b;
+
+	if (qa->leafnum != qb->leafnum)
+		return qa->leafnum - qb->leafnum;
+
+	return qa->index - qb->index;
+}
+
+/*
+==================
+CM_BoxTraceBatch
+
+Traces a set of independent queries. They are run in the order of the
+leaf their start point is in, and leafs are numbered depth first, so
+traces through the same part of the tree run back to back and find its
+nodes, brushes and planes still in cache. Duplicates within the batch
+are answered by the trace cache. Results come back in query order.
+==================
+*/
+void CM_BoxTraceBatch (tracequery_t *queries, trace_t *results, int count)
+{
+	tracesort_t		order[TRACE_BATCH];
+	tracequery_t	*q;
+	int				i, n;
+
+	for ( ; count > 0; queries += n, results += n, count -= n)
+	{
+		n = count < TRACE_BATCH ? count : TRACE_BATCH;
+
+		for (i = 0; i < n; i++)
+		{
+			order[i].leafnum = numnodes ? CM_PointLeafnum_r (queries[i].start, queries[i].headnode) : 0;
+			order[i].index = i;
+		}
+
+		qsort (order, n, sizeof (order[0]), CM_SortTraceQueries);
+
+		for (i = 0; i < n; i++)
+		{
+			q = &queries[order[i].index];
+			results[order[i].index] = CM_BoxTrace (q->start, q->end, q->mins, q->maxs, q->headnode, q->brushmask);
+		}
+	}
+}
+
+/*
+==================
+CM_TraceRecord_f
+
+cm_tracerecord [filename] starts writing every world and inline model
+trace to <gamedir>/<filename>.trc, without a name it stops
+==================
+*/
+void CM_TraceRecord_f (void)
+{
+	char	name[MAX_OSPATH];
+	int		header[2];
+
+	if (cm_tracefile)
+	{
+		Com_Printf ("Stopped recording traces.\n");
+		fclose (cm_tracefile);
+		cm_tracefile = NULL;
+	}
+
+	if (Cmd_Argc () < 2)
+		return;
+
+	if (!map_name[0])
+	{
+		Com_Printf (S_COLOR_RED "No map loaded.\n");
+		return;
+	}
+
+	Com_sprintf (name, sizeof (name), "%s/%s.trc", FS_Gamedir (), Cmd_Argv (1));
+	FS_CreatePath (name);
+	cm_tracefile = fopen (name, "wb");
+
+	if (!cm_tracefile)
+	{
+		Com_Printf (S_COLOR_RED "ERROR: couldn't open %s.\n", name);
+		return;
+	}
+
+	header[0] = TRACE_MAGIC;
+	header[1] = TRACE_VERSION;
+	fwrite (header, sizeof (header), 1, cm_tracefile);
+	fwrite (map_name, sizeof (map_name), 1, cm_tracefile);
+
+	Com_Printf ("Recording traces on %s to %s\n", map_name, name);
+}
+
+// bit for bit, so a -0 fraction doesn't match a 0 one
+static qboolean CM_TracesEqual (trace_t *a, trace_t *b)
+{
+	return a->allsolid == b->allsolid && a->startsolid == b->startsolid
+		&& !memcmp (&a->fraction, &b->fraction, sizeof (a->fraction))
+		&& !memcmp (a->endpos, b->endpos, sizeof (a->endpos))
+		&& !memcmp (&a->plane, &b->plane, sizeof (a->plane))
+		&& a->surface == b->surface && a->contents == b->contents;
+}
+
+/*
+==================
+CM_TraceReplay_f
+
+cm_tracereplay <filename> [passes]
+
+Runs a recorded trace stream against the loaded map one trace at a
+time, with the trace cache and as one batch per recorded frame, and
+checks all three give the same results
+==================
+*/
+void CM_TraceReplay_f (void)
+{
+	char			name[MAX_OSPATH];
+	char			mapname[MAX_QPATH];
+	int				header[2];
+	FILE			*f;
+	int				i, j, len, last, count, frames, passes, mode;
+	int				hits, mismatches[3], oldcache;
+	unsigned		start, usec[3];
+	tracequery_t	*queries, *q;
+	trace_t			*results[3];
+	static const char *modenames[3] = {"uncached", "cached", "batched"};
+
+	if (Cmd_Argc () < 2)
+	{
+		Com_Printf ("usage: cm_tracereplay <filename> [passes]\n");
+		return;
+	}
+
+	if (cm_tracefile)
+	{
+		Com_Printf ("Can't replay while recording.\n");
+		return;
+	}
+
+	passes = (Cmd_Argc () > 2) ? atoi (Cmd_Argv (2)) : 1;
+
+	if (passes < 1)
+		passes = 1;
+
+	Com_sprintf (name, sizeof (name), "%s/%s.trc", FS_Gamedir (), Cmd_Argv (1));
+	f = fopen (name, "rb");
+
+	if (!f)
+	{
+		Com_Printf (S_COLOR_RED "ERROR: couldn't open %s.\n", name);
+		return;
+	}
+
+	if (fread (header, sizeof (header), 1, f) != 1 || fread (mapname, sizeof (mapname), 1, f) != 1
+			|| header[0] != TRACE_MAGIC || header[1] != TRACE_VERSION)
+	{
+		Com_Printf (S_COLOR_RED "%s is not a trace recording.\n", name);
+		fclose (f);
+		return;
+	}
+
+	mapname[sizeof (mapname) - 1] = 0;
+
+	if (strcmp (mapname, map_name))
+	{
+		Com_Printf (S_COLOR_RED "%s was recorded on %s, load that map first.\n", name, mapname);
+		fclose (f);
+		return;
+	}
+
+	fseek (f, 0, SEEK_END);
+	len = ftell (f) - (sizeof (header) + sizeof (mapname));
+	fseek (f, sizeof (header) + sizeof (mapname), SEEK_SET);
+
+	count = len / sizeof (tracequery_t);
+	queries = Z_Malloc (count * sizeof (tracequery_t) + 1);
+	count = fread (queries, sizeof (tracequery_t), count, f);
+	fclose (f);
+
+	// the frame markers don't get results
+	for (i = 0; i < 3; i++)
+		results[i] = Z_Malloc (count * sizeof (trace_t) + 1);
+
+	for (i = frames = 0; i < count; i++)
+	{
+		if (queries[i].headnode < 0)
+			frames++;
+		else if (queries[i].headnode >= numnodes)
+		{
+			Com_Printf (S_COLOR_RED "%s has a bad headnode, was the map changed?\n", name);
+			count = 0;
+			break;
+		}
+	}
+
+	oldcache = cm_tracecache->integer;
+	hits = 0;
+
+	for (mode = 0; mode < 3; mode++)
+	{
+		Cvar_SetValue ("cm_tracecache", mode > 0);
+		start = Sys_Microseconds ();
+
+		for (j = 0; j < passes; j++)
+		{
+			CM_ClearTraceCache ();
+			c_tracehits = 0;
+
+			if (mode == 2)
+			{
+				// batch everything between two frame markers
+				for (i = 0; i < count; i = last + 1)
+				{
+					for (last = i; last < count && queries[last].headnode >= 0; last++)
+						;
+
+					CM_BoxTraceBatch (queries + i, results[2] + i, last - i);
+					CM_ClearTraceCache ();
+				}
+
+				continue;
+			}
+
+			for (i = 0, q = queries; i < count; i++, q++)
+			{
+				if (q->headnode < 0)
+					CM_ClearTraceCache ();
+				else
+					results[mode][i] = CM_BoxTrace (q->start, q->end, q->mins, q->maxs, q->headnode, q->brushmask);
+			}
+
+			if (mode == 1)
+				hits = c_tracehits;
+		}
+
+		usec[mode] = Sys_Microseconds () - start;
+	}
+
+	Cvar_SetValue ("cm_tracecache", oldcache);
+
+	mismatches[1] = mismatches[2] = 0;
+
+	for (i = 0; i < count; i++)
+	{
+		if (queries[i].headnode < 0)
+			continue;
+
+		for (mode = 1; mode < 3; mode++)
+			if (!CM_TracesEqual (&results[0][i], &results[mode][i]))
+				mismatches[mode]++;
+	}
+
+	Com_Printf ("%i traces in %i frames on %s, %i passes\n", count - frames, frames, map_name, passes);
+
+	for (mode = 0; mode < 3; mode++)
+	{
+		Com_Printf ("%-8s : %8.3f usec/trace, %6i msec total\n", modenames[mode],
+			count > frames ? (float) usec[mode] / ((count - frames) * passes) : 0.0f, usec[mode] / 1000);
+	}
+
+	Com_Printf ("cache hits: %i of %i\n", hits, count - frames);
+
+	if (mismatches[1] || mismatches[2])
+		Com_Printf (S_COLOR_RED "%i cached and %i batched traces differ!\n", mismatches[1], mismatches[2]);
+
+	for (i = 0; i < 3; i++)
+		Z_Free (results[i]);
+
+	Z_Free (queries);
+}
+
+/*
+==================
+CM_RandomTraces
+
+Fills in a repeatable mix of long and short point and box traces,
+position tests and the usual content masks inside the world bounds
+==================
+*/
+static void CM_RandomTraces (tracequery_t *queries, int count, unsigned seed)
+{
+	static vec3_t	boxes[3][2] = {
+		{{0, 0, 0}, {0, 0, 0}},
+		{{-16, -16, -24}, {16, 16, 32}},
+		{{-4, -4, -4}, {4, 4, 4}}
+	};
+	static int		masks[4] = {MASK_SOLID, MASK_PLAYERSOLID, MASK_SHOT, MASK_OPAQUE};
+	vec3_t			size;
+	tracequery_t	*q;
+	int				i, j, r;
+
+#define	TRACE_RAND()	(seed = seed * 1664525 + 1013904223, seed >> 8)
+#define	TRACE_FRAND()	((float) TRACE_RAND () / (1 << 24))
+
+	VectorSubtract (map_cmodels[0].maxs, map_cmodels[0].mins, size);
+
+	for (i = 0, q = queries; i < count; i++, q++)
+	{
+		r = TRACE_RAND ();
+
+		for (j = 0; j < 3; j++)
+			q->start[j] = map_cmodels[0].mins[j] + TRACE_FRAND () * size[j];
+
+		if ((r & 15) == 0)
+			VectorCopy (q->start, q->end);		// position test
+		else if (r & 16)
+		{
+			for (j = 0; j < 3; j++)
+				q->end[j] = q->start[j] + (TRACE_FRAND () * 2 - 1) * 256;
+		}
+		else
+		{
+			for (j = 0; j < 3; j++)
+				q->end[j] = map_cmodels[0].mins[j] + TRACE_FRAND () * size[j];
+		}
+
+		VectorCopy (boxes[(r >> 5) % 3][0], q->mins);
+		VectorCopy (boxes[(r >> 5) % 3][1], q->maxs);
+		q->headnode = map_cmodels[0].headnode;
+		q->brushmask = masks[(r >> 8) & 3];
+	}
+
+#undef	TRACE_RAND
+#undef	TRACE_FRAND
+}
+
+/*
+==================
+CM_TraceBench_f
+
+cm_tracebench [count]
+
+Times random traces through the loaded map with the original tree and
+with the flattened one using each brush clipping routine the cpu has,
+and checks that every routine gives results identical to the original.
+Run it on each of the stock maps with a few million traces to cover
+the vector code.
+==================
+*/
+#define	BENCH_CHUNK		65536
+#define	BENCH_MODES		(SIMD_AVX2 + 2)
+
+void CM_TraceBench_f (void)
+{
+	int				i, done, count, chunk, mode, nummodes;
+	int				oldflat, mismatches[BENCH_MODES], brushes[BENCH_MODES];
+	unsigned		start, usec[BENCH_MODES];
+	tracequery_t	*queries, *q;
+	trace_t			*results[BENCH_MODES];
+
+	if (!numnodes)
+	{
+		Com_Printf (S_COLOR_RED "No map loaded.\n");
+		return;
+	}
+
+	count = (Cmd_Argc () > 1) ? atoi (Cmd_Argv (1)) : 100000;
+
+	if (count < 1)
+		count = 1;
+
+	// the original tree, then the flat one with each simd level
+	nummodes = Com_SIMDLevel () + 2;
+
+	queries = Z_Malloc (BENCH_CHUNK * sizeof (tracequery_t));
+
+	for (mode = 0; mode < nummodes; mode++)
+	{
+		results[mode] = Z_Malloc (BENCH_CHUNK * sizeof (trace_t));
+		usec[mode] = mismatches[mode] = brushes[mode] = 0;
+	}
+
+	oldflat = cm_flathull->integer;
+
+	for (done = 0; done < count; done += chunk)
+	{
+		chunk = count - done < BENCH_CHUNK ? count - done : BENCH_CHUNK;
+		CM_RandomTraces (queries, chunk, 0x1234567 + done);
+
+		for (mode = 0; mode < nummodes; mode++)
+		{
+			Cvar_SetValue ("cm_flathull", mode > 0);
+
+			if (mode > 0)
+				CM_SetBrushSIMD (mode - 1);
+
+			c_brush_traces = 0;
+			start = Sys_Microseconds ();
+
+			// straight to the hull walk, the trace cache would hide it
+			for (i = 0, q = queries; i < chunk; i++, q++)
+				results[mode][i] = CM_DoBoxTrace (q->start, q->end, q->mins, q->maxs, q->headnode, q->brushmask);
+
+			usec[mode] += Sys_Microseconds () - start;
+			brushes[mode] += c_brush_traces;
+
+			if (!mode)
+				continue;
+
+			for (i = 0; i < chunk; i++)
+			{
+				if (!CM_TracesEqual (&results[0][i], &results[mode][i]))
+					mismatches[mode]++;
+			}
+		}
+	}
+
+	Cvar_SetValue ("cm_flathull", oldflat);
+	CM_SetBrushSIMD (Com_SIMDLevel ());
+
+	Com_Printf ("%i traces on %s\n", count, map_name);
+
+	for (mode = 0; mode < nummodes; mode++)
+	{
+		Com_Printf ("%-9s %-4s : %8.3f usec/trace, %8.0f traces/sec, %i brushes clipped", mode ? "flat" : "original",
+			mode ? Com_SIMDName (mode - 1) : "", (float) usec[mode] / count, usec[mode] ? count * 1000000.0 / usec[mode] : 0.0,
+			brushes[mode]);
+
+		if (mismatches[mode])
+			Com_Printf (S_COLOR_RED ", %i differ!\n", mismatches[mode]);
+		else
+			Com_Printf ("\n");
+
+		Z_Free (results[mode]);
+	}
+
+	Z_Free (queries);
+}
+
+
+/*
+==================
+CM_TransformedBoxTrace
+
+Handles offseting and rotation of the end points for moving and
+rotating entities
+==================
+*/
+#ifdef _WIN32
+#pragma optimize( "", off )
+#endif
+
+
+trace_t		CM_TransformedBoxTrace (vec3_t start, vec3_t end,
+									vec3_t mins, vec3_t maxs,
+									int headnode, int brushmask,
+									vec3_t origin, vec3_t angles)
+{
+	trace_t		trace;
+	vec3_t		start_l, end_l;
+	vec3_t		a;
+	vec3_t		forward, right, up;
+	vec3_t		temp;
+	qboolean	rotated;
+
+	// subtract origin offset
+	VectorSubtract (start, origin, start_l);
+	VectorSubtract (end, origin, end_l);
+
+	// rotate start and end into the models frame of reference
+	if (headnode != box_headnode &&
+			(angles[0] || angles[1] || angles[2]))
+		rotated = true;
+	else
+		rotated = false;
+
+	if (rotated)
+	{
+		AngleVectors (angles, forward, right, up);
+
+		VectorCopy (start_l, temp);
+		start_l[0] = DotProduct (temp, forward);
+		start_l[1] = -DotProduct (temp, right);
+		start_l[2] = DotProduct (temp, up);
+
+		VectorCopy (end_l, temp);
+		end_l[0] = DotProduct (temp, forward);
+		end_l[1] = -DotProduct (temp, right);
+		end_l[2] = DotProduct (temp, up);
+	}
+
+	// sweep the box through the model
+	trace = CM_BoxTrace (start_l, end_l, mins, maxs, headnode, brushmask);
+
+	if (rotated && trace.fraction != 1.0)
+	{
+		// FIXME: figure out how to do this with existing angles
+		VectorNegate (angles, a);
+		AngleVectors (a, forward, right, up);
+
+		VectorCopy (trace.plane.normal, temp);
+		trace.plane.normal[0] = DotProduct (temp, forward);
+		trace.plane.normal[1] = -DotProduct (temp, right);
+		trace.plane.normal[2] = DotProduct (temp, up);
+	}
+
+	trace.endpos[0] = start[0] + trace.fraction * (end[0] - start[0]);
+	trace.endpos[1] = start[1] + trace.fraction * (end[1] - start[1]);
+	trace.endpos[2] = start[2] + trace.fraction * (end[2] - start[2]);
+
+	return trace;
+}
+
+#ifdef _WIN32
+#pragma optimize( "", on )
+#endif
+
+
+
+/*
+===============================================================================
+
+PVS / PHS
+
+===============================================================================
+*/
+
+/*
+===================
+CM_DecompressVis
+===================
+*/
+void CM_DecompressVis (byte *in, byte *out)
+{
+	int		c;
+	byte	*out_p;
+	int		row;
+
+	row = (numclusters + 7) >> 3;
+	out_p = out;
+
+	if (!in || !numvisibility)
+	{
+		// no vis info, so make all visible
+		while (row)
+		{
+			*out_p++ = 0xff;
+			row--;
+		}
+
+		return;
+	}
+
+	do
+	{
+		if (*in)
+		{
+			*out_p++ = *in++;
+			continue;
+		}
+
+		c = in[1];
+		in += 2;
+
+		if ((out_p - out) + c > row)
 		{
 			c = row - (out_p - out);
 			Com_DPrintf ("warning: Vis decompression overrun\n");
@@ -1703,24 +3249,285 @@ void CM_DecompressVis (byte *in, byte *out)
 byte	pvsrow[MAX_MAP_LEAFS/8];
 byte	phsrow[MAX_MAP_LEAFS/8];
 
-byte	*CM_ClusterPVS (int cluster)
+/*
+===============================================================================
+
+VIS ROW CACHE
+
+Every cluster's PVS and PHS is decompressed once when the map is loaded,
+so looking up a row is a pointer fetch instead of a run length decode.
+Rows are padded with zeros to a multiple of 32 bytes so they can be
+merged a whole vector at a time. Maps whose rows don't fit in
+cm_viscache kilobytes fall back to decompressing on every lookup.
+
+The cache is never written after CM_LoadMap returns, so it is safe to
+read from the snapshot workers.
+
+===============================================================================
+*/
+
+cvar_t		*cm_viscache;
+
+static byte	*cm_visrows;		// PVS then PHS row for each cluster, NULL if not cached
+static int	cm_rowbytes;		// significant bytes in a row
+static int	cm_rowstride;		// cm_rowbytes padded to VIS_ROWALIGN
+static byte	cm_nullrow[MAX_MAP_LEAFS/8];	// cluster -1
+
+#define	VIS_ROWALIGN	32
+
+typedef void (*mergevis_t) (byte *out, const byte *in, int bytes);
+
+static void CM_MergeVis_C (byte *out, const byte *in, int bytes)
+{
+	int		i;
+
+	for (i = 0; i < bytes; i += 4)
+		*(unsigned *) (out + i) |= *(const unsigned *) (in + i);
+}
+
+#ifdef Q_SSE2
+#include <emmintrin.h>
+
+static void CM_MergeVis_SSE2 (byte *out, const byte *in, int bytes)
+{
+	int		i;
+	__m128i	a, b;
+
+	for (i = 0; i < bytes; i += 32)
+	{
+		a = _mm_or_si128 (_mm_loadu_si128 ((__m128i *) (out + i)), _mm_loadu_si128 ((const __m128i *) (in + i)));
+		b = _mm_or_si128 (_mm_loadu_si128 ((__m128i *) (out + i + 16)), _mm_loadu_si128 ((const __m128i *) (in + i + 16)));
+		_mm_storeu_si128 ((__m128i *) (out + i), a);
+		_mm_storeu_si128 ((__m128i *) (out + i + 16), b);
+	}
+}
+#endif
+
+#ifdef Q_AVX2
+#include <immintrin.h>
+
+static Q_TARGET_AVX2 void CM_MergeVis_AVX2 (byte *out, const byte *in, int bytes)
+{
+	int		i;
+
+	for (i = 0; i < bytes; i += 32)
+	{
+		_mm256_storeu_si256 ((__m256i *) (out + i), _mm256_or_si256 (
+			_mm256_loadu_si256 ((__m256i *) (out + i)),
+			_mm256_loadu_si256 ((const __m256i *) (in + i))));
+	}
+}
+#endif
+
+static mergevis_t	cm_mergevis = CM_MergeVis_C;
+
+static mergevis_t CM_MergeVisFunc (int level)
+{
+#ifdef Q_AVX2
+	if (level >= SIMD_AVX2)
+		return CM_MergeVis_AVX2;
+#endif
+#ifdef Q_SSE2
+	if (level >= SIMD_SSE2)
+		return CM_MergeVis_SSE2;
+#endif
+	return CM_MergeVis_C;
+}
+
+/*
+===================
+CM_FreeVisCache
+===================
+*/
+static void CM_FreeVisCache (void)
+{
+	if (cm_visrows)
+		Z_Free (cm_visrows);
+
+	cm_visrows = NULL;
+}
+
+/*
+===================
+CM_InitVisCache
+
+Called after the leafs and the visibility lump are loaded
+===================
+*/
+static void CM_InitVisCache (void)
+{
+	int		i;
+	byte	*row;
+
+	CM_FreeVisCache ();
+
+	cm_viscache = Cvar_Get ("cm_viscache", "16384", CVAR_ARCHIVE);
+	cm_rowbytes = (numclusters + 7) >> 3;
+	cm_rowstride = (cm_rowbytes + VIS_ROWALIGN - 1) & ~(VIS_ROWALIGN - 1);
+	cm_mergevis = CM_MergeVisFunc (Com_SIMDLevel ());
+
+	if ((double) numclusters * cm_rowstride * 2 > cm_viscache->value * 1024)
+	{
+		Com_DPrintf ("CM_InitVisCache: %i clusters don't fit in cm_viscache\n", numclusters);
+		return;
+	}
+
+	// Z_Malloc clears the padding
+	cm_visrows = Z_Malloc (numclusters * cm_rowstride * 2);
+
+	for (i = 0, row = cm_visrows; i < numclusters; i++, row += cm_rowstride * 2)
+	{
+		CM_DecompressVis (map_visibility + map_vis->bitofs[i][DVIS_PVS], row);
+		CM_DecompressVis (map_visibility + map_vis->bitofs[i][DVIS_PHS], row + cm_rowstride);
+	}
+}
+
+/*
+===================
+CM_VisRowBytes
+
+Length of the rows handed out below, including the padding
+===================
+*/
+int		CM_VisRowBytes (void)
+{
+	return cm_rowstride;
+}
+
+/*
+===================
+CM_MergeVis
+
+out |= in over a whole padded row
+===================
+*/
+void	CM_MergeVis (byte *out, const byte *in)
+{
+	cm_mergevis (out, in, cm_rowstride);
+}
+
+/*
+===================
+CM_CopyClusterPVS / CM_CopyClusterPHS
+
+Thread safe row lookup. When the rows are cached the returned pointer
+is into the cache and the buffer isn't touched, otherwise the row is
+decompressed into the buffer, which must hold MAX_MAP_LEAFS/8 bytes.
+Either way the row must not be written to.
+===================
+*/
+static byte *CM_CopyClusterVis (int cluster, int vis, byte *buffer)
 {
 	if (cluster == -1)
-		memset (pvsrow, 0, (numclusters + 7) >> 3);
-	else
-		CM_DecompressVis (map_visibility + map_vis->bitofs[cluster][DVIS_PVS], pvsrow);
+		return cm_nullrow;
+
+	if (cm_visrows)
+		return cm_visrows + (cluster * 2 + vis) * cm_rowstride;
 
-	return pvsrow;
+	CM_DecompressVis (map_visibility + map_vis->bitofs[cluster][vis], buffer);
+	memset (buffer + cm_rowbytes, 0, cm_rowstride - cm_rowbytes);
+
+	return buffer;
+}
+
+byte	*CM_CopyClusterPVS (int cluster, byte *buffer)
+{
+	return CM_CopyClusterVis (cluster, DVIS_PVS, buffer);
+}
+
+byte	*CM_CopyClusterPHS (int cluster, byte *buffer)
+{
+	return CM_CopyClusterVis (cluster, DVIS_PHS, buffer);
+}
+
+byte	*CM_ClusterPVS (int cluster)
+{
+	return CM_CopyClusterVis (cluster, DVIS_PVS, pvsrow);
 }
 
 byte	*CM_ClusterPHS (int cluster)
 {
-	if (cluster == -1)
-		memset (phsrow, 0, (numclusters + 7) >> 3);
-	else
-		CM_DecompressVis (map_visibility + map_vis->bitofs[cluster][DVIS_PHS], phsrow);
+	return CM_CopyClusterVis (cluster, DVIS_PHS, phsrow);
+}
+
+/*
+===================
+CM_VisBench_f
+
+Times decompressing every row of the current map against reading it
+from the cache, and each merge routine over the map's row length
+===================
+*/
+void CM_VisBench_f (void)
+{
+	int			i, c, level, passes, maxlevel;
+	unsigned	start, usec;
+	byte		*row, *ref, *out;
+	qboolean	mismatch;
+
+	if (!map_name[0] || !numvisibility)
+	{
+		Com_Printf (S_COLOR_RED "No map with visibility loaded.\n");
+		return;
+	}
+
+	passes = (Cmd_Argc () > 1) ? atoi (Cmd_Argv (1)) : 10;
+
+	if (passes < 1)
+		passes = 1;
+
+	Com_Printf ("%s: %i clusters, %i byte rows (%i padded), cache %s\n", map_name, numclusters, cm_rowbytes, cm_rowstride,
+		cm_visrows ? va ("%i KB", numclusters * cm_rowstride * 2 / 1024) : "off");
+
+	start = Sys_Microseconds ();
+
+	for (i = 0; i < passes; i++)
+	{
+		for (c = 0; c < numclusters; c++)
+			CM_DecompressVis (map_visibility + map_vis->bitofs[c][DVIS_PVS], pvsrow);
+	}
+
+	usec = Sys_Microseconds () - start;
+	Com_Printf ("decompress   : %8.3f usec/row\n", (float) usec / (passes * numclusters));
+
+	ref = Z_Malloc (cm_rowstride * 2);
+	out = ref + cm_rowstride;
+	maxlevel = Com_SIMDLevel ();
+	mismatch = false;
+
+	// the scalar result is the reference for the vector ones
+	for (c = 0; c < numclusters; c++)
+		CM_MergeVis_C (ref, CM_CopyClusterPVS (c, pvsrow), cm_rowstride);
+
+	for (level = SIMD_NONE; level <= maxlevel; level++)
+	{
+		mergevis_t merge = CM_MergeVisFunc (level);
+
+		start = Sys_Microseconds ();
+
+		for (i = 0; i < passes; i++)
+		{
+			memset (out, 0, cm_rowstride);
+
+			for (c = 0; c < numclusters; c++)
+			{
+				row = CM_CopyClusterPVS (c, pvsrow);
+				merge (out, row, cm_rowstride);
+			}
+		}
+
+		usec = Sys_Microseconds () - start;
+		Com_Printf ("merge %-6s : %8.3f usec/row, %7.1f MB/s\n", Com_SIMDName (level), (float) usec / (passes * numclusters),
+			usec ? (double) passes * numclusters * cm_rowstride / usec : 0.0);
+
+		if (memcmp (out, ref, cm_rowstride))
+			mismatch = true;
+	}
+
+	Z_Free (ref);
 
-	return phsrow;
+	if (mismatch)
+		Com_Printf (S_COLOR_RED "merge results differ!\n");
 }
 
 
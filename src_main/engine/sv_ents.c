@@ -120,6 +120,105 @@ void SV_EmitProjectileUpdate (sizebuf_t *msg)
 }
 #endif
 
+/*
+=============
+SV_WriteDeltaEntity
+
+MSG_WriteDeltaEntity through the worker's delta cache, fromtag and
+totag say where the states came from
+=============
+*/
+static void SV_WriteDeltaEntity (entity_state_t *from, entity_state_t *to, unsigned fromtag, unsigned totag, sizebuf_t *msg, qboolean force, qboolean newentity, snapshot_worker_t *worker)
+{
+	deltacache_t	*dc, *ways;
+	sizebuf_t		buf;
+	int				i, flags;
+
+	if (!sv_deltacache->integer || !fromtag || !totag)
+	{
+		MSG_WriteDeltaEntity (from, to, msg, force, newentity);
+		return;
+	}
+
+	flags = 0;
+
+	if (force)
+		flags |= DELTA_FORCE;
+
+	if (newentity)
+		flags |= DELTA_NEWENTITY;
+
+	ways = worker->deltacache[to->number & (MAX_EDICTS - 1)];
+	worker->delta_lookups++;
+
+	for (i = 0, dc = ways; i < DELTA_WAYS; i++, dc++)
+	{
+		if (dc->totag == totag && dc->fromtag == fromtag && dc->flags == flags)
+			break;
+	}
+
+	if (i < DELTA_WAYS)
+		worker->delta_hits++;
+	else
+	{
+		// replace the one that went longest without a hit
+		for (i = 1, dc = ways; i < DELTA_WAYS; i++)
+		{
+			if (ways[i].lastused < dc->lastused)
+				dc = &ways[i];
+		}
+
+		SZ_Init (&buf, dc->data, sizeof (dc->data));
+		MSG_WriteDeltaEntity (from, to, &buf, force, newentity);
+
+		dc->fromtag = fromtag;
+		dc->totag = totag;
+		dc->flags = flags;
+		dc->len = buf.cursize;
+	}
+
+	dc->lastused = worker->delta_lookups;
+
+	if (dc->len)
+		SZ_Write (msg, dc->data, dc->len);
+}
+
+/*
+=============
+SV_DeltaStats_f
+
+sv_deltastats [reset]
+=============
+*/
+void SV_DeltaStats_f (void)
+{
+	snapshot_worker_t	*worker;
+	unsigned	lookups, hits, usec, frames;
+	int			i;
+
+	lookups = hits = usec = frames = 0;
+
+	for (i = 0, worker = svs.snapshot_workers; i < svs.num_snapshot_workers; i++, worker++)
+	{
+		lookups += worker->delta_lookups;
+		hits += worker->delta_hits;
+		usec += worker->encode_usec;
+		frames += worker->encode_frames;
+
+		if (Cmd_Argc () > 1 && !Q_stricmp (Cmd_Argv (1), "reset"))
+		{
+			worker->delta_lookups = 0;
+			worker->delta_hits = 0;
+			worker->encode_usec = 0;
+			worker->encode_frames = 0;
+		}
+	}
+
+	Com_Printf ("delta cache is %s, %i workers\n", sv_deltacache->integer ? "on" : "off", svs.num_snapshot_workers);
+	Com_Printf ("%u entity deltas, %u from the cache (%.1f%%)\n", lookups, hits, lookups ? 100.0f * hits / lookups : 0.0f);
+	Com_Printf ("%u client frames encoded, %.2f usec each\n", frames, frames ? (float) usec / frames : 0.0f);
+}
+
 /*
 =============
 SV_EmitPacketEntities
@@ -127,7 +226,7 @@ SV_EmitPacketEntities
 Writes a delta update of an entity_state_t list to the message.
 =============
 */
-void SV_EmitPacketEntities (client_frame_t *from, client_frame_t *to, sizebuf_t *msg)
+void SV_EmitPacketEntities (client_t *client, client_frame_t *from, client_frame_t *to, sizebuf_t *msg, snapshot_worker_t *worker)
 {
 	entity_state_t	*oldent = NULL, *newent = NULL;
 	int		oldindex, newindex;
@@ -156,7 +255,7 @@ void SV_EmitPacketEntities (client_frame_t *from, client_frame_t *to, sizebuf_t
 			newnum = 9999;
 		else
 		{
-			newent = &svs.client_entities[(to->first_entity+newindex) %svs.num_client_entities];
+			newent = CLIENT_ENTITY_NUM (client, to->first_entity + newindex);
 			newnum = newent->number;
 		}
 
@@ -164,7 +263,7 @@ void SV_EmitPacketEntities (client_frame_t *from, client_frame_t *to, sizebuf_t
 			oldnum = 9999;
 		else
 		{
-			oldent = &svs.client_entities[(from->first_entity+oldindex) %svs.num_client_entities];
+			oldent = CLIENT_ENTITY_NUM (client, from->first_entity + oldindex);
 			oldnum = oldent->number;
 		}
 
@@ -175,7 +274,8 @@ void SV_EmitPacketEntities (client_frame_t *from, client_frame_t *to, sizebuf_t
 			// in any bytes being emited if the entity has not changed at all
 			// note that players are always 'newentities', this updates their oldorigin always
 			// and prevents warping
-			MSG_WriteDeltaEntity (oldent, newent, msg, false, newent->number <= maxclients->value);
+			SV_WriteDeltaEntity (oldent, newent, *CLIENT_ENTITY_TAG (client, from->first_entity + oldindex),
+				*CLIENT_ENTITY_TAG (client, to->first_entity + newindex), msg, false, newent->number <= maxclients->value, worker);
 			oldindex++;
 			newindex++;
 			continue;
@@ -184,7 +284,8 @@ void SV_EmitPacketEntities (client_frame_t *from, client_frame_t *to, sizebuf_t
 		if (newnum < oldnum)
 		{
 			// this is a new entity, send it from the baseline
-			MSG_WriteDeltaEntity (&sv.baselines[newnum], newent, msg, true, true);
+			SV_WriteDeltaEntity (&sv.baselines[newnum], newent, sv.baselinetag,
+				*CLIENT_ENTITY_TAG (client, to->first_entity + newindex), msg, true, true, worker);
 			newindex++;
 			continue;
 		}
@@ -429,14 +530,17 @@ void SV_WritePlayerstateToClient (client_frame_t *from, client_frame_t *to, size
 SV_WriteFrameToClient
 ==================
 */
-void SV_WriteFrameToClient (client_t *client, sizebuf_t *msg)
+void SV_WriteFrameToClient (client_t *client, sizebuf_t *msg, snapshot_worker_t *worker)
 {
 	client_frame_t		*frame, *oldframe;
 	int					lastframe;
+	unsigned			prof;
+
+	prof = Prof_Begin ();
 
 	//Com_Printf ("%i -> %i\n", client->lastframe, sv.framenum);
 	// this is the frame we are creating
-	frame = &client->frames[sv.framenum & UPDATE_MASK];
+	frame = CLIENT_FRAME (client, sv.framenum);
 
 	if (client->lastframe <= 0)
 	{
@@ -444,7 +548,7 @@ void SV_WriteFrameToClient (client_t *client, sizebuf_t *msg)
 		oldframe = NULL;
 		lastframe = -1;
 	}
-	else if (sv.framenum - client->lastframe >= (UPDATE_BACKUP - 3))
+	else if (sv.framenum - client->lastframe >= (client->updatebackup - 3))
 	{
 		// client hasn't gotten a good message through in a long time
 		//		Com_Printf ("%s: Delta request from out-of-date packet.\n", client->name);
@@ -454,8 +558,15 @@ void SV_WriteFrameToClient (client_t *client, sizebuf_t *msg)
 	else
 	{
 		// we have a valid message to delta from
-		oldframe = &client->frames[client->lastframe & UPDATE_MASK];
+		oldframe = CLIENT_FRAME (client, client->lastframe);
 		lastframe = client->lastframe;
+
+		// the entities of the old frame have been overwritten in the client's ring
+		if (frame->first_entity + frame->num_entities - oldframe->first_entity > client->updatebackup * MAX_PACKET_ENTITIES)
+		{
+			oldframe = NULL;
+			lastframe = -1;
+		}
 	}
 
 	MSG_WriteByte (msg, svc_frame);
@@ -472,7 +583,9 @@ void SV_WriteFrameToClient (client_t *client, sizebuf_t *msg)
 	SV_WritePlayerstateToClient (oldframe, frame, msg);
 
 	// delta encode the entities
-	SV_EmitPacketEntities (oldframe, frame, msg);
+	SV_EmitPacketEntities (client, oldframe, frame, msg, worker);
+
+	Prof_End ("SV_WriteFrameToClient", prof);
 }
 
 
@@ -484,8 +597,6 @@ Build a client frame structure
 =============================================================================
 */
 
-byte		fatpvs[65536/8];	// 32767 is MAX_MAP_LEAFS
-
 /*
 ============
 SV_FatPVS
@@ -494,12 +605,13 @@ The client will interpolate the view position,
 so we can't use a single PVS point
 ===========
 */
-void SV_FatPVS (vec3_t org)
+byte *SV_FatPVS (vec3_t org, snapshot_worker_t *worker)
 {
 	int		leafs[64];
-	int		i, j, count;
-	int		longs;
-	byte	*src;
+	int		clusters[64];
+	int		i, j, count, numclusters, cluster;
+	byte	*fatpvs;
+	fatpvs_memo_t	*memo, *oldest;
 	vec3_t	mins, maxs;
 
 	for (i = 0; i < 3; i++)
@@ -513,28 +625,95 @@ void SV_FatPVS (vec3_t org)
 	if (count < 1)
 		Com_Error (ERR_FATAL, "SV_FatPVS: count < 1");
 
-	longs = (CM_NumClusters() + 31) >> 5;
+	// convert leafs to a sorted set of clusters
+	numclusters = 0;
 
-	// convert leafs to clusters
 	for (i = 0; i < count; i++)
-		leafs[i] = CM_LeafCluster (leafs[i]);
+	{
+		cluster = CM_LeafCluster (leafs[i]);
+
+		for (j = numclusters; j > 0 && clusters[j - 1] > cluster; j--)
+			;
+
+		if (j > 0 && clusters[j - 1] == cluster)
+			continue;		// already have the cluster we want
+
+		memmove (&clusters[j + 1], &clusters[j], (numclusters - j) * sizeof (int));
+		clusters[j] = cluster;
+		numclusters++;
+	}
+
+	// a single cluster is just its row
+	if (numclusters == 1)
+		return CM_CopyClusterPVS (clusters[0], worker->pvsrow);
 
-	memcpy (fatpvs, CM_ClusterPVS (leafs[0]), longs << 2);
+	fatpvs = worker->fatpvs;
 
-	// or in all the other leaf bits
-	for (i = 1; i < count; i++)
+	if (numclusters <= FATPVS_MEMO_CLUSTERS)
 	{
-		for (j = 0; j < i; j++)
-			if (leafs[i] == leafs[j])
-				break;
+		worker->fatpvs_lookups++;
+		oldest = NULL;
 
-		if (j != i)
-			continue;		// already have the cluster we want
+		for (i = 0, memo = worker->fatpvs_memo; i < FATPVS_MEMO; i++, memo++)
+		{
+			if (memo->numclusters == numclusters && memo->spawncount == svs.spawncount
+					&& !memcmp (memo->clusters, clusters, numclusters * sizeof (int)))
+			{
+				memo->lastused = worker->fatpvs_lookups;
+				worker->fatpvs_hits++;
+				return memo->pvs;
+			}
 
-		src = CM_ClusterPVS (leafs[i]);
+			if (!oldest || memo->lastused < oldest->lastused)
+				oldest = memo;
+		}
 
-		for (j = 0; j < longs; j++)
-			((long *) fatpvs) [j] |= ((long *) src) [j];
+		// merge into the least recently used slot
+		oldest->spawncount = svs.spawncount;
+		oldest->numclusters = numclusters;
+		oldest->lastused = worker->fatpvs_lookups;
+		memcpy (oldest->clusters, clusters, numclusters * sizeof (int));
+		fatpvs = oldest->pvs;
+	}
+
+	memcpy (fatpvs, CM_CopyClusterPVS (clusters[0], worker->pvsrow), CM_VisRowBytes ());
+
+	// or in all the other cluster bits
+	for (i = 1; i < numclusters; i++)
+		CM_MergeVis (fatpvs, CM_CopyClusterPVS (clusters[i], worker->pvsrow));
+
+	return fatpvs;
+}
+
+
+/*
+=============
+SV_FixEntityNumbers
+
+Done once per frame on the main thread before any client frames are built
+=============
+*/
+void SV_FixEntityNumbers (void)
+{
+	int		e;
+	edict_t	*ent;
+
+	for (e = 1; e < ge->num_edicts; e++)
+	{
+		ent = EDICT_NUM (e);
+
+		// only entities that could be sent to a client
+		if (ent->svflags & SVF_NOCLIENT)
+			continue;
+
+		if (!ent->s.modelindex && !ent->s.effects && !ent->s.sound && !ent->s.event)
+			continue;
+
+		if (ent->s.number != e)
+		{
+			Com_DPrintf ("FIXING ENT->S.NUMBER!!!\n");
+			ent->s.number = e;
+		}
 	}
 }
 
@@ -545,9 +724,12 @@ SV_BuildClientFrame
 
 Decides which entities are going to be visible to the client, and
 copies off the playerstat and areabits.
+
+This can run on any thread, so it must only touch the client and the
+worker, and read the world.
 =============
 */
-void SV_BuildClientFrame (client_t *client, qboolean clientonly)
+void SV_BuildClientFrame (client_t *client, qboolean clientonly, snapshot_worker_t *worker)
 {
 	int		e, i;
 	vec3_t	org;
@@ -560,19 +742,24 @@ void SV_BuildClientFrame (client_t *client, qboolean clientonly)
 	int		leafnum;
 	int		c_fullsend;
 	byte	*clientphs;
+	byte	*fatpvs;
 	byte	*bitvector;
+	byte	*candidates;
+	unsigned	prof;
 
 	clent = client->edict;
 
 	if (!clent->client)
 		return;		// not in game yet
 
+	prof = Prof_Begin ();
+
 #if 0
 	numprojs = 0; // no projectiles yet
 #endif
 
 	// this is the frame we are creating
-	frame = &client->frames[sv.framenum & UPDATE_MASK];
+	frame = CLIENT_FRAME (client, sv.framenum);
 
 	frame->senttime = svs.realtime; // save it for ping calc later
 
@@ -590,17 +777,41 @@ void SV_BuildClientFrame (client_t *client, qboolean clientonly)
 	// grab the current player_state_t
 	frame->ps = clent->client->ps;
 
-	SV_FatPVS (org);
-	clientphs = CM_ClusterPHS (clientcluster);
+	fatpvs = SV_FatPVS (org, worker);
+	clientphs = CM_CopyClusterPHS (clientcluster, worker->phsrow);
+
+	// only look at the entities in the visible clusters
+	if (sv_entindex->integer)
+	{
+		candidates = worker->entbits;
+		SV_ClusterEntities (fatpvs, clientphs, candidates);
+
+		e = NUM_FOR_EDICT (clent);
+		candidates[e >> 3] |= 1 << (e & 7);
+	}
+	else candidates = NULL;
 
 	// build up the list of visible entities
 	frame->num_entities = 0;
-	frame->first_entity = svs.next_client_entities;
+	frame->first_entity = client->next_client_entities;
 
 	c_fullsend = 0;
 
 	for (e = 1; e < ge->num_edicts; e++)
 	{
+		if (candidates)
+		{
+			// skip whole bytes of entities that can't be seen
+			if (!candidates[e >> 3])
+			{
+				e |= 7;
+				continue;
+			}
+
+			if (!(candidates[e >> 3] & (1 << (e & 7))))
+				continue;
+		}
+
 		ent = EDICT_NUM (e);
 
 		// ignore ents without visible models
@@ -691,24 +902,24 @@ void SV_BuildClientFrame (client_t *client, qboolean clientonly)
 
 #endif
 
-		// add it to the circular client_entities array
-		state = &svs.client_entities[svs.next_client_entities%svs.num_client_entities];
-
-		if (ent->s.number != e)
-		{
-			Com_DPrintf ("FIXING ENT->S.NUMBER!!!\n");
-			ent->s.number = e;
-		}
-
+		// add it to the client's circular entity array, the entity
+		// numbers were fixed up by SV_FixEntityNumbers
+		state = CLIENT_ENTITY_NUM (client, client->next_client_entities);
 		*state = ent->s;
+		*CLIENT_ENTITY_TAG (client, client->next_client_entities) = svs.snapshotgen << 1;
 
 		// don't mark players missiles as solid
 		if (ent->owner == client->edict)
+		{
 			state->solid = 0;
+			*CLIENT_ENTITY_TAG (client, client->next_client_entities) |= 1;
+		}
 
-		svs.next_client_entities++;
+		client->next_client_entities++;
 		frame->num_entities++;
 	}
+
+	Prof_End ("SV_BuildClientFrame", prof);
 }
 
 
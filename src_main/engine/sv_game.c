@@ -303,6 +303,19 @@ void PF_StartSound (edict_t *entity, int channel, int sound_num, float volume,
 	SV_StartSound (NULL, entity, channel, sound_num, volume, attenuation, timeofs);
 }
 
+/*
+=================
+PF_SetAreaPortalState
+
+Clients that could hear each other may not anymore
+=================
+*/
+void PF_SetAreaPortalState (int portalnum, qboolean open)
+{
+	CM_SetAreaPortalState (portalnum, open);
+	SV_ClearMulticastCache ();
+}
+
 //==============================================
 
 /*
@@ -392,7 +405,9 @@ void SV_InitGameProgs (void)
 	import.AddCommandString = Cbuf_AddText;
 
 	import.DebugGraph = SCR_DebugGraph;
-	import.SetAreaPortalState = CM_SetAreaPortalState;
+	import.ProfileBegin = Prof_Begin;
+	import.ProfileEnd = Prof_End;
+	import.SetAreaPortalState = PF_SetAreaPortalState;
 	import.AreasConnected = CM_AreasConnected;
 
 	ge = (game_export_t *) Sys_GetGameAPI (&import);
@@ -400,7 +415,8 @@ void SV_InitGameProgs (void)
 	if (!ge)
 		Com_Error (ERR_DROP, "failed to load game DLL");
 
-	if (ge->apiversion != GAME_API_VERSION)
+	// the profiler imports were appended, so version 3 games still fit
+	if (ge->apiversion != GAME_API_VERSION && ge->apiversion != GAME_API_VERSION_OLD)
 		Com_Error (ERR_DROP, "game is version %i, not %i", ge->apiversion, GAME_API_VERSION);
 
 	ge->Init ();
@@ -19,6 +19,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 */
 
 #include "server.h"
+#include "q_threads.h"
 
 server_static_t	svs;				// persistant server info
 server_t		sv;					// local server
@@ -110,6 +111,8 @@ void SV_CreateBaseline (void)
 		VectorCopy (svent->s.origin, svent->s.old_origin);
 		sv.baselines[entnum] = svent->s;
 	}
+
+	sv.baselinetag = ++svs.snapshotgen << 1;
 }
 
 
@@ -246,6 +249,9 @@ void SV_SpawnServer (char *server, char *spawnpoint, server_state_t serverstate,
 	Com_sprintf (sv.configstrings[CS_MAPCHECKSUM], sizeof (sv.configstrings[CS_MAPCHECKSUM]),
 				 "%i", checksum);
 
+	// client leafs are from the old map
+	SV_ClearMulticastCache ();
+
 	//
 	// clear physics interaction links
 	//
@@ -290,6 +296,45 @@ void SV_SpawnServer (char *server, char *spawnpoint, server_state_t serverstate,
 	Com_Printf ("-------------------------------------\n");
 }
 
+/*
+==============
+SV_InitSnapshotWorkers
+
+Sizes the thread pool from sv_threads and allocates the scratch
+space used to build client frames, one per pool thread plus one
+for the main thread
+==============
+*/
+void SV_InitSnapshotWorkers (void)
+{
+	static int	numthreads;
+
+	if (sv_threads->integer < 0)
+		Cvar_FullSet ("sv_threads", "0", CVAR_ARCHIVE | CVAR_LATCH);
+	else if (sv_threads->integer > MAX_THREADS)
+		Cvar_FullSet ("sv_threads", va ("%i", MAX_THREADS), CVAR_ARCHIVE | CVAR_LATCH);
+
+	// only restart the pool when the count changes
+	if (sv_threads->integer != numthreads)
+	{
+		if (numthreads)
+			Thread_Shutdown ();
+
+		numthreads = sv_threads->integer;
+
+		if (numthreads)
+			Thread_Init (numthreads);
+	}
+
+	// the client may have started a pool of its own while sv_threads is 0
+	svs.num_snapshot_workers = 1 + min (numthreads, (int) Thread_Count ());
+	svs.snapshot_workers = Z_Malloc (sizeof (snapshot_worker_t) * svs.num_snapshot_workers);
+
+	if (numthreads)
+		Com_Printf ("Building client frames on %i threads\n", svs.num_snapshot_workers);
+}
+
+
 /*
 ==============
 SV_InitGame
@@ -354,8 +399,21 @@ void SV_InitGame (void)
 
 	svs.spawncount = rand ();
 	svs.clients = Z_Malloc (sizeof (client_t) * maxclients->value);
-	svs.num_client_entities = maxclients->value * UPDATE_BACKUP * 64;
+
+	// the frame history is sized once per game, a power of two between
+	// what vanilla clients keep and what ours can
+	for (svs.updatebackup = UPDATE_BACKUP; svs.updatebackup < MAX_UPDATE_BACKUP; svs.updatebackup <<= 1)
+	{
+		if (svs.updatebackup << 1 > sv_updatebackup->integer)
+			break;
+	}
+
+	svs.client_frames = Z_Malloc (sizeof (client_frame_t) * maxclients->value * svs.updatebackup);
+	svs.num_client_entities = maxclients->value * CLIENT_ENTITIES;
 	svs.client_entities = Z_Malloc (sizeof (entity_state_t) * svs.num_client_entities);
+	svs.client_entity_tags = Z_Malloc (sizeof (unsigned) * svs.num_client_entities);
+
+	SV_InitSnapshotWorkers ();
 
 	// init network stuff
 	NET_Config ((maxclients->value > 1));
@@ -373,6 +431,8 @@ void SV_InitGame (void)
 		ent = EDICT_NUM (i + 1);
 		ent->s.number = i + 1;
 		svs.clients[i].edict = ent;
+		svs.clients[i].frames = &svs.client_frames[i * svs.updatebackup];
+		svs.clients[i].updatebackup = UPDATE_BACKUP;
 		memset (&svs.clients[i].lastcmd, 0, sizeof (svs.clients[i].lastcmd));
 	}
 }
@@ -20,6 +20,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
 #include "server.h"
 
+#include <SDL_atomic.h>
+
 netadr_t	master_adr[MAX_MASTERS];	// address of group servers
 
 client_t	*sv_client;			// current client
@@ -28,6 +30,11 @@ cvar_t	*sv_paused;
 cvar_t	*sv_timedemo;
 
 cvar_t	*sv_enforcetime;
+cvar_t	*sv_threads;
+cvar_t	*sv_entindex;
+cvar_t	*sv_areagrid;
+cvar_t	*sv_deltacache;
+cvar_t	*sv_updatebackup;
 
 cvar_t	*timeout;				// seconds without any message
 cvar_t	*zombietime;			// seconds to sink messages after disconnect
@@ -90,6 +97,117 @@ void SV_DropClient (client_t *drop)
 
 	drop->state = cs_zombie;		// become free in a few seconds
 	drop->name[0] = 0;
+
+	// zombies stay hashed so the final reliable message can still be
+	// acknowledged, they are unhashed when the slot is freed
+}
+
+
+/*
+==============================================================================
+
+CLIENT ADDRESS HASH
+
+==============================================================================
+*/
+
+/*
+=================
+SV_ClientHashKey
+=================
+*/
+static int SV_ClientHashKey (netadr_t *adr, int qport)
+{
+	unsigned int	hash;
+
+	hash = qport & 0xffff;
+
+	// all loopback addresses compare equal, so only the qport counts
+	if (adr->type == NA_IP)
+		hash ^= (adr->ip[0] << 24) ^ (adr->ip[1] << 16) ^ (adr->ip[2] << 8) ^ adr->ip[3];
+
+	hash ^= hash >> 9;
+	hash ^= hash >> 18;
+
+	return hash & (CLIENT_HASH_SIZE - 1);
+}
+
+
+/*
+=================
+SV_HashClient
+
+Called when a client's netchan has been set up
+=================
+*/
+void SV_HashClient (client_t *cl)
+{
+	int		key;
+
+	key = SV_ClientHashKey (&cl->netchan.remote_address, cl->netchan.qport);
+
+	cl->hashnext = svs.client_hash[key];
+	svs.client_hash[key] = cl;
+}
+
+
+/*
+=================
+SV_UnhashClient
+
+Called before a client slot is freed or reused
+=================
+*/
+void SV_UnhashClient (client_t *cl)
+{
+	client_t	**prev;
+	int			key;
+
+	key = SV_ClientHashKey (&cl->netchan.remote_address, cl->netchan.qport);
+
+	for (prev = &svs.client_hash[key]; *prev; prev = &(*prev)->hashnext)
+	{
+		if (*prev == cl)
+		{
+			*prev = cl->hashnext;
+			break;
+		}
+	}
+
+	cl->hashnext = NULL;
+}
+
+
+/*
+=================
+SV_FindClient
+
+Returns the client a packet from adr with qport belongs to.
+If more than one matches, the lowest slot wins like a scan would
+=================
+*/
+static client_t *SV_FindClient (netadr_t *adr, int qport)
+{
+	client_t	*cl, *best;
+
+	best = NULL;
+
+	for (cl = svs.client_hash[SV_ClientHashKey (adr, qport)]; cl; cl = cl->hashnext)
+	{
+		if (cl->state == cs_free)
+			continue;
+
+		if (!NET_CompareBaseAdr (*adr, cl->netchan.remote_address))
+			continue;
+
+		if (cl->netchan.qport != qport)
+			continue;
+
+		if (!best || cl < best)
+			best = cl;
+	}
+
+	return best;
 }
 
 
@@ -112,7 +230,7 @@ Builds the string that is sent as heartbeats and status replies
 char	*SV_StatusString (void)
 {
 	char	player[1024];
-	static char	status[MAX_MSGLEN - 16];
+	static char	status[MAX_PACKETLEN - 16];
 	int		i;
 	client_t	*cl;
 	int		statusLength;
@@ -143,6 +261,161 @@ char	*SV_StatusString (void)
 	return status;
 }
 
+/*
+==============================================================================
+
+NETWORK THREAD QUERIES
+
+With net_thread running, status, ping and getchallenge are answered on the
+network thread. The status string is copied out once a frame and the
+challenges are shared with SVC_DirectConnect, both under a spinlock
+
+==============================================================================
+*/
+
+static SDL_SpinLock	sv_statuslock;
+static char			sv_statuscache[MAX_PACKETLEN - 16];
+
+SDL_SpinLock		sv_challengelock;
+
+/*
+================
+SV_UpdateStatusCache
+
+Called at the end of every server frame
+================
+*/
+void SV_UpdateStatusCache (void)
+{
+	char	*status;
+
+	if (!NET_ThreadActive ())
+		return;
+
+	status = SV_StatusString ();
+
+	SDL_AtomicLock (&sv_statuslock);
+	strcpy (sv_statuscache, status);
+	SDL_AtomicUnlock (&sv_statuslock);
+}
+
+
+/*
+================
+SV_ChallengeForAddress
+
+Returns the challenge for adr, making a new one if there isn't any.
+Called with sv_challengelock held
+================
+*/
+static int SV_ChallengeForAddress (netadr_t *adr, int time)
+{
+	static unsigned int	seed;
+	int		i;
+	int		oldest;
+	int		oldestTime;
+
+	oldest = 0;
+	oldestTime = 0x7fffffff;
+
+	// see if we already have a challenge for this ip
+	for (i = 0; i < MAX_CHALLENGES; i++)
+	{
+		if (NET_CompareBaseAdr (*adr, svs.challenges[i].adr))
+			break;
+
+		if (svs.challenges[i].time < oldestTime)
+		{
+			oldestTime = svs.challenges[i].time;
+			oldest = i;
+		}
+	}
+
+	if (i == MAX_CHALLENGES)
+	{
+		// overwrite the oldest, the network thread can't use rand ()
+		// without changing the sequence the game sees
+		if (NET_ThreadActive ())
+		{
+			seed = seed * 1103515245 + 12345 + time;
+			svs.challenges[oldest].challenge = (seed >> 16) & 0x7fff;
+		}
+		else
+			svs.challenges[oldest].challenge = rand () & 0x7fff;
+
+		svs.challenges[oldest].adr = *adr;
+		svs.challenges[oldest].time = time;
+		i = oldest;
+	}
+
+	return svs.challenges[i].challenge;
+}
+
+
+/*
+================
+SV_NetThreadPacket
+
+Runs on the network thread, so it must not print or touch anything
+the server frame changes without a lock. Returns false to pass the
+packet on to SV_ConnectionlessPacket
+================
+*/
+qboolean SV_NetThreadPacket (netadr_t *from, sizebuf_t *msg)
+{
+	char	cmd[16];
+	char	reply[MAX_PACKETLEN - 4];
+	int		i, len;
+
+	if (!svs.initialized)
+		return false;
+
+	// the first word after the -1 marker
+	for (i = 4, len = 0; i < msg->cursize && len < sizeof (cmd) - 1; i++)
+	{
+		if (msg->data[i] <= ' ')
+			break;
+
+		cmd[len++] = msg->data[i];
+	}
+
+	cmd[len] = 0;
+
+	if (!strcmp (cmd, "ping"))
+	{
+		Netchan_OutOfBand (NS_SERVER, *from, 3, (byte *) "ack");
+		return true;
+	}
+
+	if (!strcmp (cmd, "status"))
+	{
+		SDL_AtomicLock (&sv_statuslock);
+		Com_sprintf (reply, sizeof (reply), "print\n%s", sv_statuscache);
+		SDL_AtomicUnlock (&sv_statuslock);
+
+		// no frame has run yet
+		if (!reply[6])
+			return false;
+
+		Netchan_OutOfBand (NS_SERVER, *from, strlen (reply), (byte *) reply);
+		return true;
+	}
+
+	if (!strcmp (cmd, "getchallenge"))
+	{
+		SDL_AtomicLock (&sv_challengelock);
+		i = SV_ChallengeForAddress (from, Sys_Milliseconds ());
+		SDL_AtomicUnlock (&sv_challengelock);
+
+		Com_sprintf (reply, sizeof (reply), "challenge %i", i);
+		Netchan_OutOfBand (NS_SERVER, *from, strlen (reply), (byte *) reply);
+		return true;
+	}
+
+	return false;
+}
+
+
 /*
 ================
 SVC_Status
@@ -232,37 +505,14 @@ challenge, they must give a valid IP address.
 */
 void SVC_GetChallenge (void)
 {
-	int		i;
-	int		oldest;
-	int		oldestTime;
-
-	oldest = 0;
-	oldestTime = 0x7fffffff;
-
-	// see if we already have a challenge for this ip
-	for (i = 0; i < MAX_CHALLENGES; i++)
-	{
-		if (NET_CompareBaseAdr (net_from, svs.challenges[i].adr))
-			break;
-
-		if (svs.challenges[i].time < oldestTime)
-		{
-			oldestTime = svs.challenges[i].time;
-			oldest = i;
-		}
-	}
+	int		challenge;
 
-	if (i == MAX_CHALLENGES)
-	{
-		// overwrite the oldest
-		svs.challenges[oldest].challenge = rand () & 0x7fff;
-		svs.challenges[oldest].adr = net_from;
-		svs.challenges[oldest].time = curtime;
-		i = oldest;
-	}
+	SDL_AtomicLock (&sv_challengelock);
+	challenge = SV_ChallengeForAddress (&net_from, curtime);
+	SDL_AtomicUnlock (&sv_challengelock);
 
 	// send it back
-	Netchan_OutOfBandPrint (NS_SERVER, net_from, "challenge %i", svs.challenges[i].challenge);
+	Netchan_OutOfBandPrint (NS_SERVER, net_from, "challenge %i", challenge);
 }
 
 /*
@@ -284,6 +534,9 @@ void SVC_DirectConnect (void)
 	int			version;
 	int			qport;
 	int			challenge;
+	int			frames;
+	qboolean	fragments;
+	char		reply[MAX_INFO_STRING];
 
 	adr = net_from;
 
@@ -305,6 +558,18 @@ void SVC_DirectConnect (void)
 	strncpy (userinfo, Cmd_Argv (4), sizeof (userinfo) - 1);
 	userinfo[sizeof (userinfo) - 1] = 0;
 
+	// newer clients ask for a longer frame history and fragmented frames
+	frames = UPDATE_BACKUP;
+	fragments = false;
+
+	for (i = 5; i < Cmd_Argc (); i++)
+	{
+		if (!strncmp (Cmd_Argv (i), "frames=", 7))
+			frames = atoi (Cmd_Argv (i) + 7);
+		else if (!strcmp (Cmd_Argv (i), "fragments=1"))
+			fragments = true;
+	}
+
 	// force the IP key/value pair so the game can filter based on ip
 	Info_SetValueForKey (userinfo, "ip", NET_AdrToString (net_from));
 
@@ -322,18 +587,23 @@ void SVC_DirectConnect (void)
 	// see if the challenge is valid
 	if (!NET_IsLocalAddress (adr))
 	{
+		SDL_AtomicLock (&sv_challengelock);
+
 		for (i = 0; i < MAX_CHALLENGES; i++)
 		{
 			if (NET_CompareBaseAdr (net_from, svs.challenges[i].adr))
-			{
-				if (challenge == svs.challenges[i].challenge)
-					break;		// good
+				break;
+		}
 
-				Netchan_OutOfBandPrint (NS_SERVER, adr, "print\nBad challenge.\n");
-				return;
-			}
+		if (i < MAX_CHALLENGES && challenge != svs.challenges[i].challenge)
+		{
+			SDL_AtomicUnlock (&sv_challengelock);
+			Netchan_OutOfBandPrint (NS_SERVER, adr, "print\nBad challenge.\n");
+			return;
 		}
 
+		SDL_AtomicUnlock (&sv_challengelock);
+
 		if (i == MAX_CHALLENGES)
 		{
 			Netchan_OutOfBandPrint (NS_SERVER, adr, "print\nNo challenge for address.\n");
@@ -386,6 +656,10 @@ void SVC_DirectConnect (void)
 	}
 
 gotnewcl:
+	// a reconnecting client is still hashed by its old address
+	if (newcl->state != cs_free)
+		SV_UnhashClient (newcl);
+
 	// build a new connection
 	// accept the new client
 	// this is the only place a client_t is ever initialized
@@ -396,6 +670,15 @@ gotnewcl:
 	newcl->edict = ent;
 	newcl->challenge = challenge; // save challenge for checksumming
 
+	newcl->frames = &svs.client_frames[(newcl - svs.clients) * svs.updatebackup];
+	memset (newcl->frames, 0, sizeof (client_frame_t) * svs.updatebackup);
+
+	for (newcl->updatebackup = UPDATE_BACKUP; newcl->updatebackup < svs.updatebackup; newcl->updatebackup <<= 1)
+	{
+		if (newcl->updatebackup << 1 > frames)
+			break;
+	}
+
 	// get the game a chance to reject this connection or modify the userinfo
 	if (!(ge->ClientConnect (ent, userinfo)))
 	{
@@ -414,16 +697,24 @@ gotnewcl:
 	SV_UserinfoChanged (newcl);
 
 	// send the connect packet to the client
+	Q_strlcpy (reply, "client_connect", sizeof (reply));
+
 	if (sv_download_server->string[0])
-		Netchan_OutOfBandPrint (NS_SERVER, adr, "client_connect dlserver=%s", sv_download_server->string);
-	else
-		Netchan_OutOfBandPrint (NS_SERVER, adr, "client_connect");
+		Q_strlcat (reply, va (" dlserver=%s", sv_download_server->string), sizeof (reply));
+
+	if (fragments)
+		Q_strlcat (reply, " fragments=1", sizeof (reply));
+
+	Netchan_OutOfBandPrint (NS_SERVER, adr, "%s", reply);
 
 	Netchan_Setup (NS_SERVER, &newcl->netchan, adr, qport);
+	newcl->netchan.fragments = fragments;
+	SV_HashClient (newcl);
 
 	newcl->state = cs_connected;
 
-	SZ_Init (&newcl->datagram, newcl->datagram_buf, sizeof (newcl->datagram_buf));
+	// vanilla clients can't take more than a packet of frame message
+	SZ_Init (&newcl->datagram, newcl->datagram_buf, fragments ? sizeof (newcl->datagram_buf) : MAX_PACKETLEN);
 	newcl->datagram.allowoverflow = true;
 	newcl->lastmessage = svs.realtime;	// don't timeout
 	newcl->lastconnect = svs.realtime;
@@ -621,7 +912,6 @@ SV_ReadPackets
 */
 void SV_ReadPackets (void)
 {
-	int			i;
 	client_t	*cl;
 	int			qport;
 
@@ -642,38 +932,26 @@ void SV_ReadPackets (void)
 		qport = MSG_ReadShort (&net_message) & 0xffff;
 
 		// check for packets from connected clients
-		for (i = 0, cl = svs.clients; i < maxclients->value; i++, cl++)
-		{
-			if (cl->state == cs_free)
-				continue;
-
-			if (!NET_CompareBaseAdr (net_from, cl->netchan.remote_address))
-				continue;
-
-			if (cl->netchan.qport != qport)
-				continue;
+		if ((cl = SV_FindClient (&net_from, qport)) == NULL)
+			continue;
 
-			if (cl->netchan.remote_address.port != net_from.port)
-			{
-				Com_Printf ("SV_ReadPackets: fixing up a translated port\n");
-				cl->netchan.remote_address.port = net_from.port;
-			}
+		// the port isn't part of the hash key, so the
+		// client stays in the same chain
+		if (cl->netchan.remote_address.port != net_from.port)
+		{
+			Com_Printf ("SV_ReadPackets: fixing up a translated port\n");
+			cl->netchan.remote_address.port = net_from.port;
+		}
 
-			if (Netchan_Process (&cl->netchan, &net_message))
+		if (Netchan_Process (&cl->netchan, &net_message))
+		{
+			// this is a valid, sequenced packet, so process it
+			if (cl->state != cs_zombie)
 			{
-				// this is a valid, sequenced packet, so process it
-				if (cl->state != cs_zombie)
-				{
-					cl->lastmessage = svs.realtime;	// don't timeout
-					SV_ExecuteClientMessage (cl);
-				}
+				cl->lastmessage = svs.realtime;	// don't timeout
+				SV_ExecuteClientMessage (cl);
 			}
-
-			break;
 		}
-
-		if (i != maxclients->value)
-			continue;
 	}
 }
 
@@ -709,6 +987,7 @@ void SV_CheckTimeouts (void)
 		if (cl->state == cs_zombie
 				&& cl->lastmessage < zombiepoint)
 		{
+			SV_UnhashClient (cl);
 			cl->state = cs_free;	// can now be reused
 			continue;
 		}
@@ -718,6 +997,7 @@ void SV_CheckTimeouts (void)
 		{
 			SV_BroadcastPrintf (PRINT_HIGH, "%s timed out\n", cl->name);
 			SV_DropClient (cl);
+			SV_UnhashClient (cl);
 			cl->state = cs_free;	// don't bother with zombie state
 		}
 	}
@@ -753,6 +1033,8 @@ SV_RunGameFrame
 */
 void SV_RunGameFrame (void)
 {
+	unsigned	prof;
+
 	if (host_speeds->value)
 		time_before_game = Sys_Milliseconds ();
 
@@ -763,10 +1045,16 @@ void SV_RunGameFrame (void)
 	sv.framenum++;
 	sv.time = sv.framenum * 100;
 
+	// traces are only remembered for a frame
+	CM_ClearTraceCache ();
+	SV_ClearMulticastCache ();
+
 	// don't run if paused
 	if (!sv_paused->value || maxclients->value > 1)
 	{
+		prof = Prof_Begin ();
 		ge->RunFrame ();
+		Prof_End ("ge->RunFrame", prof);
 
 		// never get more than one tic behind
 		if (sv.time < svs.realtime)
@@ -790,6 +1078,8 @@ SV_Frame
 */
 void SV_Frame (int msec)
 {
+	unsigned	prof, sendprof;
+
 	time_before_game = time_after_game = 0;
 
 	// if server is not active, do nothing
@@ -805,7 +1095,9 @@ void SV_Frame (int msec)
 	SV_CheckTimeouts ();
 
 	// get packets from clients
+	prof = Prof_Begin ();
 	SV_ReadPackets ();
+	Prof_End ("SV_ReadPackets", prof);
 
 	// move autonomous things around if enough time has passed
 	if (!sv_timedemo->value && svs.realtime < sv.time)
@@ -823,6 +1115,9 @@ void SV_Frame (int msec)
 		return;
 	}
 
+	Prof_Frame ();
+	prof = Prof_Begin ();
+
 	// update ping based on the last known frame from all clients
 	SV_CalcPings ();
 
@@ -833,7 +1128,9 @@ void SV_Frame (int msec)
 	SV_RunGameFrame ();
 
 	// send messages back to the clients that had packets read this frame
+	sendprof = Prof_Begin ();
 	SV_SendClientMessages ();
+	Prof_End ("SV_SendClientMessages", sendprof);
 
 	// save the entire world state if recording a serverdemo
 	SV_RecordDemoMessage ();
@@ -844,6 +1141,323 @@ void SV_Frame (int msec)
 	// clear teleport flags, etc for next frame
 	SV_PrepWorldFrame ();
 
+	// let the network thread answer status queries with this frame
+	SV_UpdateStatusCache ();
+
+	Prof_End ("SV_Frame", prof);
+}
+
+/*
+==============================================================================
+
+LOAD TEST
+
+sv_loadtest connects scripted clients that run, turn, jump and fire,
+and runs server frames back to back as fast as they go. The clients
+are sent through the loopback like a local client, every command
+packet is read by SV_ReadPackets and every frame message goes through
+the netchan, so the whole server side of a frame is timed.
+
+Loopback packets carry no port, the clients are told apart by qport
+==============================================================================
+*/
+
+#define	LOADTEST_QPORT		0x4000	// first client's qport
+
+typedef struct
+{
+	client_t	*cl;
+	int			qport;
+	int			sequence;			// of the next packet sent
+	int			lastframe;			// last frame message sent to it
+	usercmd_t	cmds[3];			// oldest to newest
+	int			bytes;				// frame messages received
+	int			maxbytes;
+} loadclient_t;
+
+typedef struct
+{
+	char		*name;
+	unsigned	*usec;				// [frames]
+} loadphase_t;
+
+/*
+==================
+SV_LoadTestSend
+
+Sends data to the server as the client's next packet, acknowledging
+everything the server has sent, and has the server read it before
+the loopback wraps
+==================
+*/
+static void SV_LoadTestSend (loadclient_t *lc, byte *data, int length)
+{
+	sizebuf_t	msg;
+	byte		buf[MAX_PACKETLEN];
+	netchan_t	*chan = &lc->cl->netchan;
+	netadr_t	adr;
+
+	SZ_Init (&msg, buf, sizeof (buf));
+	MSG_WriteLong (&msg, lc->sequence++);
+	MSG_WriteLong (&msg, (chan->outgoing_sequence - 1) | ((unsigned) chan->reliable_sequence << 31));
+	MSG_WriteShort (&msg, lc->qport);
+	SZ_Write (&msg, data, length);
+
+	memset (&adr, 0, sizeof (adr));
+	adr.type = NA_LOOPBACK;
+
+	NET_SendPacket (NS_CLIENT, msg.cursize, msg.data, adr);
+	SV_ReadPackets ();
+}
+
+/*
+==================
+SV_LoadTestConnect
+==================
+*/
+static qboolean SV_LoadTestConnect (loadclient_t *lc, int num)
+{
+	char	userinfo[MAX_INFO_STRING];
+	byte	buf[64];
+	sizebuf_t	msg;
+
+	memset (lc, 0, sizeof (*lc));
+	lc->qport = LOADTEST_QPORT + num;
+	lc->sequence = 1;
+	lc->lastframe = -1;
+
+	// the port only keeps SVC_DirectConnect from taking the
+	// clients for one reconnecting
+	memset (&net_from, 0, sizeof (net_from));
+	net_from.type = NA_LOOPBACK;
+	net_from.port = BigShort (num + 1);
+
+	Com_sprintf (userinfo, sizeof (userinfo), "\\name\\loadtest%i\\skin\\male/grunt\\hand\\2\\rate\\15000", num);
+	Cmd_TokenizeString (va ("connect %i %i 0 \"%s\" frames=%i fragments=1", PROTOCOL_VERSION, lc->qport, userinfo, MAX_UPDATE_BACKUP), false);
+	SVC_DirectConnect ();
+
+	if (!sv_client || sv_client->state != cs_connected || sv_client->netchan.qport != lc->qport)
+		return false;
+
+	lc->cl = sv_client;
+	lc->cl->netchan.remote_address.port = 0;
+
+	// skip the configstrings and baselines, nothing reads them
+	SZ_Init (&msg, buf, sizeof (buf));
+	MSG_WriteByte (&msg, clc_stringcmd);
+	MSG_WriteString (&msg, "new");
+	MSG_WriteByte (&msg, clc_stringcmd);
+	MSG_WriteString (&msg, va ("begin %i", svs.spawncount));
+	SV_LoadTestSend (lc, msg.data, msg.cursize);
+
+	return lc->cl->state == cs_spawned;
+}
+
+/*
+==================
+SV_LoadTestMove
+
+Runs forward while turning, strafes, and jumps and fires now and then
+==================
+*/
+static void SV_LoadTestMove (loadclient_t *lc, int num, int frame)
+{
+	sizebuf_t	msg;
+	byte		buf[128];
+	usercmd_t	nullcmd, *cmd;
+	int			checksumIndex;
+
+	lc->cmds[0] = lc->cmds[1];
+	lc->cmds[1] = lc->cmds[2];
+
+	cmd = &lc->cmds[2];
+	memset (cmd, 0, sizeof (*cmd));
+	cmd->msec = 100;
+	cmd->forwardmove = 400;
+	cmd->sidemove = ((frame / 20 + num) & 1) ? 200 : -200;
+	cmd->angles[YAW] = ANGLE2SHORT ((frame * 7 + num * 37) % 360);
+	cmd->lightlevel = 128;
+
+	if (!((frame + num) % 15))
+		cmd->upmove = 200;
+
+	if ((frame + num) % 40 < 10)
+		cmd->buttons = BUTTON_ATTACK;
+
+	SZ_Init (&msg, buf, sizeof (buf));
+	MSG_WriteByte (&msg, clc_move);
+
+	checksumIndex = msg.cursize;
+	MSG_WriteByte (&msg, 0);
+	MSG_WriteLong (&msg, lc->lastframe);
+
+	memset (&nullcmd, 0, sizeof (nullcmd));
+	MSG_WriteDeltaUsercmd (&msg, &nullcmd, &lc->cmds[0]);
+	MSG_WriteDeltaUsercmd (&msg, &lc->cmds[0], &lc->cmds[1]);
+	MSG_WriteDeltaUsercmd (&msg, &lc->cmds[1], &lc->cmds[2]);
+
+	msg.data[checksumIndex] = COM_BlockSequenceCRCByte (
+								  msg.data + checksumIndex + 1, msg.cursize - checksumIndex - 1,
+								  lc->sequence);
+
+	SV_LoadTestSend (lc, msg.data, msg.cursize);
+}
+
+static int SV_LoadTestCompare (const void *a, const void *b)
+{
+	unsigned	ua = *(const unsigned *) a, ub = *(const unsigned *) b;
+
+	return (ua > ub) - (ua < ub);
+}
+
+/*
+==================
+SV_LoadTest_f
+
+sv_loadtest <clients> [frames]
+==================
+*/
+void SV_LoadTest_f (void)
+{
+	loadclient_t	*lcs, *lc;
+	loadphase_t		phases[4];
+	unsigned		start, mid;
+	int				i, j, numclients, frames, connected;
+	int				bytes, maxbytes;
+
+	if (Cmd_Argc () < 2)
+	{
+		Com_Printf ("usage: sv_loadtest <clients> [frames]\n");
+		return;
+	}
+
+	// the local client would read the server's half of the loopback
+	if (!dedicated->value)
+	{
+		Com_Printf (S_COLOR_RED "sv_loadtest only runs on a dedicated server.\n");
+		return;
+	}
+
+	if (sv.state != ss_game)
+	{
+		Com_Printf (S_COLOR_RED "No map loaded.\n");
+		return;
+	}
+
+	numclients = atoi (Cmd_Argv (1));
+	frames = (Cmd_Argc () > 2) ? atoi (Cmd_Argv (2)) : 600;
+
+	if (numclients < 1 || frames < 1)
+	{
+		Com_Printf ("usage: sv_loadtest <clients> [frames]\n");
+		return;
+	}
+
+	lcs = Z_Malloc (sizeof (*lcs) * numclients);
+
+	for (i = 0, connected = 0; i < numclients; i++)
+	{
+		if (!SV_LoadTestConnect (&lcs[connected], i))
+			break;
+
+		connected++;
+	}
+
+	if (connected < numclients)
+		Com_Printf (S_COLOR_YELLOW "WARNING: only %i of %i clients could join, raise maxclients\n", connected, numclients);
+
+	if (!connected)
+	{
+		Z_Free (lcs);
+		return;
+	}
+
+	phases[0].name = "packets";
+	phases[1].name = "game";
+	phases[2].name = "send";
+	phases[3].name = "frame";
+
+	for (i = 0; i < 4; i++)
+		phases[i].usec = Z_Malloc (sizeof (unsigned) * frames);
+
+	for (i = 0; i < frames; i++)
+	{
+		start = Sys_Microseconds ();
+
+		for (j = 0, lc = lcs; j < connected; j++, lc++)
+		{
+			if (lc->cl->state == cs_spawned)
+				SV_LoadTestMove (lc, j, i);
+		}
+
+		mid = Sys_Microseconds ();
+		phases[0].usec[i] = mid - start;
+
+		// what SV_Frame does once a frame is due
+		svs.realtime = sv.time;
+		SV_CalcPings ();
+		SV_GiveMsec ();
+		SV_RunGameFrame ();
+
+		phases[1].usec[i] = Sys_Microseconds () - mid;
+		mid = Sys_Microseconds ();
+
+		SV_SendClientMessages ();
+
+		phases[2].usec[i] = Sys_Microseconds () - mid;
+
+		SV_PrepWorldFrame ();
+
+		phases[3].usec[i] = Sys_Microseconds () - start;
+
+		// the clients got everything that was sent
+		for (j = 0, lc = lcs; j < connected; j++, lc++)
+		{
+			if (lc->cl->state != cs_spawned)
+				continue;
+
+			bytes = lc->cl->message_size[sv.framenum % RATE_MESSAGES];
+			lc->bytes += bytes;
+
+			if (lc->maxbytes < bytes)
+				lc->maxbytes = bytes;
+
+			lc->lastframe = sv.framenum;
+		}
+	}
+
+	Com_Printf ("%i clients, %i frames on %s, %i edicts\n", connected, frames, sv.name, ge->num_edicts);
+	Com_Printf ("phase       p50     p90     p99     max usec\n");
+
+	for (i = 0; i < 4; i++)
+	{
+		qsort (phases[i].usec, frames, sizeof (unsigned), SV_LoadTestCompare);
+		Com_Printf ("%-8s %6u  %6u  %6u  %6u\n", phases[i].name,
+			phases[i].usec[frames / 2], phases[i].usec[frames * 9 / 10],
+			phases[i].usec[frames * 99 / 100], phases[i].usec[frames - 1]);
+		Z_Free (phases[i].usec);
+	}
+
+	for (j = 0, lc = lcs, bytes = maxbytes = 0; j < connected; j++, lc++)
+	{
+		bytes += lc->bytes;
+
+		if (maxbytes < lc->maxbytes)
+			maxbytes = lc->maxbytes;
+
+		// done, drop them the way a timeout would
+		if (lc->cl->state != cs_free)
+		{
+			SV_DropClient (lc->cl);
+			SV_UnhashClient (lc->cl);
+			lc->cl->state = cs_free;
+		}
+	}
+
+	Com_Printf ("sent %.0f bytes per client per frame, %i at most, %.1f KB/s per client\n",
+		(float) bytes / (connected * frames), maxbytes, (float) bytes * 10 / (connected * frames * 1024));
+
+	Z_Free (lcs);
 }
 
 //============================================================================
@@ -999,6 +1613,11 @@ void SV_Init (void)
 	sv_paused = Cvar_Get ("paused", "0", 0);
 	sv_timedemo = Cvar_Get ("timedemo", "0", 0);
 	sv_enforcetime = Cvar_Get ("sv_enforcetime", "0", 0);
+	sv_threads = Cvar_Get ("sv_threads", "0", CVAR_ARCHIVE | CVAR_LATCH);
+	sv_entindex = Cvar_Get ("sv_entindex", "1", 0);
+	sv_areagrid = Cvar_Get ("sv_areagrid", "0", 0);
+	sv_deltacache = Cvar_Get ("sv_deltacache", "1", 0);
+	sv_updatebackup = Cvar_Get ("sv_updatebackup", va ("%i", MAX_UPDATE_BACKUP), CVAR_LATCH);
 	sv_download_server = Cvar_Get("sv_download_server", "", 0);
 	allow_download = Cvar_Get ("allow_download", "1", CVAR_ARCHIVE);
 	allow_download_players = Cvar_Get ("allow_download_players", "1", CVAR_ARCHIVE);
@@ -1016,6 +1635,8 @@ void SV_Init (void)
 
 	sv_reconnect_limit = Cvar_Get ("sv_reconnect_limit", "3", CVAR_ARCHIVE);
 
+	NET_SetConnectionlessHandler (SV_NetThreadPacket);
+
 	SZ_Init (&net_message, net_message_buffer, sizeof (net_message_buffer));
 }
 
@@ -1085,12 +1706,24 @@ void SV_Shutdown (char *finalmsg, qboolean reconnect)
 	if (svs.clients)
 		Z_Free (svs.clients);
 
+	if (svs.client_frames)
+		Z_Free (svs.client_frames);
+
 	if (svs.client_entities)
 		Z_Free (svs.client_entities);
 
+	if (svs.client_entity_tags)
+		Z_Free (svs.client_entity_tags);
+
+	if (svs.snapshot_workers)
+		Z_Free (svs.snapshot_workers);
+
 	if (svs.demofile)
 		fclose (svs.demofile);
 
+	// the network thread may be handing out challenges
+	SDL_AtomicLock (&sv_challengelock);
 	memset (&svs, 0, sizeof (svs));
+	SDL_AtomicUnlock (&sv_challengelock);
 }
 
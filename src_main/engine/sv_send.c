@@ -20,6 +20,9 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 // sv_main.c -- server main program
 
 #include "server.h"
+#include "q_threads.h"
+
+#include <SDL_atomic.h>
 
 /*
 =============================================================================
@@ -150,6 +153,154 @@ void SV_BroadcastCommand (char *fmt, ...)
 }
 
 
+/*
+=============================================================================
+
+MULTICAST RECIPIENTS
+
+Most multicasts in a frame come from a few places, a rocket's trail and
+its explosion, a fight in one room, so the clients that can see or hear
+a cluster are worked out once and reused for the rest of the frame.
+Only visibility is kept, client states are still checked per message.
+
+=============================================================================
+*/
+
+#define	RECIPIENT_SETS	64		// must be a power of two
+
+typedef struct
+{
+	int			frame;			// svs.multicastframe, 0 = unused
+	int			gen;			// svs.multicastgen
+	int			cluster;
+	int			area;
+	qboolean	phs;
+	unsigned	clients[MAX_CLIENTS/32];
+} recipientset_t;
+
+static recipientset_t	sv_recipients[RECIPIENT_SETS];
+
+
+/*
+=================
+SV_ClearMulticastCache
+
+Called every server frame, on map changes and when an area portal
+opens or closes
+=================
+*/
+void SV_ClearMulticastCache (void)
+{
+	int		i;
+
+	svs.multicastframe++;
+
+	if (svs.multicastframe > 0)
+		return;
+
+	// wrapped, forget everything
+	svs.multicastframe = 1;
+	memset (sv_recipients, 0, sizeof (sv_recipients));
+
+	if (svs.clients)
+	{
+		for (i = 0; i < maxclients->value; i++)
+			svs.clients[i].leafframe = 0;
+	}
+}
+
+
+/*
+=================
+SV_UpdateClientLeafs
+
+Finds the leaf of every client that moved since it was last looked up
+this frame. Any client changing cluster or area makes the recipient sets
+built so far stale
+=================
+*/
+static void SV_UpdateClientLeafs (void)
+{
+	client_t	*cl;
+	float		*org;
+	int			i, leafnum, cluster, area;
+
+	for (i = 0, cl = svs.clients; i < maxclients->value; i++, cl++)
+	{
+		if (!cl->edict)
+			continue;
+
+		org = cl->edict->s.origin;
+
+		if (cl->leafframe == svs.multicastframe && VectorCompare (org, cl->leaforigin))
+			continue;
+
+		leafnum = CM_PointLeafnum (org);
+		cluster = CM_LeafCluster (leafnum);
+		area = CM_LeafArea (leafnum);
+
+		if (cl->leafframe != svs.multicastframe || cluster != cl->leafcluster || area != cl->leafarea)
+			svs.multicastgen++;
+
+		VectorCopy (org, cl->leaforigin);
+		cl->leafframe = svs.multicastframe;
+		cl->leafcluster = cluster;
+		cl->leafarea = area;
+	}
+}
+
+
+/*
+=================
+SV_MulticastRecipients
+
+Returns a bit for every client that is in an area connected to area and
+in a cluster set in mask, the PVS or PHS of cluster
+=================
+*/
+static unsigned *SV_MulticastRecipients (int cluster, int area, qboolean phs, byte *mask)
+{
+	recipientset_t	*set;
+	client_t		*cl;
+	int				i, numclients;
+
+	numclients = maxclients->value;
+	set = &sv_recipients[(cluster * 2 + area * 31 + phs) & (RECIPIENT_SETS - 1)];
+
+	if (set->frame == svs.multicastframe && set->gen == svs.multicastgen &&
+		set->cluster == cluster && set->area == area && set->phs == phs)
+	{
+		svs.num_multicast_saved += numclients;
+		return set->clients;
+	}
+
+	set->frame = svs.multicastframe;
+	set->gen = svs.multicastgen;
+	set->cluster = cluster;
+	set->area = area;
+	set->phs = phs;
+	memset (set->clients, 0, sizeof (set->clients));
+
+	for (i = 0, cl = svs.clients; i < numclients; i++, cl++)
+	{
+		if (!cl->edict)
+			continue;
+
+		if (!CM_AreasConnected (area, cl->leafarea))
+			continue;
+
+		if (!(mask[cl->leafcluster>>3] & (1 << (cl->leafcluster & 7))))
+			continue;
+
+		set->clients[i >> 5] |= 1u << (i & 31);
+	}
+
+	svs.num_multicast_tests += numclients;
+
+	return set->clients;
+}
+
+
 /*
 =================
 SV_Multicast
@@ -166,12 +317,17 @@ void SV_Multicast (vec3_t origin, multicast_t to)
 {
 	client_t	*client;
 	byte		*mask;
+	unsigned	*recipients;
 	int			leafnum, cluster;
 	int			j;
-	qboolean	reliable;
-	int			area1, area2;
+	qboolean	reliable, phs;
+	int			area1;
+	unsigned	prof;
 
+	prof = Prof_Begin ();
 	reliable = false;
+	phs = false;
+	recipients = NULL;
 
 	if (to != MULTICAST_ALL_R && to != MULTICAST_ALL)
 	{
@@ -200,15 +356,14 @@ void SV_Multicast (vec3_t origin, multicast_t to)
 	case MULTICAST_PHS_R:
 		reliable = true;	// intentional fallthrough
 	case MULTICAST_PHS:
-		leafnum = CM_PointLeafnum (origin);
 		cluster = CM_LeafCluster (leafnum);
 		mask = CM_ClusterPHS (cluster);
+		phs = true;
 		break;
 
 	case MULTICAST_PVS_R:
 		reliable = true;	// intentional fallthrough
 	case MULTICAST_PVS:
-		leafnum = CM_PointLeafnum (origin);
 		cluster = CM_LeafCluster (leafnum);
 		mask = CM_ClusterPVS (cluster);
 		break;
@@ -218,6 +373,17 @@ void SV_Multicast (vec3_t origin, multicast_t to)
 		Com_Error (ERR_FATAL, "SV_Multicast: bad to:%i", to);
 	}
 
+	svs.num_multicasts++;
+
+	if (mask)
+	{
+		if (!svs.multicastframe)
+			SV_ClearMulticastCache ();
+
+		SV_UpdateClientLeafs ();
+		recipients = SV_MulticastRecipients (cluster, area1, phs, mask);
+	}
+
 	// send the data to all relevent clients
 	for (j = 0, client = svs.clients; j < maxclients->value; j++, client++)
 	{
@@ -227,18 +393,8 @@ void SV_Multicast (vec3_t origin, multicast_t to)
 		if (client->state != cs_spawned && !reliable)
 			continue;
 
-		if (mask)
-		{
-			leafnum = CM_PointLeafnum (client->edict->s.origin);
-			cluster = CM_LeafCluster (leafnum);
-			area2 = CM_LeafArea (leafnum);
-
-			if (!CM_AreasConnected (area1, area2))
-				continue;
-
-			if (mask && (!(mask[cluster>>3] & (1 << (cluster & 7)))))
-				continue;
-		}
+		if (recipients && !(recipients[j >> 5] & (1u << (j & 31))))
+			continue;
 
 		if (reliable)
 			SZ_Write (&client->netchan.message, sv.multicast.data, sv.multicast.cursize);
@@ -247,6 +403,32 @@ void SV_Multicast (vec3_t origin, multicast_t to)
 	}
 
 	SZ_Clear (&sv.multicast);
+
+	Prof_End ("SV_Multicast", prof);
+}
+
+
+/*
+=================
+SV_MulticastStats_f
+=================
+*/
+void SV_MulticastStats_f (void)
+{
+	unsigned	total;
+
+	total = svs.num_multicast_tests + svs.num_multicast_saved;
+
+	Com_Printf ("%u multicasts\n", svs.num_multicasts);
+	Com_Printf ("%u client tests, %u answered from recipient sets (%.1f%%)\n",
+		total, svs.num_multicast_saved, total ? 100.0f * svs.num_multicast_saved / total : 0.0f);
+
+	if (Cmd_Argc () > 1 && !Q_stricmp (Cmd_Argv (1), "reset"))
+	{
+		svs.num_multicasts = 0;
+		svs.num_multicast_tests = 0;
+		svs.num_multicast_saved = 0;
+	}
 }
 
 
@@ -401,59 +583,160 @@ FRAME UPDATES
 
 /*
 =======================
-SV_SendClientDatagram
+SV_BuildClientDatagram
+
+Builds the frame message for a client into client->snapshot_buf.
+Runs on the snapshot workers, so nothing here may print or touch
+anything but the client and the worker; warnings are left in
+client->snapshot_flags for SV_SendClientDatagram
 =======================
 */
-qboolean SV_SendClientDatagram (client_t *client, qboolean clientonly)
+void SV_BuildClientDatagram (client_t *client, snapshot_worker_t *worker)
 {
-	byte		msg_buf[MAX_MSGLEN];
 	sizebuf_t	msg;
+	qboolean	clientonly = false;
+	unsigned	start;
+
+	client->snapshot_flags = 0;
 
 retry_send:;
-	SV_BuildClientFrame (client, clientonly);
+	SV_BuildClientFrame (client, clientonly, worker);
 
-	SZ_Init (&msg, msg_buf, sizeof (msg_buf));
-	msg.allowoverflow = true;
+	// the worker buffer is larger than any frame, so an overflow
+	// is just a message that doesn't fit in CLIENT_MSGLEN
+	SZ_Init (&msg, worker->msg_buf, sizeof (worker->msg_buf));
 
 	// send over all the relevant entity_state_t
 	// and the player_state_t
-	SV_WriteFrameToClient (client, &msg);
+	start = Sys_Microseconds ();
+	SV_WriteFrameToClient (client, &msg, worker);
+	worker->encode_usec += Sys_Microseconds () - start;
+	worker->encode_frames++;
 
 	// copy the accumulated multicast datagram
 	// for this client out to the message
 	// it is necessary for this to be after the WriteEntities
 	// so that entity references will be current
 	if (client->datagram.overflowed)
-		Com_Printf (S_COLOR_YELLOW "WARNING: datagram overflowed for %s\n", client->name);
+		client->snapshot_flags |= SNAP_DATAGRAM_OVERFLOW;
 	else SZ_Write (&msg, client->datagram.data, client->datagram.cursize);
 
 	SZ_Clear (&client->datagram);
 
-	if (msg.overflowed)
+	if (msg.cursize > CLIENT_MSGLEN (client))
 	{
 		if (!clientonly)
 		{
+			// reuse the ring space of the frame that didn't fit
+			client->next_client_entities = CLIENT_FRAME (client, sv.framenum)->first_entity;
 			clientonly = true;
 			goto retry_send;
 		}
 		else
 		{
 			// must have room left for the packet header
-			Com_Printf (S_COLOR_YELLOW "WARNING: msg overflowed for %s\n", client->name);
+			client->snapshot_flags |= SNAP_MSG_OVERFLOW;
 			SZ_Clear (&msg);
 		}
 	}
 
+	memcpy (client->snapshot_buf, msg.data, msg.cursize);
+	client->snapshot_size = msg.cursize;
+	client->snapshot_pending = true;
+}
+
+
+/*
+=======================
+SV_SendClientDatagram
+
+Sends the frame message built by SV_BuildClientDatagram
+=======================
+*/
+qboolean SV_SendClientDatagram (client_t *client)
+{
+	if (!client->snapshot_pending)
+		return false;
+
+	client->snapshot_pending = false;
+
+	if (client->snapshot_flags & SNAP_DATAGRAM_OVERFLOW)
+		Com_Printf (S_COLOR_YELLOW "WARNING: datagram overflowed for %s\n", client->name);
+
+	if (client->snapshot_flags & SNAP_MSG_OVERFLOW)
+		Com_Printf (S_COLOR_YELLOW "WARNING: msg overflowed for %s\n", client->name);
+
 	// send the datagram
-	Netchan_Transmit (&client->netchan, msg.cursize, msg.data);
+	Netchan_Transmit (&client->netchan, client->snapshot_size, client->snapshot_buf);
 
 	// record the size for rate estimation
-	client->message_size[sv.framenum % RATE_MESSAGES] = msg.cursize;
+	client->message_size[sv.framenum % RATE_MESSAGES] = client->snapshot_size;
 
 	return true;
 }
 
 
+// clients waiting for a frame message, handed out through snapshot_next
+static client_t		*snapshot_clients[MAX_CLIENTS];
+static int			num_snapshot_clients;
+static SDL_atomic_t	snapshot_next;
+
+/*
+=======================
+SV_SnapshotWorker_Run
+
+Pulls clients off the pending list until it is empty
+=======================
+*/
+static void SV_SnapshotWorker_Run (void *data)
+{
+	snapshot_worker_t	*worker = (snapshot_worker_t *) data;
+	int		i;
+
+	while ((i = SDL_AtomicAdd (&snapshot_next, 1)) < num_snapshot_clients)
+		SV_BuildClientDatagram (snapshot_clients[i], worker);
+}
+
+
+/*
+=======================
+SV_BuildClientDatagrams
+
+Builds the frame messages of all pending clients, spread over
+the thread pool when sv_threads is set. Every client only touches
+its own frames and entity ring, so the messages are the same no
+matter which thread builds them
+=======================
+*/
+void SV_BuildClientDatagrams (void)
+{
+	thread_t	*threads[MAX_THREADS];
+	int			i, numthreads;
+
+	if (!num_snapshot_clients)
+		return;
+
+	// players may have moved since the last round
+	svs.snapshotgen++;
+
+	SDL_AtomicSet (&snapshot_next, 0);
+
+	numthreads = svs.num_snapshot_workers - 1;
+
+	if (numthreads > num_snapshot_clients - 1)
+		numthreads = num_snapshot_clients - 1;
+
+	for (i = 0; i < numthreads; i++)
+		threads[i] = Thread_Create (SV_SnapshotWorker_Run, &svs.snapshot_workers[i + 1]);
+
+	// the main thread works too
+	SV_SnapshotWorker_Run (&svs.snapshot_workers[0]);
+
+	for (i = 0; i < numthreads; i++)
+		Thread_Wait (threads[i]);
+}
+
+
 /*
 ==================
 SV_DemoCompleted
@@ -556,7 +839,9 @@ void SV_SendClientMessages (void)
 		}
 	}
 
-	// send a message to each connected client
+	// find the clients that get a frame this time
+	num_snapshot_clients = 0;
+
 	for (i = 0, c = svs.clients; i < maxclients->value; i++, c++)
 	{
 		if (!c->state)
@@ -572,19 +857,45 @@ void SV_SendClientMessages (void)
 			SV_DropClient (c);
 		}
 
+		if (sv.state == ss_cinematic
+				|| sv.state == ss_demo
+				|| sv.state == ss_pic
+		  )
+			continue;
+
+		if (c->state != cs_spawned)
+			continue;
+
+		// don't overrun bandwidth
+		if (SV_RateDrop (c))
+			continue;
+
+		snapshot_clients[num_snapshot_clients++] = c;
+	}
+
+	if (num_snapshot_clients)
+	{
+		SV_FixEntityNumbers ();
+		SV_RefreshClusterIndex ();
+		SV_BuildClientDatagrams ();
+	}
+
+	// send a message to each connected client, with as few
+	// socket calls as the system allows
+	NET_BeginPacketBatch (NS_SERVER);
+
+	for (i = 0, c = svs.clients; i < maxclients->value; i++, c++)
+	{
+		if (!c->state)
+			continue;
+
 		if (sv.state == ss_cinematic
 				|| sv.state == ss_demo
 				|| sv.state == ss_pic
 		  )
 			Netchan_Transmit (&c->netchan, msglen, msgbuf);
 		else if (c->state == cs_spawned)
-		{
-			// don't overrun bandwidth
-			if (SV_RateDrop (c))
-				continue;
-
-			SV_SendClientDatagram (c, false);
-		}
+			SV_SendClientDatagram (c);
 		else
 		{
 			// just update reliable	if needed
@@ -592,5 +903,7 @@ void SV_SendClientMessages (void)
 				Netchan_Transmit (&c->netchan, 0, NULL);
 		}
 	}
+
+	NET_FlushPackets (NS_SERVER);
 }
 
@@ -146,7 +146,7 @@ void SV_Configstrings_f (void)
 
 	// write a packet full of data
 
-	while (sv_client->netchan.message.cursize < MAX_MSGLEN / 2
+	while (sv_client->netchan.message.cursize < MAX_PACKETLEN / 2
 			&& start < MAX_CONFIGSTRINGS)
 	{
 		if (sv.configstrings[start][0])
@@ -206,7 +206,7 @@ void SV_Baselines_f (void)
 
 	// write a packet full of data
 
-	while (sv_client->netchan.message.cursize < MAX_MSGLEN / 2
+	while (sv_client->netchan.message.cursize < MAX_PACKETLEN / 2
 			&& start < MAX_EDICTS)
 	{
 		base = &sv.baselines[start];
@@ -614,7 +614,7 @@ void SV_ExecuteClientMessage (client_t *cl)
 				if (cl->lastframe > 0)
 				{
 					cl->frame_latency[cl->lastframe& (LATENCY_COUNTS-1)] =
-						svs.realtime - cl->frames[cl->lastframe & UPDATE_MASK].senttime;
+						svs.realtime - CLIENT_FRAME (cl, cl->lastframe)->senttime;
 				}
 			}
 
@@ -61,6 +61,39 @@ int		area_type;
 int SV_HullForEntity (edict_t *ent);
 
 
+/*
+The loose grid is the alternative to the areanode tree, picked with
+sv_areagrid when a map is loaded. The world is cut into square columns
+sized from its bounds and every entity goes in the one column holding
+the center of its box, if the box is no wider than half a column in any
+direction. Boxes touching a query then always have their centers within
+half a column of it, so a query looks at a fixed ring of columns instead
+of walking down a tree whose upper nodes collect everything that crosses
+a split. Entities that are too big go on a list that is always checked.
+*/
+typedef struct
+{
+	link_t	trigger_edicts;
+	link_t	solid_edicts;
+} areacell_t;
+
+#define	AREA_GRID			64			// most columns along an axis
+#define	AREA_GRID_MINCELL	128			// smallest column size
+#define	AREA_GRID_BIGCELL	(AREA_GRID * AREA_GRID)
+
+static areacell_t	sv_areacells[AREA_GRID * AREA_GRID + 1];	// big entities last
+static int		sv_areacols, sv_arearows;
+static float	sv_areacellsize, sv_areacellscale;
+static vec2_t	sv_areaorigin;
+static qboolean	sv_usegrid;
+
+// cell * 2 + 1 for triggers, -1 = none, which SV_LinkEdict leaves alone
+// when the entity is still on the same list
+static int		sv_entcells[MAX_EDICTS];
+
+static unsigned	sv_arearelinks, sv_areakeeps;
+
+
 // ClearLink is used for new headnodes
 void ClearLink (link_t *l)
 {
@@ -128,6 +161,77 @@ areanode_t *SV_CreateAreaNode (int depth, vec3_t mins, vec3_t maxs)
 	return anode;
 }
 
+/*
+===============
+SV_CreateAreaGrid
+
+Sizes the loose grid for the given world size
+===============
+*/
+static void SV_CreateAreaGrid (vec3_t mins, vec3_t maxs)
+{
+	float	size;
+	int		i;
+
+	size = maxs[0] - mins[0];
+
+	if (maxs[1] - mins[1] > size)
+		size = maxs[1] - mins[1];
+
+	sv_areacellsize = size / AREA_GRID;
+
+	if (sv_areacellsize < AREA_GRID_MINCELL)
+		sv_areacellsize = AREA_GRID_MINCELL;
+
+	sv_areacellscale = 1.0f / sv_areacellsize;
+	sv_areaorigin[0] = mins[0];
+	sv_areaorigin[1] = mins[1];
+
+	sv_areacols = ceil ((maxs[0] - mins[0]) * sv_areacellscale);
+	sv_arearows = ceil ((maxs[1] - mins[1]) * sv_areacellscale);
+
+	if (sv_areacols < 1) sv_areacols = 1;
+	if (sv_areacols > AREA_GRID) sv_areacols = AREA_GRID;
+	if (sv_arearows < 1) sv_arearows = 1;
+	if (sv_arearows > AREA_GRID) sv_arearows = AREA_GRID;
+
+	for (i = 0; i <= AREA_GRID_BIGCELL; i++)
+	{
+		ClearLink (&sv_areacells[i].trigger_edicts);
+		ClearLink (&sv_areacells[i].solid_edicts);
+	}
+
+	for (i = 0; i < MAX_EDICTS; i++)
+		sv_entcells[i] = -1;
+}
+
+/*
+===============
+SV_AreaColumn / SV_AreaRow
+
+Positions outside the world go in the border cells
+===============
+*/
+static int SV_AreaColumn (float x)
+{
+	int		c = (x - sv_areaorigin[0]) * sv_areacellscale;
+
+	if (c < 0) return 0;
+	if (c >= sv_areacols) return sv_areacols - 1;
+
+	return c;
+}
+
+static int SV_AreaRow (float y)
+{
+	int		r = (y - sv_areaorigin[1]) * sv_areacellscale;
+
+	if (r < 0) return 0;
+	if (r >= sv_arearows) return sv_arearows - 1;
+
+	return r;
+}
+
 /*
 ===============
 SV_ClearWorld
@@ -139,6 +243,245 @@ void SV_ClearWorld (void)
 	memset (sv_areanodes, 0, sizeof (sv_areanodes));
 	sv_numareanodes = 0;
 	SV_CreateAreaNode (0, sv.models[1]->mins, sv.models[1]->maxs);
+	SV_CreateAreaGrid (sv.models[1]->mins, sv.models[1]->maxs);
+
+	sv_usegrid = sv_areagrid->integer ? true : false;
+
+	SV_ClearClusterIndex ();
+}
+
+
+/*
+===============================================================================
+
+ENTITY CLUSTER INDEX
+
+Every entity is kept on a list for each cluster it was last linked into,
+so client frames only have to look at the entities of the visible clusters
+instead of every edict. The index may hold entities that are no longer in
+a cluster (freed or unlinked ones), frame building still does the full
+visibility test on everything it gets from here.
+
+Beams are only checked against the PHS by their first cluster, so they
+are kept off the cluster lists and tested one by one instead.
+
+===============================================================================
+*/
+
+typedef struct
+{
+	int		cluster;		// -1 = not on a list
+	int		prev, next;		// into sv_clusterlinks, -1 terminated
+} clusterlink_t;
+
+// link e * MAX_ENT_CLUSTERS + i holds clusternums[i] of edict e
+static clusterlink_t	sv_clusterlinks[MAX_EDICTS * MAX_ENT_CLUSTERS];
+static int		sv_clusterheads[MAX_MAP_LEAFS];
+static int		sv_numentclusters[MAX_EDICTS];		// as last indexed, -1 = headnode
+static byte		sv_headnodeents[MAX_EDICTS / 8];	// entities that are always checked
+static byte		sv_beaments[MAX_EDICTS / 8];		// RF_BEAM entities, as last indexed
+static int		sv_numclusters;
+
+/*
+===============
+SV_ClearClusterIndex
+===============
+*/
+void SV_ClearClusterIndex (void)
+{
+	int		i;
+
+	sv_numclusters = CM_NumClusters ();
+
+	for (i = 0; i < sv_numclusters; i++)
+		sv_clusterheads[i] = -1;
+
+	for (i = 0; i < MAX_EDICTS * MAX_ENT_CLUSTERS; i++)
+		sv_clusterlinks[i].cluster = -1;
+
+	memset (sv_numentclusters, 0, sizeof (sv_numentclusters));
+	memset (sv_headnodeents, 0, sizeof (sv_headnodeents));
+	memset (sv_beaments, 0, sizeof (sv_beaments));
+}
+
+
+/*
+===============
+SV_IndexedClusters
+===============
+*/
+static int SV_IndexedClusters (edict_t *ent)
+{
+	if (ent->num_clusters == -1 || (ent->s.renderfx & RF_BEAM))
+		return 0;
+
+	return ent->num_clusters;
+}
+
+
+/*
+===============
+SV_ClusterIndexChanged
+===============
+*/
+static qboolean SV_ClusterIndexChanged (edict_t *ent, int e)
+{
+	int		i, count;
+
+	if (!(sv_beaments[e >> 3] & (1 << (e & 7))) != !(ent->s.renderfx & RF_BEAM))
+		return true;
+
+	if (sv_numentclusters[e] != ent->num_clusters)
+		return true;
+
+	count = SV_IndexedClusters (ent);
+
+	for (i = 0; i < count; i++)
+	{
+		if (sv_clusterlinks[e * MAX_ENT_CLUSTERS + i].cluster != ent->clusternums[i])
+			return true;
+	}
+
+	return false;
+}
+
+
+/*
+===============
+SV_IndexEdictClusters
+
+Moves the entity to the cluster lists of its current clusternums
+===============
+*/
+static void SV_IndexEdictClusters (edict_t *ent, int e)
+{
+	clusterlink_t	*link;
+	int		i, l, count, cluster;
+
+	// take it off the old lists
+	for (i = 0, l = e * MAX_ENT_CLUSTERS; i < MAX_ENT_CLUSTERS; i++, l++)
+	{
+		link = &sv_clusterlinks[l];
+
+		if (link->cluster == -1)
+			continue;
+
+		if (link->prev == -1)
+			sv_clusterheads[link->cluster] = link->next;
+		else sv_clusterlinks[link->prev].next = link->next;
+
+		if (link->next != -1)
+			sv_clusterlinks[link->next].prev = link->prev;
+
+		link->cluster = -1;
+	}
+
+	sv_numentclusters[e] = ent->num_clusters;
+
+	if (ent->num_clusters == -1 && !(ent->s.renderfx & RF_BEAM))
+		sv_headnodeents[e >> 3] |= 1 << (e & 7);
+	else sv_headnodeents[e >> 3] &= ~(1 << (e & 7));
+
+	if (ent->s.renderfx & RF_BEAM)
+		sv_beaments[e >> 3] |= 1 << (e & 7);
+	else sv_beaments[e >> 3] &= ~(1 << (e & 7));
+
+	// and put it on the new ones
+	count = SV_IndexedClusters (ent);
+
+	for (i = 0, l = e * MAX_ENT_CLUSTERS; i < count; i++, l++)
+	{
+		cluster = ent->clusternums[i];
+
+		if (cluster < 0 || cluster >= sv_numclusters)
+			continue;
+
+		link = &sv_clusterlinks[l];
+		link->cluster = cluster;
+		link->prev = -1;
+		link->next = sv_clusterheads[cluster];
+
+		if (link->next != -1)
+			sv_clusterlinks[link->next].prev = l;
+
+		sv_clusterheads[cluster] = l;
+	}
+}
+
+
+/*
+===============
+SV_RefreshClusterIndex
+
+SV_LinkEdict keeps the index current, but the game can change the
+cluster fields behind our back (clearing a freed edict for example),
+so this catches up once a frame before any client frames are built
+===============
+*/
+void SV_RefreshClusterIndex (void)
+{
+	int		e;
+	edict_t	*ent;
+
+	for (e = 1; e < ge->num_edicts; e++)
+	{
+		ent = EDICT_NUM (e);
+
+		if (SV_ClusterIndexChanged (ent, e))
+			SV_IndexEdictClusters (ent, e);
+	}
+}
+
+
+/*
+===============
+SV_ClusterEntities
+
+Marks every entity that is listed in a cluster set in the pvs row,
+the ones that have to be checked by headnode, and the beams whose first
+cluster is in the phs row. entbits must hold MAX_EDICTS bits. Only reads
+the index and the edicts, so it is safe to call from the snapshot workers
+===============
+*/
+void SV_ClusterEntities (byte *pvs, byte *phs, byte *entbits)
+{
+	int		i, c, l, e, longs;
+	unsigned int	vis;
+
+	memcpy (entbits, sv_headnodeents, MAX_EDICTS / 8);
+
+	for (i = 0; i < (ge->num_edicts + 7) >> 3; i++)
+	{
+		if (!sv_beaments[i])
+			continue;
+
+		for (e = i << 3; e < (i << 3) + 8 && e < ge->num_edicts; e++)
+		{
+			if (!(sv_beaments[i] & (1 << (e & 7))))
+				continue;
+
+			l = EDICT_NUM (e)->clusternums[0];
+
+			if (l >= 0 && l < sv_numclusters && (phs[l >> 3] & (1 << (l & 7))))
+				entbits[i] |= 1 << (e & 7);
+		}
+	}
+
+	longs = (sv_numclusters + 31) >> 5;
+
+	for (i = 0; i < longs; i++)
+	{
+		vis = ((unsigned int *) pvs)[i];
+
+		for (c = i << 5; vis; vis >>= 1, c++)
+		{
+			if (!(vis & 1) || c >= sv_numclusters)
+				continue;
+
+			for (l = sv_clusterheads[c]; l != -1; l = sv_clusterlinks[l].next)
+				entbits[l / (MAX_ENT_CLUSTERS * 8)] |= 1 << ((l / MAX_ENT_CLUSTERS) & 7);
+		}
+	}
 }
 
 
@@ -158,6 +501,80 @@ void SV_UnlinkEdict (edict_t *ent)
 }
 
 
+/*
+===============
+SV_AreaLink
+
+Puts the entity on the list its abs box belongs to. The areanode lists
+are kept in link order, on the grid an entity that is still in the same
+cell is left where it is. cell remembers the list for the next call
+===============
+*/
+static void SV_AreaLink (edict_t *ent, int *cell)
+{
+	areanode_t	*node;
+	int			newcell;
+
+	if (ent->solid == SOLID_NOT)
+	{
+		SV_UnlinkEdict (ent);
+		return;
+	}
+
+	if (!sv_usegrid)
+	{
+		SV_UnlinkEdict (ent);
+
+		// find the first node that the ent's box crosses
+		node = sv_areanodes;
+
+		while (1)
+		{
+			if (node->axis == -1)
+				break;
+
+			if (ent->absmin[node->axis] > node->dist)
+				node = node->children[0];
+			else if (ent->absmax[node->axis] < node->dist)
+				node = node->children[1];
+			else break;		// crosses the node
+		}
+
+		// link it in
+		if (ent->solid == SOLID_TRIGGER)
+			InsertLinkBefore (&ent->area, &node->trigger_edicts);
+		else InsertLinkBefore (&ent->area, &node->solid_edicts);
+
+		return;
+	}
+
+	if (ent->absmax[0] - ent->absmin[0] > sv_areacellsize || ent->absmax[1] - ent->absmin[1] > sv_areacellsize)
+		newcell = AREA_GRID_BIGCELL;
+	else
+	{
+		newcell = SV_AreaRow (0.5f * (ent->absmin[1] + ent->absmax[1])) * sv_areacols +
+			SV_AreaColumn (0.5f * (ent->absmin[0] + ent->absmax[0]));
+	}
+
+	newcell = newcell * 2 + (ent->solid == SOLID_TRIGGER);
+
+	if (ent->area.prev && *cell == newcell)
+	{
+		sv_areakeeps++;
+		return;
+	}
+
+	SV_UnlinkEdict (ent);
+
+	if (newcell & 1)
+		InsertLinkBefore (&ent->area, &sv_areacells[newcell >> 1].trigger_edicts);
+	else InsertLinkBefore (&ent->area, &sv_areacells[newcell >> 1].solid_edicts);
+
+	*cell = newcell;
+	sv_arearelinks++;
+}
+
+
 /*
 ===============
 SV_LinkEdict
@@ -168,17 +585,22 @@ SV_LinkEdict
 
 void SV_LinkEdict (edict_t *ent)
 {
-	areanode_t	*node;
+	int			e;
 	int			leafs[MAX_TOTAL_ENT_LEAFS];
 	int			clusters[MAX_TOTAL_ENT_LEAFS];
 	int			num_leafs;
 	int			i, j, k;
 	int			area;
 	int			topnode;
+	unsigned	prof;
+
+	if (ent == ge->edicts || !ent->inuse)
+	{
+		SV_UnlinkEdict (ent);		// don't add the world
+		return;
+	}
 
-	if (ent->area.prev) SV_UnlinkEdict (ent);	// unlink from old position
-	if (ent == ge->edicts) return;		// don't add the world
-	if (!ent->inuse) return;
+	prof = Prof_Begin ();
 
 	// set the size
 	VectorSubtract (ent->maxs, ent->mins, ent->size);
@@ -311,6 +733,9 @@ void SV_LinkEdict (edict_t *ent)
 		}
 	}
 
+	e = NUM_FOR_EDICT (ent);
+	SV_IndexEdictClusters (ent, e);
+
 	// if first time, make sure old_origin is valid
 	if (!ent->linkcount)
 	{
@@ -319,47 +744,25 @@ void SV_LinkEdict (edict_t *ent)
 
 	ent->linkcount++;
 
-	if (ent->solid == SOLID_NOT)
-		return;
+	// unlinks from the old position if needed
+	SV_AreaLink (ent, &sv_entcells[e]);
 
-	// find the first node that the ent's box crosses
-	node = sv_areanodes;
-
-	while (1)
-	{
-		if (node->axis == -1)
-			break;
-
-		if (ent->absmin[node->axis] > node->dist)
-			node = node->children[0];
-		else if (ent->absmax[node->axis] < node->dist)
-			node = node->children[1];
-		else break;		// crosses the node
-	}
-
-	// link it in
-	if (ent->solid == SOLID_TRIGGER)
-		InsertLinkBefore (&ent->area, &node->trigger_edicts);
-	else InsertLinkBefore (&ent->area, &node->solid_edicts);
+	Prof_End ("SV_LinkEdict", prof);
 }
 
 
 /*
 ====================
-SV_AreaEdicts_r
+SV_AreaEdictsList
 
+Returns false when the list is full
 ====================
 */
-void SV_AreaEdicts_r (areanode_t *node)
+static qboolean SV_AreaEdictsList (link_t *start)
 {
-	link_t		*l, *next, *start;
+	link_t		*l, *next;
 	edict_t		*check;
 
-	// touch linked edicts
-	if (area_type == AREA_SOLID)
-		start = &node->solid_edicts;
-	else start = &node->trigger_edicts;
-
 	for (l = start->next; l != start; l = next)
 	{
 		next = l->next;
@@ -379,13 +782,34 @@ void SV_AreaEdicts_r (areanode_t *node)
 		if (area_count == area_maxcount)
 		{
 			Com_Printf (S_COLOR_RED "SV_AreaEdicts: MAXCOUNT\n");
-			return;
+			return false;
 		}
 
 		area_list[area_count] = check;
 		area_count++;
 	}
 
+	return true;
+}
+
+
+/*
+====================
+SV_AreaEdicts_r
+
+====================
+*/
+void SV_AreaEdicts_r (areanode_t *node)
+{
+	// touch linked edicts
+	if (area_type == AREA_SOLID)
+	{
+		if (!SV_AreaEdictsList (&node->solid_edicts))
+			return;
+	}
+	else if (!SV_AreaEdictsList (&node->trigger_edicts))
+		return;
+
 	if (node->axis == -1)
 		return;		// terminal node
 
@@ -395,6 +819,45 @@ void SV_AreaEdicts_r (areanode_t *node)
 }
 
 
+/*
+====================
+SV_AreaEdictsGrid
+
+Boxes touching the area have their centers within half a cell of it
+====================
+*/
+static void SV_AreaEdictsGrid (void)
+{
+	areacell_t	*cell;
+	float		margin;
+	int			x, y, x0, x1, y0, y1;
+
+	cell = &sv_areacells[AREA_GRID_BIGCELL];
+
+	if (!SV_AreaEdictsList (area_type == AREA_SOLID ? &cell->solid_edicts : &cell->trigger_edicts))
+		return;
+
+	// one more unit for the rounding of the centers
+	margin = 0.5f * sv_areacellsize + 1;
+
+	x0 = SV_AreaColumn (area_mins[0] - margin);
+	x1 = SV_AreaColumn (area_maxs[0] + margin);
+	y0 = SV_AreaRow (area_mins[1] - margin);
+	y1 = SV_AreaRow (area_maxs[1] + margin);
+
+	for (y = y0; y <= y1; y++)
+	{
+		cell = &sv_areacells[y * sv_areacols + x0];
+
+		for (x = x0; x <= x1; x++, cell++)
+		{
+			if (!SV_AreaEdictsList (area_type == AREA_SOLID ? &cell->solid_edicts : &cell->trigger_edicts))
+				return;
+		}
+	}
+}
+
+
 /*
 ================
 SV_AreaEdicts
@@ -410,12 +873,188 @@ int SV_AreaEdicts (vec3_t mins, vec3_t maxs, edict_t **list,
 	area_maxcount = maxcount;
 	area_type = areatype;
 
-	SV_AreaEdicts_r (sv_areanodes);
+	if (sv_usegrid)
+		SV_AreaEdictsGrid ();
+	else SV_AreaEdicts_r (sv_areanodes);
 
 	return area_count;
 }
 
 
+/*
+===============
+SV_BenchRandom
+===============
+*/
+static float SV_BenchRandom (unsigned *seed)
+{
+	*seed = *seed * 1664525 + 1013904223;
+
+	return (float) (*seed >> 8) / (float) (1 << 24);
+}
+
+
+/*
+===============
+SV_AreaBench_f
+
+sv_areabench [entities] [frames]
+
+Moves a swarm of boxes around the current map and times linking them
+and querying around every one of them, with the areanode tree and with
+the loose grid. The game's entities are taken out while it runs and put
+back in edict order afterwards
+===============
+*/
+void SV_AreaBench_f (void)
+{
+	static edict_t	*touch[MAX_EDICTS];
+	edict_t		*ents, *ent;
+	vec3_t		*vel, mins, maxs, size, qmins, qmaxs;
+	int			*cells;
+	byte		relink[MAX_EDICTS / 8];
+	int			numents, frames, mode, i, j, f, e;
+	int			hits[2];
+	unsigned	seed, start, linkusec[2], queryusec[2];
+	qboolean	usegrid;
+	float		half;
+
+	if (sv.state != ss_game)
+	{
+		Com_Printf ("No map loaded.\n");
+		return;
+	}
+
+	numents = (Cmd_Argc () > 1) ? atoi (Cmd_Argv (1)) : 1000;
+	frames = (Cmd_Argc () > 2) ? atoi (Cmd_Argv (2)) : 100;
+
+	if (numents < 1) numents = 1;
+	if (numents > MAX_EDICTS) numents = MAX_EDICTS;
+	if (frames < 1) frames = 1;
+
+	ents = Z_Malloc (numents * sizeof (edict_t));
+	vel = Z_Malloc (numents * sizeof (vec3_t));
+	cells = Z_Malloc (numents * sizeof (int));
+
+	// both structures have to hold the same boxes
+	memset (relink, 0, sizeof (relink));
+
+	for (e = 1; e < ge->num_edicts; e++)
+	{
+		ent = EDICT_NUM (e);
+
+		if (!ent->area.prev)
+			continue;
+
+		SV_UnlinkEdict (ent);
+		relink[e >> 3] |= 1 << (e & 7);
+	}
+
+	VectorCopy (sv.models[1]->mins, mins);
+	VectorCopy (sv.models[1]->maxs, maxs);
+	VectorSubtract (maxs, mins, size);
+
+	usegrid = sv_usegrid;
+	sv_arearelinks = sv_areakeeps = 0;
+
+	for (mode = 0; mode < 2; mode++)
+	{
+		sv_usegrid = mode;
+		seed = 0x5eed;
+
+		// players, monsters and missiles, a few triggers and some big movers
+		for (i = 0, ent = ents; i < numents; i++, ent++)
+		{
+			if (!(i & 63))
+				half = 96 + 160 * SV_BenchRandom (&seed);
+			else half = 4 + 28 * SV_BenchRandom (&seed);
+
+			for (j = 0; j < 3; j++)
+			{
+				ent->s.origin[j] = mins[j] + size[j] * SV_BenchRandom (&seed);
+				ent->mins[j] = -half;
+				ent->maxs[j] = half;
+				vel[i][j] = (SV_BenchRandom (&seed) - 0.5f) * (j == 2 ? 20 : 60);
+			}
+
+			ent->solid = (i & 7) ? SOLID_BBOX : SOLID_TRIGGER;
+			ent->area.prev = ent->area.next = NULL;
+			cells[i] = -1;
+		}
+
+		linkusec[mode] = queryusec[mode] = 0;
+		hits[mode] = 0;
+
+		for (f = 0; f < frames; f++)
+		{
+			start = Sys_Microseconds ();
+
+			for (i = 0, ent = ents; i < numents; i++, ent++)
+			{
+				for (j = 0; j < 3; j++)
+				{
+					ent->s.origin[j] += vel[i][j];
+
+					if (ent->s.origin[j] < mins[j] || ent->s.origin[j] > maxs[j])
+						vel[i][j] = -vel[i][j];
+				}
+
+				VectorAdd (ent->s.origin, ent->mins, ent->absmin);
+				VectorAdd (ent->s.origin, ent->maxs, ent->absmax);
+
+				SV_AreaLink (ent, &cells[i]);
+			}
+
+			linkusec[mode] += Sys_Microseconds () - start;
+			start = Sys_Microseconds ();
+
+			// about what a trace for the next move of each one would ask for
+			for (i = 0, ent = ents; i < numents; i++, ent++)
+			{
+				for (j = 0; j < 3; j++)
+				{
+					qmins[j] = ent->absmin[j] - fabs (vel[i][j]) - 1;
+					qmaxs[j] = ent->absmax[j] + fabs (vel[i][j]) + 1;
+				}
+
+				hits[mode] += SV_AreaEdicts (qmins, qmaxs, touch, MAX_EDICTS, (i & 1) ? AREA_TRIGGERS : AREA_SOLID);
+			}
+
+			queryusec[mode] += Sys_Microseconds () - start;
+		}
+
+		for (i = 0; i < numents; i++)
+			SV_UnlinkEdict (&ents[i]);
+	}
+
+	sv_usegrid = usegrid;
+
+	for (e = 1; e < ge->num_edicts; e++)
+	{
+		if (relink[e >> 3] & (1 << (e & 7)))
+			SV_AreaLink (EDICT_NUM (e), &sv_entcells[e]);
+	}
+
+	Z_Free (cells);
+	Z_Free (vel);
+	Z_Free (ents);
+
+	Com_Printf ("%i entities, %i frames, %i x %i cells of %i units\n", numents, frames, sv_areacols, sv_arearows, (int) sv_areacellsize);
+
+	for (mode = 0; mode < 2; mode++)
+	{
+		Com_Printf ("%-10s link %6u usec, query %6u usec, %.3f usec and %.1f entities per query\n",
+			mode ? "loose grid" : "areanodes", linkusec[mode], queryusec[mode],
+			(float) queryusec[mode] / (numents * frames), (float) hits[mode] / (numents * frames));
+	}
+
+	Com_Printf ("grid kept %u of %u links in place\n", sv_areakeeps, sv_areakeeps + sv_arearelinks);
+
+	if (hits[0] != hits[1])
+		Com_Printf (S_COLOR_RED "areanodes and grid found %i and %i entities\n", hits[0], hits[1]);
+}
+
+
 //===========================================================================
 
 /*
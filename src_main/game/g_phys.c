@@ -1116,11 +1116,15 @@ G_RunEntity
 */
 void G_RunEntity (edict_t *ent)
 {
+	unsigned prof;
+
 	if (!ent)
 	{
 		return;
 	}
 
+	prof = gi.ProfileBegin ();
+
 	if (ent->prethink)
 		ent->prethink (ent);
 
@@ -1148,4 +1152,6 @@ void G_RunEntity (edict_t *ent)
 	default:
 		gi.error ("SV_Physics: bad movetype %i", (int)ent->movetype);			
 	}
+
+	gi.ProfileEnd ("G_RunEntity", prof);
 }
@@ -45,6 +45,8 @@ void            (* RE_BeginRegistration)( char *model ) = NULL;
 struct model_s * (* RE_RegisterModel)( char *name ) = NULL;
 struct image_s * (* RE_RegisterSkin)( char *name ) = NULL;
 struct image_s * (* RE_Draw_RegisterPic)( char *name ) = NULL;
+void            (* RE_PrefetchModel)( char *name ) = NULL;
+void            (* RE_Draw_PrefetchPic)( char *name ) = NULL;
 void            (* RE_SetSky)( char *name, float rotate, vec3_t axis ) = NULL;
 void			(* RE_SetFog)( vec4_t fog ) = NULL;
 void			(* RE_RegisterFont)( char *fontName, int pointSize, fontInfo_t *font ) = NULL;
@@ -347,6 +347,25 @@ image_t	*RE_GL_Draw_RegisterPic(char *name)
 	return gl;
 }
 
+/*
+=============
+RE_Draw_PrefetchPic
+
+Reads ahead the pic RE_Draw_RegisterPic will look for first
+=============
+*/
+void RE_GL_Draw_PrefetchPic (char *name)
+{
+	char	fullname[MAX_QPATH];
+
+	if (name[0] != '/' && name[0] != '\\')
+	{
+		Com_sprintf (fullname, sizeof (fullname), "pics/%s.pcx", name);
+		R_PrefetchImage (fullname);
+	}
+	else R_PrefetchImage (name + 1);
+}
+
 /*
 =============
 RE_Draw_GetPicSize
@@ -389,9 +389,12 @@ PCX LOADING
 /*
 ==============
 LoadPCX
+
+The pic and palette are malloc'd. When not verbose, a file that would
+have been complained about is not loaded at all
 ==============
 */
-static void LoadPCX (char *filename, byte **pic, byte **palette, int *width, int *height)
+static void LoadPCX (char *filename, byte **pic, byte **palette, int *width, int *height, qboolean verbose)
 {
 	byte	*raw;
 	pcx_t	*pcx;
@@ -403,13 +406,17 @@ static void LoadPCX (char *filename, byte **pic, byte **palette, int *width, int
 	byte	*out, *pix;
 
 	*pic = NULL;
-	*palette = NULL;
+	if (palette)
+		*palette = NULL;
 
 	// load the file
 	len = FS_LoadFile (filename, (void **) &raw);
 	if (!raw || len < sizeof(pcx_t))
 	{
-		VID_Printf (PRINT_DEVELOPER, S_COLOR_RED "Bad pcx file %s\n", filename);
+		if (verbose)
+			VID_Printf (PRINT_DEVELOPER, S_COLOR_RED "Bad pcx file %s\n", filename);
+		if (raw)
+			FS_FreeFile (raw);
 		return;
 	}
 
@@ -437,19 +444,21 @@ static void LoadPCX (char *filename, byte **pic, byte **palette, int *width, int
 		pcx->bits_per_pixel != 8 ||
 		(pcx_width >= 4096) || (pcx_height >= 4096))
 	{
-		VID_Printf (PRINT_ALL, S_COLOR_RED "Bad pcx file %s\n", filename);
+		if (verbose)
+			VID_Printf (PRINT_ALL, S_COLOR_RED "Bad pcx file %s\n", filename);
+		FS_FreeFile (pcx);
 		return;
 	}
 
 	full_size = (pcx_height + 1) * (pcx_width + 1);
-	out = Img_Alloc (full_size);
+	out = malloc (full_size);
 
 	*pic = out;
 	pix = out;
 
 	if (palette)
 	{
-		*palette = Img_Alloc (768);
+		*palette = malloc (768);
 		if (len > 768)
 			memcpy (*palette, (byte *) pcx + len - 768, 768);
 		else
@@ -505,12 +514,22 @@ static void LoadPCX (char *filename, byte **pic, byte **palette, int *width, int
 
 	if (raw - (byte *) pcx > len)
 	{
-		VID_Printf (PRINT_DEVELOPER, S_COLOR_RED "PCX file %s was malformed.\n", filename);
+		if (verbose)
+			VID_Printf (PRINT_DEVELOPER, S_COLOR_RED "PCX file %s was malformed.\n", filename);
+		free (out);
 		*pic = NULL;
 	}
 
 	if (image_issues)
-		VID_Printf (PRINT_ALL, S_COLOR_YELLOW "PCX file %s has possible size issues.\n", filename);
+	{
+		if (verbose)
+			VID_Printf (PRINT_ALL, S_COLOR_YELLOW "PCX file %s has possible size issues.\n", filename);
+		else if (*pic)
+		{
+			free (out);
+			*pic = NULL;
+		}
+	}
 
 	FS_FreeFile (pcx);
 }
@@ -548,35 +567,6 @@ WAL LOADING
 =========================================================
 */
 
-/*
-================
-GL_LoadWal
-================
-*/
-static image_t *GL_LoadWal(char *name)
-{
-	miptex_t	*mt;
-	int			width, height, ofs;
-	image_t		*image;
-
-	FS_LoadFile(name, (void **)&mt);
-	if (!mt)
-	{
-		VID_Printf(PRINT_ALL, S_COLOR_RED "GL_FindImage: can't load %s\n", name);
-		return r_notexture;
-	}
-
-	width = LittleLong(mt->width);
-	height = LittleLong(mt->height);
-	ofs = LittleLong(mt->offsets[0]);
-
-	image = GL_LoadPic(name, (byte *)mt + ofs, width, height, it_wall, 8);
-
-	FS_FreeFile((void *)mt);
-
-	return image;
-}
-
 /*
 ================
 GetWalInfo
@@ -609,17 +599,46 @@ GENERIC RGBA PICTURE LOADING
 
 /*
 =============
-LoadImageThruSTB
+R_FileExtension
+
+COM_FileExtension without the static buffer, for the prefetch workers
 =============
 */
-qboolean LoadImageThruSTB (char *origname, char* type, byte **pic, int *width, int *height)
+static void R_FileExtension (char *in, char *out, int size)
+{
+	int		i;
+
+	while (*in && *in != '.')
+		in++;
+
+	if (*in)
+		in++;
+
+	for (i = 0; i < size - 1 && *in; i++, in++)
+		out[i] = *in;
+
+	out[i] = 0;
+}
+
+/*
+=============
+R_LoadSTB
+
+Returns 1 if loaded, 0 if there is no such file. A file that is there
+but won't decode is complained about when verbose, otherwise -1
+=============
+*/
+static int R_LoadSTB (char *origname, char* type, byte **pic, int *width, int *height, qboolean verbose)
 {
 	char filename[256];
+	char ext[8];
 
 	Q_strlcpy (filename, origname, sizeof(filename));
 
 	// add the extension
-	if (strcmp(COM_FileExtension(filename), type) != 0)
+	R_FileExtension (filename, ext, sizeof(ext));
+
+	if (strcmp(ext, type) != 0)
 	{
 		Q_strlcat (filename, ".", sizeof(filename));
 		Q_strlcat (filename, type, sizeof(filename));
@@ -631,7 +650,7 @@ qboolean LoadImageThruSTB (char *origname, char* type, byte **pic, int *width, i
 	byte* rawdata = NULL;
 	int rawsize = FS_LoadFile (filename, (void **)&rawdata);
 	if (rawdata == NULL)
-		return false;
+		return 0;
 
 	// load file into memory
 	int w, h, bytesPerPixel;
@@ -639,9 +658,13 @@ qboolean LoadImageThruSTB (char *origname, char* type, byte **pic, int *width, i
 	data = stbi_load_from_memory (rawdata, rawsize, &w, &h, &bytesPerPixel, STBI_rgb_alpha);
 	if (data == NULL)
 	{
-		VID_Printf (PRINT_ALL, S_COLOR_RED "stb_image couldn't load data from %s: %s!\n", filename, stbi_failure_reason());
 		FS_FreeFile (rawdata);
-		return false;
+
+		if (!verbose)
+			return -1;
+
+		VID_Printf (PRINT_ALL, S_COLOR_RED "stb_image couldn't load data from %s: %s!\n", filename, stbi_failure_reason());
+		return 0;
 	}
 	
 	FS_FreeFile (rawdata);
@@ -650,7 +673,194 @@ qboolean LoadImageThruSTB (char *origname, char* type, byte **pic, int *width, i
 	*width = w;
 	*height = h;
 
-	return true;
+	return 1;
+}
+
+/*
+=============
+LoadImageThruSTB
+=============
+*/
+qboolean LoadImageThruSTB (char *origname, char* type, byte **pic, int *width, int *height)
+{
+	return R_LoadSTB (origname, type, pic, width, height, true) == 1;
+}
+
+
+/*
+=========================================================
+
+IMAGE DATA
+
+=========================================================
+*/
+
+typedef struct
+{
+	byte		*pic;
+	byte		*file;		// the wal pic points into, otherwise pic is malloc'd
+	int			width, height;
+	int			bits;
+	qboolean	wal;		// always uploaded as it_wall
+} imagedata_t;
+
+/*
+=============
+R_LoadImageData
+
+Everything GL_FindImage does to an image short of uploading it. It
+only uses the filesystem and malloc so the prefetch workers can run it,
+and when not verbose it fails instead of printing anything
+=============
+*/
+static qboolean R_LoadImageData (char *name, imagedata_t *data, qboolean verbose)
+{
+	char		ext[8];
+	char		namewe[256];
+	int			len, found;
+	int			width, height;
+	miptex_t	*mt;
+
+	memset (data, 0, sizeof (*data));
+
+	// remove the extension
+	len = strlen (name);
+	if (len < 5 || len - 4 >= sizeof (namewe))
+		return false;
+	memset (namewe, 0, sizeof (namewe));
+	memcpy (namewe, name, len - 4);
+
+	R_FileExtension (name, ext, sizeof (ext));
+
+	if (strcmp (ext, "pcx") == 0 || strcmp (ext, "wal") == 0)
+	{
+		if (ext[0] == 'p')
+			GetPCXInfo (name, &data->width, &data->height);
+		else
+			GetWalInfo (name, &data->width, &data->height);
+
+		if (data->width == 0)
+		{
+			// no texture found
+			return false;
+		}
+
+		// check for retexture, it keeps the size of the original
+		found = R_LoadSTB (namewe, "tga", &data->pic, &width, &height, verbose);
+		if (!found)
+			found = R_LoadSTB (namewe, "png", &data->pic, &width, &height, verbose);
+		if (!found)
+			found = R_LoadSTB (namewe, "jpg", &data->pic, &width, &height, verbose);
+
+		if (found)
+		{
+			data->bits = 32;
+			return (found == 1);
+		}
+
+		if (ext[0] == 'p')
+		{
+			// PCX
+			LoadPCX (name, &data->pic, NULL, &data->width, &data->height, verbose);
+			data->bits = 8;
+			return (data->pic != NULL);
+		}
+
+		// wal
+		FS_LoadFile (name, (void **)&mt);
+		if (!mt)
+		{
+			if (verbose)
+				VID_Printf (PRINT_ALL, S_COLOR_RED "GL_FindImage: can't load %s\n", name);
+			return false;
+		}
+
+		data->file = (byte *) mt;
+		data->pic = (byte *) mt + LittleLong (mt->offsets[0]);
+		data->width = LittleLong (mt->width);
+		data->height = LittleLong (mt->height);
+		data->bits = 8;
+		data->wal = true;
+		return true;
+	}
+	else if (strcmp (ext, "tga") == 0 || strcmp (ext, "png") == 0 || strcmp (ext, "jpg") == 0)
+	{
+		// load tga, png, or jpg
+		data->bits = 32;
+		return (R_LoadSTB (name, ext, &data->pic, &data->width, &data->height, verbose) == 1);
+	}
+
+	return false;
+}
+
+/*
+=============
+R_FreeImageData
+=============
+*/
+static void R_FreeImageData (imagedata_t *data)
+{
+	if (data->file)
+		FS_FreeFile (data->file);
+	else if (data->pic)
+		free (data->pic);
+}
+
+/*
+=============
+R_PrefetchImageData
+=============
+*/
+static void *R_PrefetchImageData (char *name)
+{
+	imagedata_t	*data;
+
+	data = malloc (sizeof (*data));
+
+	if (!R_LoadImageData (name, data, false))
+	{
+		R_FreeImageData (data);
+		free (data);
+		return NULL;
+	}
+
+	return data;
+}
+
+/*
+=============
+R_ReleaseImageData
+=============
+*/
+static void R_ReleaseImageData (void *data)
+{
+	R_FreeImageData (data);
+	free (data);
+}
+
+/*
+=============
+R_PrefetchImage
+
+Has a prefetch worker load and decode name for GL_FindImage
+=============
+*/
+void R_PrefetchImage (char *name)
+{
+	image_t	*image;
+	int		i;
+
+	// gltextures belongs to the main thread
+	if (!Prefetch_Worker ())
+	{
+		for (i = 0, image = gltextures; i < numgltextures; i++, image++)
+		{
+			if (!strcmp (name, image->name))
+				return;
+		}
+	}
+
+	Prefetch_Add (name, R_PrefetchImageData, R_ReleaseImageData);
 }
 
 
@@ -985,11 +1195,8 @@ image_t	*GL_FindImage (char *name, imagetype_t type)
 {
 	image_t	*image;
 	int		i, len;
-	byte	*pic, *palette;
-	int		width, height;
 	char	*ext, *ptr;
-	char	namewe[256];
-	int		realwidth = 0, realheight = 0;
+	imagedata_t	data, *prefetched;
 
 	if (!name)
 		return NULL;
@@ -1001,12 +1208,9 @@ image_t	*GL_FindImage (char *name, imagetype_t type)
 		return NULL;
 	}
 
-	// remove the extension
 	len = strlen (name);
 	if (len < 5)
 		return NULL;
-	memset(namewe, 0, 256);
-	memcpy(namewe, name, len - 4);
 
 	// fix backslashes
 	while ((ptr = strchr(name, '\\')))
@@ -1025,77 +1229,22 @@ image_t	*GL_FindImage (char *name, imagetype_t type)
 	// this is a hack to force drawing to flush if a new texture needs to be loaded, thanks to OpenGL bind-to-modify insanity
 	Draw_End2D ();
 
-	// load the pic from disk
-	pic = NULL;
-	palette = NULL;
+	// load the pic from disk, unless a prefetch worker already has
+	prefetched = Prefetch_Take (name, R_PrefetchImageData);
 
-	if (strcmp(ext, "pcx") == 0)
+	if (prefetched)
 	{
-		GetPCXInfo (name, &realwidth, &realheight);
-		if (realwidth == 0)
-		{
-			// no texture found
-			return NULL;
-		}
-
-		// check for retexture
-		if (LoadImageThruSTB(namewe, "tga", &pic, &width, &height)
-			|| LoadImageThruSTB(namewe, "png", &pic, &width, &height)
-			|| LoadImageThruSTB(namewe, "jpg", &pic, &width, &height))
-		{
-			// upload tga or png or jpg
-			image = GL_LoadPic (name, pic, realwidth, realheight, type, 32);
-		}
-		else
-		{
-			// upload PCX
-			LoadPCX (name, &pic, &palette, &width, &height);
-			if (!pic)
-				return NULL;
-
-			image = GL_LoadPic (name, pic, width, height, type, 8);
-		}
-	}
-	else if (strcmp(ext, "wal") == 0)
-	{
-		GetWalInfo (name, &realwidth, &realheight);
-		if (realwidth == 0)
-		{
-			// no texture found
-			return NULL;
-		}
-
-		// check for retexture
-		if (LoadImageThruSTB(namewe, "tga", &pic, &width, &height)
-			|| LoadImageThruSTB(namewe, "png", &pic, &width, &height)
-			|| LoadImageThruSTB(namewe, "jpg", &pic, &width, &height))
-		{
-			// upload tga or png or jpg
-			image = GL_LoadPic (name, pic, realwidth, realheight, type, 32);
-		}
-		else
-		{
-			// upload wal
-			image = GL_LoadWal (name);
-		}
-
-		if (!image)
-			return NULL;
+		data = *prefetched;
+		free (prefetched);
 	}
-	else if (strcmp(ext, "tga") == 0 || strcmp(ext, "png") == 0 || strcmp(ext, "jpg") == 0)
-	{
-		// load tga, png, or jpg
-		LoadImageThruSTB (name, ext, &pic, &width, &height);
-		if (!pic)
-			return NULL;
-
-		image = GL_LoadPic (name, pic, width, height, type, 32);
-	}
-	else
+	else if (!R_LoadImageData (name, &data, true))
 	{
 		return NULL;
 	}
 
+	image = GL_LoadPic (name, data.pic, data.width, data.height, data.wal ? it_wall : type, data.bits);
+
+	R_FreeImageData (&data);
 	Img_Free ();
 
 	return image;
@@ -1157,7 +1306,7 @@ int Draw_GetPalette (void)
 	int		width, height;
 
 	// get the palette
-	LoadPCX ("pics/colormap.pcx", &pic, &pal, &width, &height);
+	LoadPCX ("pics/colormap.pcx", &pic, &pal, &width, &height, true);
 
 	if (!pal)
 		VID_Error (ERR_FATAL, "Couldn't load pics/colormap.pcx");
@@ -1179,7 +1328,8 @@ int Draw_GetPalette (void)
 	d_8to24table_rgba[255] = 0;
 	d_8to24table_bgra[255] = 0;
 
-	Img_Free ();
+	free (pic);
+	free (pal);
 
 	return 0;
 }
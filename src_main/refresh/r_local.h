@@ -366,6 +366,8 @@ void RE_GL_BeginRegistration(char *model);
 struct model_s *RE_GL_RegisterModel(char *name);
 struct image_s *RE_GL_RegisterSkin(char *name);
 struct image_s *RE_GL_Draw_RegisterPic(char *name);
+void RE_GL_PrefetchModel(char *name);
+void RE_GL_Draw_PrefetchPic(char *name);
 void RE_GL_SetSky(char *name, float rotate, vec3_t axis);
 void RE_GL_SetFog(vec4_t axis);
 void RE_GL_EndRegistration(void);
@@ -376,6 +378,7 @@ void GL_ResampleTexture (unsigned *in, int inwidth, int inheight, unsigned *out,
 
 image_t *GL_LoadPic (char *name, byte *pic, int width, int height, imagetype_t type, int bits);
 image_t	*GL_FindImage (char *name, imagetype_t type);
+void R_PrefetchImage (char *name);
 void GL_TextureMode (char *string, int anisotropy);
 void GL_ImageList_f (void);
 
@@ -1175,6 +1175,8 @@ void GL_GFX_CoreInit(void)
 	RE_RegisterModel = RE_GL_RegisterModel;
 	RE_RegisterSkin = RE_GL_RegisterSkin;
 	RE_Draw_RegisterPic = RE_GL_Draw_RegisterPic;
+	RE_PrefetchModel = RE_GL_PrefetchModel;
+	RE_Draw_PrefetchPic = RE_GL_Draw_PrefetchPic;
 	RE_SetSky = RE_GL_SetSky;
 	RE_SetFog = RE_GL_SetFog;
 	RE_RegisterFont = RE_GL_RegisterFont;
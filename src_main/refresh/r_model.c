@@ -178,6 +178,183 @@ void Mod_Init (void)
 
 
 
+/*
+===============================================================================
+
+					MODEL PREFETCH
+
+===============================================================================
+*/
+
+typedef struct
+{
+	int		len;
+	void	*buffer;
+} modelfile_t;
+
+/*
+==================
+Mod_PrefetchSkin
+==================
+*/
+static void Mod_PrefetchSkin (byte *skin)
+{
+	char	name[MAX_SKINNAME];
+
+	// the file may not terminate it
+	memcpy (name, skin, MAX_SKINNAME - 1);
+	name[MAX_SKINNAME - 1] = 0;
+
+	R_PrefetchImage (name);
+}
+
+/*
+==================
+Mod_PrefetchImages
+
+Queues the images a model file will ask GL_FindImage for, only what is
+known to lie inside the file is looked at
+==================
+*/
+static void Mod_PrefetchImages (byte *buf, int len)
+{
+	dmdl_t		*alias;
+	dsprite_t	*sprite;
+	dheader_t	*header;
+	texinfo_t	*texinfo;
+	char		texture[sizeof (texinfo->texture) + 1];
+	char		name[MAX_QPATH];
+	int			i, num, ofs, size;
+
+	if (len < 4)
+		return;
+
+	switch (LittleLong (*(unsigned *) buf))
+	{
+	case IDALIASHEADER:
+		if (len < sizeof (*alias))
+			return;
+
+		alias = (dmdl_t *) buf;
+		num = LittleLong (alias->num_skins);
+		ofs = LittleLong (alias->ofs_skins);
+
+		if (num < 0 || num > MAX_MD2SKINS || ofs < 0 || ofs > len - num * MAX_SKINNAME)
+			return;
+
+		for (i = 0; i < num; i++)
+			Mod_PrefetchSkin (buf + ofs + i * MAX_SKINNAME);
+		break;
+
+	case IDSPRITEHEADER:
+		sprite = (dsprite_t *) buf;
+		ofs = (byte *) sprite->frames - buf;
+
+		if (len < ofs)
+			return;
+
+		num = LittleLong (sprite->numframes);
+
+		if (num < 0 || num > MAX_MD2SKINS || num > (len - ofs) / (int) sizeof (dsprframe_t))
+			return;
+
+		for (i = 0; i < num; i++)
+			Mod_PrefetchSkin ((byte *) sprite->frames[i].name);
+		break;
+
+	case IDBSPHEADER:
+		if (len < sizeof (*header))
+			return;
+
+		header = (dheader_t *) buf;
+		ofs = LittleLong (header->lumps[LUMP_TEXINFO].fileofs);
+		size = LittleLong (header->lumps[LUMP_TEXINFO].filelen);
+
+		if (LittleLong (header->version) != BSPVERSION || ofs < 0 || size < 0 || ofs > len - size)
+			return;
+
+		texinfo = (texinfo_t *) (buf + ofs);
+		num = size / sizeof (*texinfo);
+
+		// same name as Mod_LoadTexinfo, animations are texinfos of their own
+		for (i = 0; i < num; i++, texinfo++)
+		{
+			memcpy (texture, texinfo->texture, sizeof (texinfo->texture));
+			texture[sizeof (texinfo->texture)] = 0;
+
+			Com_sprintf (name, sizeof (name), "textures/%s.wal", texture);
+			R_PrefetchImage (name);
+		}
+		break;
+	}
+}
+
+/*
+==================
+Mod_PrefetchModelData
+
+Runs on a prefetch worker, Mod_ForName takes the file it read
+==================
+*/
+static void *Mod_PrefetchModelData (char *name)
+{
+	modelfile_t	*file;
+	void		*buffer;
+	int			len;
+
+	len = FS_LoadFile (name, &buffer);
+
+	if (!buffer)
+		return NULL;
+
+	Mod_PrefetchImages (buffer, len);
+
+	file = malloc (sizeof (*file));
+	file->len = len;
+	file->buffer = buffer;
+
+	return file;
+}
+
+/*
+==================
+Mod_ReleaseModelData
+==================
+*/
+static void Mod_ReleaseModelData (void *data)
+{
+	modelfile_t	*file = data;
+
+	FS_FreeFile (file->buffer);
+	free (file);
+}
+
+/*
+==================
+RE_PrefetchModel
+
+Called by the client for every model configstring that arrives before
+the level is registered
+==================
+*/
+void RE_GL_PrefetchModel (char *name)
+{
+	model_t	*mod;
+	int		i;
+
+	if (name[0] == '*' || name[0] == '#')
+		return;		// inline models and view weapons
+
+	// still loaded from the last level
+	for (i = 0, mod = mod_known; i < mod_numknown; i++, mod++)
+	{
+		if (!strcmp (mod->name, name))
+			return;
+	}
+
+	Prefetch_Add (name, Mod_PrefetchModelData, Mod_ReleaseModelData);
+}
+
 /*
 ==================
 Mod_ForName
@@ -190,6 +367,7 @@ model_t *Mod_ForName (char *name, qboolean crash)
 	model_t	*mod;
 	unsigned *buf;
 	int		i;
+	modelfile_t	*prefetched;
 
 	if (!name[0])
 		VID_Error (ERR_DROP, "Mod_ForName: NULL name");
@@ -239,9 +417,17 @@ model_t *Mod_ForName (char *name, qboolean crash)
 	strcpy (mod->name, name);
 
 	//
-	// load the file
+	// load the file, unless a prefetch worker already has
 	//
-	modfilelen = FS_LoadFile (mod->name, &buf);
+	prefetched = Prefetch_Take (mod->name, Mod_PrefetchModelData);
+
+	if (prefetched)
+	{
+		buf = prefetched->buffer;
+		modfilelen = prefetched->len;
+		free (prefetched);
+	}
+	else modfilelen = FS_LoadFile (mod->name, &buf);
 
 	if (!buf)
 	{
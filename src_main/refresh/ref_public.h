@@ -68,7 +68,7 @@ void GL_TransformPoint (glmatrix *m, float *in, float *out);
 
 #define	MAX_ENTITIES		1024	// same as max_edicts
 
-#define	MAX_PARTICLES		16000
+#define	MAX_PARTICLES		65536	// the most cl_maxparticles allows
 
 #define	MAX_LIGHTSTYLES		256
 
@@ -225,6 +225,8 @@ extern void(*RE_BeginRegistration)(char *model);
 extern struct model_s * (*RE_RegisterModel)(char *name);
 extern struct image_s * (*RE_RegisterSkin)(char *name);
 extern struct image_s * (*RE_Draw_RegisterPic)(char *name);
+extern void(*RE_PrefetchModel)(char *name);
+extern void(*RE_Draw_PrefetchPic)(char *name);
 extern void(*RE_SetSky)(char *name, float rotate, vec3_t axis);
 extern void(*RE_SetFog)(vec4_t fog);
 extern void(*RE_RegisterFont)(char *fontName, int pointSize, fontInfo_t *font);
@@ -20,7 +20,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
 // game.h -- game dll information visible to server
 
-#define	GAME_API_VERSION	3
+#define	GAME_API_VERSION	4
+#define	GAME_API_VERSION_OLD	3	// no profiler imports, still loads
 
 // edict->svflags
 
@@ -173,6 +174,10 @@ typedef struct
 	void	(*AddCommandString) (char *text);
 
 	void	(*DebugGraph) (float value, int color);
+
+	// frame profiler zones, names are copied and truncated to 31 characters
+	unsigned	(*ProfileBegin) (void);
+	void	(*ProfileEnd) (const char *name, unsigned start);
 } game_import_t;
 
 //
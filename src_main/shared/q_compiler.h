@@ -64,3 +64,18 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 #else
 #define Q_alloca alloca
 #endif
+
+// SSE2 is part of every x86-64 target, AVX2 code is compiled with a
+// per-function target attribute and only called after a cpuid check
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define Q_SSE2
+#if defined(__GNUC__) || defined(_MSC_VER)
+#define Q_AVX2
+#endif
+#endif
+
+#if defined(__GNUC__)
+#define Q_TARGET_AVX2 __attribute__ ((target ("avx2")))
+#else
+#define Q_TARGET_AVX2
+#endif
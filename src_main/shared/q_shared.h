@@ -211,6 +211,7 @@ typedef struct cvar_s
 	float		value;
 	int			integer;
 	struct cvar_s *next;
+	struct cvar_s *hashNext;	// engine only, after everything the game reads
 } cvar_t;
 
 #define	MAX_ALIAS_NAME	32
@@ -220,6 +221,7 @@ typedef struct cmdalias_s
 	struct cmdalias_s *next;
 	char		name[MAX_ALIAS_NAME];
 	char		*value;
+	struct cmdalias_s *hashNext;
 } cmdalias_t;
 
 typedef void(*xcommand_t) (void);
@@ -229,6 +231,7 @@ typedef struct cmd_function_s
 	struct cmd_function_s *next;
 	char		*name;
 	xcommand_t	function;
+	struct cmd_function_s *hashNext;
 } cmd_function_t;
 
 #endif		// CVAR
@@ -23,6 +23,7 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #include <SDL_cpuinfo.h>
 #include <SDL_timer.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <time.h>
 #include <string.h>
 
@@ -96,7 +97,7 @@ static void Thread_Init_ (size_t num_threads)
 	thread_pool.num_threads = num_threads;
 	if (thread_pool.num_threads)
 	{
-		thread_pool.threads = malloc (sizeof(thread_t) * thread_pool.num_threads);
+		thread_pool.threads = calloc (thread_pool.num_threads, sizeof(thread_t));
 
 		thread_t *t = thread_pool.threads;
 		size_t i = 0;
@@ -124,7 +125,11 @@ static void Thread_Shutdown_ (void)
 
 		for (i = 0; i < thread_pool.num_threads; i++, t++)
 		{
+			// signal under the lock so a thread about to wait can't miss it
+			SDL_mutexP (t->mutex);
 			SDL_CondSignal (t->cond);
+			SDL_mutexV (t->mutex);
+
 			SDL_WaitThread (t->thread, NULL);
 			SDL_DestroyCond (t->cond);
 			SDL_DestroyMutex (t->mutex);
@@ -210,6 +215,38 @@ void Thread_Wait(thread_t *t)
 	t->status = THREAD_IDLE;
 }
 
+/*
+===============
+Thread_RunJobs
+
+Runs every job and returns once they have all finished. The jobs that
+aren't local are handed to idle threads first, then the local ones run
+here, as does any job no thread was free for.
+===============
+*/
+void Thread_RunJobs (job_t *jobs, size_t num_jobs)
+{
+	size_t i;
+
+	for (i = 0; i < num_jobs; i++)
+	{
+		if (!jobs[i].local)
+			jobs[i].thread = Thread_Create_ (jobs[i].name, jobs[i].Run, jobs[i].data);
+	}
+
+	for (i = 0; i < num_jobs; i++)
+	{
+		if (jobs[i].local)
+		{
+			jobs[i].thread = NULL;
+			jobs[i].Run (jobs[i].data);
+		}
+	}
+
+	for (i = 0; i < num_jobs; i++)
+		Thread_Wait (jobs[i].thread);
+}
+
 /*
 ===============
 Thread_Count
@@ -226,11 +263,15 @@ size_t Thread_Count(void)
 ===============
 Thread_Init
 
-Initializes the thread pool.
+Initializes the thread pool, replacing the current one. The client and
+server share it.
 ===============
 */
 void Thread_Init(size_t num_threads)
 {
+	if (thread_pool.mutex)
+		Thread_Shutdown ();
+
 	memset (&thread_pool, 0, sizeof(thread_pool));
 
 	thread_pool.mutex = SDL_CreateMutex ();
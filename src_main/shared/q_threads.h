@@ -47,9 +47,20 @@ typedef struct thread_s
 	void *data;
 } thread_t;
 
+// one of a set of jobs handed to Thread_RunJobs
+typedef struct job_s
+{
+	char *name;
+	ThreadRunFunc Run;
+	void *data;
+	qboolean local;		// must run in the calling thread
+	thread_t *thread;
+} job_t;
+
 thread_t *Thread_Create_ (char *name, ThreadRunFunc Run, void *data);
 #define Thread_Create(f, d) Thread_Create_(#f, f, d)
 void Thread_Wait (thread_t *t);
+void Thread_RunJobs (job_t *jobs, size_t num_jobs);
 size_t Thread_Count (void);
 void Thread_Init (size_t num_threads);
 void Thread_Shutdown (void);